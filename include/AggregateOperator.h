@@ -0,0 +1,217 @@
+/**
+ * @file AggregateOperator.h - AggregateOperator class: GROUP BY, by hash aggregation
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "EvalOperator.h"
+#include "SpillFile.h"
+#include "BTreeNode.h"
+
+/**
+ * @class Accumulator - the running state of one aggregate for one group
+ */
+struct Accumulator {
+    int64_t count = 0;  // rows
+    int64_t sum = 0;  // for SUM and AVG (wide, so it only wraps around when the result is made)
+    Value extreme;  // for MIN and MAX, once count > 0
+};
+
+typedef std::vector<Accumulator> Accumulators;
+
+
+/**
+ * @class Aggregate - an aggregate function of a grouped query's rows, as one of the columns of its grouped rows
+ *
+ * There are no NULLs, so COUNT(x) is COUNT(*), and the aggregates of no rows (which only a query with no GROUP BY
+ * has) are 0, or, for MIN and MAX of TEXT, "". SUM and AVG are of INTs, and give INTs (AVG rounded toward zero).
+ */
+class Aggregate {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX, AVG
+    };
+
+    /**
+     * @param function  which one
+     * @param argument  what it's of, on the input's rows (nullptr for COUNT(*)); owned by whoever has the Aggregate
+     * @param name      its column in the grouped rows
+     */
+    Aggregate(Function function, Expression *argument, const Identifier &name) : function(function),
+                                                                                 argument(argument), name(name) {}
+
+    Function function;
+    Expression *argument;
+    Identifier name;
+
+    /**
+     * Which function a name is (in any case).
+     * @returns  false if it isn't one
+     */
+    static bool get_function(const std::string &name, Function &function);
+
+    ColumnAttribute::DataType get_data_type() const;
+
+    /**
+     * Add a row to the aggregate.
+     */
+    void update(Accumulator &accumulator, const ValueDict &row) const;
+
+    /**
+     * Add another group's accumulated rows (say, one thread's part of the same group) to the aggregate.
+     */
+    void merge(Accumulator &accumulator, const Accumulator &other) const;
+
+    Value result(const Accumulator &accumulator) const;
+};
+
+typedef std::vector<Aggregate> Aggregates;
+
+
+/**
+ * @class GroupTable - the groups of an aggregation, by their encoded keys, in an open-addressing hash table
+ *
+ * The groups are kept in the order they were first added, and the table's slots just have their numbers (plus one,
+ * so that 0 is an empty slot). A key is looked for from the slot its hash picks, on through the slots after it,
+ * until it or an empty slot turns up; the table is grown to stay at most half full, so that's seldom far, and each
+ * group keeps its hash, so that other keys are seldom compared with it.
+ */
+class GroupTable {
+public:
+    struct Group {
+        NormalizedKey key;
+        u_int32_t hash;
+        ValueDict key_values;  // the group columns' values
+        Accumulators accumulators;  // one for each aggregate
+    };
+
+    static const u_long INITIAL_SLOTS = 64;
+
+    GroupTable();
+
+    virtual ~GroupTable();
+
+    GroupTable(const GroupTable &other) = delete;
+
+    GroupTable &operator=(const GroupTable &other) = delete;
+
+    /**
+     * The group with a key.
+     * @returns  the group, or nullptr if there isn't one
+     */
+    Group *find(const NormalizedKey &key, u_int32_t hash) const;
+
+    /**
+     * Add a group (which mustn't be there already).
+     * @param group  the group (freed by the table)
+     */
+    void add(Group *group);
+
+    const std::vector<Group *> &get_groups() const { return this->groups; }
+
+    /**
+     * Bytes the groups take in memory, roughly (for operators keeping to a memory budget).
+     */
+    u_long bytes() const { return this->group_bytes + this->slots.size() * sizeof(u_int32_t); }
+
+    void clear();
+
+protected:
+    std::vector<Group *> groups;
+    std::vector<u_int32_t> slots;  // how many is a power of two
+    u_long group_bytes;
+
+    void grow();
+};
+
+
+/**
+ * @class AggregateOperator - a row for each group of its input's rows, with the values of the group columns and of
+ * the aggregates of the group's rows
+ *
+ * The groups are kept in a GroupTable, by their group columns' values normalized the way a BTree's keys are. The
+ * input is read a chunk at a time, and given a TaskScheduler (with more than one worker), each chunk is split into
+ * morsels that the workers aggregate into their own GroupTables, which are merged into the operator's once the
+ * chunk is done. So the workers share nothing but reads of the operator's table.
+ *
+ * Once the groups take more than memory_budget bytes, no more are added: the rows of groups not in the table are
+ * partitioned by their keys' hashes out to PARTITIONS spill files, and once the table's groups are handed out, each
+ * partition is aggregated in turn the same way (the table's groups having none of its rows), partitioned by the
+ * next bits of the hash if need be. (A partition still too big after MAX_LEVELS of that is aggregated in memory
+ * anyway.) With no group columns there's just the one group, which there is even for no rows.
+ */
+class AggregateOperator : public BufferedOperator {
+public:
+    static const u_long DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint PARTITION_BITS = 4;
+    static const uint PARTITIONS = 1U << PARTITION_BITS;
+    static const uint MAX_LEVELS = 4;
+    static const u_long CHUNK_SIZE = 16384;  // input rows aggregated at a time
+    static const u_long MORSEL_SIZE = 1024;  // of a chunk, for a worker
+    static const u_long BATCH_SIZE = 1024;  // groups handed out at a time
+
+    /**
+     * Bytes of groups kept in memory before rows of other groups go to spill files
+     */
+    static u_long memory_budget;
+
+    /**
+     * @param input        operator to pull rows from (freed by the AggregateOperator)
+     * @param names        the group columns' names
+     * @param expressions  their values, on the input's columns (must outlive the operator)
+     * @param aggregates   the aggregates' columns (must outlive the operator)
+     * @param scheduler    workers to aggregate the input's chunks, or nullptr to do it all on this thread
+     */
+    AggregateOperator(EvalOperator *input, const ColumnNames &names, const Expressions &expressions,
+                      const Aggregates &aggregates, TaskScheduler *scheduler = nullptr);
+
+    virtual ~AggregateOperator();
+
+    virtual void open();
+
+    virtual void close();
+
+    /**
+     * Did rows go out to spill files (as of the last open)?
+     */
+    bool spilled() const { return this->partitions_made; }
+
+protected:
+    typedef std::pair<u_int32_t, ValueDict *> HashedRow;
+    typedef std::pair<SpillFile *, uint> Partition;  // and its level
+
+    EvalOperator *input;
+    ColumnNames names;
+    const Expressions &expressions;
+    const Aggregates &aggregates;
+    TaskScheduler *scheduler;
+    GroupTable table;
+    bool full;  // the table has no room for more groups
+    uint level;  // how many times the rows being aggregated have been partitioned
+    std::vector<SpillFile *> partitions;  // of the rows being aggregated, once the table is full
+    std::vector<Partition> pending;  // still to be aggregated
+    bool partitions_made;
+    u_long group_index;  // next group of the table to hand out
+
+    virtual bool fill();
+
+    NormalizedKey group_key(const ValueDict &row, ValueDict &values) const;
+
+    void aggregate_all(const std::function<ValueDict *()> &next);
+
+    void aggregate(const ValueDicts &chunk);
+
+    void aggregate_rows(const ValueDicts &chunk, u_long begin, u_long end, GroupTable &groups,
+                        std::vector<HashedRow> &overflow);
+
+    void spill(const std::vector<HashedRow> &overflow);
+
+    void finish_level();
+
+    void aggregate_partition();
+
+    void clear_partitions();
+};
+
+bool test_aggregate();
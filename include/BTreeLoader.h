@@ -0,0 +1,95 @@
+/**
+ * @file BTreeLoader.h - BTreeLoader class: bottom-up bulk build of a BTreeIndex
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "BTreeNode.h"
+
+typedef std::pair<NormalizedKey, Handle> IndexEntry;
+typedef std::vector<IndexEntry> IndexEntries;
+
+/**
+ * @class BTreeLoader - builds a BTree index from the bottom up
+ *
+ * Entries are fed in any order with add(). They are sorted in memory (comparing the normalized
+ * key bytes) and, if they exceed the sort budget, spilled as sorted runs into temporary HeapFiles
+ * which are merged at the end. The sorted stream is then packed left to right into leaves (filled
+ * up to the fill factor, counting the prefix the leaf's keys share only once), with the handles of
+ * equal keys gathered into one BTreePosting. The interior levels are built on top of them as each
+ * node fills up, using the shortest separator between adjacent leaves, so each block is written once.
+ */
+class BTreeLoader {
+public:
+    /**
+     * @param file         the (already created) index file
+     * @param key_profile  data types of the key columns
+     * @param run_prefix   name prefix for the temporary sorted-run files
+     * @param unique       throw if the same key shows up twice
+     * @param key_columns  how many of the columns in key_profile make up the key that has to be unique (the rest
+     *                     are included columns, just carried along in the index)
+     * @param fill_factor  fraction of each block to fill (0 < fill_factor <= 1)
+     * @param sort_budget  approximate bytes of entries to hold in memory before spilling a run
+     */
+    BTreeLoader(HeapFile &file, const KeyProfile &key_profile, Identifier run_prefix, bool unique,
+                uint key_columns, double fill_factor, u_long sort_budget);
+
+    virtual ~BTreeLoader();
+
+    BTreeLoader(const BTreeLoader &other) = delete;
+
+    BTreeLoader &operator=(const BTreeLoader &other) = delete;
+
+    /**
+     * Add an index entry (in any order).
+     * @param key     normalized key for the entry
+     * @param handle  row the key came from
+     */
+    void add(const NormalizedKey &key, Handle handle);
+
+    /**
+     * Sort everything added so far and write out the tree.
+     * Sets the root and height in stat and saves it.
+     * @param stat  stat block of the index
+     */
+    void build(BTreeStat *stat);
+
+protected:
+    HeapFile &file;
+    const KeyProfile &key_profile;
+    Identifier run_prefix;
+    bool unique;
+    uint key_columns;
+    double fill_factor;
+    u_long sort_budget;
+    IndexEntries buffer;
+    u_long buffer_bytes;
+    std::vector<HeapFile *> runs;
+
+    // the nodes currently being filled: leaf, then interior levels from the bottom up
+    BTreeLeaf *leaf;
+    u_long leaf_bytes;  // without prefix compression
+    u_long leaf_count;
+    NormalizedKey leaf_first;
+    NormalizedKey leaf_last;
+    std::vector<BTreeInterior *> levels;
+    std::vector<u_long> level_bytes;
+    bool have_last;
+    NormalizedKey last_key;
+    Handles pending;  // handles for last_key not yet put in a leaf
+
+    static u_long entry_bytes(const NormalizedKey &key);
+
+    void spill();
+
+    void merge_runs();
+
+    void append(const NormalizedKey &key, Handle handle);
+
+    void flush();
+
+    void append_boundary(uint level, const NormalizedKey &boundary, BlockID left, BlockID right);
+
+    u_int16_t target(u_int16_t reserved) const;
+};
@@ -1,5 +1,6 @@
 /**
  * @file BTreeNode.h - BTreeNode class and its subclasses: BTreeStat, BTreeInterior, BTreeLeaf
+ *                     and BTreePosting, the handle list for a key in a leaf
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
@@ -11,47 +12,231 @@
 
 typedef std::vector<ColumnAttribute::DataType> KeyProfile;
 typedef std::vector<Value> KeyValue;
-typedef std::vector<KeyValue *> KeyValues;
+
+/**
+ * A KeyValue in normalized form: the bytes of two normalized keys compare (with memcmp, which is
+ * what std::string comparison does) in the same order as the KeyValues they came from.
+ *      INT:     4 bytes, big-endian, with the sign bit flipped
+ *      TEXT:    the characters with each 0x00 escaped as 0x00 0xFF, then terminated by 0x00 0x00
+ *      BOOLEAN: 1 byte, 0 or 1
+ * The parts of a composite key are just concatenated. This is also the form stored on the page.
+ */
+typedef std::string NormalizedKey;
+typedef std::vector<NormalizedKey> NormalizedKeys;
 typedef std::vector<BlockID> BlockPointers;
-typedef std::pair<BlockID, KeyValue> Insertion;
+typedef std::pair<BlockID, NormalizedKey> Insertion;
+
+/**
+ * @class BTreePosting - the sorted list of handles for one key in a BTreeLeaf
+ *
+ * Short lists are stored in the leaf right along with their key, delta-encoded:
+ *      varint count, then for each handle: varint block delta, varint record id
+ *      (the record id is also a delta from the previous one when the block delta is 0)
+ * A list that would take more than OVERFLOW_SZ bytes in the leaf is moved out to a chain
+ * of overflow blocks in the index file, each holding one encoded chunk of the list. Then
+ * the leaf just keeps:
+ *      varint 0, head block, tail block, count
+ */
+class BTreePosting {
+public:
+    static const u_int16_t OVERFLOW_SZ = DbBlock::BLOCK_SZ / 8;
+
+    BTreePosting() : handles(), count(0), head(0), tail(0) {}
+
+    explicit BTreePosting(Handle handle) : handles{handle}, count(1), head(0), tail(0) {}
+
+    bool is_overflow() const { return head != 0; }
+
+    u_int32_t size() const { return count; }
+
+    /**
+     * Get all the handles (reading the overflow chain if there is one).
+     * @param file  index file holding the overflow blocks
+     * @returns     sorted handles (freed by caller)
+     */
+    Handles *get_handles(HeapFile &file) const;
+
+    /**
+     * Add a handle to the list, moving the list out to overflow blocks if it gets too long.
+     * @param file    index file holding the overflow blocks
+     * @param handle  handle to add (ignored if already there)
+     */
+    void add(HeapFile &file, Handle handle);
+
+    /**
+     * Replace the list with the given one, using overflow blocks if it is too long for the leaf.
+     * @param file     index file holding the overflow blocks
+     * @param handles  sorted handles
+     */
+    void assign(HeapFile &file, const Handles &handles);
+
+    /**
+     * Take a handle out of the list.
+     * @param file    index file holding the overflow blocks
+     * @param handle  handle to remove
+     * @returns       false if it wasn't there
+     */
+    bool remove(HeapFile &file, Handle handle);
+
+    Dbt *marshal() const;
+
+    static BTreePosting unmarshal(const Dbt *dbt);
+
+protected:
+    Handles handles;  // empty when the list is in overflow blocks
+    u_int32_t count;
+    BlockID head;
+    BlockID tail;
+
+    static void encode(std::string &bytes, Handles::const_iterator begin, Handles::const_iterator end);
+
+    static void decode(const char *bytes, Handles &handles);
+
+    void write_overflow(HeapFile &file, const Handles &handles);
+};
 
 class BTreeNode {
 public:
+    /**
+     * Bytes in a block for records and their slot headers (after the block header)
+     */
+    static const u_int16_t PAGE_ROOM = DbBlock::BLOCK_SZ - 4 - 1;
+
+    /**
+     * Bytes of slot header for each record in a block
+     */
+    static const u_int16_t SLOT_OVERHEAD = 4;
+
+    /**
+     * Bytes of the record ending each node (right sibling and high key length), not counting the high key
+     */
+    static const u_int16_t LINK_SZ = SLOT_OVERHEAD + sizeof(BlockID) + sizeof(u_int16_t);
+
+    /**
+     * Largest normalized key we allow, so that a node always has room for a few entries
+     */
+    static const u_int16_t MAX_KEY_SZ = DbBlock::BLOCK_SZ / 4;
+
+    /**
+     * Fraction of a full node left in place when it splits because of an insert at the right edge
+     * of the tree (where increasing keys go); the usual split is half and half
+     */
+    static constexpr double APPEND_SPLIT = 0.9;
+
     BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
     virtual ~BTreeNode();
 
     static bool insertion_is_none(Insertion insertion) { return insertion.first == 0; }
 
-    static Insertion insertion_none() { return Insertion(0, KeyValue()); }
+    static Insertion insertion_none() { return Insertion(0, NormalizedKey()); }
 
     virtual void save();
 
     BlockID get_id() const { return this->id; }
 
+    /**
+     * Whether key belongs in this node or in one to its right (in the B-link tree each node
+     * but the last on its level has a right sibling and a high key, above all the node's keys).
+     * @param key  normalized key
+     * @returns    false if the search for key has to move right to get_right()
+     */
+    bool covers(const NormalizedKey &key) const { return this->right == 0 || key < this->high_key; }
+
+    BlockID get_right() const { return this->right; }
+
+    const NormalizedKey &get_high_key() const { return this->high_key; }
+
+    void set_right(BlockID right, const NormalizedKey &high_key) {
+        this->right = right;
+        this->high_key = high_key;
+    }
+
+    /**
+     * Convert a key into its normalized form.
+     * @param key          key values, in key_profile order
+     * @param key_profile  data types of the key columns
+     * @returns            normalized key bytes
+     */
+    static NormalizedKey normalize(const KeyValue &key, const KeyProfile &key_profile);
+
+    /**
+     * Append the normalized form of one value to a key (with no limit on the key's size, unlike normalize).
+     * @param value      the value
+     * @param data_type  its column's data type
+     * @param bytes      normalized key bytes so far
+     */
+    static void normalize_value(const Value &value, ColumnAttribute::DataType data_type, NormalizedKey &bytes);
+
+    /**
+     * Convert a normalized key back into key values.
+     * @param key          normalized key bytes
+     * @param key_profile  data types of the key columns
+     * @returns            key values (freed by caller)
+     */
+    static KeyValue *denormalize(const NormalizedKey &key, const KeyProfile &key_profile);
+
+    /**
+     * Bytes the values of the first few key columns take at the start of a normalized key.
+     * @param key          normalized key bytes
+     * @param key_profile  data types of the key columns
+     * @param columns      how many of the key columns
+     */
+    static u_long key_length(const NormalizedKey &key, const KeyProfile &key_profile, uint columns);
+
+    /**
+     * Number of leading bytes two normalized keys have in common.
+     */
+    static u_long common_prefix_length(const NormalizedKey &a, const NormalizedKey &b);
+
+    /**
+     * Shortest boundary that separates two adjacent keys (suffix truncation).
+     * @param left   largest key going to the left of the boundary
+     * @param right  smallest key going to the right of the boundary (> left)
+     * @returns      shortest prefix of right that is > left (it might not be a whole key)
+     */
+    static NormalizedKey separator(const NormalizedKey &left, const NormalizedKey &right);
+
+    /**
+     * Is key within a range's (inclusive) upper limit?
+     * @param key   normalized key
+     * @param high  normalized upper limit, which may be the prefix of some whole keys
+     * @returns     true if key <= high or high is a prefix of key
+     */
+    static bool up_to(const NormalizedKey &key, const NormalizedKey &high);
+
 protected:
     SlottedPage *block;
     HeapFile &file;
     BlockID id;
     const KeyProfile &key_profile;
+    BlockID right;  // right sibling, 0 for the last node on a level
+    NormalizedKey high_key;  // keys >= this go to the right sibling
 
     static Dbt *marshal_block_id(BlockID block_id);
 
+    Dbt *marshal_link(const NormalizedKey &extra) const;
+
+    NormalizedKey get_link(RecordID record_id);
+
     static Dbt *marshal_handle(Handle handle);
 
-    virtual Dbt *marshal_key(const KeyValue *key);
+    static Dbt *marshal_key(const NormalizedKey &key);
 
     virtual BlockID get_block_id(RecordID record_id) const;
 
     virtual Handle get_handle(RecordID record_id) const;
 
-    virtual KeyValue *get_key(RecordID record_id) const;
+    virtual BTreePosting get_posting(RecordID record_id) const;
+
+    virtual NormalizedKey get_key(RecordID record_id) const;
 };
 
 class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID BLOOM = HEIGHT + 1;  // where we store whether the index has a Bloom filter (if we do)
 
     BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile);
 
@@ -69,9 +254,14 @@ public:
 
     void set_height(uint height) { this->height = height; }
 
+    bool has_bloom() const { return this->bloom; }
+
+    void set_bloom(bool bloom) { this->bloom = bloom; }
+
 protected:
     BlockID root_id;
     uint height;
+    bool bloom;  // there's a Bloom filter file next to the index
 
 };
 
@@ -81,20 +271,32 @@ public:
 
     virtual ~BTreeInterior();
 
-    BTreeNode *find(const KeyValue *key, uint depth) const;
+    BlockID find_child(const NormalizedKey &key) const;  // key must be covered by this node
 
-    Insertion insert(const KeyValue *boundary, BlockID block_id);
+    Insertion insert(const NormalizedKey &boundary, BlockID block_id);
 
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
 
+    void append(const NormalizedKey &boundary, BlockID block_id);  // bulk load: boundary must be the largest so far
+
+    void pop_back(NormalizedKey &boundary, BlockID &block_id);  // bulk load: take the last ones back off
+
+    u_long byte_size() const;
+
+    BlockPointers children() const;  // first, then the other pointers, in order
+
+    BlockID last_child() const { return this->pointers.empty() ? this->first : this->pointers.back(); }
+
+    const NormalizedKey *last_boundary() const { return this->boundaries.empty() ? nullptr : &this->boundaries.back(); }
+
     friend std::ostream &operator<<(std::ostream &out, const BTreeInterior &node);
 
 protected:
     BlockID first;
     BlockPointers pointers;
-    KeyValues boundaries;
+    NormalizedKeys boundaries;
 };
 
 class BTreeLeaf : public BTreeNode {
@@ -103,14 +305,33 @@ public:
 
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue *key) const;  // throws if not found
-    Insertion insert(const KeyValue *key, Handle handle);
+    Handles *find_eq(const NormalizedKey &key) const;  // empty if not found
+
+    /**
+     * Add the handles of the keys in a range to handles.
+     * @param low   smallest key (or key prefix) to include
+     * @param high  largest key to include, along with all the keys it is a prefix of (nullptr for no limit)
+     * @param keys  if not nullptr, gets each handle's key, too
+     */
+    void find_range(const NormalizedKey &low, const NormalizedKey *high, Handles &handles,
+                    NormalizedKeys *keys = nullptr) const;
+
+    Insertion insert(const NormalizedKey &key, Handle handle, bool unique);
+
+    bool remove(const NormalizedKey &key, Handle handle);  // false if not there; the leaf is never merged away
+
+    void append(const NormalizedKey &key, const BTreePosting &posting);  // bulk load: key must be the largest so far
+
+    static u_long entry_size(const NormalizedKey &key, const BTreePosting &posting);
 
     virtual void save();
 
 protected:
-    BlockID next_leaf;
-    std::map<KeyValue, Handle> key_map;
+    std::map<NormalizedKey, BTreePosting> key_map;  // whole keys (the common prefix is only factored out on the page)
+
+    u_long prefix_length() const;
+
+    u_long byte_size() const;
 };
 
 
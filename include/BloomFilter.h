@@ -0,0 +1,97 @@
+/**
+ * @file BloomFilter.h - BloomFilter class: set membership with no false negatives, for skipping lookups of absent keys
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "HeapFile.h"
+
+/**
+ * @class BloomFilter - blocked Bloom filter on byte-string keys
+ *
+ * The bits are split into groups of 512 (a cache line). A key's hash picks one group and then the bits to set
+ * within it, so checking a key touches just one cache line, and adding one changes just one block of the file the
+ * filter is saved in. Keys can't be taken out (the filter is rebuilt instead), and once more keys are added than
+ * it was sized for, the false positive rate goes up (see estimated_false_positive_rate).
+ *
+ * Saved, a filter is a header block (its group count and hash count) followed by blocks of groups.
+ * Adds and checks may come from several threads at once.
+ */
+class BloomFilter {
+public:
+    /**
+     * Fraction of the absent keys that may_contain says might be present, unless asked for otherwise
+     */
+    static constexpr double DEFAULT_FALSE_POSITIVE_RATE = 0.01;
+
+    /**
+     * Fewest keys a filter is sized for (so that a filter for an empty table has some room to fill)
+     */
+    static const u_long MIN_KEYS = 1024;
+
+    /**
+     * Make an empty filter (in memory until saved).
+     * @param expected_keys        how many keys it will hold
+     * @param false_positive_rate  fraction of the absent keys may_contain should let through (0 < rate < 1)
+     */
+    BloomFilter(u_long expected_keys, double false_positive_rate = DEFAULT_FALSE_POSITIVE_RATE);
+
+    virtual ~BloomFilter() {}
+
+    BloomFilter(const BloomFilter &other) = delete;
+
+    BloomFilter &operator=(const BloomFilter &other) = delete;
+
+    /**
+     * Read a filter back from where save put it. It stays tied to the file, as after save.
+     * @returns  the filter (freed by caller)
+     */
+    static BloomFilter *load(HeapFile &file, BlockID header_id);
+
+    /**
+     * Write the filter to file: its header to header_id (an existing block), and its groups to new blocks. From then
+     * on, add writes the block it changes, too.
+     */
+    void save(HeapFile &file, BlockID header_id);
+
+    void add(const std::string &key);
+
+    bool may_contain(const std::string &key) const;  // false if key was never added
+
+    /**
+     * Guess at the current false positive rate, from how many of the bits are set.
+     */
+    double estimated_false_positive_rate() const;
+
+    u_long byte_size() const { return this->groups * GROUP_BYTES; }
+
+    /**
+     * Bytes of a Value to put in a filter: its data type and then its data.
+     */
+    static std::string value_key(const Value &value);
+
+protected:
+    static const uint GROUP_BITS = 512;
+    static const uint GROUP_WORDS = GROUP_BITS / 64;
+    static const uint GROUP_BYTES = GROUP_BITS / 8;
+    static const uint GROUPS_PER_BLOCK = (DbBlock::BLOCK_SZ - 64) / GROUP_BYTES;
+
+    u_int32_t groups;
+    u_int32_t hashes;
+    std::unique_ptr<std::atomic<u_int64_t>[]> words;
+    HeapFile *file;  // where it's saved, nullptr if it isn't
+    BlockID first_block;  // block of the first GROUPS_PER_BLOCK groups in file
+    std::mutex save_mutex;  // keeps saves of the same block in order
+
+    BloomFilter(u_int32_t groups, u_int32_t hashes);
+
+    static u_int64_t hash(const std::string &key);
+
+    void save_block(u_int32_t block_index);
+};
+
+bool test_bloom_filter();
@@ -0,0 +1,129 @@
+/**
+ * @file ColumnBatch.h - ColumnBatch class: rows stored a column at a time, for vectorized scans
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <string_view>
+#include "storage_engine.h"
+
+class Expression;
+
+/**
+ * @class ColumnVector - one column's values for the rows of a batch
+ *
+ * INT and BOOLEAN values are kept in an array of int32_t; TEXT values end to end in one buffer, with the offset
+ * where each starts.
+ */
+class ColumnVector {
+public:
+    explicit ColumnVector(ColumnAttribute::DataType data_type) : data_type(data_type), ints(), offsets(1, 0),
+                                                                 bytes() {}
+
+    ColumnAttribute::DataType get_data_type() const { return this->data_type; }
+
+    void append(const Value &value);
+
+    void append_int(int32_t n) { this->ints.push_back(n); }
+
+    void append_text(const char *text, u_int16_t size) {
+        this->bytes.append(text, size);
+        this->offsets.push_back((u_int32_t) this->bytes.size());
+    }
+
+    Value get(u_long i) const;
+
+    int32_t get_int(u_long i) const { return this->ints[i]; }
+
+    std::string_view get_text(u_long i) const {
+        return std::string_view(this->bytes.data() + this->offsets[i], this->offsets[i + 1] - this->offsets[i]);
+    }
+
+    void clear();
+
+    /**
+     * Clear mask[i] for each row i whose value doesn't satisfy the comparison (which must be with a value of the
+     * column's data type).
+     */
+    void filter(const Comparison &comparison, u_int8_t *mask) const;
+
+protected:
+    ColumnAttribute::DataType data_type;
+    std::vector<int32_t> ints;  // for INT and BOOLEAN
+    std::vector<u_int32_t> offsets;  // for TEXT: where each value starts in bytes (and, last, where the last ends)
+    std::string bytes;
+};
+
+
+/**
+ * @class ColumnBatch - a batch of rows (about CAPACITY of them), a ColumnVector for each column, with a selection
+ * vector of the rows that have passed the filters so far
+ *
+ * Filters check one column for all the rows at a time, in tight loops over arrays that the compiler can turn into
+ * SIMD instructions, and just the selected rows are made into ValueDicts at the end.
+ */
+class ColumnBatch {
+public:
+    /**
+     * Rows a scan puts in a batch (give or take a block's worth)
+     */
+    static const u_long CAPACITY = 1024;
+
+    /**
+     * @param column_names       the batch's columns (distinct)
+     * @param column_attributes  their data types
+     */
+    ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    const ColumnNames &get_column_names() const { return this->column_names; }
+
+    ColumnVector &column(u_long i) { return this->columns[i]; }
+
+    const ColumnVector &column(u_long i) const { return this->columns[i]; }
+
+    /**
+     * Add a row (for relations that can't fill a batch straight from their blocks).
+     * @param handle  the row's handle
+     * @param row     values for (at least) the batch's columns
+     */
+    void add_row(Handle handle, const ValueDict &row);
+
+    /**
+     * Call after adding a row's values to each of the columns.
+     */
+    void added(Handle handle) { this->handles.push_back(handle); }
+
+    u_long size() const { return this->handles.size(); }
+
+    /**
+     * Select the rows that satisfy all the comparisons (whose columns must be in the batch, compared with values
+     * of their data types).
+     */
+    void filter(const Conjunction &where);
+
+    /**
+     * Narrow the selection down to the rows for which a BOOLEAN expression (bound to the batch's columns) is true.
+     */
+    void filter(const Expression &where);
+
+    const std::vector<u_int32_t> &get_selection() const { return this->selection; }
+
+    /**
+     * Make a ValueDict of a row's values.
+     * @param i        the row
+     * @param columns  how many of the batch's columns to put in it (the first ones)
+     * @returns        the row (freed by caller)
+     */
+    ValueDict *row(u_long i, u_long columns) const;
+
+    void clear();
+
+protected:
+    ColumnNames column_names;
+    std::vector<ColumnVector> columns;
+    Handles handles;
+    std::vector<u_int32_t> selection;  // rows that passed filter, in order
+};
+
+bool test_column_batch();
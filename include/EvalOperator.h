@@ -0,0 +1,354 @@
+/**
+ * @file EvalOperator.h - Operators that evaluation plans are compiled into (see EvalPlan::compile)
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include "storage_engine.h"
+#include "ColumnBatch.h"
+#include "Expression.h"
+#include "TaskScheduler.h"
+
+class EvalPlan;
+
+/**
+ * @class EvalOperator - iterator over the rows of part of an evaluation plan, in the manner of Volcano
+ *
+ * open() gets it ready, each next() pulls one row up from the operators below, and close() lets go of whatever it
+ * still holds. So the rows in memory at once are just those on their way up (scans read a block's rows, or a
+ * batch of handles' rows, at a time), and whoever is pulling can stop as soon as it has all it wants.
+ */
+class EvalOperator {
+public:
+    EvalOperator() = default;
+
+    virtual ~EvalOperator() {}
+
+    EvalOperator(const EvalOperator &other) = delete;
+
+    EvalOperator &operator=(const EvalOperator &other) = delete;
+
+    virtual void open() = 0;
+
+    /**
+     * Get the next row.
+     * @returns  the row (freed by caller), or nullptr if there are no more
+     */
+    virtual ValueDict *next() = 0;
+
+    virtual void close() = 0;
+};
+
+
+/**
+ * @class BufferedOperator - operator that gets its rows a batch at a time (from fill) and hands them out one by one
+ */
+class BufferedOperator : public EvalOperator {
+public:
+    BufferedOperator() : EvalOperator(), buffer(), position(0) {}
+
+    virtual ~BufferedOperator() { clear(); }
+
+    virtual ValueDict *next();
+
+    virtual void close() { clear(); }
+
+protected:
+    ValueDicts buffer;
+    u_long position;  // next row of buffer to hand out (the ones before it are the caller's now)
+
+    /**
+     * Put the next batch of rows in buffer.
+     * @returns  false if there are no more
+     */
+    virtual bool fill() = 0;
+
+    void clear();
+};
+
+
+/**
+ * @class TableScanOperator - rows of a table a block at a time, with a conjunction (if any) checked as they're read
+ */
+class TableScanOperator : public BufferedOperator {
+public:
+    /**
+     * @param table    relation to scan
+     * @param columns  columns of the rows to get
+     * @param where    comparisons the rows must satisfy (the columns needn't be in columns)
+     */
+    TableScanOperator(DbRelation &table, const ColumnNames &columns, const Conjunction &where);
+
+    virtual ~TableScanOperator() { delete this->block_ids; }
+
+    virtual void open();
+
+    virtual void close();
+
+protected:
+    DbRelation &table;
+    ColumnNames columns;
+    Conjunction where;
+    BlockIDs *block_ids;  // the table's blocks, while open
+    u_long block_index;  // next one to read
+
+    virtual bool fill();
+};
+
+
+/**
+ * @class VectorScanOperator - rows of a table a ColumnBatch at a time, decoded a column at a time and filtered by
+ * vectorized comparisons (and then, if there's one, a filter expression evaluated a batch at a time), so that only
+ * the rows that satisfy the conjunction are made into ValueDicts
+ */
+class VectorScanOperator : public BufferedOperator {
+public:
+    /**
+     * @param table    relation to scan
+     * @param columns  columns of the rows to get
+     * @param where    comparisons the rows must satisfy (the columns needn't be in columns)
+     * @param filter   BOOLEAN expression the rows must also satisfy (nullptr for none; the operator uses a copy)
+     */
+    VectorScanOperator(DbRelation &table, const ColumnNames &columns, const Conjunction &where,
+                       const Expression *filter = nullptr);
+
+    virtual ~VectorScanOperator();
+
+    virtual void open();
+
+    /**
+     * Get the next batch of rows, filtered: its selection has the rows that satisfy the conjunction (and there's
+     * at least one).
+     * @returns  the batch (good until the next call), or nullptr if there are no more rows
+     */
+    ColumnBatch *next_batch();
+
+    virtual void close();
+
+protected:
+    DbRelation &table;
+    u_long output_columns;  // the batch has the rows' columns first, then the other ones the conjunction needs
+    ColumnNames batch_columns;
+    ColumnAttributes batch_attributes;
+    Conjunction where;
+    Expression *filter;  // bound to batch_columns
+    ColumnBatch *batch;  // while open
+    BlockIDs *block_ids;
+    u_long block_index;
+
+    virtual bool fill();
+};
+
+
+/**
+ * @class ParallelScanOperator - a VectorScanOperator whose blocks are scanned by all the scheduler's workers at once
+ *
+ * The blocks are split into morsels of MORSEL_BLOCKS blocks, and each fill scans the next few morsels for each
+ * worker. A worker scans and filters a morsel into its own ColumnBatch and makes the selected rows into the
+ * morsel's own list, so the workers share nothing but the table; then the lists are put together in block order
+ * (so the rows come out in the same order as from a serial scan). Tables with fewer than MIN_BLOCKS blocks aren't
+ * worth splitting up, so they're scanned as by a VectorScanOperator.
+ */
+class ParallelScanOperator : public VectorScanOperator {
+public:
+    static const u_long MIN_BLOCKS = 64;
+    static const u_long MORSEL_BLOCKS = 8;
+    static const u_long MORSELS_PER_WORKER = 4;  // in each fill
+
+    ParallelScanOperator(DbRelation &table, const ColumnNames &columns, const Conjunction &where,
+                         const Expression *filter = nullptr, TaskScheduler &scheduler = TaskScheduler::shared());
+
+protected:
+    TaskScheduler &scheduler;
+
+    virtual bool fill();
+};
+
+
+/**
+ * @class IndexScanOperator - rows for the handles from an index scan (or an intersection of them), fetched a batch
+ * at a time, with a conjunction (if any) checked as they're fetched
+ */
+class IndexScanOperator : public BufferedOperator {
+public:
+    /**
+     * Handles fetched at once: enough that the rows sharing a block are usually read together
+     */
+    static const u_long BATCH_SIZE = 1024;
+
+    /**
+     * @param scan     IndexLookup, IndexRange, IndexAnd, or IndexOr plan for the handles (must outlive the operator)
+     * @param table    relation the handles are for
+     * @param columns  columns of the rows to get
+     * @param where    comparisons the rows must satisfy
+     */
+    IndexScanOperator(EvalPlan *scan, DbRelation &table, const ColumnNames &columns, const Conjunction &where);
+
+    virtual ~IndexScanOperator() { delete this->handles; }
+
+    virtual void open();
+
+    virtual void close();
+
+protected:
+    EvalPlan *scan;
+    DbRelation &table;
+    ColumnNames columns;
+    Conjunction where;
+    Handles *handles;  // from the index, while open
+    u_long handle_index;  // next one to fetch
+
+    virtual bool fill();
+};
+
+
+/**
+ * @class IndexValuesOperator - rows of an index-only scan (or a Select on one), straight from the index
+ */
+class IndexValuesOperator : public BufferedOperator {
+public:
+    explicit IndexValuesOperator(EvalPlan *plan) : BufferedOperator(), plan(plan), done(false) {}
+
+    virtual void open() { this->done = false; }
+
+protected:
+    EvalPlan *plan;  // must outlive the operator
+    bool done;
+
+    virtual bool fill();
+};
+
+
+/**
+ * @class FilterOperator - the rows of its input for which a BOOLEAN expression is true, checked a row at a time
+ */
+class FilterOperator : public EvalOperator {
+public:
+    /**
+     * @param input   operator to pull rows from (freed by the FilterOperator)
+     * @param filter  expression on the input's columns (the operator uses a copy)
+     */
+    FilterOperator(EvalOperator *input, const Expression *filter) : EvalOperator(), input(input),
+                                                                    filter(filter->copy()) {}
+
+    virtual ~FilterOperator() {
+        delete this->input;
+        delete this->filter;
+    }
+
+    virtual void open() { this->input->open(); }
+
+    virtual ValueDict *next();
+
+    virtual void close() { this->input->close(); }
+
+protected:
+    EvalOperator *input;
+    Expression *filter;
+};
+
+
+/**
+ * @class ProjectOperator - the given columns of its input's rows
+ */
+class ProjectOperator : public EvalOperator {
+public:
+    /**
+     * @param input       operator to pull rows from (freed by the ProjectOperator)
+     * @param projection  columns to keep (nullptr for all the input's)
+     */
+    ProjectOperator(EvalOperator *input, const ColumnNames *projection);
+
+    virtual ~ProjectOperator() { delete this->input; }
+
+    virtual void open() { this->input->open(); }
+
+    virtual ValueDict *next();
+
+    virtual void close() { this->input->close(); }
+
+protected:
+    EvalOperator *input;
+    const ColumnNames *projection;
+};
+
+
+/**
+ * @class ComputeOperator - rows of the values of a select list's expressions for its input's rows
+ */
+class ComputeOperator : public EvalOperator {
+public:
+    /**
+     * @param input        operator to pull rows from (freed by the ComputeOperator)
+     * @param names        the result columns' names
+     * @param expressions  their values, on the input's columns (must outlive the operator)
+     */
+    ComputeOperator(EvalOperator *input, const ColumnNames *names, const Expressions *expressions)
+            : EvalOperator(), input(input), names(names), expressions(expressions) {}
+
+    virtual ~ComputeOperator() { delete this->input; }
+
+    virtual void open() { this->input->open(); }
+
+    virtual ValueDict *next();
+
+    virtual void close() { this->input->close(); }
+
+protected:
+    EvalOperator *input;
+    const ColumnNames *names;
+    const Expressions *expressions;
+};
+
+
+/**
+ * @class LimitOperator - its input's rows after the first offset of them, up to limit of them
+ *
+ * Once it has given limit rows it pulls no more, so the operators below (which read a block, or a batch of handles,
+ * at a time) stop there too.
+ */
+class LimitOperator : public EvalOperator {
+public:
+    /**
+     * @param input   operator to pull rows from (freed by the LimitOperator)
+     * @param limit   most rows to give
+     * @param offset  rows to skip first
+     */
+    LimitOperator(EvalOperator *input, u_long limit, u_long offset) : EvalOperator(), input(input), limit(limit),
+                                                                       offset(offset), given(0) {}
+
+    virtual ~LimitOperator() { delete this->input; }
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close() { this->input->close(); }
+
+protected:
+    EvalOperator *input;
+    u_long limit;
+    u_long offset;
+    u_long given;  // rows since open (skipped or not)
+};
+
+
+/**
+ * @class RowsOperator - copies of rows already made (for using operators without a table, as the tests do)
+ */
+class RowsOperator : public BufferedOperator {
+public:
+    /**
+     * @param rows  the rows (must outlive the operator)
+     */
+    explicit RowsOperator(const ValueDicts &rows) : BufferedOperator(), rows(rows), done(false) {}
+
+    virtual void open() { this->done = false; }
+
+protected:
+    const ValueDicts &rows;
+    bool done;
+
+    virtual bool fill();
+};
@@ -6,7 +6,10 @@
  */
 #pragma once
 
-#include "storage_engine.h"
+#include "schema_tables.h"
+#include "EvalOperator.h"
+#include "JoinOperator.h"
+#include "AggregateOperator.h"
 
 
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
@@ -14,29 +17,93 @@ typedef std::pair<DbRelation *, Handles *> EvalPipeline;
 class EvalPlan {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, Filter, Compute, Aggregate, Sort, TopN, Limit, Join, IndexJoin, MergeJoin,
+        TableScan, IndexLookup, IndexRange, IndexAnd, IndexOr
     };
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
-    EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(Conjunction *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(Expression *filter, EvalPlan *relation);  // use for Filter, e.g., on a Select
+    EvalPlan(ColumnNames *names, Expressions *expressions, EvalPlan *relation);  // use for Compute, on a projection
+    // use for Aggregate, on a projection
+    EvalPlan(ColumnNames *names, Expressions *expressions, Aggregates *aggregates, EvalPlan *relation);
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbRelation &table, DbIndex &index, ValueDict *key);  // use for IndexLookup
+    EvalPlan(DbRelation &table, DbIndex &index, ValueDict *min_key, ValueDict *max_key);  // use for IndexRange
+    EvalPlan(PlanType type, EvalPlan *relation, EvalPlan *other);  // use for IndexAnd or IndexOr, on two index scans
+    EvalPlan(SortKeys *keys, EvalPlan *relation);  // use for Sort, e.g., on a Compute
+    EvalPlan(u_long limit, u_long offset, EvalPlan *relation);  // use for Limit, e.g., on a Sort
+    EvalPlan(JoinKeys *keys, EvalPlan *relation, EvalPlan *other);  // use for Join, e.g., of two Computes
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan, using the table's indices where they help
+    EvalPlan *optimize(Indices &indices);
 
     // Evaluate the plan: evaluate gets values, pipeline gets handles
     ValueDicts *evaluate();
 
     EvalPipeline pipeline();
 
+    // Compile the plan (which must end with a projection, or a Compute on one) into operators that give its rows
+    // one at a time (freed by caller, and the plan must outlive them)
+    EvalOperator *compile();
+
+    ValueDicts *index_values();  // for an index_only scan, or a Select on one
+
+    // Guess at how big the plan's result is, in blocks' worth of rows (for choosing between plans)
+    double estimate() const;
+
+    // A Limit's limit for none (just an offset)
+    static const u_long NO_LIMIT = ~0UL;
+
+    // Whether compile scans tables a ColumnBatch at a time (VectorScanOperator), rather than a row at a time
+    static bool vectorized;
+
+    // Whether vectorized scans use all the cores (ParallelScanOperator)
+    static bool parallel;
+
 protected:
 
     PlanType type;
     EvalPlan *relation;  // for everything except TableScan
-    ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    EvalPlan *other;  // for IndexAnd (IndexOr): the scan whose handles are intersected with (added to) relation's;
+                      // for Join: the build side; for IndexJoin: the (renamed) scan of the table looked up
+    ColumnNames *projection;  // for Project, and for Compute and Aggregate: the names of its (group) columns
+    Conjunction *select_conjunction;  // for Select
+    Expression *filter;  // for Filter: what the rows the Select lets through must satisfy besides
+    Expressions *expressions;  // for Compute and Aggregate: the values of its (group) columns
+    Aggregates *aggregates;  // for Aggregate: its other columns
+    SortKeys *sort_keys;  // for Sort
+    JoinKeys *join_keys;  // for Join and MergeJoin: (relation's column, other's column) pairs to match; for IndexJoin:
+                          // (relation's column, other's table's column) pairs
+    DbRelation &table;  // for TableScan, IndexLookup, and IndexRange
+    DbIndex *index;  // for IndexLookup, IndexRange, and IndexJoin
+    ValueDict *index_key;  // for IndexLookup: values for all the index's key columns, or the first few (BTree)
+    ValueDict *min_key, *max_key;  // for IndexRange: inclusive limits (see DbIndex::range), nullptr if none
+    bool index_only;  // for IndexLookup and IndexRange: the index has all the columns needed, so skip the table
+    u_long limit;  // for Limit: most rows to give; for TopN: rows to give; for IndexRange: most handles to get
+                   // (0 for all of them)
+    u_long offset;  // for Limit: rows to skip first
+
+    EvalPlan *use_index(Indices &indices) const;
+
+    EvalPlan *use_index_union(Indices &indices) const;
+
+    EvalPlan *use_index_join(Indices &indices) const;
+
+    const Identifier *renamed_column(const Identifier &name) const;
+
+    bool ordered_by(const SortKeys &keys) const;
+
+    void use_merge_join();
+
+    void push_limit(Indices &indices);
+
+    bool scan_in_order(Indices &indices);
+
+    void use_index_only();
+
+    DbRelation &scanned_table() const;
 };
\ No newline at end of file
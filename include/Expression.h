@@ -0,0 +1,318 @@
+/**
+ * @file Expression.h - Expression classes: compiled expressions for where clauses and select lists
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <string_view>
+#include "storage_engine.h"
+#include "ColumnBatch.h"
+
+typedef std::vector<u_int32_t> Selection;  // rows of a ColumnBatch, in order
+
+/**
+ * @class Expression - node of a typed expression tree (see SQLExec for how one is made from a parse tree)
+ *
+ * The types are checked when the tree is made, so evaluating it never has to look at a Value's data type: INT and
+ * BOOLEAN expressions give plain int32_t's (BOOLEANs are 0 or 1) and TEXT expressions give views of their text.
+ * Each can be evaluated a row at a time, on a ValueDict, or a batch at a time, on the selected rows of a
+ * ColumnBatch, in loops over arrays of int32_t's. AND and OR short-circuit either way: a row at a time the right side
+ * isn't evaluated when the left decides, and a batch at a time it's only evaluated on the rows the left doesn't
+ * decide.
+ *
+ * A subclass overrides eval_ints or select (or both), whichever it does best: each is done by the other by default.
+ */
+class Expression {
+public:
+    explicit Expression(ColumnAttribute::DataType data_type) : data_type(data_type) {}
+
+    virtual ~Expression() {}
+
+    Expression(const Expression &other) = delete;
+
+    Expression &operator=(const Expression &other) = delete;
+
+    ColumnAttribute::DataType get_data_type() const { return this->data_type; }
+
+    /**
+     * A copy of the whole tree.
+     * @returns  the copy (freed by caller)
+     */
+    virtual Expression *copy() const = 0;
+
+    /**
+     * Add the columns the expression uses to columns (those not there already).
+     */
+    virtual void get_columns(ColumnNames &columns) const {}
+
+    /**
+     * The column the expression is, if it is just a column (so a Compute of them only renames columns).
+     * @returns  the column's name, or nullptr
+     */
+    virtual const Identifier *get_column() const { return nullptr; }
+
+    /**
+     * The constant the expression is, if it is just a literal.
+     * @returns  its value, or nullptr
+     */
+    virtual const Value *get_value() const { return nullptr; }
+
+    /**
+     * Add the comparisons the expression is made of to conjunction, if it is just <column> <op> <literal>
+     * comparisons (either way around) ANDed together, so that an index might find its rows.
+     * @returns  false if it isn't (and then conjunction may have some of them added)
+     */
+    virtual bool get_comparisons(Conjunction &conjunction) const { return false; }
+
+    /**
+     * Add the operands of the expression's ANDs (the expression itself, if it isn't an AND) to conjuncts.
+     */
+    virtual void get_conjuncts(std::vector<const Expression *> &conjuncts) const { conjuncts.push_back(this); }
+
+    /**
+     * Add the operands of the expression's ORs (the expression itself, if it isn't an OR) to disjuncts.
+     */
+    virtual void get_disjuncts(std::vector<const Expression *> &disjuncts) const { disjuncts.push_back(this); }
+
+    /**
+     * Get ready to be evaluated on ColumnBatches with the given columns (which must include all of get_columns).
+     */
+    virtual void bind(const ColumnNames &batch_columns) {}
+
+    // a row at a time
+
+    /**
+     * Value of an INT or BOOLEAN expression for a row (which must have all of get_columns).
+     */
+    virtual int32_t eval_int(const ValueDict &row) const = 0;
+
+    /**
+     * Value of a TEXT expression for a row (good as long as the row and the expression are).
+     */
+    virtual std::string_view eval_text(const ValueDict &row) const;
+
+    /**
+     * Is a BOOLEAN expression true for a row?
+     */
+    bool test(const ValueDict &row) const { return eval_int(row) != 0; }
+
+    /**
+     * Value of the expression for a row, of whatever data type it is.
+     */
+    Value eval(const ValueDict &row) const;
+
+    // a batch at a time (once bound)
+
+    /**
+     * Values of an INT or BOOLEAN expression for some of a batch's rows.
+     * @param batch  the rows
+     * @param rows   which of them
+     * @param out    returned: the value for each of rows
+     */
+    virtual void eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const;
+
+    /**
+     * Value of a TEXT expression for one of a batch's rows (good until the batch is cleared).
+     */
+    virtual std::string_view eval_text(const ColumnBatch &batch, u_long i) const;
+
+    /**
+     * Narrow rows down to those for which a BOOLEAN expression is true.
+     */
+    virtual void select(const ColumnBatch &batch, Selection &rows) const;
+
+protected:
+    ColumnAttribute::DataType data_type;
+};
+
+typedef std::vector<Expression *> Expressions;
+
+
+/**
+ * @class ColumnExpression - a row's value for a column
+ */
+class ColumnExpression : public Expression {
+public:
+    ColumnExpression(Identifier column_name, ColumnAttribute::DataType data_type) : Expression(data_type),
+                                                                                     column_name(column_name),
+                                                                                     slot(0) {}
+
+    virtual Expression *copy() const;
+
+    virtual void get_columns(ColumnNames &columns) const;
+
+    virtual const Identifier *get_column() const { return &this->column_name; }
+
+    virtual void bind(const ColumnNames &batch_columns);
+
+    virtual int32_t eval_int(const ValueDict &row) const { return row.at(this->column_name).n; }
+
+    virtual std::string_view eval_text(const ValueDict &row) const { return row.at(this->column_name).s; }
+
+    virtual void eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const;
+
+    virtual std::string_view eval_text(const ColumnBatch &batch, u_long i) const;
+
+protected:
+    Identifier column_name;
+    u_long slot;  // which of the batch's columns it is, once bound
+};
+
+
+/**
+ * @class LiteralExpression - a constant
+ */
+class LiteralExpression : public Expression {
+public:
+    explicit LiteralExpression(const Value &value) : Expression(value.data_type), value(value) {}
+
+    virtual Expression *copy() const { return new LiteralExpression(this->value); }
+
+    virtual const Value *get_value() const { return &this->value; }
+
+    virtual int32_t eval_int(const ValueDict &row) const { return this->value.n; }
+
+    virtual std::string_view eval_text(const ValueDict &row) const { return this->value.s; }
+
+    virtual void eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const;
+
+    virtual std::string_view eval_text(const ColumnBatch &batch, u_long i) const { return this->value.s; }
+
+protected:
+    Value value;
+};
+
+
+/**
+ * @class BinaryExpression - expression with a left and a right operand (which it owns)
+ */
+class BinaryExpression : public Expression {
+public:
+    BinaryExpression(ColumnAttribute::DataType data_type, Expression *left, Expression *right)
+            : Expression(data_type), left(left), right(right) {}
+
+    virtual ~BinaryExpression() {
+        delete this->left;
+        delete this->right;
+    }
+
+    virtual void get_columns(ColumnNames &columns) const;
+
+    virtual void bind(const ColumnNames &batch_columns);
+
+protected:
+    Expression *left;
+    Expression *right;
+};
+
+
+/**
+ * @class CompareExpression - BOOLEAN: left <op> right, for two INT, TEXT, or BOOLEAN operands of the same type
+ */
+class CompareExpression : public BinaryExpression {
+public:
+    CompareExpression(Comparison::Op op, Expression *left, Expression *right)
+            : BinaryExpression(ColumnAttribute::BOOLEAN, left, right), op(op) {}
+
+    virtual Expression *copy() const;
+
+    virtual bool get_comparisons(Conjunction &conjunction) const;
+
+    virtual int32_t eval_int(const ValueDict &row) const;
+
+    virtual void eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const;
+
+protected:
+    Comparison::Op op;
+};
+
+
+/**
+ * @class ArithmeticExpression - INT: left <op> right, for op one of + - * / % (on two INT operands), wrapping around
+ * on overflow, as the hardware does
+ */
+class ArithmeticExpression : public BinaryExpression {
+public:
+    ArithmeticExpression(char op, Expression *left, Expression *right)
+            : BinaryExpression(ColumnAttribute::INT, left, right), op(op) {}
+
+    virtual Expression *copy() const;
+
+    virtual int32_t eval_int(const ValueDict &row) const;
+
+    virtual void eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const;
+
+protected:
+    char op;
+};
+
+
+/**
+ * @class AndExpression - BOOLEAN: left AND right (the right only evaluated where the left is true)
+ */
+class AndExpression : public BinaryExpression {
+public:
+    AndExpression(Expression *left, Expression *right) : BinaryExpression(ColumnAttribute::BOOLEAN, left, right) {}
+
+    virtual Expression *copy() const { return new AndExpression(this->left->copy(), this->right->copy()); }
+
+    virtual bool get_comparisons(Conjunction &conjunction) const {
+        return this->left->get_comparisons(conjunction) && this->right->get_comparisons(conjunction);
+    }
+
+    virtual void get_conjuncts(std::vector<const Expression *> &conjuncts) const {
+        this->left->get_conjuncts(conjuncts);
+        this->right->get_conjuncts(conjuncts);
+    }
+
+    virtual int32_t eval_int(const ValueDict &row) const { return this->left->test(row) && this->right->test(row); }
+
+    virtual void select(const ColumnBatch &batch, Selection &rows) const;
+};
+
+
+/**
+ * @class OrExpression - BOOLEAN: left OR right (the right only evaluated where the left is false)
+ */
+class OrExpression : public BinaryExpression {
+public:
+    OrExpression(Expression *left, Expression *right) : BinaryExpression(ColumnAttribute::BOOLEAN, left, right) {}
+
+    virtual Expression *copy() const { return new OrExpression(this->left->copy(), this->right->copy()); }
+
+    virtual void get_disjuncts(std::vector<const Expression *> &disjuncts) const {
+        this->left->get_disjuncts(disjuncts);
+        this->right->get_disjuncts(disjuncts);
+    }
+
+    virtual int32_t eval_int(const ValueDict &row) const { return this->left->test(row) || this->right->test(row); }
+
+    virtual void select(const ColumnBatch &batch, Selection &rows) const;
+};
+
+
+/**
+ * @class NotExpression - BOOLEAN: NOT operand (which it owns)
+ */
+class NotExpression : public Expression {
+public:
+    explicit NotExpression(Expression *operand) : Expression(ColumnAttribute::BOOLEAN), operand(operand) {}
+
+    virtual ~NotExpression() { delete this->operand; }
+
+    virtual Expression *copy() const { return new NotExpression(this->operand->copy()); }
+
+    virtual void get_columns(ColumnNames &columns) const { this->operand->get_columns(columns); }
+
+    virtual void bind(const ColumnNames &batch_columns) { this->operand->bind(batch_columns); }
+
+    virtual int32_t eval_int(const ValueDict &row) const { return !this->operand->test(row); }
+
+    virtual void select(const ColumnBatch &batch, Selection &rows) const;
+
+protected:
+    Expression *operand;
+};
+
+bool test_expression();
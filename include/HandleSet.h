@@ -0,0 +1,83 @@
+/**
+ * @file HandleSet.h - HandleSet class: a compressed set of row handles, for combining index results
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <map>
+#include "storage_engine.h"
+
+/**
+ * @class HandleSet - set of handles, kept as a container of record ids for each block (in the manner of a
+ * roaring bitmap, with the block id as the high part of each handle)
+ *
+ * A block's container is a sorted array of its record ids while there are few of them, and a bitmap of them
+ * once that is smaller. Sets are intersected and united a container at a time, so the handles from several
+ * index scans can be combined before any rows are read. The handles come back out in block order.
+ */
+class HandleSet {
+public:
+    HandleSet() : blocks(), count(0) {}
+
+    explicit HandleSet(const Handles &handles);
+
+    void add(Handle handle);
+
+    bool contains(Handle handle) const;
+
+    u_long size() const { return this->count; }
+
+    bool empty() const { return this->count == 0; }
+
+    HandleSet operator&(const HandleSet &other) const;  // handles in both
+
+    HandleSet operator|(const HandleSet &other) const;  // handles in either
+
+    /**
+     * All the handles.
+     * @returns  handles, ordered by block and then by record id (freed by caller)
+     */
+    Handles *handles() const;
+
+    u_long byte_size() const;  // memory taken by the containers
+
+protected:
+    /**
+     * @class Records - container of the record ids in one block
+     */
+    class Records {
+    public:
+        Records() : array(), bitmap(), count(0) {}
+
+        void add(RecordID record_id);
+
+        bool contains(RecordID record_id) const;
+
+        void append_to(BlockID block_id, Handles &handles) const;
+
+        u_long size() const { return this->count; }
+
+        u_long byte_size() const;
+
+        static Records intersection(const Records &a, const Records &b);
+
+        static Records join(const Records &a, const Records &b);
+
+    protected:
+        std::vector<RecordID> array;  // sorted, while not using the bitmap
+        std::vector<u_int64_t> bitmap;  // bit (r % 64) of word (r / 64) for record r, if not empty
+        u_long count;
+
+        bool is_bitmap() const { return !this->bitmap.empty(); }
+
+        void set_bit(RecordID record_id);
+
+        void compact();
+    };
+
+    std::map<BlockID, Records> blocks;
+    u_long count;
+};
+
+bool test_handle_set();
@@ -0,0 +1,122 @@
+/**
+ * @file HashIndex.h - HashIndex class: disk-based extendible hashing index, and HashBucket, its bucket blocks
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "BTreeNode.h"
+
+/**
+ * @class HashBucket - one bucket block of a HashIndex
+ *
+ * Record 1 is the bucket's local depth: all its keys have the same low local_depth bits of their hash.
+ * Then, for each key: its posting (the key's handles, see BTreePosting) and its normalized key.
+ */
+class HashBucket : public BTreeNode {
+public:
+    HashBucket(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+
+    virtual ~HashBucket() {}
+
+    /**
+     * Hash of a normalized key; the directory is indexed by its low bits.
+     */
+    static u_int32_t hash(const NormalizedKey &key);
+
+    uint get_local_depth() const { return this->local_depth; }
+
+    void set_local_depth(uint local_depth) { this->local_depth = local_depth; }
+
+    Handles *find_eq(const NormalizedKey &key) const;  // empty if not found
+
+    /**
+     * Add a key, handle pair to the bucket in memory (the caller saves it or splits it if it no longer fits).
+     * @throws DbRelationError  if unique and key is already there
+     */
+    void insert(const NormalizedKey &key, Handle handle, bool unique);
+
+    bool remove(const NormalizedKey &key, Handle handle);  // false if not there; saves the bucket if it was
+
+    bool fits() const { return byte_size() <= PAGE_ROOM; }
+
+    /**
+     * Move the keys with bit local_depth of their hash set to a new bucket, and deepen both by one.
+     * Neither is saved.
+     * @returns  the new bucket (freed by caller)
+     */
+    HashBucket *split();
+
+    virtual void save();
+
+protected:
+    uint local_depth;
+    std::map<NormalizedKey, BTreePosting> key_map;
+
+    u_long byte_size() const;
+};
+
+/**
+ * @class HashIndex - extendible hashing index
+ *
+ * Block 1 of the index file holds the global depth and the list of directory blocks. The directory
+ * has 2^global_depth entries, each the bucket for keys whose hash ends in that entry's bits; a
+ * bucket with local depth less than the global depth is shared by several entries. The directory is
+ * kept in memory while the index is open, so a lookup reads just the key's bucket (and the key's
+ * overflow blocks, if it has more handles than fit in the bucket).
+ *
+ * A full bucket is split on the next bit of its keys' hashes, doubling the directory first if the
+ * bucket's local depth is already the global depth.
+ */
+class HashIndex : public DbIndex {
+public:
+    /**
+     * Largest global depth: past this a bucket that won't split apart is an error
+     */
+    static const uint MAX_GLOBAL_DEPTH = 24;
+
+    HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~HashIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void del(Handle handle);
+
+    NormalizedKey nkey(const ValueDict *key) const;  // the key's values, normalized
+
+    uint get_global_depth() const { return this->global_depth; }
+
+    u_long bucket_count() const;
+
+protected:
+    static const BlockID STAT = 1;
+    static const u_long DIRECTORY_ENTRIES = (BTreeNode::PAGE_ROOM - BTreeNode::SLOT_OVERHEAD) / sizeof(BlockID);
+
+    bool closed;
+    mutable HeapFile file;
+    KeyProfile key_profile;
+    uint global_depth;
+    BlockPointers directory;  // bucket for each value of the low global_depth bits of a key's hash
+    BlockPointers directory_blocks;  // where the directory is saved, DIRECTORY_ENTRIES per block
+
+    void build_key_profile();
+
+    void load_directory();
+
+    void save_directory();
+
+    void _insert(const NormalizedKey &key, Handle handle);
+};
+
+bool test_hash_index();
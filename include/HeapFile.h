@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <mutex>
 #include "db_cxx.h"
 #include "SlottedPage.h"
 
@@ -18,6 +19,9 @@
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
         for buffer management and file management.
         Uses SlottedPage for storing records within blocks.
+        Each page returned by get or get_new has its own copy of the block, so once the file is
+        open, gets, puts, and get_news may come from several threads at once (the callers have to
+        keep writers to the same block apart).
  */
 class HeapFile : public DbFile {
 public:
@@ -60,6 +64,7 @@ protected:
     uint32_t last;
     bool closed;
     Db db;
+    std::mutex new_block_mutex;
 
     virtual void db_open(uint flags = 0);
 
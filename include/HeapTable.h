@@ -10,6 +10,7 @@
 #include "storage_engine.h"
 #include "SlottedPage.h"
 #include "HeapFile.h"
+#include "BloomFilter.h"
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
@@ -19,7 +20,7 @@ class HeapTable : public DbRelation {
 public:
     HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
 
-    virtual ~HeapTable() {}
+    virtual ~HeapTable();
 
     HeapTable(const HeapTable &other) = delete;
 
@@ -51,14 +52,51 @@ public:
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual Handles *select(const Conjunction &where);
+
+    virtual Handles *select(Handles *current_selection, const Conjunction &where);
+
+    virtual BlockIDs *block_ids();
+
+    virtual Handles *select_block(BlockID block_id);
+
+    virtual void scan_block(BlockID block_id, ColumnBatch &batch);
+
+    virtual bool ruled_out(const Conjunction &where) const;  // true if a Bloom filter shows that an equality can't hold
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    /**
+     * Fetch the rows for many handles, reading each of their blocks just once, in block order.
+     * @param handles       rows to get values from (in any order, and possibly repeated)
+     * @param column_names  list of column names to project (all of them if empty)
+     * @returns             dictionary of values for each handle, in the same order as handles (freed by caller)
+     */
+    virtual ValueDicts *project(Handles *handles, const ColumnNames *column_names);
+
+    virtual ValueDicts *project(Handles *handles);
+
     using DbRelation::project;
 
+    /**
+     * Keep a Bloom filter on a column, so that selecting a value it doesn't have needn't read the table. The filter
+     * is built from the rows already in the table (replacing any filter the column had), kept up to date by inserts,
+     * and saved next to the table.
+     * @param column_name          column to filter
+     * @param false_positive_rate  fraction of the absent values the filter may let through to a scan
+     */
+    virtual void add_bloom_filter(const Identifier &column_name,
+                                  double false_positive_rate = BloomFilter::DEFAULT_FALSE_POSITIVE_RATE);
+
 protected:
     HeapFile file;
+    HeapFile *bloom_file;  // block 1: (filter header block, column name) for each filter; then the filters
+                           // (nullptr unless loaded; a new one each time, since a closed Db can't be opened again)
+    std::map<Identifier, BloomFilter *> bloom_filters;
+    bool bloom_loaded;  // bloom_filters has what's in the bloom file
+    bool bloom_missing;  // the table has no bloom file (it was created before tables got one)
 
     virtual ValueDict *validate(const ValueDict *row) const;
 
@@ -68,7 +106,23 @@ protected:
 
     virtual ValueDict *unmarshal(Dbt *data) const;
 
-    virtual bool selected(Handle handle, const ValueDict *where);
+    virtual ValueDict *unmarshal(Dbt *data, const std::vector<bool> &wanted) const;
+
+    std::vector<bool> wanted_columns(const ColumnNames *column_names) const;
+
+    virtual ValueDict *project(SlottedPage *block, RecordID record_id, const std::vector<bool> &wanted) const;
+
+    virtual bool selected(SlottedPage *block, RecordID record_id, const ValueDict *where) const;
+
+    HeapFile *new_bloom_file() const { return new HeapFile(this->table_name + ".bloom"); }
+
+    void load_bloom_filters();
+
+    void save_bloom_filters();
+
+    void forget_bloom_filters();
+
+    bool ruled_out(const ValueDict *where) const;  // true if a Bloom filter shows that no row has the values
 };
 
 bool test_heap_storage();
@@ -0,0 +1,197 @@
+/**
+ * @file JoinOperator.h - Operators that join the rows of two inputs
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <unordered_map>
+#include "EvalOperator.h"
+#include "SpillFile.h"
+#include "SortOperator.h"
+
+typedef std::vector<std::pair<Identifier, Identifier>> JoinKeys;  // pairs of columns (one from each input) to match
+
+/**
+ * @class JoinKeyHash - hash of an encoded join key (see HashJoinOperator)
+ */
+struct JoinKeyHash {
+    size_t operator()(const std::string &key) const;
+};
+
+
+/**
+ * @class HashJoinOperator - rows made of each row of one input (the probe side) and each row of the other (the build
+ * side) with the same values for the key columns
+ *
+ * All the build rows go into a hash table first, by their key columns' values encoded as bytes (INTs as their four
+ * bytes, TEXTs as their length and characters), so the planner makes the smaller input the build side. Then each
+ * probe row picks out its matches from the table. With no key columns, every row matches every other.
+ *
+ * If the build rows take more than memory_budget bytes, the join goes Grace style: the build rows, and then all the
+ * probe rows, are partitioned by their keys' hashes out to PARTITIONS spill files each, and each partition's build
+ * rows are put in the hash table in turn and probed with that partition's probe rows. (A partition that is still too
+ * big is joined in memory anyway.)
+ */
+class HashJoinOperator : public BufferedOperator {
+public:
+    static const u_long DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint PARTITIONS = 16;
+    static const u_long BATCH_SIZE = 1024;  // joined rows made at a time
+
+    /**
+     * Bytes of build rows kept in memory before the join goes to spill files
+     */
+    static u_long memory_budget;
+
+    /**
+     * @param probe  operator for the probe side's rows (freed by the HashJoinOperator)
+     * @param build  operator for the build side's rows (freed by the HashJoinOperator), whose columns must be
+     *               different from the probe side's
+     * @param keys   pairs of (probe column, build column) whose values must be equal (of the same data type)
+     */
+    HashJoinOperator(EvalOperator *probe, EvalOperator *build, const JoinKeys &keys);
+
+    virtual ~HashJoinOperator();
+
+    virtual void open();
+
+    virtual void close();
+
+    /**
+     * Did the build side go to spill files (as of the last open)?
+     */
+    bool spilled() const { return !this->build_partitions.empty(); }
+
+protected:
+    typedef std::unordered_multimap<std::string, ValueDict *, JoinKeyHash> Table;
+
+    EvalOperator *probe;
+    EvalOperator *build;
+    ColumnNames probe_keys;
+    ColumnNames build_keys;
+    Table table;  // build rows by key
+    u_long table_bytes;
+    std::vector<SpillFile *> build_partitions;  // once spilled
+    std::vector<SpillFile *> probe_partitions;
+    uint partition;  // the partition being joined, once spilled
+    bool loaded;  // its build rows are in table
+
+    virtual bool fill();
+
+    void add_build_row(ValueDict *row);
+
+    void spill();
+
+    void join(ValueDict *probe_row);
+
+    void clear_table();
+
+    void clear_partitions();
+
+    static std::string key(const ValueDict &row, const ColumnNames &key_columns);
+};
+
+
+/**
+ * @class MergeJoinOperator - the rows of a HashJoinOperator, but from two inputs that both come sorted on their key
+ * columns (ascending, in the order of the keys), as from a SortOperator or a scan of a BTreeIndex in key order
+ *
+ * The inputs are read through together, comparing their rows' keys normalized as a SortOperator sorts them. The
+ * right input's rows with the left's current key are kept in memory, and joined with each of the left's rows with
+ * that key; rows with keys the other input doesn't have are skipped. So the rows come out in key order too.
+ */
+class MergeJoinOperator : public BufferedOperator {
+public:
+    static const u_long BATCH_SIZE = 1024;  // joined rows made at a time
+
+    /**
+     * @param left   operator for the left side's rows (freed by the MergeJoinOperator)
+     * @param right  operator for the right side's rows (freed by the MergeJoinOperator), whose columns must be
+     *               different from the left side's
+     * @param keys   pairs of (left column, right column) whose values must be equal (of the same data type)
+     */
+    MergeJoinOperator(EvalOperator *left, EvalOperator *right, const JoinKeys &keys);
+
+    virtual ~MergeJoinOperator();
+
+    virtual void open();
+
+    virtual void close();
+
+protected:
+    EvalOperator *left;
+    EvalOperator *right;
+    SortKeys left_keys;
+    SortKeys right_keys;
+    ValueDict *left_row;  // next one to join (nullptr once there are no more)
+    NormalizedKey left_key;
+    ValueDict *right_row;  // next one after the group (nullptr once there are no more)
+    NormalizedKey right_key;
+    ValueDicts group;  // right rows with group_key
+    NormalizedKey group_key;
+
+    virtual bool fill();
+
+    void next_left();
+
+    void next_right();
+
+    void clear_rows();
+};
+
+
+/**
+ * @class IndexJoinOperator - rows made of each row of one input (the outer side) and each row of a table with the
+ * same values for the key columns, found by looking them up in an index on the table
+ *
+ * This is a nested-loop join whose inner loop is an index lookup, so only the matching rows of the table are
+ * fetched: the planner uses it when there are few outer rows and the table is big. The outer rows are taken a batch
+ * at a time, and their keys looked up together with DbIndex::lookup_many (which a BTreeIndex does in key order,
+ * reading each leaf once). As many of the index's key columns as are key columns of the join, from the first one,
+ * are looked up (so all of them, for a HashIndex); any other key columns, and the where clause's conjunction and
+ * filter, are checked on the fetched rows.
+ */
+class IndexJoinOperator : public BufferedOperator {
+public:
+    static const u_long BATCH_SIZE = 1024;  // outer rows looked up at once
+
+    /**
+     * @param outer    operator for the outer side's rows (freed by the IndexJoinOperator)
+     * @param table    the inner side's relation
+     * @param index    index on table whose first key column is a key column of the join
+     * @param keys     pairs of (outer column, table column) whose values must be equal (of the same data type)
+     * @param columns  columns of the table to put in the joined rows
+     * @param names    what to call them there (in the same order), which must be different from the outer columns
+     * @param where    comparisons the table's rows must satisfy
+     * @param filter   what else the table's rows must satisfy, or nullptr (copied)
+     */
+    IndexJoinOperator(EvalOperator *outer, DbRelation &table, DbIndex &index, const JoinKeys &keys,
+                      const ColumnNames &columns, const ColumnNames &names, const Conjunction &where,
+                      const Expression *filter);
+
+    virtual ~IndexJoinOperator();
+
+    virtual void open();
+
+    virtual void close();
+
+protected:
+    EvalOperator *outer;
+    DbRelation &table;
+    DbIndex &index;
+    JoinKeys keys;
+    ColumnNames index_columns;  // of the index's key columns, the ones looked up
+    ColumnNames index_keys;  // the outer columns with their values
+    ColumnNames columns;
+    ColumnNames names;
+    ColumnNames fetched;  // columns plus the ones the keys and the filter check
+    Conjunction where;
+    Expression *filter;
+
+    virtual bool fill();
+
+    void join(const ValueDict &outer_row, Handles *handles);
+};
+
+bool test_join();
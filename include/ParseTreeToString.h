@@ -26,6 +26,13 @@ public:
      */
     static bool is_reserved_word(std::string word);
 
+    /**
+     * Unparse an expression.
+     * @param expr  Hyrise AST pointer
+     * @returns     string of the SQL expression
+     */
+    static std::string expression(const hsql::Expr *expr);
+
 private:
     // reserved words
     static const std::vector<std::string> reserved_words;
@@ -33,8 +40,6 @@ private:
     // sub-expressions
     static std::string operator_expression(const hsql::Expr *expr);
 
-    static std::string expression(const hsql::Expr *expr);
-
     static std::string table_ref(const hsql::TableRef *table);
 
     static std::string column_definition(const hsql::ColumnDefinition *col);
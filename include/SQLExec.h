@@ -61,20 +61,30 @@ public:
     /**
      * Execute the given SQL statement.
      * @param statement   the Hyrise AST of the SQL statement to execute
+     * @param included    columns from the statement's INCLUDE clause, if any (see take_include_clause)
      * @returns           the query result (freed by caller)
      */
-    static QueryResult *execute(const hsql::SQLStatement *statement);
+    static QueryResult *execute(const hsql::SQLStatement *statement, const ColumnNames &included = ColumnNames());
+
+    /**
+     * Cut the INCLUDE (column, ...) clause of a CREATE INDEX statement out of its text, since the Hyrise parser
+     * doesn't know it.
+     * @param query     SQL text, returned by reference without the clause
+     * @param included  returned by reference: the included columns
+     * @returns         true if there was an INCLUDE clause
+     */
+    static bool take_include_clause(std::string &query, ColumnNames &included);
 
 protected:
     // the one place in the system that holds the _tables and _indices tables
     static Tables *tables;
     static Indices *indices;
     // recursive decent into the AST
-    static QueryResult *create(const hsql::CreateStatement *statement);
+    static QueryResult *create(const hsql::CreateStatement *statement, const ColumnNames &included);
 
     static QueryResult *create_table(const hsql::CreateStatement *statement);
 
-    static QueryResult *create_index(const hsql::CreateStatement *statement);
+    static QueryResult *create_index(const hsql::CreateStatement *statement, const ColumnNames &included);
 
     static QueryResult *drop(const hsql::DropStatement *statement);
 
@@ -95,6 +105,16 @@ protected:
     static QueryResult *del(const hsql::DeleteStatement *statement);
 
     static QueryResult *select(const hsql::SelectStatement *statement);
+
+    static QueryResult *select_join(const hsql::SelectStatement *statement);
+
+    /**
+     * Get a table, checking that it exists.
+     * @param table_name  the table
+     * @param attempting  what the statement attempts with it (e.g., "select from"), for the error if it doesn't exist
+     * @returns           the table
+     */
+    static DbRelation &get_table(const Identifier &table_name, const std::string &attempting);
     
     /**
      * Pull out column name and attributes from AST's column definition clause
@@ -0,0 +1,167 @@
+/**
+ * @file SortOperator.h - SortOperator class: the rows of its input in order, sorted externally if need be
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <functional>
+#include "EvalOperator.h"
+#include "SpillFile.h"
+#include "BTreeNode.h"
+
+typedef std::vector<std::pair<Identifier, bool>> SortKeys;  // columns to sort by, each with whether it's descending
+
+
+/**
+ * @class LoserTree - tournament tree for a k-way merge: which of k sources has the least head, and, after that
+ * source's head moves on, which has it then
+ *
+ * Each interior node keeps the loser of the match played there, so replaying the winner's source takes one
+ * comparison per level, against just the losers on its path to the root (where a heap would compare with both
+ * children on the way down).
+ */
+class LoserTree {
+public:
+    /**
+     * @param sources  how many there are (at least one)
+     * @param less     whether one source's head comes before another's (an exhausted source's after any other's)
+     */
+    LoserTree(uint sources, std::function<bool(uint, uint)> less);
+
+    /**
+     * The source with the least head.
+     */
+    uint winner() const { return this->tree[0]; }
+
+    /**
+     * Find the winner again, after the winner's head has moved on.
+     */
+    void replay();
+
+protected:
+    uint sources;
+    std::function<bool(uint, uint)> less;
+    std::vector<uint> tree;  // [0] is the winner; [1..sources-1] the losers at the interior nodes, heap-ordered
+
+    bool beats(uint a, uint b) const;
+
+    uint play(uint node);
+};
+
+
+/**
+ * @class SortOperator - the rows of its input, sorted on some of its columns
+ *
+ * Each row is sorted by a normalized key: its sort columns' values normalized the way a BTree's keys are, with a
+ * descending column's bytes inverted, so rows compare by just comparing bytes. The rows are sorted in memory if
+ * they fit in memory_budget. Otherwise each budget's worth is sorted and written out to a SpillFile as a run, and
+ * the runs are merged with a LoserTree (MAX_FAN_IN at a time, in passes, if there are more than that). The sort is
+ * stable: rows with the same key come out in the order they went in.
+ */
+class SortOperator : public BufferedOperator {
+public:
+    static const u_long DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint MAX_FAN_IN = 64;  // runs merged at once
+    static const u_long BATCH_SIZE = 1024;  // rows handed out at a time
+
+    /**
+     * Bytes of rows kept in memory before they are written out as a run
+     */
+    static u_long memory_budget;
+
+    /**
+     * @param input  operator for the rows to sort (freed by the SortOperator)
+     * @param keys   columns to sort by, most significant first
+     */
+    SortOperator(EvalOperator *input, const SortKeys &keys);
+
+    virtual ~SortOperator();
+
+    virtual void open();
+
+    virtual void close();
+
+    /**
+     * Did the rows go out to runs (as of the last open)?
+     */
+    bool spilled() const { return !this->runs.empty(); }
+
+    /**
+     * The normalized key of a row: comparing two rows' keys as bytes orders them as the sort keys do.
+     */
+    static NormalizedKey sort_key(const ValueDict &row, const SortKeys &keys);
+
+protected:
+    typedef std::pair<NormalizedKey, ValueDict *> Entry;
+
+    EvalOperator *input;
+    SortKeys keys;
+    std::vector<Entry> entries;  // rows in memory
+    u_long entries_bytes;
+    u_long entry_index;  // next to hand out, once they're sorted in memory
+    std::vector<SpillFile *> runs;  // in input order, while they're being merged
+    std::vector<Entry> heads;  // of the runs being merged (with a nullptr row once a run is done)
+    LoserTree *tree;
+
+    virtual bool fill();
+
+    void spill();
+
+    void start_merge(u_long runs);
+
+    ValueDict *next_merged();
+
+    void clear_entries();
+
+    void clear_runs();
+};
+
+
+/**
+ * @class TopNOperator - the first count rows a SortOperator would give, from a heap of just count rows
+ *
+ * The heap has the count rows that come first of those read so far, with the one that comes last of them on top, so
+ * each row after the first count is either dropped at once or takes the top's place. That's O(n log count) time
+ * for n rows, in memory for just count of them. Rows with the same key come out in the order they went in, as
+ * from a SortOperator.
+ */
+class TopNOperator : public BufferedOperator {
+public:
+    /**
+     * @param input  operator for the rows to sort (freed by the TopNOperator)
+     * @param keys   columns to sort by, most significant first
+     * @param count  how many of the rows to give
+     */
+    TopNOperator(EvalOperator *input, const SortKeys &keys, u_long count);
+
+    virtual ~TopNOperator();
+
+    virtual void open();
+
+    virtual void close();
+
+protected:
+    // a row with its sort key and where it came in the input (so ties go to the earlier one)
+    struct Ranked {
+        NormalizedKey key;
+        u_long sequence;
+        ValueDict *row;
+
+        bool operator<(const Ranked &other) const {
+            return this->key < other.key || (this->key == other.key && this->sequence < other.sequence);
+        }
+    };
+
+    EvalOperator *input;
+    SortKeys keys;
+    u_long count;
+    std::vector<Ranked> heap;  // a max-heap, until open is done; then in order
+    u_long heap_index;  // next to hand out
+
+    virtual bool fill();
+
+    void clear_heap();
+};
+
+bool test_sort();
@@ -0,0 +1,53 @@
+/**
+ * @file SpillFile.h - SpillFile class: rows an operator has no room for, written out to a temporary file
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <cstdio>
+#include "storage_engine.h"
+
+/**
+ * @class SpillFile - rows written to an anonymous temporary file (gone once it's closed) and read back in order
+ *
+ * All the rows must have the same columns. Each value is written as its data type's byte and then its int32_t,
+ * or (for TEXT) its length and characters; the column names are kept in memory, not in the file. The file is
+ * buffered by stdio, so rows go out and come back in big writes and reads.
+ */
+class SpillFile {
+public:
+    SpillFile();
+
+    virtual ~SpillFile();
+
+    SpillFile(const SpillFile &other) = delete;
+
+    SpillFile &operator=(const SpillFile &other) = delete;
+
+    void write(const ValueDict &row);
+
+    /**
+     * Go back to the start, for reading the rows written so far.
+     */
+    void rewind();
+
+    /**
+     * Read the next row.
+     * @returns  the row (freed by caller), or nullptr if there are no more
+     */
+    ValueDict *read();
+
+    u_long size() const { return this->rows; }
+
+    /**
+     * Bytes a row takes in memory, roughly (for operators keeping to a memory budget).
+     */
+    static u_long row_bytes(const ValueDict &row);
+
+protected:
+    std::FILE *file;
+    ColumnNames column_names;  // of the rows, from the first one written
+    u_long rows;  // written
+    u_long rows_read;  // since the last rewind
+};
@@ -0,0 +1,82 @@
+/**
+ * @file TaskScheduler.h - TaskScheduler class: worker threads for running a job's morsels in parallel
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class TaskScheduler - a pool of worker threads (one per core) that run the morsels of a job, with work stealing
+ *
+ * A job is a number of morsels (say, ranges of a table's blocks) and what to do with each. The morsels are dealt out
+ * to the workers' queues up front. A worker takes morsels from the back of its own queue, and once that is empty,
+ * steals from the front of the others', so the workers finish at about the same time even when some morsels take
+ * longer than others. One job runs at a time; run waits for all of its morsels to be done.
+ */
+class TaskScheduler {
+public:
+    typedef std::function<void(u_long morsel, uint worker)> Job;
+
+    /**
+     * @param workers  number of worker threads (0 for one per core)
+     */
+    explicit TaskScheduler(uint workers = 0);
+
+    virtual ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler &other) = delete;
+
+    TaskScheduler &operator=(const TaskScheduler &other) = delete;
+
+    /**
+     * The scheduler queries share, with a worker for each core.
+     */
+    static TaskScheduler &shared();
+
+    uint size() const { return (uint) this->threads.size(); }
+
+    /**
+     * Do job(morsel, worker) for each morsel from 0 to morsels - 1, and wait for them all to be done.
+     * @param morsels  how many there are
+     * @param job      what to do with a morsel; worker (0 to size() - 1) is the thread doing it, for keeping
+     *                 per-thread state
+     * @throws         the first exception a morsel threw (the morsels not started by then are skipped)
+     */
+    void run(u_long morsels, const Job &job);
+
+protected:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<u_long> morsels;
+    };
+    std::vector<std::thread> threads;
+    std::unique_ptr<Queue[]> queues;
+    std::mutex run_mutex;  // one job at a time
+    std::mutex mutex;  // for the rest
+    std::condition_variable wake;  // for the workers: there's a new job, or it's time to stop
+    std::condition_variable finished;  // for run: the job's done
+    const Job *job;
+    u_long job_number;  // how many jobs there have been
+    uint active;  // workers taking morsels of the job
+    std::atomic<u_long> remaining;  // morsels of the job not done yet
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+    bool stopping;
+
+    void work(uint worker);
+
+    bool take(uint worker, u_long &morsel);
+};
+
+bool test_task_scheduler();
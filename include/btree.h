@@ -6,11 +6,149 @@
  */
 #pragma once
 
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include "BTreeNode.h"
+#include "BloomFilter.h"
 
+/**
+ * @class BTreeLatches - a reader/writer latch for each block of an index, made the first time it is asked for
+ *
+ * The table is split into shards, each with its own mutex, so threads latching different blocks rarely
+ * wait on each other just to find their latches.
+ */
+class BTreeLatches {
+public:
+    BTreeLatches() = default;
+
+    BTreeLatches(const BTreeLatches &other) = delete;
+
+    BTreeLatches &operator=(const BTreeLatches &other) = delete;
+
+    std::shared_mutex &operator[](BlockID block_id);
+
+protected:
+    static const uint SHARDS = 64;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<BlockID, std::unique_ptr<std::shared_mutex>> latches;
+    };
+    Shard shards[SHARDS];
+};
+
+/**
+ * @class BTreeAdaptiveHash - in-memory hash table from an index's hot keys to their handles
+ *
+ * A key is cached once it has been looked up HOT_LOOKUPS times lately (counted, roughly, in a small table of
+ * counters that are halved now and then, so keys that were hot long ago cool off). Then its lookups skip the
+ * tree altogether. The table holds at most budget bytes, dropping the least recently used keys to make room.
+ *
+ * An insert or delete of a key invalidates it (after the leaf has changed). Each invalidation bumps a version, and
+ * a lookup only caches what it read from the leaf if no key in its shard was invalidated since it started, so a
+ * lookup that read the leaf just before a change can't put the old handles back.
+ */
+class BTreeAdaptiveHash {
+public:
+    static const u_long DEFAULT_BUDGET = 4UL * 1024 * 1024;
+
+    /**
+     * Lookups of a key (in the recent past) before it is cached
+     */
+    static const uint HOT_LOOKUPS = 3;
+
+    explicit BTreeAdaptiveHash(u_long budget = DEFAULT_BUDGET);
+
+    BTreeAdaptiveHash(const BTreeAdaptiveHash &other) = delete;
+
+    BTreeAdaptiveHash &operator=(const BTreeAdaptiveHash &other) = delete;
+
+    void set_budget(u_long budget);  // 0 turns it off (it's emptied either way)
+
+    /**
+     * Look for a key's handles.
+     * @param key      normalized key
+     * @param version  returned by reference: pass it on to offer with what the tree had for the key
+     * @returns        the key's handles (freed by caller), nullptr if it isn't cached
+     */
+    Handles *find(const NormalizedKey &key, u_int64_t &version);
+
+    void offer(const NormalizedKey &key, const Handles &handles, u_int64_t version);  // cache it, if it's hot
+
+    void invalidate(const NormalizedKey &key);
+
+    void clear();
+
+    u_long get_lookups() const { return this->lookups; }
+
+    u_long get_hits() const { return this->hits; }
+
+    double hit_rate() const { return this->lookups == 0 ? 0.0 : (double) this->hits / this->lookups; }
+
+    u_long byte_size() const;  // memory taken by the cached keys and handles
+
+protected:
+    static const uint SHARDS = 16;
+    static const uint COUNTERS = 4096;  // per shard
+    static const u_long ENTRY_OVERHEAD = 96;  // bytes of bookkeeping per cached key (roughly)
+
+    struct Entry {
+        Handles handles;
+        std::list<NormalizedKey>::iterator recent;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<NormalizedKey, Entry> entries;
+        std::list<NormalizedKey> recent;  // most recently used first
+        u_long bytes = 0;
+        u_int64_t version = 0;  // bumped by each invalidate
+        u_int8_t counts[COUNTERS] = {};  // lookups per hash of key
+        u_long counted = 0;  // lookups since the counts were last halved
+    };
+    Shard shards[SHARDS];
+    std::atomic<u_long> budget;  // set_budget may come while lookups are going on
+    std::atomic<u_long> lookups;
+    std::atomic<u_long> hits;
+
+    static u_long entry_bytes(const NormalizedKey &key, const Handles &handles);
+
+    static void evict(Shard &shard, std::unordered_map<NormalizedKey, Entry>::iterator entry);
+};
+
+/**
+ * @class BTreeIndex - B-link tree index
+ *
+ * Once the index is open, lookups and inserts may come from several threads at once. Each node has a
+ * link to its right sibling and a high key (see BTreeNode::covers), so a search that reaches a node
+ * after it has split just moves right. That lets readers hold only one (shared) latch at a time, and
+ * lets a writer split a node while holding just it, its new sister's left neighbor, and then its parent,
+ * never the whole tree. Latches are always taken bottom-up and left to right, so there are no deadlocks.
+ *
+ * An index can also carry included columns: their values go in the leaf entries after the key's (and so are
+ * part of the entry's normalized key, though not of what has to be unique), so a query that needs only the key
+ * and included columns can be answered from the index alone (see range_values).
+ *
+ * An index can have a Bloom filter on its keys (see set_bloom_filter), so that looking up a key that isn't there
+ * usually reads no blocks at all. And keys looked up over and over are answered from memory (see BTreeAdaptiveHash).
+ */
 class BTreeIndex : public DbIndex {
 public:
-    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+    /**
+     * Fraction of each block filled when the index is built by create()
+     */
+    static constexpr double DEFAULT_FILL_FACTOR = 0.9;
+
+    /**
+     * Approximate bytes of keys sorted in memory by create() before spilling sorted runs to disk
+     */
+    static const u_long DEFAULT_SORT_BUDGET = 64UL * 1024 * 1024;
+
+    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+               ColumnNames included = ColumnNames());
 
     virtual ~BTreeIndex();
 
@@ -24,7 +162,17 @@ public:
 
     virtual Handles *lookup(ValueDict *key) const;
 
-    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
+    virtual HandleLists *lookup_many(const ValueDicts &keys) const;
+
+    virtual Handles *range(ValueDict *min_key, ValueDict *max_key, u_long limit = 0) const;
+
+    virtual bool is_ordered() const { return true; }
+
+    virtual ColumnNames get_covered_columns() const { return entry_columns; }
+
+    virtual ValueDicts *lookup_values(ValueDict *key) const;
+
+    virtual ValueDicts *range_values(ValueDict *min_key, ValueDict *max_key, u_long limit = 0) const;
 
     virtual void insert(Handle handle);
 
@@ -32,19 +180,90 @@ public:
 
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
 
+    uint tkey_size(const ValueDict *key) const;  // how many leading key (then included) columns the ValueDict has
+
+    NormalizedKey nkey(const ValueDict *key) const;  // tkey, normalized
+
+    void set_fill_factor(double fill_factor) { this->fill_factor = fill_factor; }
+
+    void set_sort_budget(u_long sort_budget) { this->sort_budget = sort_budget; }
+
+    /**
+     * Have create() build a Bloom filter on the keys (kept up to date by inserts, and saved next to the index).
+     * @param false_positive_rate  fraction of the absent keys the filter may let through to the tree (0 for no filter)
+     */
+    void set_bloom_filter(double false_positive_rate) { this->bloom_rate = false_positive_rate; }
+
+    bool has_bloom_filter() const { return this->bloom != nullptr; }
+
+    /**
+     * Most memory to use for the adaptive hash index on hot keys.
+     * @param budget  bytes (0 for none)
+     */
+    void set_adaptive_hash_budget(u_long budget) { this->hot_keys.set_budget(budget); }
+
+    const BTreeAdaptiveHash &get_adaptive_hash() const { return this->hot_keys; }  // for its hit counters
+
+    /**
+     * Count the nodes on each level of the tree (to report on its shape).
+     * @returns  number of blocks per level, from the root (always 1) down to the leaves
+     */
+    std::vector<u_long> level_sizes();
+
 protected:
     static const BlockID STAT = 1;
+    ColumnNames included;
+    ColumnNames entry_columns;  // key_columns, then included
     bool closed;
     BTreeStat *stat;
-    BTreeNode *root;
-    HeapFile file;
+    mutable std::shared_mutex stat_latch;  // guards the root id and height in stat
+    mutable HeapFile file;
+    mutable BTreeLatches latches;
     KeyProfile key_profile;
+    double fill_factor;
+    u_long sort_budget;
+    double bloom_rate;
+    BloomFilter *bloom;  // on the key columns' part of each key, nullptr if the index has no filter
+    HeapFile *bloom_file;  // where bloom is saved, nullptr if the index is closed or has no filter (a new one each
+                           // time, since a closed Db can't be opened again)
+    mutable BTreeAdaptiveHash hot_keys;  // full keys looked up often, and their handles
+
+    // right edge of the tree, so that appending keys (e.g. increasing sequence numbers) need not descend from the root
+    std::mutex rightmost_mutex;
+    BlockID rightmost;  // rightmost leaf when we last looked (it may have split since), 0 if not loaded
+    NormalizedKey right_low;  // keys >= this go in rightmost or to its right
 
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    HeapFile *new_bloom_file() const { return new HeapFile(relation.get_table_name() + "-" + name + "-bloom"); }
+
+    NormalizedKey unique_part(const NormalizedKey &key) const;  // just the key columns (no included columns)
+
+    void scan(const ValueDict *min_key, const ValueDict *max_key, Handles &handles, NormalizedKeys *keys,
+              u_long limit = 0) const;
+
+    BTreeLeaf *latch_unique(const NormalizedKey &key, BlockPointers &path,
+                            std::unique_lock<std::shared_mutex> &first_latch);
+
+    void root_snapshot(BlockID &root_id, uint &height) const;
+
+    BlockID descend(const NormalizedKey &key, uint level, BlockPointers *path) const;
+
+    BlockID descend_from(const NormalizedKey &key, std::vector<BTreeInterior *> &interiors) const;
+
+    template<class Node>
+    Node *latch_covering(const NormalizedKey &key, BlockID block_id, std::unique_lock<std::shared_mutex> &latch);
+
+    void insert_above(uint level, const BlockPointers &path, BlockID child_id, Insertion insertion,
+                      std::unique_lock<std::shared_mutex> &child_latch);
+
+    void grow_root(BlockID old_root, Insertion insertion);
+
+    BlockID rightmost_for(const NormalizedKey &key);
+
+    void load_rightmost();
 
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+    void forget_rightmost();
 };
 
 bool test_btree();
@@ -129,6 +129,14 @@ public:
     virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
                              bool &is_unique);
 
+    /**
+     * Get the search key and the included columns for the given index.
+     * @param included  returned by reference: list of columns the index carries along with the search key, in order
+     * (the other parameters are as above)
+     */
+    virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+                             ColumnNames &included, bool &is_hash, bool &is_unique);
+
     /**
      * Get the instantiated DbIndex for the given index.
      * @param table_name  what table the requested index is on
@@ -220,7 +220,7 @@ public:
 
     virtual ~ColumnAttribute() {}
 
-    virtual DataType get_data_type() { return data_type; }
+    virtual DataType get_data_type() const { return data_type; }
 
     virtual void set_data_type(DataType data_type) { this->data_type = data_type; }
 
@@ -261,6 +261,39 @@ typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
+typedef std::vector<Handles *> HandleLists;
+
+
+/**
+ * @class Comparison - one term of a where clause: <column_name> <op> <value>
+ */
+class Comparison {
+public:
+    enum Op {
+        EQ, NE, LT, LE, GT, GE
+    };
+
+    Identifier column_name;
+    Op op;
+    Value value;
+
+    Comparison(Identifier column_name, Op op, Value value) : column_name(column_name), op(op), value(value) {}
+
+    /**
+     * Does a column value satisfy this comparison?
+     * @param column_value  the row's value for column_name (must be of the same data type as value)
+     */
+    bool matches(const Value &column_value) const;
+
+    /**
+     * The same comparison written the other way around (e.g., for 5 < a, a > 5).
+     */
+    static Op reversed(Op op);
+
+    friend std::ostream &operator<<(std::ostream &out, const Comparison &comparison);
+};
+
+typedef std::vector<Comparison> Conjunction;  // where clause: all of the comparisons must hold
 
 
 /**
@@ -272,6 +305,8 @@ public:
 };
 
 
+class ColumnBatch;
+
 /**
  * @class DbRelation - top-level object handling a physical database relation
  * 
@@ -288,6 +323,7 @@ public:
  *	del(handle)
  *	select()
  *	select(where)
+ *	select(conjunction)
  *	project(handle)
  *	project(handle, column_names)
  */
@@ -374,6 +410,60 @@ public:
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+     * This version takes any comparisons, not just equalities. It checks each row's values for the
+     * where-clause columns, so a subclass need only override it if it can do better.
+     * @param where  where-clause comparisons
+     * @returns      a pointer to a list of handles for qualifying rows (freed by caller)
+     * @throws DbRelationError  if a column is unknown or compared with a value of another type
+     */
+    virtual Handles *select(const Conjunction &where);
+
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+     * This version does a restricted selection based on current_selection.
+     * @param current_selection  restrict selection to be from these rows
+     * @param where              where-clause comparisons
+     * @returns                  a pointer to a list of handles for qualifying rows (freed by caller)
+     * @throws DbRelationError   if a column is unknown or compared with a value of another type
+     */
+    virtual Handles *select(Handles *current_selection, const Conjunction &where);
+
+    /**
+     * Blocks a scan can go through one at a time (see select_block), so that it needn't get all the handles at once.
+     * @returns  block ids, in the order a scan should go (freed by caller); a relation that can't be scanned a block
+     *           at a time has just the one, 0
+     */
+    virtual BlockIDs *block_ids() {
+        return new BlockIDs(1, 0);
+    }
+
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <the row is in block_id>
+     * @param block_id  one of block_ids()
+     * @returns         a pointer to a list of handles for the block's rows (freed by caller)
+     */
+    virtual Handles *select_block(BlockID block_id) {
+        return select();
+    }
+
+    /**
+     * Add the rows of one block to a batch (see block_ids), a column at a time.
+     * @param block_id  one of block_ids()
+     * @param batch     gets the block's values for its columns, and the block's handles
+     */
+    virtual void scan_block(BlockID block_id, ColumnBatch &batch);
+
+    /**
+     * Can the relation tell, without reading any rows, that none satisfy where (say, from a Bloom filter)?
+     * @param where  where-clause comparisons
+     * @returns      true if no row can, false if some might
+     */
+    virtual bool ruled_out(const Conjunction &where) const {
+        return false;
+    }
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -488,16 +578,73 @@ public:
      */
     virtual Handles *lookup(ValueDict *key_values) const = 0;
 
+    /**
+     * Lookup many search keys at once. Indices that can share the work between the keys override this.
+     * @param keys  dictionaries of values for the search keys
+     * @returns     list of DbFile handles for each key, in the same order as keys (all freed by caller)
+     */
+    virtual HandleLists *lookup_many(const ValueDicts &keys) const {
+        HandleLists *ret = new HandleLists();
+        ret->reserve(keys.size());
+        for (auto const &key: keys)
+            ret->push_back(lookup(key));
+        return ret;
+    }
+
     /**
      * Lookup a range of search keys.
      * @param min_key  dictionary of min (inclusive) search key
      * @param max_key  dictionary of max (inclusive) search key
+     * @param limit    most handles to get (the first ones, if the index is ordered), or 0 for all of them
      * @returns        list of DbFile handles for records in range
      */
-    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const {
+    virtual Handles *range(ValueDict *min_key, ValueDict *max_key, u_long limit = 0) const {
         throw DbRelationError("range index query not supported");
     }
 
+    /**
+     * Do lookup and range (and lookup_values and range_values) give the rows in the order of their keys?
+     */
+    virtual bool is_ordered() const {
+        return false;
+    }
+
+    /**
+     * Columns of the search key, in order.
+     */
+    virtual ColumnNames get_key_columns() const {
+        return this->key_columns;
+    }
+
+    /**
+     * Columns whose values the index has for each row (so that lookup_values and range_values can give
+     * them back without reading the relation).
+     * @returns  column names (empty if the index can't do index-only lookups)
+     */
+    virtual ColumnNames get_covered_columns() const {
+        return ColumnNames();
+    }
+
+    /**
+     * Index-only version of lookup.
+     * @param key_values  dictionary of values for the search key
+     * @returns           for each record with key_values, the values of the covered columns (freed by caller)
+     */
+    virtual ValueDicts *lookup_values(ValueDict *key_values) const {
+        throw DbRelationError("index-only lookup not supported");
+    }
+
+    /**
+     * Index-only version of range.
+     * @param min_key  dictionary of min (inclusive) search key
+     * @param max_key  dictionary of max (inclusive) search key
+     * @param limit    most records to get the values for (as for range), or 0 for all of them
+     * @returns        for each record in range, the values of the covered columns (freed by caller)
+     */
+    virtual ValueDicts *range_values(ValueDict *min_key, ValueDict *max_key, u_long limit = 0) const {
+        throw DbRelationError("index-only range query not supported");
+    }
+
     /**
      * Insert the index entry for the given record.
      * @param record  handle (into relation) to the record to insert
@@ -0,0 +1,457 @@
+/**
+ * @file AggregateOperator.cpp - implementation of AggregateOperator, GroupTable, and Aggregate
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include "AggregateOperator.h"
+#include "HashIndex.h"
+
+using namespace std;
+
+/*************
+ * Aggregate *
+ *************/
+
+bool Aggregate::get_function(const string &name, Function &function) {
+    static const map<string, Function> functions = {{"COUNT", COUNT}, {"SUM", SUM}, {"MIN", MIN}, {"MAX", MAX},
+                                                     {"AVG", AVG}};
+    string upper(name);
+    transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    auto it = functions.find(upper);
+    if (it == functions.end())
+        return false;
+    function = it->second;
+    return true;
+}
+
+ColumnAttribute::DataType Aggregate::get_data_type() const {
+    if (this->function == MIN || this->function == MAX)
+        return this->argument->get_data_type();
+    return ColumnAttribute::INT;
+}
+
+// MIN and MAX only make a Value when the row's is a new extreme.
+void Aggregate::update(Accumulator &accumulator, const ValueDict &row) const {
+    accumulator.count++;
+    switch (this->function) {
+        case SUM:
+        case AVG:
+            accumulator.sum += this->argument->eval_int(row);
+            break;
+        case MIN:
+        case MAX:
+            if (this->argument->get_data_type() == ColumnAttribute::TEXT) {
+                string_view text = this->argument->eval_text(row);
+                if (accumulator.count == 1 ||
+                    (this->function == MIN ? text < accumulator.extreme.s : accumulator.extreme.s < text))
+                    accumulator.extreme = Value(string(text));
+            } else {
+                int32_t n = this->argument->eval_int(row);
+                if (accumulator.count == 1 ||
+                    (this->function == MIN ? n < accumulator.extreme.n : accumulator.extreme.n < n)) {
+                    accumulator.extreme.n = n;
+                    accumulator.extreme.data_type = this->argument->get_data_type();
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void Aggregate::merge(Accumulator &accumulator, const Accumulator &other) const {
+    if (other.count == 0)
+        return;
+    if ((this->function == MIN || this->function == MAX) &&
+        (accumulator.count == 0 || (this->function == MIN ? other.extreme < accumulator.extreme
+                                                          : accumulator.extreme < other.extreme)))
+        accumulator.extreme = other.extreme;
+    accumulator.count += other.count;
+    accumulator.sum += other.sum;
+}
+
+Value Aggregate::result(const Accumulator &accumulator) const {
+    switch (this->function) {
+        case COUNT:
+            return Value((int32_t) accumulator.count);
+        case SUM:
+            return Value((int32_t) accumulator.sum);
+        case AVG:
+            return Value(accumulator.count == 0 ? 0 : (int32_t) (accumulator.sum / accumulator.count));
+        default:
+            if (accumulator.count > 0)
+                return accumulator.extreme;
+            if (this->argument->get_data_type() == ColumnAttribute::TEXT)
+                return Value("");
+            Value none(0);
+            none.data_type = this->argument->get_data_type();
+            return none;
+    }
+}
+
+
+/**************
+ * GroupTable *
+ **************/
+
+GroupTable::GroupTable() : groups(), slots(INITIAL_SLOTS, 0), group_bytes(0) {
+}
+
+GroupTable::~GroupTable() {
+    clear();
+}
+
+GroupTable::Group *GroupTable::find(const NormalizedKey &key, u_int32_t hash) const {
+    u_long mask = this->slots.size() - 1;
+    for (u_long i = hash & mask; this->slots[i] != 0; i = (i + 1) & mask) {
+        Group *group = this->groups[this->slots[i] - 1];
+        if (group->hash == hash && group->key == key)
+            return group;
+    }
+    return nullptr;
+}
+
+// Put the group's number in the first empty slot from the one its hash picks.
+static void place(vector<u_int32_t> &slots, u_int32_t hash, u_int32_t number) {
+    u_long mask = slots.size() - 1;
+    u_long i = hash & mask;
+    while (slots[i] != 0)
+        i = (i + 1) & mask;
+    slots[i] = number;
+}
+
+void GroupTable::add(Group *group) {
+    if ((this->groups.size() + 1) * 2 > this->slots.size())
+        grow();
+    this->groups.push_back(group);
+    place(this->slots, group->hash, (u_int32_t) this->groups.size());
+    this->group_bytes += sizeof(Group) + group->key.capacity() + SpillFile::row_bytes(group->key_values) +
+                         group->accumulators.size() * sizeof(Accumulator);
+}
+
+void GroupTable::grow() {
+    this->slots.assign(this->slots.size() * 2, 0);
+    for (u_int32_t i = 0; i < this->groups.size(); i++)
+        place(this->slots, this->groups[i]->hash, i + 1);
+}
+
+void GroupTable::clear() {
+    for (auto group: this->groups)
+        delete group;
+    this->groups.clear();
+    this->slots.assign(INITIAL_SLOTS, 0);
+    this->group_bytes = 0;
+}
+
+
+/*********************
+ * AggregateOperator *
+ *********************/
+
+u_long AggregateOperator::memory_budget = AggregateOperator::DEFAULT_MEMORY_BUDGET;
+
+AggregateOperator::AggregateOperator(EvalOperator *input, const ColumnNames &names, const Expressions &expressions,
+                                     const Aggregates &aggregates, TaskScheduler *scheduler)
+        : BufferedOperator(), input(input), names(names), expressions(expressions), aggregates(aggregates),
+          scheduler(scheduler), table(), full(false), level(0), partitions(), pending(), partitions_made(false),
+          group_index(0) {
+}
+
+AggregateOperator::~AggregateOperator() {
+    clear_partitions();
+    delete this->input;
+}
+
+// Free a chunk's rows.
+static void clear_chunk(ValueDicts &chunk) {
+    for (auto row: chunk)
+        delete row;
+    chunk.clear();
+}
+
+// Aggregate all the input's rows (or, if the table fills up, partition the rows of the groups it doesn't have).
+void AggregateOperator::open() {
+    clear();
+    clear_partitions();
+    this->table.clear();
+    this->full = false;
+    this->level = 0;
+    this->partitions_made = false;
+    this->group_index = 0;
+    this->input->open();
+    aggregate_all([this]() { return this->input->next(); });
+    this->input->close();
+    finish_level();
+    if (this->expressions.empty() && this->table.get_groups().empty())
+        this->table.add(new GroupTable::Group{NormalizedKey(), HashBucket::hash(NormalizedKey()), ValueDict(),
+                                              Accumulators(this->aggregates.size())});
+}
+
+void AggregateOperator::close() {
+    BufferedOperator::close();
+    this->table.clear();
+    clear_partitions();
+}
+
+// Hand out the table's groups, and then each pending partition's.
+bool AggregateOperator::fill() {
+    while (this->buffer.size() < BATCH_SIZE) {
+        const vector<GroupTable::Group *> &groups = this->table.get_groups();
+        if (this->group_index < groups.size()) {
+            const GroupTable::Group *group = groups[this->group_index++];
+            ValueDict *row = new ValueDict(group->key_values);
+            for (u_long i = 0; i < this->aggregates.size(); i++)
+                (*row)[this->aggregates[i].name] = this->aggregates[i].result(group->accumulators[i]);
+            this->buffer.push_back(row);
+            continue;
+        }
+        if (this->pending.empty())
+            break;
+        aggregate_partition();
+    }
+    return !this->buffer.empty();
+}
+
+// The row's group columns' values (put in values), normalized into the group's key.
+NormalizedKey AggregateOperator::group_key(const ValueDict &row, ValueDict &values) const {
+    NormalizedKey key;
+    for (u_long i = 0; i < this->expressions.size(); i++) {
+        Value &value = values[this->names[i]];
+        value = this->expressions[i]->eval(row);
+        BTreeNode::normalize_value(value, value.data_type, key);
+    }
+    return key;
+}
+
+// Aggregate the rows from next (until it gives nullptr) a chunk at a time.
+void AggregateOperator::aggregate_all(const function<ValueDict *()> &next) {
+    ValueDicts chunk;
+    try {
+        for (ValueDict *row = next(); row != nullptr; row = next()) {
+            chunk.push_back(row);
+            if (chunk.size() == CHUNK_SIZE) {
+                aggregate(chunk);
+                clear_chunk(chunk);
+            }
+        }
+        aggregate(chunk);
+    } catch (DbRelationError &e) {
+        clear_chunk(chunk);
+        throw;
+    }
+    clear_chunk(chunk);
+}
+
+// Aggregate a chunk of rows into the table, in morsels on the scheduler's workers if there's more than one.
+void AggregateOperator::aggregate(const ValueDicts &chunk) {
+    vector<HashedRow> overflow;
+    if (this->scheduler == nullptr || this->scheduler->size() == 1 || chunk.size() <= MORSEL_SIZE) {
+        aggregate_rows(chunk, 0, chunk.size(), this->table, overflow);
+        spill(overflow);
+        return;
+    }
+    u_long morsels = (chunk.size() + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    vector<unique_ptr<GroupTable>> partials(this->scheduler->size());  // each worker's
+    vector<vector<HashedRow>> overflows(morsels);  // each morsel's
+    this->scheduler->run(morsels, [&](u_long morsel, uint worker) {
+        if (!partials[worker])
+            partials[worker].reset(new GroupTable());
+        u_long begin = morsel * MORSEL_SIZE;
+        aggregate_rows(chunk, begin, min(begin + MORSEL_SIZE, (u_long) chunk.size()), *partials[worker],
+                       overflows[morsel]);
+    });
+
+    // merge the workers' groups into the table (the rows of ones it didn't have room for are in overflows)
+    for (auto const &partial: partials) {
+        if (!partial)
+            continue;
+        for (auto group: partial->get_groups()) {
+            GroupTable::Group *into = this->table.find(group->key, group->hash);
+            if (into == nullptr) {
+                this->table.add(new GroupTable::Group(std::move(*group)));
+                continue;
+            }
+            for (u_long i = 0; i < this->aggregates.size(); i++)
+                this->aggregates[i].merge(into->accumulators[i], group->accumulators[i]);
+        }
+    }
+    if (this->table.bytes() > memory_budget && this->level < MAX_LEVELS)
+        this->full = true;
+    for (auto const &rows: overflows)
+        spill(rows);
+}
+
+// Aggregate chunk[begin:end] into groups, except for the rows of groups the (full) table doesn't have, which go in
+// overflow. Once groups is the table itself, it is what fills up; otherwise it's a worker's own, and the table
+// is only read.
+void AggregateOperator::aggregate_rows(const ValueDicts &chunk, u_long begin, u_long end, GroupTable &groups,
+                                       vector<HashedRow> &overflow) {
+    ValueDict values;
+    for (u_long i = begin; i < end; i++) {
+        const ValueDict &row = *chunk[i];
+        NormalizedKey key = group_key(row, values);
+        u_int32_t hash = HashBucket::hash(key);
+        GroupTable::Group *group = groups.find(key, hash);
+        if (group == nullptr) {
+            if (this->full && (&groups == &this->table || this->table.find(key, hash) == nullptr)) {
+                overflow.push_back(HashedRow(hash, chunk[i]));
+                continue;
+            }
+            group = new GroupTable::Group{key, hash, values, Accumulators(this->aggregates.size())};
+            groups.add(group);
+            if (&groups == &this->table && groups.bytes() > memory_budget && this->level < MAX_LEVELS)
+                this->full = true;
+        }
+        for (u_long j = 0; j < this->aggregates.size(); j++)
+            this->aggregates[j].update(group->accumulators[j], row);
+    }
+}
+
+// Write rows out to the partitions for their hashes (making the partitions if there aren't any yet).
+void AggregateOperator::spill(const vector<HashedRow> &overflow) {
+    if (overflow.empty())
+        return;
+    if (this->partitions.empty()) {
+        for (uint i = 0; i < PARTITIONS; i++)
+            this->partitions.push_back(new SpillFile());
+        this->partitions_made = true;
+    }
+    uint shift = 32 - PARTITION_BITS * (this->level + 1);
+    for (auto const &row: overflow)
+        this->partitions[(row.first >> shift) & (PARTITIONS - 1)]->write(*row.second);
+}
+
+// The rows being aggregated are all in the table or in partitions now: put the partitions with rows in pending.
+void AggregateOperator::finish_level() {
+    for (auto file: this->partitions) {
+        if (file->size() == 0) {
+            delete file;
+            continue;
+        }
+        file->rewind();
+        this->pending.push_back(Partition(file, this->level + 1));
+    }
+    this->partitions.clear();
+}
+
+// Aggregate the next pending partition's rows into the (emptied) table.
+void AggregateOperator::aggregate_partition() {
+    Partition partition = this->pending.back();
+    this->pending.pop_back();
+    this->table.clear();
+    this->full = false;
+    this->level = partition.second;
+    this->group_index = 0;
+    try {
+        aggregate_all([&partition]() { return partition.first->read(); });
+    } catch (DbRelationError &e) {
+        delete partition.first;
+        throw;
+    }
+    delete partition.first;
+    finish_level();
+}
+
+void AggregateOperator::clear_partitions() {
+    for (auto file: this->partitions)
+        delete file;
+    this->partitions.clear();
+    for (auto const &partition: this->pending)
+        delete partition.first;
+    this->pending.clear();
+}
+
+
+// What a group of the test's rows should come out with.
+struct ExpectedGroup {
+    int32_t count = 0;
+    int32_t sum = 0;
+    string min_t;
+    int32_t max_v = 0;
+};
+
+// Group the rows by g, with COUNT(*), SUM(v), MIN(t), MAX(v), and AVG(v), and check each group's values.
+static bool test_aggregate_rows(const ValueDicts &rows, TaskScheduler *scheduler, const char *label) {
+    map<int32_t, ExpectedGroup> expected;
+    for (auto row: rows) {
+        ExpectedGroup &group = expected[row->at("g").n];
+        const string &t = row->at("t").s;
+        int32_t v = row->at("v").n;
+        group.min_t = group.count == 0 || t < group.min_t ? t : group.min_t;
+        group.max_v = group.count == 0 || v > group.max_v ? v : group.max_v;
+        group.sum += v;
+        group.count++;
+    }
+    Expressions expressions = {new ColumnExpression("g", ColumnAttribute::INT)};
+    Aggregates aggregates = {Aggregate(Aggregate::COUNT, nullptr, "n"),
+                             Aggregate(Aggregate::SUM, new ColumnExpression("v", ColumnAttribute::INT), "sum"),
+                             Aggregate(Aggregate::MIN, new ColumnExpression("t", ColumnAttribute::TEXT), "min"),
+                             Aggregate(Aggregate::MAX, new ColumnExpression("v", ColumnAttribute::INT), "max"),
+                             Aggregate(Aggregate::AVG, new ColumnExpression("v", ColumnAttribute::INT), "avg")};
+    AggregateOperator aggregate(new RowsOperator(rows), {"g"}, expressions, aggregates, scheduler);
+    auto start = chrono::steady_clock::now();
+    aggregate.open();
+    bool ok = true;
+    u_long groups = 0;
+    for (ValueDict *row = aggregate.next(); row != nullptr; row = aggregate.next(), groups++) {
+        auto it = expected.find(row->at("g").n);
+        ok = ok && it != expected.end() && row->at("n").n == it->second.count && row->at("sum").n == it->second.sum &&
+             row->at("min").s == it->second.min_t && row->at("max").n == it->second.max_v &&
+             row->at("avg").n == it->second.sum / it->second.count;
+        delete row;
+    }
+    bool spilled = aggregate.spilled();
+    aggregate.close();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << label << (spilled ? " (spilled)" : " (in memory)") << ": " << groups << " groups of " << rows.size()
+         << " rows, " << (long) (rows.size() / seconds) << " rows/s" << endl;
+    for (auto expression: expressions)
+        delete expression;
+    for (auto const &a: aggregates)
+        delete a.argument;
+    if (!ok || groups != expected.size())
+        cout << label << " got the wrong groups" << endl;
+    return ok && groups == expected.size();
+}
+
+// With no group columns, COUNT(*) of the rows: one row, even for no rows.
+static bool test_aggregate_count(const ValueDicts &rows) {
+    Expressions expressions;
+    Aggregates aggregates = {Aggregate(Aggregate::COUNT, nullptr, "n")};
+    AggregateOperator aggregate(new RowsOperator(rows), {}, expressions, aggregates);
+    aggregate.open();
+    ValueDict *row = aggregate.next();
+    bool ok = row != nullptr && row->at("n").n == (int32_t) rows.size();
+    delete row;
+    row = aggregate.next();
+    ok = ok && row == nullptr;
+    delete row;
+    aggregate.close();
+    if (!ok)
+        cout << "count of " << rows.size() << " rows is wrong" << endl;
+    return ok;
+}
+
+bool test_aggregate() {
+    mt19937 rng(5300);
+    ValueDicts rows;
+    for (int i = 0; i < 100000; i++)
+        rows.push_back(new ValueDict{{"g", Value((int32_t) (rng() % 5000))},
+                                     {"t", Value("t" + to_string(rng() % 997))},
+                                     {"v", Value((int32_t) (rng() % 2001) - 1000)}});
+    TaskScheduler scheduler(4);
+    bool ok = test_aggregate_rows(rows, nullptr, "aggregate");
+    ok = ok && test_aggregate_rows(rows, &scheduler, "parallel aggregate");
+    u_long budget = AggregateOperator::memory_budget;
+    AggregateOperator::memory_budget = 64 * 1024;  // partitioned twice over
+    ok = ok && test_aggregate_rows(rows, nullptr, "aggregate");
+    ok = ok && test_aggregate_rows(rows, &scheduler, "parallel aggregate");
+    AggregateOperator::memory_budget = budget;
+    ok = ok && test_aggregate_count(rows) && test_aggregate_count(ValueDicts());
+    for (auto row: rows)
+        delete row;
+    return ok;
+}
@@ -0,0 +1,296 @@
+/**
+ * @file BTreeLoader.cpp - implementation of BTreeLoader, the bottom-up bulk builder for BTreeIndex
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include "BTreeLoader.h"
+
+using namespace std;
+
+static const u_int16_t SLOT_OVERHEAD = BTreeNode::SLOT_OVERHEAD;
+
+// Marshal an index entry for a sorted run: handle followed by the normalized key.
+static Dbt *marshal_entry(const IndexEntry &entry) {
+    u_int32_t size = sizeof(BlockID) + sizeof(RecordID) + entry.first.size();
+    char *bytes = new char[size];
+    *(BlockID *) bytes = entry.second.first;
+    *(RecordID *) (bytes + sizeof(BlockID)) = entry.second.second;
+    memcpy(bytes + sizeof(BlockID) + sizeof(RecordID), entry.first.data(), entry.first.size());
+    return new Dbt(bytes, size);
+}
+
+/**
+ * @class RunReader - reads back the entries of one sorted run, a block at a time
+ */
+class RunReader {
+public:
+    explicit RunReader(HeapFile *run) : run(run), block_id(0), pos(0), entries() {
+        next_block();
+    }
+
+    bool done() const { return pos >= entries.size(); }
+
+    const IndexEntry &current() const { return entries[pos]; }
+
+    void advance() {
+        if (++pos >= entries.size())
+            next_block();
+    }
+
+protected:
+    HeapFile *run;
+    BlockID block_id;
+    u_long pos;
+    IndexEntries entries;
+
+    void next_block() {
+        entries.clear();
+        pos = 0;
+        while (entries.empty() && block_id < run->get_last_block_id()) {
+            SlottedPage *page = run->get(++block_id);
+            RecordIDs *record_ids = page->ids();
+            for (auto const &record_id: *record_ids) {
+                Dbt *dbt = page->get(record_id);
+                char *bytes = (char *) dbt->get_data();
+                Handle handle(*(BlockID *) bytes, *(RecordID *) (bytes + sizeof(BlockID)));
+                u_long offset = sizeof(BlockID) + sizeof(RecordID);
+                entries.push_back(IndexEntry(NormalizedKey(bytes + offset, dbt->get_size() - offset), handle));
+                delete dbt;
+            }
+            delete record_ids;
+            delete page;
+        }
+    }
+};
+
+BTreeLoader::BTreeLoader(HeapFile &file, const KeyProfile &key_profile, Identifier run_prefix, bool unique,
+                         uint key_columns, double fill_factor, u_long sort_budget) : file(file),
+                                                                                     key_profile(key_profile),
+                                                                                     run_prefix(run_prefix),
+                                                                                     unique(unique),
+                                                                                     key_columns(key_columns),
+                                                                                     fill_factor(fill_factor),
+                                                                                     sort_budget(sort_budget),
+                                                                                     buffer(), buffer_bytes(0),
+                                                                                     runs(), leaf(nullptr),
+                                                                                     leaf_bytes(0), leaf_count(0),
+                                                                                     leaf_first(), leaf_last(),
+                                                                                     levels(), level_bytes(),
+                                                                                     have_last(false), last_key(),
+                                                                                     pending() {
+    if (fill_factor <= 0.0 || fill_factor > 1.0)
+        throw DbRelationError("BTree fill factor must be in (0, 1]");
+}
+
+BTreeLoader::~BTreeLoader() {
+    delete leaf;
+    for (auto interior: levels)
+        delete interior;
+    for (auto run: runs) {
+        run->drop();
+        delete run;
+    }
+}
+
+// Approximate memory used by an entry while it sits in the sort buffer.
+u_long BTreeLoader::entry_bytes(const NormalizedKey &key) {
+    return sizeof(IndexEntry) + key.capacity();
+}
+
+// Stash an entry for sorting, spilling a sorted run if we are over budget.
+void BTreeLoader::add(const NormalizedKey &key, Handle handle) {
+    buffer.push_back(IndexEntry(key, handle));
+    buffer_bytes += entry_bytes(key);
+    if (buffer_bytes >= sort_budget)
+        spill();
+}
+
+// Sort the buffer and write it out as a new run file.
+void BTreeLoader::spill() {
+    sort(buffer.begin(), buffer.end());
+    HeapFile *run = new HeapFile(run_prefix + "-run" + to_string(runs.size()));
+    runs.push_back(run);
+    run->create();
+    SlottedPage *page = run->get(run->get_last_block_id());
+    for (auto const &entry: buffer) {
+        Dbt *dbt = marshal_entry(entry);
+        try {
+            page->add(dbt);
+        } catch (DbBlockNoRoomError &e) {
+            run->put(page);
+            delete page;
+            page = run->get_new();
+            page->add(dbt);
+        }
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+    }
+    run->put(page);
+    delete page;
+    buffer.clear();
+    buffer_bytes = 0;
+}
+
+// K-way merge of the sorted runs into the tree.
+void BTreeLoader::merge_runs() {
+    vector<RunReader *> readers;
+    for (auto run: runs)
+        readers.push_back(new RunReader(run));
+    auto greater = [&readers](uint a, uint b) { return readers[b]->current() < readers[a]->current(); };
+    priority_queue<uint, vector<uint>, decltype(greater)> heap(greater);
+    for (uint i = 0; i < readers.size(); i++)
+        if (!readers[i]->done())
+            heap.push(i);
+    try {
+        while (!heap.empty()) {
+            uint i = heap.top();
+            heap.pop();
+            append(readers[i]->current().first, readers[i]->current().second);
+            readers[i]->advance();
+            if (!readers[i]->done())
+                heap.push(i);
+        }
+    } catch (...) {
+        for (auto reader: readers)
+            delete reader;
+        throw;
+    }
+    for (auto reader: readers)
+        delete reader;
+}
+
+// Build the whole tree from the entries we've been given.
+void BTreeLoader::build(BTreeStat *stat) {
+    leaf = new BTreeLeaf(file, 0, key_profile, true);
+    leaf_bytes = 0;
+    leaf_count = 0;
+    if (runs.empty()) {
+        sort(buffer.begin(), buffer.end());
+        for (auto const &entry: buffer)
+            append(entry.first, entry.second);
+        buffer.clear();
+        buffer_bytes = 0;
+    } else {
+        if (!buffer.empty())
+            spill();
+        merge_runs();
+    }
+
+    // save the partially filled right edge of each level, from the bottom up; the top one is the root
+    flush();
+    leaf->save();
+    BlockID root_id = leaf->get_id();
+    delete leaf;
+    leaf = nullptr;
+    for (auto interior: levels) {
+        interior->save();
+        root_id = interior->get_id();
+        delete interior;
+    }
+    uint height = levels.size() + 1;
+    levels.clear();
+    level_bytes.clear();
+
+    stat->set_root_id(root_id);
+    stat->set_height(height);
+    stat->save();
+}
+
+// Bytes we're willing to fill in a block, given the bytes reserved for the node's fixed records.
+u_int16_t BTreeLoader::target(u_int16_t reserved) const {
+    return (u_int16_t) (fill_factor * (BTreeNode::PAGE_ROOM - reserved));
+}
+
+// Add the next entry (in key order). Handles for the same key are collected into one posting.
+void BTreeLoader::append(const NormalizedKey &key, Handle handle) {
+    if (have_last && key == last_key) {
+        if (unique)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        pending.push_back(handle);
+        return;
+    }
+    if (unique && have_last && key_columns < key_profile.size()) {
+        // the keys differ, but maybe just in their included columns
+        u_long length = BTreeNode::key_length(key, key_profile, key_columns);
+        if (key.compare(0, length, last_key, 0, BTreeNode::key_length(last_key, key_profile, key_columns)) == 0)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+    }
+    flush();
+    last_key = key;
+    have_last = true;
+    pending.push_back(handle);
+}
+
+// Put the pending key and its handles into the current leaf, starting a new leaf when it is full.
+void BTreeLoader::flush() {
+    if (pending.empty())
+        return;
+    BTreePosting posting;
+    posting.assign(file, pending);
+    pending.clear();
+    u_long size = BTreeLeaf::entry_size(last_key, posting);
+
+    // the leaf stores the prefix its first and last keys share just once (and reserves room for the link to the
+    // next leaf, whose high key is at most one byte longer than the leaf's last key)
+    u_long prefix = leaf_count > 0 ? BTreeNode::common_prefix_length(leaf_first, last_key) : 0;
+    if (leaf_count > 0 &&
+        leaf_bytes + size + prefix - (leaf_count + 1) * prefix + last_key.size() + 1 > target(BTreeNode::LINK_SZ)) {
+        BTreeLeaf *nleaf = new BTreeLeaf(file, 0, key_profile, true);
+        NormalizedKey boundary = BTreeNode::separator(leaf_last, last_key);
+        leaf->set_right(nleaf->get_id(), boundary);
+        leaf->save();
+        append_boundary(0, boundary, leaf->get_id(), nleaf->get_id());
+        delete leaf;
+        leaf = nleaf;
+        leaf_bytes = 0;
+        leaf_count = 0;
+    }
+    if (leaf_count == 0)
+        leaf_first = last_key;
+    leaf->append(last_key, posting);
+    leaf_bytes += size;
+    leaf_count++;
+    leaf_last = last_key;
+}
+
+// Add boundary and the new right-hand block to the interior node at the given level (0 is just above the leaves).
+// The left block is only needed if this starts a new level.
+void BTreeLoader::append_boundary(uint level, const NormalizedKey &boundary, BlockID left, BlockID right) {
+    if (level == levels.size()) {
+        BTreeInterior *interior = new BTreeInterior(file, 0, key_profile, true);
+        interior->set_first(left);
+        levels.push_back(interior);
+        level_bytes.push_back(0);
+    }
+
+    u_int16_t size = SLOT_OVERHEAD + boundary.size() + SLOT_OVERHEAD + sizeof(BlockID);
+
+    // reserve room for the first pointer record and the link to the right sibling
+    u_int16_t reserved = SLOT_OVERHEAD + sizeof(BlockID) + BTreeNode::LINK_SZ;
+    if (level_bytes[level] > 0 && level_bytes[level] + size > target(reserved)) {
+        // full: the new block starts a sister node and the boundary moves up a level, as this node's high key
+        BTreeInterior *nnode = new BTreeInterior(file, 0, key_profile, true);
+        NormalizedKey high_key = boundary;
+        if (level_bytes[level] + boundary.size() > (u_long) (BTreeNode::PAGE_ROOM - reserved)) {
+            // no room for the high key, so the last entry goes to the sister too, and its boundary moves up instead
+            BlockID last;
+            levels[level]->pop_back(high_key, last);
+            nnode->set_first(last);
+            nnode->append(boundary, right);
+            level_bytes[level] = size;
+        } else {
+            nnode->set_first(right);
+            level_bytes[level] = 0;
+        }
+        levels[level]->set_right(nnode->get_id(), high_key);
+        levels[level]->save();
+        append_boundary(level + 1, high_key, levels[level]->get_id(), nnode->get_id());
+        delete levels[level];
+        levels[level] = nnode;
+    } else {
+        levels[level]->append(boundary, right);
+        level_bytes[level] += size;
+    }
+}
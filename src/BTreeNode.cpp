@@ -4,6 +4,7 @@
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
 
+#include <algorithm>
 #include <cstring>
 #include "BTreeNode.h"
 
@@ -17,7 +18,9 @@ BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                      file(file),
                                                                                                      id(block_id),
                                                                                                      key_profile(
-                                                                                                             key_profile) {
+                                                                                                             key_profile),
+                                                                                                     right(0),
+                                                                                                     high_key() {
     if (create) {
         this->block = file.get_new();
         this->id = this->block->get_block_id();
@@ -52,38 +55,122 @@ Handle BTreeNode::get_handle(RecordID record_id) const {
     return Handle(handle_block_id, handle_record_id);
 }
 
-// Get the record and turn it into a KeyValue.
-KeyValue *BTreeNode::get_key(RecordID record_id) const {
+// Get the record and turn it into a BTreePosting.
+BTreePosting BTreeNode::get_posting(RecordID record_id) const {
     Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
+    BTreePosting posting = BTreePosting::unmarshal(dbt);
+    delete dbt;
+    return posting;
+}
+
+// Get the record, a normalized key.
+NormalizedKey BTreeNode::get_key(RecordID record_id) const {
+    Dbt *dbt = this->block->get(record_id);
+    NormalizedKey key((char *) dbt->get_data(), dbt->get_size());
+    delete dbt;
+    return key;
+}
+
+// Normalize the key so that byte-wise comparison agrees with KeyValue comparison.
+NormalizedKey BTreeNode::normalize(const KeyValue &key, const KeyProfile &key_profile) {
+    NormalizedKey bytes;
+    uint col_num = 0;
+    for (auto const &data_type: key_profile)
+        normalize_value(key[col_num++], data_type, bytes);
+    if (bytes.size() > MAX_KEY_SZ)
+        throw DbRelationError("index key too big");
+    return bytes;
+}
+
+void BTreeNode::normalize_value(const Value &value, ColumnAttribute::DataType data_type, NormalizedKey &bytes) {
+    if (data_type == ColumnAttribute::DataType::INT) {
+        // flipping the sign bit puts the negatives first
+        uint32_t n = (uint32_t) value.n ^ 0x80000000u;
+        for (int shift = 24; shift >= 0; shift -= 8)
+            bytes.push_back((char) (n >> shift));
+    } else if (data_type == ColumnAttribute::DataType::TEXT) {
+        // the terminator sorts below any escaped 0x00, so a prefix comes before the longer string
+        for (char c: value.s) {
+            bytes.push_back(c);
+            if (c == '\0')
+                bytes.push_back('\xff');
+        }
+        bytes.append(2, '\0');
+    } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+        bytes.push_back(value.n ? 1 : 0);
+    } else {
+        throw DbRelationError("only know how to normalize INT, TEXT, or BOOLEAN for BTree index");
+    }
+}
+
+// Turn normalized key bytes back into a KeyValue. A truncated key (a separator) comes back as just the
+// values it has, with the last one cut short.
+KeyValue *BTreeNode::denormalize(const NormalizedKey &key, const KeyProfile &key_profile) {
     KeyValue *key_value = new KeyValue();
-    Value value;
-    uint offset = 0;
-    for (auto const &data_type: this->key_profile) {
+    u_long offset = 0;
+    auto byte = [&key](u_long i) { return i < key.size() ? key[i] : '\0'; };
+    for (auto const &data_type: key_profile) {
+        if (offset >= key.size())
+            break;
+        Value value;
         value.data_type = data_type;
         if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
-            offset += sizeof(int32_t);
+            uint32_t n = 0;
+            for (int i = 0; i < 4; i++)
+                n = (n << 8) | (uint8_t) byte(offset++);
+            value.n = (int32_t) (n ^ 0x80000000u);
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *) (bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
+            while (offset < key.size() && (key[offset] != '\0' || byte(offset + 1) != '\0')) {
+                value.s.push_back(key[offset]);
+                offset += key[offset] == '\0' ? 2 : 1;  // skip the escape
+            }
+            offset += 2;
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
-            offset += sizeof(uint8_t);
+            value.n = (uint8_t) byte(offset++);
         } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
+            throw DbRelationError("Only know how to denormalize INT, TEXT, or BOOLEAN");
         }
         key_value->push_back(value);
     }
-    delete dbt;
     return key_value;
 }
 
+// Skip over the columns' values the way denormalize reads them.
+u_long BTreeNode::key_length(const NormalizedKey &key, const KeyProfile &key_profile, uint columns) {
+    u_long offset = 0;
+    for (uint i = 0; i < columns && i < key_profile.size() && offset < key.size(); i++) {
+        if (key_profile[i] == ColumnAttribute::DataType::INT) {
+            offset += 4;
+        } else if (key_profile[i] == ColumnAttribute::DataType::TEXT) {
+            while (offset < key.size()) {
+                if (key[offset] == '\0' && (offset + 1 == key.size() || key[offset + 1] == '\0'))
+                    break;  // the terminator
+                offset += key[offset] == '\0' ? 2 : 1;  // skip the escape
+            }
+            offset += 2;
+        } else {
+            offset += 1;
+        }
+    }
+    return min(offset, (u_long) key.size());
+}
+
+// Count the leading bytes a and b have in common.
+u_long BTreeNode::common_prefix_length(const NormalizedKey &a, const NormalizedKey &b) {
+    u_long n = min(a.size(), b.size());
+    return mismatch(a.begin(), a.begin() + n, b.begin()).first - a.begin();
+}
+
+// Cut right back to just past the first byte where it differs from left.
+NormalizedKey BTreeNode::separator(const NormalizedKey &left, const NormalizedKey &right) {
+    return right.substr(0, common_prefix_length(left, right) + 1);
+}
+
+// A prefix limit takes in all the keys that start with it, which is every key up to the prefix's last extension.
+bool BTreeNode::up_to(const NormalizedKey &key, const NormalizedKey &high) {
+    return key <= high || key.compare(0, high.size(), high) == 0;
+}
+
 // Convert block_id into bytes.
 Dbt *BTreeNode::marshal_block_id(BlockID block_id) {
     char *bytes = new char[sizeof(BlockID)];
@@ -101,49 +188,35 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
     return dbt;
 }
 
-// Convert KeyValue into bytes.
-Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &data_type: this->key_profile) {
-        Value value = (*key)[col_num];
-
-        if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("index key too big to marshal");
-
-            *(int32_t *) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint16_t *) (bytes + offset) = (uint16_t) size;
-            offset += sizeof(uint16_t);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("index key too big to marshal");
+// Convert the right sibling and high key into bytes, followed by extra (the record that ends each node).
+Dbt *BTreeNode::marshal_link(const NormalizedKey &extra) const {
+    u_int32_t size = sizeof(BlockID) + sizeof(u_int16_t) + this->high_key.size() + extra.size();
+    char *bytes = new char[size];
+    *(BlockID *) bytes = this->right;
+    *(u_int16_t *) (bytes + sizeof(BlockID)) = (u_int16_t) this->high_key.size();
+    memcpy(bytes + sizeof(BlockID) + sizeof(u_int16_t), this->high_key.data(), this->high_key.size());
+    memcpy(bytes + sizeof(BlockID) + sizeof(u_int16_t) + this->high_key.size(), extra.data(), extra.size());
+    return new Dbt(bytes, size);
+}
 
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
+// Get the right sibling and high key from the record and return the rest of it.
+NormalizedKey BTreeNode::get_link(RecordID record_id) {
+    Dbt *dbt = this->block->get(record_id);
+    const char *bytes = (const char *) dbt->get_data();
+    this->right = *(BlockID *) bytes;
+    u_int16_t size = *(u_int16_t *) (bytes + sizeof(BlockID));
+    u_long offset = sizeof(BlockID) + sizeof(u_int16_t);
+    this->high_key.assign(bytes + offset, size);
+    NormalizedKey extra(bytes + offset + size, dbt->get_size() - offset - size);
+    delete dbt;
+    return extra;
+}
 
-        } else {
-            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
-        }
-    }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+// Convert a normalized key into bytes (it is stored as is).
+Dbt *BTreeNode::marshal_key(const NormalizedKey &key) {
+    char *bytes = new char[key.size()];
+    memcpy(bytes, key.data(), key.size());
+    return new Dbt(bytes, (u_int32_t) key.size());
 }
 
 
@@ -156,31 +229,38 @@ BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const Ke
                                                                                                                    key_profile,
                                                                                                                    false),
                                                                                                          root_id(new_root),
-                                                                                                         height(1) {
+                                                                                                         height(1),
+                                                                                                         bloom(false) {
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile &key_profile) : BTreeNode(file, stat_id,
                                                                                                  key_profile, false),
                                                                                        root_id(get_block_id(ROOT)),
-                                                                                       height(get_block_id(HEIGHT)) {
+                                                                                       height(get_block_id(HEIGHT)),
+                                                                                       bloom(false) {
+    // an index saved before there were Bloom filters has no BLOOM record
+    RecordIDs *record_ids = this->block->ids();
+    if (record_ids->size() >= BLOOM)
+        this->bloom = get_block_id(BLOOM) != 0;
+    delete record_ids;
 }
 
 void BTreeStat::save() {
+    // rewrite the whole block (like the other nodes) since the block's memory may have been reused by a later get
+    this->block->clear();
     Dbt *dbt = marshal_block_id(this->root_id);
-    bool is_new = (this->block->size() == 0);
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(ROOT, *dbt);
+    this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
 
     dbt = marshal_block_id(this->height);  // not really a block ID but it fits
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(HEIGHT, *dbt);
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+
+    dbt = marshal_block_id(this->bloom ? 1 : 0);
+    this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
 
@@ -196,48 +276,28 @@ BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile
         file, block_id, key_profile, create), first(0), pointers(), boundaries() {
     if (!create) {
         RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == 1) {
-                // first pointer
-                this->first = get_block_id(i);
-            } else if (i % 2 != 0) {
-                // pointer
-                this->pointers.push_back(get_block_id(i));
-            } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
+        RecordID last = (RecordID) record_id_list->size();
+        delete record_id_list;
+        if (last > 0) {
+            // first pointer, then key/pointer pairs, then the right sibling and high key
+            this->first = get_block_id(1);
+            for (RecordID i = 2; i + 1 < last; i += 2) {
+                this->boundaries.push_back(get_key(i));
+                this->pointers.push_back(get_block_id(i + 1));
             }
-            i++;
+            get_link(last);
         }
-        delete record_id_list;
     }
 }
 
 BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
 }
 
 // Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
-    }
-    if (depth == 2)
-        return new BTreeLeaf(this->file, down, this->key_profile, false);
-    else
-        return new BTreeInterior(this->file, down, this->key_profile, false);
+BlockID BTreeInterior::find_child(const NormalizedKey &key) const {
+    // follow the pointer after the last boundary <= key (a bulk-loaded right edge may have only first)
+    auto after = upper_bound(this->boundaries.begin(), this->boundaries.end(), key);
+    return after == this->boundaries.begin() ? this->first : this->pointers[after - this->boundaries.begin() - 1];
 }
 
 // Save the pointers and boundaries in the correct order
@@ -261,79 +321,98 @@ void BTreeInterior::save() {
         delete[] (char *) dbt->get_data();
         delete dbt;
     }
+    dbt = marshal_link(NormalizedKey());
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
     BTreeNode::save();
 }
 
 // Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
+Insertion BTreeInterior::insert(const NormalizedKey &boundary, BlockID block_id) {
     // cout << "inserting (" << block_id << ", " << (*boundary)[0] << ") into interior node " << id; // DEBUG
     // cout << " (pointers:" << boundaries.size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
 
-    Dbt *dbt;
+    auto after = upper_bound(this->boundaries.begin(), this->boundaries.end(), boundary);
+    bool appending = this->right == 0 && after == this->boundaries.end();
+    this->pointers.insert(this->pointers.begin() + (after - this->boundaries.begin()), block_id);
+    this->boundaries.insert(after, boundary);
 
-    bool inserted = false;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
-            this->pointers.insert(this->pointers.begin() + i, block_id);
-            inserted = true;
-            break;
-        }
-    }
-    if (!inserted) {
-        // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
-        this->pointers.push_back(block_id);
-    }
-    dbt = marshal_block_id(block_id);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(boundary);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
+    // check the size from what we have in memory (the block's buffer may have been reused since we read it)
+    if (byte_size() <= PAGE_ROOM) {
+        // it fits, so no need to split
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        cout << "splitting " << *this << endl; // DEBUG
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+    // too big, so split
+    // cout << "splitting " << *this << endl; // DEBUG
+
+    // create the sister and put her to the right
+    BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+
+    // only the pointer of the middle entry goes into the sister (as it's first pointer)
+    // the corresponding boundary is moved up to be inserted into the parent node, and is this node's new high key
+    // (at the right edge, where the keys are likely increasing, leave this node nearly full instead)
+    u_long split = appending ? (u_long) (this->boundaries.size() * APPEND_SPLIT) : this->boundaries.size() / 2;
+    auto left_size = [this](u_long split) {
+        u_long size = (1 + split) * (SLOT_OVERHEAD + sizeof(BlockID)) + LINK_SZ + this->boundaries[split].size();
+        for (u_long i = 0; i < split; i++)
+            size += SLOT_OVERHEAD + this->boundaries[i].size();
+        return size;
+    };
+    while (split > 1 && left_size(split) > PAGE_ROOM)
+        split--;
+    nnode->first = this->pointers[split];
+    Insertion ret(nnode->id, this->boundaries[split]);
+
+    // move the rest of the entries to the sister
+    for (u_long i = split + 1; i < this->boundaries.size(); i++) {
+        nnode->boundaries.push_back(this->boundaries[i]);
+        nnode->pointers.push_back(this->pointers[i]);
+    }
+    this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
+    this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
+    nnode->set_right(this->right, this->high_key);
+    set_right(nnode->id, ret.second);
+    // cout << "after split " << *this << endl; // DEBUG
+    // cout << "new sibling " << *nnode << endl; // DEBUG
+
+    // save everything (the sister first, so she is there when this node points to her)
+    nnode->save();
+    this->save();
+    delete nnode;
+    return ret;
+}
 
-        // too big, so split
+// Bytes needed to save this node.
+u_long BTreeInterior::byte_size() const {
+    u_long size = (1 + this->pointers.size()) * (SLOT_OVERHEAD + sizeof(BlockID)) + LINK_SZ + this->high_key.size();
+    for (auto const &boundary: this->boundaries)
+        size += SLOT_OVERHEAD + boundary.size();
+    return size;
+}
 
-        // create the sister
-        BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+// Add boundary, block_id pair to the end of the node without checking for room (used by BTreeLoader).
+void BTreeInterior::append(const NormalizedKey &boundary, BlockID block_id) {
+    this->boundaries.push_back(boundary);
+    this->pointers.push_back(block_id);
+}
 
-        // only the pointer of the middle entry goes into the sister (as it's first pointer)
-        // the corresponding boundary is moved up to be inserted into the parent node
-        u_long split = this->boundaries.size() / 2;
-        nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
+// Remove the last boundary, block_id pair from the node (used by BTreeLoader).
+void BTreeInterior::pop_back(NormalizedKey &boundary, BlockID &block_id) {
+    boundary = this->boundaries.back();
+    block_id = this->pointers.back();
+    this->boundaries.pop_back();
+    this->pointers.pop_back();
+}
 
-        // move half of the entries to the sister
-        for (u_long i = split + 1; i < this->boundaries.size(); i++) {
-            nnode->boundaries.push_back(this->boundaries[i]);
-            nnode->pointers.push_back(this->pointers[i]);
-        }
-        this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
-        this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
-        // cout << "after split " << *this << endl; // DEBUG
-        // cout << "new sibling " << *nnode << endl; // DEBUG
 
-        // save everything
-        nnode->save();
-        this->save();
-        return ret;
-    }
+// All the child blocks, left to right.
+BlockPointers BTreeInterior::children() const {
+    BlockPointers children{this->first};
+    children.insert(children.end(), this->pointers.begin(), this->pointers.end());
+    return children;
 }
 
 
@@ -342,9 +421,14 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
     if (node.boundaries.size() != node.pointers.size()) {
         out << " MISMATCH boundaries: " << node.boundaries.size() << ", pointers: " << node.pointers.size();
     } else {
-        for (unsigned int i = 0; i < node.boundaries.size(); i++)
-            out << '|' << (*node.boundaries[i])[0] << '|' << node.pointers[i];
+        for (unsigned int i = 0; i < node.boundaries.size(); i++) {
+            KeyValue *boundary = BTreeNode::denormalize(node.boundaries[i], node.key_profile);
+            out << '|' << (*boundary)[0] << '|' << node.pointers[i];
+            delete boundary;
+        }
     }
+    if (node.right != 0)
+        out << " -> " << node.right;
     return out;
 }
 
@@ -357,53 +441,78 @@ BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                                block_id,
                                                                                                                key_profile,
                                                                                                                create),
-                                                                                                     next_leaf(0),
                                                                                                      key_map() {
     if (!create) {
         RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i % 2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i - 1);
-            }
-            i++;
-        }
+        RecordID last = (RecordID) record_id_list->size();
         delete record_id_list;
+        if (last > 0) {
+            // final record: next leaf block and high key, then the prefix the keys share
+            NormalizedKey prefix = get_link(last);
+
+            // record i-1: posting, record i: rest of the key
+            for (RecordID i = 2; i < last; i += 2)
+                this->key_map.emplace_hint(this->key_map.end(), prefix + get_key(i), get_posting(i - 1));
+        }
     }
 }
 
 BTreeLeaf::~BTreeLeaf() {
 }
 
-// Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue *key) const {
-    return this->key_map.at(*key);
+// Find the handles for a given key
+Handles *BTreeLeaf::find_eq(const NormalizedKey &key) const {
+    auto entry = this->key_map.find(key);
+    if (entry == this->key_map.end())
+        return new Handles();
+    return entry->second.get_handles(this->file);
+}
+
+// Add the handles for the keys from low up to high, or starting with high (in key order).
+void BTreeLeaf::find_range(const NormalizedKey &low, const NormalizedKey *high, Handles &handles,
+                           NormalizedKeys *keys) const {
+    for (auto entry = this->key_map.lower_bound(low);
+         entry != this->key_map.end() && (high == nullptr || up_to(entry->first, *high)); entry++) {
+        Handles *more = entry->second.get_handles(this->file);
+        handles.insert(handles.end(), more->begin(), more->end());
+        if (keys != nullptr)
+            keys->insert(keys->end(), more->size(), entry->first);
+        delete more;
+    }
+}
+
+// Remove key, handle pair from the leaf, and the key too if that was its last handle.
+bool BTreeLeaf::remove(const NormalizedKey &key, Handle handle) {
+    auto entry = this->key_map.find(key);
+    if (entry == this->key_map.end() || !entry->second.remove(this->file, handle))
+        return false;
+    if (entry->second.size() == 0)
+        this->key_map.erase(entry);
+    save();
+    return true;
 }
 
-// Save the key_map and next_leaf data in the correct order
+// Save the key_map and next leaf data in the correct order. The prefix common to all the keys is stored
+// once, after the next leaf and high key, and left off of each key.
 void BTreeLeaf::save() {
     Dbt *dbt;
+    u_long prefix = prefix_length();
     this->block->clear();
     for (auto const &item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
+        // posting
+        dbt = item.second.marshal();
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
 
         // key
-        dbt = marshal_key(&item.first);
+        dbt = marshal_key(item.first.substr(prefix));
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
     }
-    // next leaf pointer is final record
-    dbt = marshal_block_id(this->next_leaf);
+    // next leaf pointer, high key, and prefix are the final record
+    dbt = marshal_link(prefix > 0 ? this->key_map.begin()->first.substr(0, prefix) : NormalizedKey());
     this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
@@ -411,66 +520,384 @@ void BTreeLeaf::save() {
     BTreeNode::save();
 }
 
-// Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
-    // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
-    // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
-        throw DbRelationError("Duplicate keys are not allowed in unique index");
+// Bytes one key and its posting take up in a leaf block (including their slot headers).
+u_long BTreeLeaf::entry_size(const NormalizedKey &key, const BTreePosting &posting) {
+    Dbt *dbt = posting.marshal();
+    u_long size = SLOT_OVERHEAD + dbt->get_size() + SLOT_OVERHEAD + key.size();
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    return size;
+}
 
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+// Length of the prefix all the keys share (the first and last have it in common since they're sorted).
+// A lone key keeps all its bytes so that no key record is empty.
+u_long BTreeLeaf::prefix_length() const {
+    if (this->key_map.size() < 2)
+        return 0;
+    return common_prefix_length(this->key_map.begin()->first, this->key_map.rbegin()->first);
+}
 
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
+// Bytes needed to save this leaf.
+u_long BTreeLeaf::byte_size() const {
+    u_long prefix = prefix_length();
+    u_long size = LINK_SZ + this->high_key.size() + prefix;  // next leaf, high key, and prefix
+    for (auto const &item: this->key_map)
+        size += entry_size(item.first, item.second) - prefix;
+    return size;
+}
+
+// Add key, posting pair to the end of the leaf without checking for room (used by BTreeLoader).
+void BTreeLeaf::append(const NormalizedKey &key, const BTreePosting &posting) {
+    this->key_map.emplace_hint(this->key_map.end(), key, posting);
+}
+
+// Insert key, handle pair into block.
+Insertion BTreeLeaf::insert(const NormalizedKey &key, Handle handle, bool unique) {
+    auto entry = this->key_map.find(key);
+    if (entry != this->key_map.end()) {
+        if (unique)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        entry->second.add(this->file, handle);
+    } else {
+        this->key_map[key] = BTreePosting(handle);
+    }
+
+    if (byte_size() <= PAGE_ROOM) {
+        // it fits, so no need to split
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
+    // too big, so split
+    bool appending = this->right == 0 && this->key_map.rbegin()->first == key;
+
+    // create the sister and put her to the right
+    BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+
+    // move the upper half (by size, since postings vary a lot) of the entries to the sister
+    // (or, if we're adding to the end of the last leaf, where the keys are likely increasing, just enough of
+    // them to leave this leaf nearly full)
+    u_long prefix = prefix_length();
+    u_long kept = 0;
+    auto split = this->key_map.begin();
+    if (appending) {
+        u_long keep = (u_long) (PAGE_ROOM * APPEND_SPLIT);
+        while (split != this->key_map.end() && kept + entry_size(split->first, split->second) - prefix <= keep) {
+            kept += entry_size(split->first, split->second) - prefix;
+            split++;
+        }
+    } else {
+        u_long half = byte_size() / 2;
+        while (split != this->key_map.end() && kept < half) {
+            kept += entry_size(split->first, split->second) - prefix;
+            split++;
+        }
+    }
+    if (split == this->key_map.end())
+        split--;
+    if (split == this->key_map.begin())
+        split++;
+    nleaf->key_map.insert(split, this->key_map.end());
+    this->key_map.erase(split, this->key_map.end());
+    nleaf->set_right(this->right, this->high_key);
+
+    // the boundary is this leaf's new high key; if that makes it too big, move more over to the sister
+    NormalizedKey boundary = separator(this->key_map.rbegin()->first, nleaf->key_map.begin()->first);
+    set_right(nleaf->id, boundary);
+    while (byte_size() > PAGE_ROOM && this->key_map.size() > 1) {
+        nleaf->key_map.insert(*this->key_map.rbegin());
+        this->key_map.erase(prev(this->key_map.end()));
+        boundary = separator(this->key_map.rbegin()->first, nleaf->key_map.begin()->first);
+        set_right(nleaf->id, boundary);
+    }
+    // cout << "splitting leaf " << id << ", new sibling " << nleaf->id << endl; // DEBUG
+
+    // the sister goes first, so she is there when this leaf points to her
+    nleaf->save();
+    this->save();
+    Insertion ret(nleaf->id, boundary);
+    delete nleaf;
+    return ret;
+}
+
+
+/****************
+ * BTreePosting *
+ ****************/
+
+// records in an overflow block
+static const RecordID OVERFLOW_NEXT = 1;
+static const RecordID OVERFLOW_CHUNK = 2;
+
+// bytes available for the encoded chunk in an overflow block (after the next-block record)
+static const u_int16_t CHUNK_SZ = BTreeNode::PAGE_ROOM - (BTreeNode::SLOT_OVERHEAD + sizeof(BlockID)) -
+                                  BTreeNode::SLOT_OVERHEAD;
+
+// most bytes the count at the front of an encoded list can take
+static const u_int16_t MAX_COUNT_SZ = 5;
+
+static void put_varint(string &bytes, u_int32_t n) {
+    while (n >= 0x80) {
+        bytes.push_back((char) (n | 0x80));
+        n >>= 7;
+    }
+    bytes.push_back((char) n);
+}
+
+static u_int32_t get_varint(const char *&bytes) {
+    u_int32_t n = 0;
+    uint shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(const uint8_t *) bytes++;
+        n |= (u_int32_t) (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return n;
+}
+
+static u_int16_t varint_size(u_int32_t n) {
+    u_int16_t size = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Delta-encode the handles from begin up to end (which must be sorted) onto bytes.
+void BTreePosting::encode(string &bytes, Handles::const_iterator begin, Handles::const_iterator end) {
+    put_varint(bytes, (u_int32_t) (end - begin));
+    BlockID prev_block = 0;
+    RecordID prev_record = 0;
+    for (auto it = begin; it != end; it++) {
+        BlockID delta = it->first - prev_block;
+        put_varint(bytes, delta);
+        put_varint(bytes, delta == 0 ? it->second - prev_record : it->second);
+        prev_block = it->first;
+        prev_record = it->second;
+    }
+}
+
+// Decode a delta-encoded list of handles and append them to handles.
+void BTreePosting::decode(const char *bytes, Handles &handles) {
+    u_int32_t n = get_varint(bytes);
+    BlockID block_id = 0;
+    RecordID record_id = 0;
+    for (u_int32_t i = 0; i < n; i++) {
+        BlockID delta = get_varint(bytes);
+        RecordID r = (RecordID) get_varint(bytes);
+        block_id += delta;
+        record_id = delta == 0 ? record_id + r : r;
+        handles.push_back(Handle(block_id, record_id));
+    }
+}
+
+// Convert posting into bytes to store in the leaf.
+Dbt *BTreePosting::marshal() const {
+    string bytes;
+    if (is_overflow()) {
+        put_varint(bytes, 0);
+        bytes.append((const char *) &this->head, sizeof(BlockID));
+        bytes.append((const char *) &this->tail, sizeof(BlockID));
+        bytes.append((const char *) &this->count, sizeof(u_int32_t));
+    } else {
+        encode(bytes, this->handles.begin(), this->handles.end());
+    }
+    char *data = new char[bytes.size()];
+    memcpy(data, bytes.data(), bytes.size());
+    return new Dbt(data, (u_int32_t) bytes.size());
+}
+
+// Get the posting back from the bytes stored in the leaf.
+BTreePosting BTreePosting::unmarshal(const Dbt *dbt) {
+    BTreePosting posting;
+    const char *bytes = (const char *) dbt->get_data();
+    const char *after_count = bytes;
+    if (get_varint(after_count) == 0) {
+        posting.head = *(BlockID *) after_count;
+        posting.tail = *(BlockID *) (after_count + sizeof(BlockID));
+        posting.count = *(u_int32_t *) (after_count + 2 * sizeof(BlockID));
+    } else {
+        decode(bytes, posting.handles);
+        posting.count = (u_int32_t) posting.handles.size();
+    }
+    return posting;
+}
+
+// Get all the handles, following the overflow chain if there is one.
+Handles *BTreePosting::get_handles(HeapFile &file) const {
+    if (!is_overflow())
+        return new Handles(this->handles);
+    Handles *ret = new Handles();
+    ret->reserve(this->count);
+    BlockID block_id = this->head;
+    while (block_id != 0) {
+        SlottedPage *page = file.get(block_id);
+        Dbt *dbt = page->get(OVERFLOW_NEXT);
+        block_id = *(BlockID *) dbt->get_data();
+        delete dbt;
+        dbt = page->get(OVERFLOW_CHUNK);
+        decode((const char *) dbt->get_data(), *ret);
         delete dbt;
+        delete page;
+    }
+    return ret;
+}
 
-        // too big, so split
-
-        // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
-        nleaf->next_leaf = this->next_leaf;
-        this->next_leaf = nleaf->id;
-
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
-        u_long i = 0;
-        KeyValue boundary;
-        for (auto const &item: key_list) {
-            if (i < split) {
-                this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
-            } else {
-                nleaf->key_map[item.first] = item.second;
-            }
-            i++;
+// Write one overflow block: the pointer to the next block in the chain and a chunk of encoded handles.
+static void write_overflow_block(HeapFile &file, BlockID block_id, BlockID next, const string &chunk) {
+    SlottedPage *page = file.get(block_id);
+    page->clear();
+    Dbt dbt(&next, sizeof(BlockID));
+    page->add(&dbt);
+    dbt = Dbt((void *) chunk.data(), (u_int32_t) chunk.size());
+    page->add(&dbt);
+    file.put(page);
+    delete page;
+}
+
+// Write the handles out to a chain of overflow blocks, reusing the blocks of the current chain first.
+// (Blocks left over from a longer chain are abandoned; HeapFile doesn't have a free list.)
+void BTreePosting::write_overflow(HeapFile &file, const Handles &all) {
+    // cut the list into chunks that fit in a block
+    vector<string> chunks;
+    auto begin = all.begin();
+    while (begin != all.end()) {
+        u_long size = MAX_COUNT_SZ;
+        auto end = begin;
+        Handle prev(0, 0);
+        while (end != all.end()) {
+            BlockID delta = end->first - prev.first;
+            u_long more = varint_size(delta) + varint_size(delta == 0 ? end->second - prev.second : end->second);
+            if (size + more > CHUNK_SZ)
+                break;
+            size += more;
+            prev = *end++;
         }
-        cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
-        cout << " starting at value " << boundary[0] << endl; // DEBUG
+        string chunk;
+        encode(chunk, begin, end);
+        chunks.push_back(chunk);
+        begin = end;
+    }
+
+    BlockIDs block_ids;
+    BlockID block_id = this->head;
+    while (block_id != 0 && block_ids.size() < chunks.size()) {
+        block_ids.push_back(block_id);
+        SlottedPage *page = file.get(block_id);
+        Dbt *dbt = page->get(OVERFLOW_NEXT);
+        block_id = *(BlockID *) dbt->get_data();
+        delete dbt;
+        delete page;
+    }
+    while (block_ids.size() < chunks.size()) {
+        SlottedPage *page = file.get_new();
+        block_ids.push_back(page->get_block_id());
+        delete page;
+    }
+    for (u_long i = 0; i < chunks.size(); i++)
+        write_overflow_block(file, block_ids[i], i + 1 < chunks.size() ? block_ids[i + 1] : 0, chunks[i]);
+
+    this->handles.clear();
+    this->head = block_ids.front();
+    this->tail = block_ids.back();
+    this->count = (u_int32_t) all.size();
+}
+
+// Replace the list, keeping it in the leaf if it is short enough.
+void BTreePosting::assign(HeapFile &file, const Handles &all) {
+    string bytes;
+    encode(bytes, all.begin(), all.end());
+    if (bytes.size() > OVERFLOW_SZ) {
+        write_overflow(file, all);
+    } else {
+        this->handles = all;
+        this->count = (u_int32_t) all.size();
+        this->head = this->tail = 0;
+    }
+}
 
-        nleaf->save();
-        this->save();
-        return Insertion(nleaf->id, boundary);
+// Take a handle out of the list. An overflowed list is rewritten (back into the leaf if it is short enough now).
+bool BTreePosting::remove(HeapFile &file, Handle handle) {
+    if (!is_overflow()) {
+        auto pos = lower_bound(this->handles.begin(), this->handles.end(), handle);
+        if (pos == this->handles.end() || *pos != handle)
+            return false;
+        this->handles.erase(pos);
+        this->count--;
+        return true;
+    }
+    Handles *all = get_handles(file);
+    auto pos = lower_bound(all->begin(), all->end(), handle);
+    bool found = pos != all->end() && *pos == handle;
+    if (found) {
+        all->erase(pos);
+        assign(file, *all);
     }
+    delete all;
+    return found;
 }
 
+// Add a handle in sorted order.
+void BTreePosting::add(HeapFile &file, Handle handle) {
+    if (!is_overflow()) {
+        auto pos = lower_bound(this->handles.begin(), this->handles.end(), handle);
+        if (pos != this->handles.end() && *pos == handle)
+            return;
+        this->handles.insert(pos, handle);
+        this->count++;
+        string bytes;
+        encode(bytes, this->handles.begin(), this->handles.end());
+        if (bytes.size() > OVERFLOW_SZ) {
+            Handles all;
+            all.swap(this->handles);
+            write_overflow(file, all);
+        }
+        return;
+    }
 
+    // new rows usually land at the end of the table, so first try just tacking it onto the tail chunk
+    SlottedPage *page = file.get(this->tail);
+    Dbt *dbt = page->get(OVERFLOW_CHUNK);
+    Handles chunk;
+    decode((const char *) dbt->get_data(), chunk);
+    delete dbt;
+    if (handle > chunk.back()) {
+        chunk.push_back(handle);
+        string bytes;
+        encode(bytes, chunk.begin(), chunk.end());
+        if (bytes.size() <= CHUNK_SZ) {
+            // rewrite the tail block (SlottedPage::put wants room for another slot header to enlarge a record)
+            delete page;
+            write_overflow_block(file, this->tail, 0, bytes);
+        } else {
+            // tail block is full, so start a new one and link the old tail to it
+            delete page;
+            page = file.get_new();
+            BlockID new_tail = page->get_block_id();
+            delete page;
+            bytes.clear();
+            encode(bytes, chunk.end() - 1, chunk.end());
+            write_overflow_block(file, new_tail, 0, bytes);
+            page = file.get(this->tail);
+            Dbt next(&new_tail, sizeof(BlockID));
+            page->put(OVERFLOW_NEXT, next);
+            file.put(page);
+            delete page;
+            this->tail = new_tail;
+        }
+        this->count++;
+        return;
+    }
+    delete page;
+
+    // otherwise rewrite the whole chain
+    Handles *all = get_handles(file);
+    auto pos = lower_bound(all->begin(), all->end(), handle);
+    if (pos == all->end() || *pos != handle) {
+        all->insert(pos, handle);
+        write_overflow(file, *all);
+    }
+    delete all;
+}
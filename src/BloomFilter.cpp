@@ -0,0 +1,263 @@
+/**
+ * @file BloomFilter.cpp - implementation of BloomFilter, a blocked Bloom filter
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cmath>
+#include <cstring>
+#include "BloomFilter.h"
+#include "HeapTable.h"
+
+using namespace std;
+
+// Odd multipliers, one for each bit a key sets in its group (as in Parquet's split block Bloom filters)
+static const u_int32_t SALTS[] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU,
+                                  0x9efc4947U, 0x5c6bfb31U, 0x3b1d5a87U, 0xd1f3ab2fU, 0x6a09e667U, 0xbb67ae85U,
+                                  0x3c6ef373U, 0xa54ff53bU, 0x510e527fU, 0x9b05688dU};
+static const u_int32_t MAX_HASHES = sizeof(SALTS) / sizeof(SALTS[0]);
+
+// Size the filter as usual for the rate (bits per key = -ln p / ln^2 2, hashes = bits per key * ln 2), plus a tenth
+// more bits, since the keys don't spread evenly over the groups.
+BloomFilter::BloomFilter(u_long expected_keys, double false_positive_rate) : groups(0), hashes(0), words(),
+                                                                             file(nullptr), first_block(0),
+                                                                             save_mutex() {
+    if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0)
+        throw DbRelationError("Bloom filter false positive rate must be in (0, 1)");
+    double bits_per_key = -log(false_positive_rate) / (M_LN2 * M_LN2);
+    u_long keys = max(expected_keys, MIN_KEYS);
+    this->groups = (u_int32_t) ceil(1.1 * bits_per_key * keys / GROUP_BITS);
+    this->hashes = (u_int32_t) min((long) MAX_HASHES, max(1L, lround(bits_per_key * M_LN2)));
+    this->words.reset(new atomic<u_int64_t>[(u_long) this->groups * GROUP_WORDS]);
+    for (u_long i = 0; i < (u_long) this->groups * GROUP_WORDS; i++)
+        this->words[i] = 0;
+}
+
+BloomFilter::BloomFilter(u_int32_t groups, u_int32_t hashes) : groups(groups), hashes(hashes), words(),
+                                                               file(nullptr), first_block(0), save_mutex() {
+    this->words.reset(new atomic<u_int64_t>[(u_long) groups * GROUP_WORDS]);
+}
+
+BloomFilter *BloomFilter::load(HeapFile &file, BlockID header_id) {
+    SlottedPage *header = file.get(header_id);
+    Dbt *dbt = header->get(1);
+    u_int32_t *fields = (u_int32_t *) dbt->get_data();
+    BloomFilter *filter = new BloomFilter(fields[0], fields[1]);
+    filter->first_block = fields[2];
+    delete dbt;
+    delete header;
+
+    for (u_int32_t block_index = 0; block_index * GROUPS_PER_BLOCK < filter->groups; block_index++) {
+        SlottedPage *block = file.get(filter->first_block + block_index);
+        dbt = block->get(1);
+        const u_int64_t *bits = (const u_int64_t *) dbt->get_data();
+        u_long first = (u_long) block_index * GROUPS_PER_BLOCK * GROUP_WORDS;
+        for (u_long i = 0; i < dbt->get_size() / sizeof(u_int64_t); i++)
+            filter->words[first + i] = bits[i];
+        delete dbt;
+        delete block;
+    }
+    filter->file = &file;
+    return filter;
+}
+
+void BloomFilter::save(HeapFile &file, BlockID header_id) {
+    lock_guard<mutex> guard(this->save_mutex);
+    this->file = &file;
+    u_int32_t blocks = (this->groups + GROUPS_PER_BLOCK - 1) / GROUPS_PER_BLOCK;
+    for (u_int32_t block_index = 0; block_index < blocks; block_index++) {
+        SlottedPage *block = file.get_new();
+        if (block_index == 0)
+            this->first_block = block->get_block_id();
+        delete block;
+        save_block(block_index);
+    }
+
+    u_int32_t fields[] = {this->groups, this->hashes, this->first_block};
+    Dbt dbt(fields, sizeof(fields));
+    SlottedPage *header = file.get(header_id);
+    header->clear();
+    header->add(&dbt);
+    file.put(header);
+    delete header;
+}
+
+// Rewrite one block of groups. Called with save_mutex held.
+void BloomFilter::save_block(u_int32_t block_index) {
+    u_long first = (u_long) block_index * GROUPS_PER_BLOCK;
+    u_long count = min((u_long) GROUPS_PER_BLOCK, this->groups - first);
+    vector<u_int64_t> bits(count * GROUP_WORDS);
+    for (u_long i = 0; i < bits.size(); i++)
+        bits[i] = this->words[first * GROUP_WORDS + i].load(memory_order_relaxed);
+    Dbt dbt(bits.data(), (u_int32_t) (bits.size() * sizeof(u_int64_t)));
+    SlottedPage *block = this->file->get(this->first_block + block_index);
+    block->clear();
+    block->add(&dbt);
+    this->file->put(block);
+    delete block;
+}
+
+// FNV-1a, then a 64-bit finalizer to spread it over all the bits.
+u_int64_t BloomFilter::hash(const string &key) {
+    u_int64_t h = 14695981039346656037ULL;
+    for (unsigned char c: key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// The high half of the hash picks the group, and the low half, times each salt, picks a bit in it.
+void BloomFilter::add(const string &key) {
+    u_int64_t h = hash(key);
+    u_int32_t group = (u_int32_t) (((h >> 32) * this->groups) >> 32);
+    bool changed = false;
+    for (u_int32_t i = 0; i < this->hashes; i++) {
+        u_int32_t b = ((u_int32_t) h * SALTS[i]) >> 23;  // top 9 bits: 0 to 511
+        u_int64_t mask = (u_int64_t) 1 << (b % 64);
+        u_int64_t before = this->words[group * GROUP_WORDS + b / 64].fetch_or(mask, memory_order_relaxed);
+        changed = changed || (before & mask) == 0;
+    }
+    if (changed && this->file != nullptr) {
+        lock_guard<mutex> guard(this->save_mutex);
+        save_block(group / GROUPS_PER_BLOCK);
+    }
+}
+
+bool BloomFilter::may_contain(const string &key) const {
+    u_int64_t h = hash(key);
+    u_int32_t group = (u_int32_t) (((h >> 32) * this->groups) >> 32);
+    for (u_int32_t i = 0; i < this->hashes; i++) {
+        u_int32_t b = ((u_int32_t) h * SALTS[i]) >> 23;
+        if ((this->words[group * GROUP_WORDS + b / 64].load(memory_order_relaxed) >> (b % 64) & 1) == 0)
+            return false;
+    }
+    return true;
+}
+
+// A key that isn't there gets through if all its bits are set, which for evenly spread keys happens about
+// (fraction of bits set)^hashes of the time.
+double BloomFilter::estimated_false_positive_rate() const {
+    u_long set = 0;
+    for (u_long i = 0; i < (u_long) this->groups * GROUP_WORDS; i++)
+        set += __builtin_popcountll(this->words[i].load(memory_order_relaxed));
+    return pow((double) set / ((double) this->groups * GROUP_BITS), this->hashes);
+}
+
+string BloomFilter::value_key(const Value &value) {
+    string key(1, (char) value.data_type);
+    if (value.data_type == ColumnAttribute::TEXT)
+        key += value.s;
+    else
+        key.append((const char *) &value.n, sizeof(value.n));
+    return key;
+}
+
+
+// Check a filter for false negatives, and measure its false positive rate.
+static bool test_filter_keys(const BloomFilter &filter, int n, double rate, const char *what) {
+    for (int i = 0; i < n; i++) {
+        if (!filter.may_contain("key" + to_string(i))) {
+            cout << what << ": key" << i << " missing" << endl;
+            return false;
+        }
+    }
+    int false_positives = 0;
+    for (int i = n; i < 11 * n; i++)
+        if (filter.may_contain("key" + to_string(i)))
+            false_positives++;
+    double measured = (double) false_positives / (10 * n);
+    cout << what << ": " << filter.byte_size() << " bytes, false positives " << measured << " (estimated "
+         << filter.estimated_false_positive_rate() << ")" << endl;
+    if (measured > 2 * rate) {
+        cout << what << ": false positive rate " << measured << " is too high for " << rate << endl;
+        return false;
+    }
+    return true;
+}
+
+bool test_bloom_filter() {
+    // a filter in memory, at two rates
+    const int n = 20000;
+    for (double rate: {0.01, 0.001}) {
+        BloomFilter filter(n, rate);
+        for (int i = 0; i < n; i++)
+            filter.add("key" + to_string(i));
+        if (!test_filter_keys(filter, n, rate, rate == 0.01 ? "bloom filter (1%)" : "bloom filter (0.1%)"))
+            return false;
+    }
+
+    // saved, added to (which writes just the changed blocks), and loaded again
+    HeapFile file("__test_bloom");
+    file.create();
+    BloomFilter *filter = new BloomFilter(n);
+    for (int i = 0; i < n / 2; i++)
+        filter->add("key" + to_string(i));
+    filter->save(file, 1);
+    for (int i = n / 2; i < n; i++)
+        filter->add("key" + to_string(i));
+    delete filter;
+    file.close();
+    file.open();
+    filter = BloomFilter::load(file, 1);
+    bool ok = test_filter_keys(*filter, n, BloomFilter::DEFAULT_FALSE_POSITIVE_RATE, "saved bloom filter");
+    delete filter;
+    file.drop();
+    if (!ok)
+        return false;
+    if (BloomFilter::value_key(Value(7)) == BloomFilter::value_key(Value(std::string("\7\0\0\0", 4))))
+        return false;
+
+    // a table's filter on a column: lookups of absent values are answered without scanning
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable table("__test_bloom_table", column_names, column_attributes);
+    table.create();
+    ValueDict row;
+    for (int i = 0; i < 1000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("b" + to_string(i % 50));
+        table.insert(&row);
+    }
+    table.add_bloom_filter("b");
+    row["a"] = Value(1000);
+    row["b"] = Value("late");
+    table.insert(&row);
+    table.close();  // the filter is saved with the table
+    table.open();
+    ValueDict where;
+    where["b"] = Value("b7");
+    Handles *handles = table.select(&where);
+    ok = handles->size() == 20;
+    delete handles;
+    where["b"] = Value("late");
+    handles = table.select(&where);
+    ok = ok && handles->size() == 1;
+    delete handles;
+    where["b"] = Value("nowhere");
+    handles = table.select(&where);
+    ok = ok && handles->empty();
+    delete handles;
+    Conjunction conjunction = {Comparison("b", Comparison::EQ, Value("b8")), Comparison("a", Comparison::LT, 100)};
+    handles = table.select(conjunction);
+    ok = ok && handles->size() == 2;
+    delete handles;
+    if (!ok) {
+        cout << "table bloom filter select failed" << endl;
+        return false;
+    }
+    try {
+        conjunction = {Comparison("b", Comparison::EQ, Value(8))};
+        handles = table.select(conjunction);
+        delete handles;
+        cout << "comparison with a value of another type should have failed" << endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    table.drop();
+    return true;
+}
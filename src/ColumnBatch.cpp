@@ -0,0 +1,240 @@
+/**
+ * @file ColumnBatch.cpp - implementation of ColumnBatch, rows stored a column at a time
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include "ColumnBatch.h"
+#include "Expression.h"
+#include "HeapTable.h"
+
+using namespace std;
+
+/****************
+ * ColumnVector *
+ ****************/
+
+void ColumnVector::append(const Value &value) {
+    if (this->data_type == ColumnAttribute::TEXT)
+        append_text(value.s.data(), (u_int16_t) value.s.size());
+    else
+        append_int(value.n);
+}
+
+Value ColumnVector::get(u_long i) const {
+    Value value;
+    value.data_type = this->data_type;
+    if (this->data_type == ColumnAttribute::TEXT)
+        value.s.assign(this->bytes, this->offsets[i], this->offsets[i + 1] - this->offsets[i]);
+    else
+        value.n = this->ints[i];
+    return value;
+}
+
+void ColumnVector::clear() {
+    this->ints.clear();
+    this->offsets.resize(1);
+    this->bytes.clear();
+}
+
+// One pass over the values for each kind of comparison, with no branches in the loop, so that it vectorizes.
+template<typename Compare>
+static void filter_ints(const int32_t *values, u_long n, int32_t constant, u_int8_t *mask, Compare compare) {
+    for (u_long i = 0; i < n; i++)
+        mask[i] &= (u_int8_t) compare(values[i], constant);
+}
+
+// Compare each TEXT value with the constant as std::string would (bytes, then length): <0, 0, or >0.
+static int compare_text(const char *text, u_int32_t size, const string &constant) {
+    int c = memcmp(text, constant.data(), min((size_t) size, constant.size()));
+    if (c != 0)
+        return c;
+    return size < constant.size() ? -1 : size > constant.size() ? 1 : 0;
+}
+
+template<typename Compare>
+static void filter_texts(const char *bytes, const u_int32_t *offsets, u_long n, const string &constant,
+                         u_int8_t *mask, Compare compare) {
+    for (u_long i = 0; i < n; i++)
+        if (mask[i])
+            mask[i] = (u_int8_t) compare(compare_text(bytes + offsets[i], offsets[i + 1] - offsets[i], constant), 0);
+}
+
+void ColumnVector::filter(const Comparison &comparison, u_int8_t *mask) const {
+    if (this->data_type == ColumnAttribute::TEXT) {
+        u_long n = this->offsets.size() - 1;
+        const string &constant = comparison.value.s;
+        const char *bytes = this->bytes.data();
+        switch (comparison.op) {
+            case Comparison::EQ:
+                return filter_texts(bytes, this->offsets.data(), n, constant, mask, equal_to<int>());
+            case Comparison::NE:
+                return filter_texts(bytes, this->offsets.data(), n, constant, mask, not_equal_to<int>());
+            case Comparison::LT:
+                return filter_texts(bytes, this->offsets.data(), n, constant, mask, less<int>());
+            case Comparison::LE:
+                return filter_texts(bytes, this->offsets.data(), n, constant, mask, less_equal<int>());
+            case Comparison::GT:
+                return filter_texts(bytes, this->offsets.data(), n, constant, mask, greater<int>());
+            case Comparison::GE:
+                return filter_texts(bytes, this->offsets.data(), n, constant, mask, greater_equal<int>());
+        }
+    }
+    u_long n = this->ints.size();
+    int32_t constant = comparison.value.n;
+    switch (comparison.op) {
+        case Comparison::EQ:
+            return filter_ints(this->ints.data(), n, constant, mask, equal_to<int32_t>());
+        case Comparison::NE:
+            return filter_ints(this->ints.data(), n, constant, mask, not_equal_to<int32_t>());
+        case Comparison::LT:
+            return filter_ints(this->ints.data(), n, constant, mask, less<int32_t>());
+        case Comparison::LE:
+            return filter_ints(this->ints.data(), n, constant, mask, less_equal<int32_t>());
+        case Comparison::GT:
+            return filter_ints(this->ints.data(), n, constant, mask, greater<int32_t>());
+        case Comparison::GE:
+            return filter_ints(this->ints.data(), n, constant, mask, greater_equal<int32_t>());
+    }
+}
+
+
+/***************
+ * ColumnBatch *
+ ***************/
+
+ColumnBatch::ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+        : column_names(column_names), columns(), handles(), selection() {
+    for (auto const &attribute: column_attributes)
+        this->columns.push_back(ColumnVector(attribute.get_data_type()));
+}
+
+void ColumnBatch::add_row(Handle handle, const ValueDict &row) {
+    for (u_long i = 0; i < this->columns.size(); i++)
+        this->columns[i].append(row.at(this->column_names[i]));
+    added(handle);
+}
+
+// AND each comparison's mask into one for all the rows, then list the rows left.
+void ColumnBatch::filter(const Conjunction &where) {
+    vector<u_int8_t> mask(size(), 1);
+    for (auto const &comparison: where) {
+        u_long i = find(this->column_names.begin(), this->column_names.end(), comparison.column_name) -
+                   this->column_names.begin();
+        this->columns[i].filter(comparison, mask.data());
+    }
+    this->selection.clear();
+    for (u_long i = 0; i < mask.size(); i++)
+        if (mask[i])
+            this->selection.push_back((u_int32_t) i);
+}
+
+void ColumnBatch::filter(const Expression &where) {
+    if (!this->selection.empty())
+        where.select(*this, this->selection);
+}
+
+ValueDict *ColumnBatch::row(u_long i, u_long columns) const {
+    ValueDict *row = new ValueDict();
+    for (u_long column = 0; column < columns; column++)
+        (*row)[this->column_names[column]] = this->columns[column].get(i);
+    return row;
+}
+
+void ColumnBatch::clear() {
+    for (auto &column: this->columns)
+        column.clear();
+    this->handles.clear();
+    this->selection.clear();
+}
+
+
+// Check a batch's selection against Comparison::matches, row by row.
+static bool test_batch_filter(DbRelation &table, const Conjunction &where) {
+    ColumnNames column_names = table.get_column_names();
+    ColumnBatch batch(column_names, table.get_column_attributes());
+    Handles *handles = table.select();
+    ValueDicts *rows = table.project(handles);
+    for (u_long i = 0; i < handles->size(); i++)
+        batch.add_row((*handles)[i], *(*rows)[i]);
+    batch.filter(where);
+    u_long selected = 0;
+    bool ok = true;
+    for (u_long i = 0; i < rows->size(); i++) {
+        bool matches = true;
+        for (auto const &comparison: where)
+            matches = matches && comparison.matches((*(*rows)[i])[comparison.column_name]);
+        bool in_batch = selected < batch.get_selection().size() && batch.get_selection()[selected] == i;
+        if (in_batch)
+            selected++;
+        ok = ok && matches == in_batch;
+        delete (*rows)[i];
+    }
+    delete rows;
+    delete handles;
+    return ok && selected == batch.get_selection().size();
+}
+
+bool test_column_batch() {
+    ColumnNames column_names = {"a", "b", "c"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable table("__test_column_batch", column_names, column_attributes);
+    table.create();
+    const int n = 50000;
+    ValueDict row;
+    for (int i = 0; i < n; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(i % 100);
+        row["c"] = Value(string(i % 3, 'x') + to_string(i % 17));
+        table.insert(&row);
+    }
+
+    // each kind of comparison, on each kind of column, against the row-at-a-time check
+    for (auto op: {Comparison::EQ, Comparison::NE, Comparison::LT, Comparison::LE, Comparison::GT, Comparison::GE}) {
+        Conjunction where = {Comparison("b", op, Value(42)), Comparison("c", op, Value("x5"))};
+        if (!test_batch_filter(table, where)) {
+            cout << "column batch filter failed for op " << op << endl;
+            return false;
+        }
+    }
+
+    // a scan a batch at a time (columns decoded straight from the blocks) against the row-at-a-time one
+    Conjunction where = {Comparison("b", Comparison::LT, Value(5)), Comparison("a", Comparison::GE, Value(1000))};
+    auto start = chrono::steady_clock::now();
+    Handles *handles = table.select(where);
+    double row_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    ColumnNames batch_columns = {"a", "b"};
+    ColumnAttributes *batch_attributes = table.get_column_attributes(batch_columns);
+    ColumnBatch batch(batch_columns, *batch_attributes);
+    delete batch_attributes;
+    BlockIDs *block_ids = table.block_ids();
+    u_long selected = 0;
+    bool ok = true;
+    for (auto const &block_id: *block_ids) {
+        table.scan_block(block_id, batch);
+        if (batch.size() >= ColumnBatch::CAPACITY || block_id == block_ids->back()) {
+            batch.filter(where);
+            for (auto const &i: batch.get_selection()) {
+                ValueDict *got = batch.row(i, 1);
+                ok = ok && selected < handles->size() && (*got)["a"] == Value(1000 + (int) selected / 5 * 100 +
+                                                                              (int) selected % 5);
+                delete got;
+                selected++;
+            }
+            batch.clear();
+        }
+    }
+    double batch_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    delete block_ids;
+    cout << "scan with filter: " << (long) (n / row_seconds) << " rows/s a row at a time, "
+         << (long) (n / batch_seconds) << " rows/s a batch at a time" << endl;
+    ok = ok && selected == handles->size();
+    delete handles;
+    table.drop();
+    if (!ok)
+        cout << "batch scan failed" << endl;
+    return ok;
+}
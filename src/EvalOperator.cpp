@@ -0,0 +1,385 @@
+/**
+ * @file EvalOperator.cpp - implementation of the operators evaluation plans are compiled into
+ * @see "Seattle University, CPSC5300, Winter 24"
+ */
+#include <algorithm>
+#include "EvalOperator.h"
+#include "EvalPlan.h"
+
+
+/********************
+ * BufferedOperator *
+ ********************/
+
+ValueDict *BufferedOperator::next() {
+    while (this->position == this->buffer.size()) {
+        clear();
+        if (!fill())
+            return nullptr;
+    }
+    ValueDict *row = this->buffer[this->position];
+    this->buffer[this->position++] = nullptr;
+    return row;
+}
+
+// Free the rows not handed out yet.
+void BufferedOperator::clear() {
+    for (u_long i = this->position; i < this->buffer.size(); i++)
+        delete this->buffer[i];
+    this->buffer.clear();
+    this->position = 0;
+}
+
+// Fetch the rows for a batch of handles into buffer (and free the handles).
+static void fetch_rows(DbRelation &table, Handles *handles, ColumnNames &columns, ValueDicts &buffer) {
+    ValueDicts *rows;
+    try {
+        rows = table.project(handles, &columns);
+    } catch (DbRelationError &e) {
+        delete handles;
+        throw;
+    }
+    delete handles;
+    buffer.assign(rows->begin(), rows->end());
+    delete rows;
+}
+
+
+/*********************
+ * TableScanOperator *
+ *********************/
+
+TableScanOperator::TableScanOperator(DbRelation &table, const ColumnNames &columns, const Conjunction &where)
+        : BufferedOperator(), table(table), columns(columns), where(where), block_ids(nullptr), block_index(0) {
+}
+
+// Comparisons with values of the wrong type are reported even if no block gets read; and if the table can tell
+// that no row satisfies them, none are.
+void TableScanOperator::open() {
+    if (!this->where.empty()) {
+        Handles none;
+        delete this->table.select(&none, this->where);
+    }
+    delete this->block_ids;
+    this->block_ids = this->where.empty() || !this->table.ruled_out(this->where) ? this->table.block_ids()
+                                                                                 : new BlockIDs();
+    this->block_index = 0;
+}
+
+void TableScanOperator::close() {
+    BufferedOperator::close();
+    delete this->block_ids;
+    this->block_ids = nullptr;
+}
+
+// The next block's rows (that satisfy the where clause). Blocks with none are skipped.
+bool TableScanOperator::fill() {
+    while (this->block_index < this->block_ids->size()) {
+        Handles *handles = this->table.select_block((*this->block_ids)[this->block_index++]);
+        if (!this->where.empty()) {
+            Handles *selected = this->table.select(handles, this->where);
+            delete handles;
+            handles = selected;
+        }
+        if (!handles->empty()) {
+            fetch_rows(this->table, handles, this->columns, this->buffer);
+            return true;
+        }
+        delete handles;
+    }
+    return false;
+}
+
+
+/**********************
+ * VectorScanOperator *
+ **********************/
+
+VectorScanOperator::VectorScanOperator(DbRelation &table, const ColumnNames &columns, const Conjunction &where,
+                                       const Expression *filter)
+        : BufferedOperator(), table(table), output_columns(0), batch_columns(), batch_attributes(), where(where),
+          filter(nullptr), batch(nullptr), block_ids(nullptr), block_index(0) {
+    for (auto const &column_name: columns) {
+        if (std::find(this->batch_columns.begin(), this->batch_columns.end(), column_name) == this->batch_columns.end())
+            this->batch_columns.push_back(column_name);
+    }
+    this->output_columns = this->batch_columns.size();
+    for (auto const &comparison: where) {
+        if (std::find(this->batch_columns.begin(), this->batch_columns.end(), comparison.column_name) ==
+            this->batch_columns.end())
+            this->batch_columns.push_back(comparison.column_name);
+    }
+    if (filter != nullptr) {
+        filter->get_columns(this->batch_columns);
+        this->filter = filter->copy();
+        this->filter->bind(this->batch_columns);
+    }
+}
+
+VectorScanOperator::~VectorScanOperator() {
+    delete this->filter;
+    delete this->batch;
+    delete this->block_ids;
+}
+
+// Errors come in the same order as from a TableScanOperator: the comparisons' types, then the columns.
+void VectorScanOperator::open() {
+    if (!this->where.empty()) {
+        Handles none;
+        delete this->table.select(&none, this->where);
+    }
+    const ColumnNames &column_names = this->table.get_column_names();
+    for (auto const &column_name: this->batch_columns)
+        if (std::find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+    ColumnAttributes *attributes = this->table.get_column_attributes(this->batch_columns);
+    this->batch_attributes = *attributes;
+    delete attributes;
+    delete this->batch;
+    this->batch = new ColumnBatch(this->batch_columns, this->batch_attributes);
+    delete this->block_ids;
+    this->block_ids = this->where.empty() || !this->table.ruled_out(this->where) ? this->table.block_ids()
+                                                                                 : new BlockIDs();
+    this->block_index = 0;
+}
+
+void VectorScanOperator::close() {
+    BufferedOperator::close();
+    delete this->batch;
+    this->batch = nullptr;
+    delete this->block_ids;
+    this->block_ids = nullptr;
+}
+
+// Read blocks into the batch until it's full, then filter it (the expression only looks at the rows the comparisons
+// leave). Batches with no rows left are skipped.
+ColumnBatch *VectorScanOperator::next_batch() {
+    while (this->block_index < this->block_ids->size()) {
+        this->batch->clear();
+        while (this->block_index < this->block_ids->size() && this->batch->size() < ColumnBatch::CAPACITY)
+            this->table.scan_block((*this->block_ids)[this->block_index++], *this->batch);
+        this->batch->filter(this->where);
+        if (this->filter != nullptr)
+            this->batch->filter(*this->filter);
+        if (!this->batch->get_selection().empty())
+            return this->batch;
+    }
+    return nullptr;
+}
+
+bool VectorScanOperator::fill() {
+    ColumnBatch *rows = next_batch();
+    if (rows == nullptr)
+        return false;
+    for (auto const &i: rows->get_selection())
+        this->buffer.push_back(rows->row(i, this->output_columns));
+    return true;
+}
+
+
+/************************
+ * ParallelScanOperator *
+ ************************/
+
+ParallelScanOperator::ParallelScanOperator(DbRelation &table, const ColumnNames &columns, const Conjunction &where,
+                                           const Expression *filter, TaskScheduler &scheduler)
+        : VectorScanOperator(table, columns, where, filter), scheduler(scheduler) {
+}
+
+// Scan the next few morsels in parallel. Morsels with no rows left are skipped.
+bool ParallelScanOperator::fill() {
+    u_long blocks = this->block_ids->size();
+    if (blocks < MIN_BLOCKS)
+        return VectorScanOperator::fill();
+    while (this->block_index < blocks) {
+        u_long first = this->block_index;
+        u_long morsels = std::min((blocks - first + MORSEL_BLOCKS - 1) / MORSEL_BLOCKS,
+                                  this->scheduler.size() * MORSELS_PER_WORKER);
+        this->block_index = std::min(first + morsels * MORSEL_BLOCKS, blocks);
+        std::vector<std::unique_ptr<ColumnBatch>> batches(this->scheduler.size());  // each worker's
+        std::vector<ValueDicts> outputs(morsels);  // each morsel's
+        try {
+            this->scheduler.run(morsels, [&](u_long morsel, uint worker) {
+                if (!batches[worker])
+                    batches[worker].reset(new ColumnBatch(this->batch_columns, this->batch_attributes));
+                ColumnBatch &batch = *batches[worker];
+                batch.clear();
+                u_long begin = first + morsel * MORSEL_BLOCKS;
+                for (u_long i = begin; i < std::min(begin + MORSEL_BLOCKS, blocks); i++)
+                    this->table.scan_block((*this->block_ids)[i], batch);
+                batch.filter(this->where);
+                if (this->filter != nullptr)
+                    batch.filter(*this->filter);
+                for (auto const &i: batch.get_selection())
+                    outputs[morsel].push_back(batch.row(i, this->output_columns));
+            });
+        } catch (DbRelationError &e) {
+            for (auto const &output: outputs)
+                for (auto row: output)
+                    delete row;
+            throw;
+        }
+        for (auto const &output: outputs)
+            this->buffer.insert(this->buffer.end(), output.begin(), output.end());
+        if (!this->buffer.empty())
+            return true;
+    }
+    return false;
+}
+
+
+/*********************
+ * IndexScanOperator *
+ *********************/
+
+IndexScanOperator::IndexScanOperator(EvalPlan *scan, DbRelation &table, const ColumnNames &columns,
+                                     const Conjunction &where) : BufferedOperator(), scan(scan), table(table),
+                                                                 columns(columns), where(where), handles(nullptr),
+                                                                 handle_index(0) {
+}
+
+void IndexScanOperator::open() {
+    delete this->handles;
+    this->handles = this->scan->pipeline().second;
+    this->handle_index = 0;
+}
+
+void IndexScanOperator::close() {
+    BufferedOperator::close();
+    delete this->handles;
+    this->handles = nullptr;
+}
+
+// The rows for the next batch of handles (that satisfy the where clause).
+bool IndexScanOperator::fill() {
+    while (this->handle_index < this->handles->size()) {
+        u_long end = std::min(this->handle_index + BATCH_SIZE, (u_long) this->handles->size());
+        Handles batch(this->handles->begin() + this->handle_index, this->handles->begin() + end);
+        this->handle_index = end;
+        Handles *selected = this->where.empty() ? new Handles(batch) : this->table.select(&batch, this->where);
+        if (!selected->empty()) {
+            fetch_rows(this->table, selected, this->columns, this->buffer);
+            return true;
+        }
+        delete selected;
+    }
+    return false;
+}
+
+
+/***********************
+ * IndexValuesOperator *
+ ***********************/
+
+// The index gives all its rows at once.
+bool IndexValuesOperator::fill() {
+    if (this->done)
+        return false;
+    ValueDicts *rows = this->plan->index_values();
+    this->buffer.assign(rows->begin(), rows->end());
+    delete rows;
+    this->done = true;
+    return true;
+}
+
+
+/******************
+ * FilterOperator *
+ ******************/
+
+ValueDict *FilterOperator::next() {
+    for (ValueDict *row = this->input->next(); row != nullptr; row = this->input->next()) {
+        bool selected;
+        try {
+            selected = this->filter->test(*row);
+        } catch (DbRelationError &e) {
+            delete row;
+            throw;
+        }
+        if (selected)
+            return row;
+        delete row;
+    }
+    return nullptr;
+}
+
+
+/*******************
+ * ProjectOperator *
+ *******************/
+
+ProjectOperator::ProjectOperator(EvalOperator *input, const ColumnNames *projection) : EvalOperator(), input(input),
+                                                                                       projection(projection) {
+}
+
+ValueDict *ProjectOperator::next() {
+    ValueDict *row = this->input->next();
+    if (row == nullptr || this->projection == nullptr)
+        return row;
+    ValueDict *projected = new ValueDict();
+    for (auto const &column_name: *this->projection)
+        (*projected)[column_name] = (*row)[column_name];
+    delete row;
+    return projected;
+}
+
+
+/*******************
+ * ComputeOperator *
+ *******************/
+
+ValueDict *ComputeOperator::next() {
+    ValueDict *row = this->input->next();
+    if (row == nullptr)
+        return nullptr;
+    ValueDict *computed = new ValueDict();
+    try {
+        for (u_long i = 0; i < this->names->size(); i++)
+            (*computed)[(*this->names)[i]] = (*this->expressions)[i]->eval(*row);
+    } catch (DbRelationError &e) {
+        delete row;
+        delete computed;
+        throw;
+    }
+    delete row;
+    return computed;
+}
+
+
+/*****************
+ * LimitOperator *
+ *****************/
+
+void LimitOperator::open() {
+    this->given = 0;
+    this->input->open();
+}
+
+ValueDict *LimitOperator::next() {
+    for (; this->given < this->offset; this->given++) {
+        ValueDict *row = this->input->next();
+        if (row == nullptr)
+            return nullptr;
+        delete row;
+    }
+    if (this->given - this->offset >= this->limit)
+        return nullptr;
+    ValueDict *row = this->input->next();
+    if (row != nullptr)
+        this->given++;
+    return row;
+}
+
+
+/****************
+ * RowsOperator *
+ ****************/
+
+bool RowsOperator::fill() {
+    if (this->done)
+        return false;
+    for (auto row: this->rows)
+        this->buffer.push_back(new ValueDict(*row));
+    this->done = true;
+    return !this->buffer.empty();
+}
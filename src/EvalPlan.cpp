@@ -4,7 +4,10 @@
  * @see "Seattle University, CPSC5300, Winter 24"
  */
 
+#include <algorithm>
+#include <cmath>
 #include "EvalPlan.h"
+#include "HandleSet.h"
 
 
 class Dummy : public DbRelation {
@@ -43,81 +46,949 @@ public:
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) { return nullptr; }
 };
 
-EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
+        : type(type), relation(relation), other(nullptr), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
 }
 
-EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
-                                                                  projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
+        : type(Project), relation(relation), other(nullptr), projection(projection), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
 }
 
-EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+EvalPlan::EvalPlan(Conjunction *conjunction, EvalPlan *relation)
+        : type(Select), relation(relation), other(nullptr), projection(nullptr), select_conjunction(conjunction),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
 }
 
-EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+EvalPlan::EvalPlan(Expression *filter, EvalPlan *relation)
+        : type(Filter), relation(relation), other(nullptr), projection(nullptr), select_conjunction(nullptr),
+          filter(filter), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(ColumnNames *names, Expressions *expressions, EvalPlan *relation)
+        : type(Compute), relation(relation), other(nullptr), projection(names), select_conjunction(nullptr),
+          filter(nullptr), expressions(expressions), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *names, Expressions *expressions, Aggregates *aggregates, EvalPlan *relation)
+        : type(Aggregate), relation(relation), other(nullptr), projection(names), select_conjunction(nullptr),
+          filter(nullptr), expressions(expressions), aggregates(aggregates), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table)
+        : type(TableScan), relation(nullptr), other(nullptr), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(table), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, DbIndex &index, ValueDict *key)
+        : type(IndexLookup), relation(nullptr), other(nullptr), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(table), index(&index), index_key(key), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, DbIndex &index, ValueDict *min_key, ValueDict *max_key)
+        : type(IndexRange), relation(nullptr), other(nullptr), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(table), index(&index), index_key(nullptr), min_key(min_key), max_key(max_key),
+          index_only(false), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(PlanType type, EvalPlan *relation, EvalPlan *other)
+        : type(type), relation(relation), other(other), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(SortKeys *keys, EvalPlan *relation)
+        : type(Sort), relation(relation), other(nullptr), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(keys), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(u_long limit, u_long offset, EvalPlan *relation)
+        : type(Limit), relation(relation), other(nullptr), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(nullptr),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(limit), offset(offset) {
+}
+
+EvalPlan::EvalPlan(JoinKeys *keys, EvalPlan *relation, EvalPlan *other)
+        : type(Join), relation(relation), other(other), projection(nullptr), select_conjunction(nullptr),
+          filter(nullptr), expressions(nullptr), aggregates(nullptr), sort_keys(nullptr), join_keys(keys),
+          table(Dummy::one()), index(nullptr), index_key(nullptr), min_key(nullptr), max_key(nullptr),
+          index_only(false), limit(0), offset(0) {
+}
+
+// Copy of a ValueDict, or nullptr for none.
+static ValueDict *copy(const ValueDict *dict) {
+    return dict == nullptr ? nullptr : new ValueDict(*dict);
+}
+
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table), index(other->index),
+                                            index_only(other->index_only), limit(other->limit),
+                                            offset(other->offset) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
         relation = nullptr;
+    if (other->other != nullptr)
+        this->other = new EvalPlan(other->other);
+    else
+        this->other = nullptr;
     if (other->projection != nullptr)
         projection = new ColumnNames(*other->projection);
     else
         projection = nullptr;
     if (other->select_conjunction != nullptr)
-        select_conjunction = new ValueDict(*other->select_conjunction);
+        select_conjunction = new Conjunction(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    filter = other->filter != nullptr ? other->filter->copy() : nullptr;
+    if (other->expressions != nullptr) {
+        expressions = new Expressions();
+        for (auto const &expression: *other->expressions)
+            expressions->push_back(expression->copy());
+    } else {
+        expressions = nullptr;
+    }
+    if (other->aggregates != nullptr) {
+        aggregates = new Aggregates();
+        for (auto const &aggregate: *other->aggregates)
+            aggregates->push_back(::Aggregate(aggregate.function,
+                                              aggregate.argument != nullptr ? aggregate.argument->copy() : nullptr,
+                                              aggregate.name));
+    } else {
+        aggregates = nullptr;
+    }
+    sort_keys = other->sort_keys != nullptr ? new SortKeys(*other->sort_keys) : nullptr;
+    join_keys = other->join_keys != nullptr ? new JoinKeys(*other->join_keys) : nullptr;
+    index_key = copy(other->index_key);
+    min_key = copy(other->min_key);
+    max_key = copy(other->max_key);
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
+    delete other;
     delete projection;
     delete select_conjunction;
+    delete filter;
+    if (expressions != nullptr) {
+        for (auto expression: *expressions)
+            delete expression;
+        delete expressions;
+    }
+    if (aggregates != nullptr) {
+        for (auto const &aggregate: *aggregates)
+            delete aggregate.argument;
+        delete aggregates;
+    }
+    delete sort_keys;
+    delete join_keys;
+    delete index_key;
+    delete min_key;
+    delete max_key;
+}
+
+
+// So far the only things we know how to do better are to use an index for a Select right on a TableScan (or
+// indices for an OR in a Filter on one), to look up a Join's few rows on one side in an index on the other, to
+// merge a Join's sides when they come in key order, otherwise to build a Join's hash table on its smaller side, to
+// skip a Sort of rows already in order, and to do no more than a Limit needs of the Sort or index scan under it.
+EvalPlan *EvalPlan::optimize(Indices &indices) {
+    if (this->type == Select && this->relation->type == TableScan) {
+        EvalPlan *lookup = use_index(indices);
+        if (lookup != nullptr)
+            return lookup;
+    }
+    if (this->type == Filter) {
+        EvalPlan *union_scan = use_index_union(indices);
+        if (union_scan != nullptr)
+            return union_scan;
+    }
+    if (this->type == Join && !this->join_keys->empty()) {
+        EvalPlan *index_join = use_index_join(indices);
+        if (index_join != nullptr)
+            return index_join;
+    }
+    EvalPlan *ret = new EvalPlan(this);
+    if (ret->relation != nullptr) {
+        EvalPlan *relation = ret->relation->optimize(indices);
+        delete ret->relation;
+        ret->relation = relation;
+    }
+    if (ret->type == Join) {
+        EvalPlan *other = ret->other->optimize(indices);
+        delete ret->other;
+        ret->other = other;
+        if (!ret->join_keys->empty())
+            ret->use_merge_join();
+        // build the hash table on the smaller side
+        if (ret->type == Join && ret->other->estimate() > ret->relation->estimate()) {
+            std::swap(ret->relation, ret->other);
+            for (auto &pair: *ret->join_keys)
+                std::swap(pair.first, pair.second);
+        }
+    }
+    if (ret->type == ProjectAll || ret->type == Project)
+        ret->use_index_only();
+    if (ret->type == Sort && ret->relation->ordered_by(*ret->sort_keys)) {
+        EvalPlan *relation = ret->relation;
+        ret->relation = nullptr;
+        delete ret;
+        return relation;
+    }
+    if (ret->type == Limit)
+        ret->push_limit(indices);
+    return ret;
+}
+
+// Does the plan give a row for each of its relation's rows (in the same order)?
+static bool one_to_one(EvalPlan::PlanType type) {
+    return type == EvalPlan::Compute || type == EvalPlan::Project || type == EvalPlan::ProjectAll;
+}
+
+// Only this Limit's first offset + limit rows are wanted, so a Sort under it (past just Computes and projections)
+// need only keep that many, as a TopN, unless an index can give the rows in order instead (see scan_in_order). And
+// an index range scan under it (past just Computes and projections) need only get that many handles.
+void EvalPlan::push_limit(Indices &indices) {
+    if (this->limit == NO_LIMIT || this->offset > NO_LIMIT - this->limit)
+        return;
+    u_long wanted = this->limit + this->offset;
+    EvalPlan **link = &this->relation;
+    while (one_to_one((*link)->type))
+        link = &(*link)->relation;
+    if ((*link)->type == Sort) {
+        EvalPlan *sort = *link;
+        if (!sort->scan_in_order(indices)) {
+            sort->type = TopN;
+            sort->limit = wanted;
+            return;
+        }
+        *link = sort->relation;
+        sort->relation = nullptr;
+        delete sort;
+        while (one_to_one((*link)->type))
+            link = &(*link)->relation;
+    }
+    if ((*link)->type == IndexRange && wanted > 0)
+        (*link)->limit = wanted;
+}
+
+// If this Sort's rows come from a scan of a whole table (past just Computes and projections), and a BTree index on
+// the table is in the Sort's order, scan the index instead, so the Sort isn't needed. (That fetches the rows in
+// key order rather than block order, so it's only worth it for the first few of them, under a Limit.)
+bool EvalPlan::scan_in_order(Indices &indices) {
+    EvalPlan *scan = this->relation;
+    while (one_to_one(scan->type))
+        scan = scan->relation;
+    if (scan->type != TableScan)
+        return false;
+    Identifier table_name = scan->table.get_table_name();
+    for (auto const &index_name: indices.get_index_names(table_name)) {
+        DbIndex &index = indices.get_index(table_name, index_name);
+        if (!index.is_ordered())
+            continue;
+        scan->type = IndexRange;
+        scan->index = &index;
+        if (this->relation->ordered_by(*this->sort_keys))
+            return true;
+        scan->type = TableScan;
+        scan->index = nullptr;
+    }
+    return false;
+}
+
+// If the index scan under this projection (right under it, or under a Select and/or a Filter) has all the columns
+// the projection, the Select, and the Filter need, mark it to get them from the index instead of fetching the rows.
+void EvalPlan::use_index_only() {
+    EvalPlan *filter = this->relation->type == Filter ? this->relation : nullptr;
+    EvalPlan *below = filter != nullptr ? filter->relation : this->relation;
+    EvalPlan *select = below->type == Select ? below : nullptr;
+    EvalPlan *scan = select != nullptr ? select->relation : below;
+    if (scan->type != IndexLookup && scan->type != IndexRange)
+        return;
+    ColumnNames needed = this->type == Project ? *this->projection : scan->table.get_column_names();
+    if (filter != nullptr)
+        filter->filter->get_columns(needed);
+    ColumnNames compared;
+    if (select != nullptr)
+        for (auto const &comparison: *select->select_conjunction)
+            compared.push_back(comparison.column_name);
+    ColumnNames covered = scan->index->get_covered_columns();
+    for (auto const &column_name: compared)
+        needed.push_back(column_name);
+    for (auto const &column_name: needed)
+        if (std::find(covered.begin(), covered.end(), column_name) == covered.end())
+            return;
+
+    // leave comparisons with values of the wrong type to the row-at-a-time Select (it reports them)
+    ColumnAttributes *attributes = scan->table.get_column_attributes(compared);
+    for (uint i = 0; i < compared.size(); i++) {
+        if ((*select->select_conjunction)[i].value.data_type != (*attributes)[i].get_data_type()) {
+            delete attributes;
+            return;
+        }
+    }
+    delete attributes;
+    scan->index_only = true;
 }
 
+// Guesses (as in System R, for lack of statistics on the data) of the fraction of the rows satisfying comparisons
+static const double EQUALITY_SELECTIVITY = 0.1;
+static const double RANGE_SELECTIVITY = 1.0 / 3;  // one limit
+static const double BETWEEN_SELECTIVITY = 0.25;  // both limits
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+// Cost of getting a handle from an index, relative to fetching its row from the table
+static const double INDEX_ENTRY_COST = 0.05;
+
+// Is the comparison one an index can find the rows for: an equality (or, if ranged, a range limit) on column_name
+// with a value of the column's data type?
+static bool indexable(const Comparison &comparison, const Identifier &column_name, ColumnAttribute::DataType data_type,
+                      bool ranged) {
+    if (comparison.column_name != column_name || comparison.value.data_type != data_type)
+        return false;
+    if (ranged)
+        return comparison.op != Comparison::EQ && comparison.op != Comparison::NE;
+    return comparison.op == Comparison::EQ;
+}
+
+static bool indexable(const Conjunction &conjunction, const Identifier &column_name,
+                      ColumnAttribute::DataType data_type, bool ranged) {
+    for (auto const &comparison: conjunction)
+        if (indexable(comparison, column_name, data_type, ranged))
+            return true;
+    return false;
+}
+
+/**
+ * How an index could do part of a conjunction: equalities on its first few key columns, then (for a BTree)
+ * range limits on the next one.
+ */
+struct IndexChoice {
+    DbIndex *index = nullptr;
+    ColumnNames columns;  // the key columns with equalities, then the ranged one, if any
+    ColumnAttributes attributes;
+    bool ranged = false;
+    uint rank = 0;
+    double selectivity = 1.0;  // estimated fraction of the table's rows it finds (0 for just one)
+};
+
+// Find the index (of those not already used) that does the most of the conjunction. Whole unique keys are best,
+// then other whole keys (hash before BTree), then the longest prefix (a range on the column after it breaks ties).
+// Returns false if no index helps.
+static bool choose_index(Indices &indices, DbRelation &table, const Conjunction &conjunction,
+                         const std::vector<DbIndex *> &used, IndexChoice &best) {
+    Identifier table_name = table.get_table_name();
+    best = IndexChoice();
+    for (auto const &index_name: indices.get_index_names(table_name)) {
+        DbIndex *index = &indices.get_index(table_name, index_name);
+        if (std::find(used.begin(), used.end(), index) != used.end())
+            continue;
+        ColumnNames columns;
+        bool is_hash, is_unique;
+        indices.get_columns(table_name, index_name, columns, is_hash, is_unique);
+        ColumnAttributes *attributes = table.get_column_attributes(columns);
+        uint matched = 0;
+        while (matched < columns.size() &&
+               indexable(conjunction, columns[matched], (*attributes)[matched].get_data_type(), false))
+            matched++;
+        bool whole = matched == columns.size();
+        bool ranged = !is_hash && !whole &&
+                      indexable(conjunction, columns[matched], (*attributes)[matched].get_data_type(), true);
+        if ((matched == 0 && !ranged) || (is_hash && !whole)) {
+            delete attributes;
+            continue;
+        }
+        uint rank = (whole && is_unique ? 1000 : 0) + (whole ? 100 : 0) + 4 * matched + (ranged ? 2 : 0) +
+                    (is_hash ? 1 : 0);
+        if (rank > best.rank) {
+            uint used_columns = matched + (ranged ? 1 : 0);
+            best.index = index;
+            best.columns.assign(columns.begin(), columns.begin() + used_columns);
+            best.attributes.assign(attributes->begin(), attributes->begin() + used_columns);
+            best.ranged = ranged;
+            best.rank = rank;
+            best.selectivity = whole && is_unique ? 0.0 : pow(EQUALITY_SELECTIVITY, matched);
+            if (ranged) {
+                bool low = false, high = false;
+                for (auto const &comparison: conjunction) {
+                    if (indexable(comparison, columns[matched], (*attributes)[matched].get_data_type(), true)) {
+                        low = low || comparison.op == Comparison::GT || comparison.op == Comparison::GE;
+                        high = high || comparison.op == Comparison::LT || comparison.op == Comparison::LE;
+                    }
+                }
+                best.selectivity *= low && high ? BETWEEN_SELECTIVITY : RANGE_SELECTIVITY;
+            }
+        }
+        delete attributes;
+    }
+    return best.index != nullptr;
+}
+
+// An IndexLookup or IndexRange on the chosen index, taking the comparisons it does out of the conjunction.
+static EvalPlan *index_scan(DbRelation &table, const IndexChoice &choice, Conjunction &conjunction) {
+    // the equalities make up the key (or its prefix); the ranged column's tightest limits bound the scan
+    uint equalities = choice.columns.size() - (choice.ranged ? 1 : 0);
+    ValueDict *key = new ValueDict();
+    Conjunction rest;
+    const Value *low = nullptr, *high = nullptr;
+    for (auto const &comparison: conjunction) {
+        bool used = false;
+        for (uint i = 0; i < equalities && !used; i++) {
+            if (indexable(comparison, choice.columns[i], choice.attributes[i].get_data_type(), false) &&
+                key->find(choice.columns[i]) == key->end()) {
+                (*key)[choice.columns[i]] = comparison.value;
+                used = true;
+            }
+        }
+        if (!used && choice.ranged &&
+            indexable(comparison, choice.columns.back(), choice.attributes.back().get_data_type(), true)) {
+            const Value &value = comparison.value;
+            if (comparison.op == Comparison::GT || comparison.op == Comparison::GE) {
+                if (low == nullptr || *low < value)
+                    low = &value;
+            } else if (high == nullptr || value < *high) {
+                high = &value;
+            }
+            // the scan is inclusive, so only <= and >= are done with
+            used = comparison.op == Comparison::GE || comparison.op == Comparison::LE;
+        }
+        if (!used)
+            rest.push_back(comparison);
+    }
+
+    EvalPlan *scan;
+    if (!choice.ranged) {
+        scan = new EvalPlan(table, *choice.index, key);
+    } else {
+        ValueDict *min_key = nullptr, *max_key = nullptr;
+        if (low != nullptr || !key->empty()) {
+            min_key = new ValueDict(*key);
+            if (low != nullptr)
+                (*min_key)[choice.columns.back()] = *low;
+        }
+        if (high != nullptr || !key->empty()) {
+            max_key = new ValueDict(*key);
+            if (high != nullptr)
+                (*max_key)[choice.columns.back()] = *high;
+        }
+        delete key;
+        scan = new EvalPlan(table, *choice.index, min_key, max_key);
+    }
+    conjunction = rest;
+    return scan;
 }
 
+// Replace this Select's TableScan with scans of the table's indices, under a Select for the rest of the conjunction
+// (if there is any left). Returns nullptr if no index helps.
+// The best index (see choose_index) is used first. Then, while the rows found are estimated to be more than a few,
+// the handles from other indices on other columns are intersected with them, as long as reading those handles
+// costs less than fetching the rows they rule out. That way no rows are fetched until all the handles are in.
+EvalPlan *EvalPlan::use_index(Indices &indices) const {
+    DbRelation &scanned = this->relation->table;
+    Conjunction *residual = new Conjunction(*this->select_conjunction);
+    std::vector<DbIndex *> used;
+    IndexChoice choice;
+    if (!choose_index(indices, scanned, *residual, used, choice)) {
+        delete residual;
+        return nullptr;
+    }
+    EvalPlan *scan = index_scan(scanned, choice, *residual);
+    used.push_back(choice.index);
+    double selectivity = choice.selectivity;
+    ColumnNames done = choice.columns;
+
+    while (selectivity > 0.0) {
+        // another index is only any use for the columns not done yet
+        Conjunction others;
+        for (auto const &comparison: *residual)
+            if (std::find(done.begin(), done.end(), comparison.column_name) == done.end())
+                others.push_back(comparison);
+        if (!choose_index(indices, scanned, others, used, choice) ||
+            INDEX_ENTRY_COST * choice.selectivity >= selectivity * (1.0 - choice.selectivity))
+            break;
+        scan = new EvalPlan(IndexAnd, scan, index_scan(scanned, choice, *residual));
+        used.push_back(choice.index);
+        selectivity *= choice.selectivity;
+        done.insert(done.end(), choice.columns.begin(), choice.columns.end());
+    }
+
+    if (residual->empty()) {
+        delete residual;
+        return scan;
+    }
+    return new EvalPlan(residual, scan);
+}
+
+// Replace the TableScan under this Filter (or under the Select under it, if no index helps the Select) with the
+// union of index scans for one of the Filter's ORs, where an index can do some of each of the OR's operands. The
+// Filter (and the Select) stay on top to check the rows found. Of the ORs that can be done that way, the one
+// guessed to find the fewest rows is used, if that's fewer than all of them. Returns nullptr if none can.
+EvalPlan *EvalPlan::use_index_union(Indices &indices) const {
+    const EvalPlan *select = this->relation->type == Select ? this->relation : nullptr;
+    const EvalPlan *below = select != nullptr ? select->relation : this->relation;
+    if (below->type != TableScan)
+        return nullptr;
+    DbRelation &scanned = below->table;
+    IndexChoice choice;
+    if (select != nullptr && choose_index(indices, scanned, *select->select_conjunction, {}, choice))
+        return nullptr;
+
+    std::vector<const Expression *> conjuncts;
+    this->filter->get_conjuncts(conjuncts);
+    std::vector<Conjunction> best;
+    double best_selectivity = 1.0;
+    for (auto const &conjunct: conjuncts) {
+        std::vector<const Expression *> disjuncts;
+        conjunct->get_disjuncts(disjuncts);
+        if (disjuncts.size() < 2)
+            continue;
+        std::vector<Conjunction> comparisons(disjuncts.size());
+        double selectivity = 0.0;
+        for (uint i = 0; i < disjuncts.size() && selectivity < best_selectivity; i++) {
+            if (disjuncts[i]->get_comparisons(comparisons[i]) &&
+                choose_index(indices, scanned, comparisons[i], {}, choice))
+                selectivity += choice.selectivity;
+            else
+                selectivity = 1.0;
+        }
+        if (selectivity < best_selectivity) {
+            best = comparisons;
+            best_selectivity = selectivity;
+        }
+    }
+    if (best.empty())
+        return nullptr;
+
+    EvalPlan *scan = nullptr;
+    for (auto &comparisons: best) {
+        choose_index(indices, scanned, comparisons, {}, choice);
+        EvalPlan *disjunct_scan = index_scan(scanned, choice, comparisons);
+        scan = scan == nullptr ? disjunct_scan : new EvalPlan(IndexOr, scan, disjunct_scan);
+    }
+    if (select != nullptr)
+        scan = new EvalPlan(new Conjunction(*select->select_conjunction), scan);
+    return new EvalPlan(this->filter->copy(), scan);
+}
+
+// Rows in a block, on average (a guess, for lack of statistics), for how many lookups an IndexJoin would do
+static const double ROWS_PER_BLOCK = 40.0;
+
+// The column of the table scanned that a Compute on the scan's projection (under a Select and/or a Filter) has
+// under the given name, if the Compute just renames the columns (as for each input of a Join); otherwise nullptr.
+const Identifier *EvalPlan::renamed_column(const Identifier &name) const {
+    if (this->type != Compute || this->relation->type != Project)
+        return nullptr;
+    const EvalPlan *scan = this->relation->relation;
+    if (scan->type == Filter)
+        scan = scan->relation;
+    if (scan->type == Select)
+        scan = scan->relation;
+    if (scan->type != TableScan)
+        return nullptr;
+    auto it = std::find(this->projection->begin(), this->projection->end(), name);
+    if (it == this->projection->end())
+        return nullptr;
+    return (*this->expressions)[it - this->projection->begin()]->get_column();
+}
+
+// The index on the table to look up a join's keys in: the one with the most of its key columns among the keys'
+// (counting from its first), preferring one with all of them, and a unique one. A HashIndex must have all of them.
+static DbIndex *join_index(Indices &indices, DbRelation &table, const JoinKeys &keys) {
+    Identifier table_name = table.get_table_name();
+    DbIndex *best = nullptr;
+    uint best_rank = 0;
+    for (auto const &index_name: indices.get_index_names(table_name)) {
+        ColumnNames columns;
+        bool is_hash, is_unique;
+        indices.get_columns(table_name, index_name, columns, is_hash, is_unique);
+        uint matched = 0;
+        while (matched < columns.size() && std::find_if(keys.begin(), keys.end(), [&](const auto &key) {
+            return key.second == columns[matched];
+        }) != keys.end())
+            matched++;
+        bool whole = matched == columns.size();
+        if (matched == 0 || (is_hash && !whole))
+            continue;
+        uint rank = (whole && is_unique ? 1000 : 0) + (whole ? 100 : 0) + 4 * matched + (is_hash ? 1 : 0);
+        if (rank > best_rank) {
+            best = &indices.get_index(table_name, index_name);
+            best_rank = rank;
+        }
+    }
+    return best;
+}
+
+// If either side of the join is a scan of a table with an index on its key columns, and the other side is guessed
+// to have fewer rows than the table has blocks to build a hash table from, an IndexJoin looking up the other side's
+// rows in the index (it's about a block read for each of them). Otherwise nullptr.
+EvalPlan *EvalPlan::use_index_join(Indices &indices) const {
+    for (int side = 0; side < 2; side++) {
+        EvalPlan *outer = side == 0 ? this->relation : this->other;
+        EvalPlan *inner = side == 0 ? this->other : this->relation;
+        JoinKeys keys;
+        for (auto const &pair: *this->join_keys) {
+            const Identifier *column = inner->renamed_column(side == 0 ? pair.second : pair.first);
+            if (column == nullptr)
+                break;
+            keys.push_back(std::make_pair(side == 0 ? pair.first : pair.second, *column));
+        }
+        if (keys.size() < this->join_keys->size())
+            continue;
+        DbIndex *index = join_index(indices, inner->scanned_table(), keys);
+        if (index == nullptr)
+            continue;
+        EvalPlan *optimized = outer->optimize(indices);
+        if (optimized->estimate() * ROWS_PER_BLOCK >= inner->estimate()) {
+            delete optimized;
+            continue;
+        }
+        EvalPlan *ret = new EvalPlan(new JoinKeys(keys), optimized, new EvalPlan(inner));
+        ret->type = IndexJoin;
+        ret->index = index;
+        return ret;
+    }
+    return nullptr;
+}
+
+// Do the plan's rows come in the order of the sort keys (all ascending), because they come from a scan of a BTree
+// index in key order (or a Sort, or a MergeJoin, in that order) with just Selects, Filters, projections, and
+// Limits since?
+bool EvalPlan::ordered_by(const SortKeys &keys) const {
+    for (auto const &key: keys)
+        if (key.second)
+            return false;
+    switch (this->type) {
+        case Compute: {
+            SortKeys renamed;
+            for (auto const &key: keys) {
+                auto it = std::find(this->projection->begin(), this->projection->end(), key.first);
+                if (it == this->projection->end())
+                    return false;
+                const Identifier *column = (*this->expressions)[it - this->projection->begin()]->get_column();
+                if (column == nullptr)
+                    return false;
+                renamed.push_back(std::make_pair(*column, false));
+            }
+            return this->relation->ordered_by(renamed);
+        }
+        case Project:
+            for (auto const &key: keys)
+                if (std::find(this->projection->begin(), this->projection->end(), key.first) ==
+                    this->projection->end())
+                    return false;
+            return this->relation->ordered_by(keys);
+        case ProjectAll:
+        case Select:
+        case Filter:
+        case Limit:
+            return this->relation->ordered_by(keys);
+        case Sort:
+        case TopN:
+            return keys.size() <= this->sort_keys->size() &&
+                   std::equal(keys.begin(), keys.end(), this->sort_keys->begin());
+        case MergeJoin:
+            if (keys.size() > this->join_keys->size())
+                return false;
+            for (uint i = 0; i < keys.size(); i++)
+                if (keys[i].first != (*this->join_keys)[i].first && keys[i].first != (*this->join_keys)[i].second)
+                    return false;
+            return true;
+        case IndexLookup:
+        case IndexRange: {
+            if (!this->index->is_ordered())
+                return false;
+            // a lookup's key columns have just the one value, so the order doesn't depend on them
+            ColumnNames columns = this->index->get_key_columns();
+            uint i = 0;
+            for (auto const &key: keys) {
+                while (i < columns.size() && key.first != columns[i] && this->index_key != nullptr &&
+                       this->index_key->find(columns[i]) != this->index_key->end())
+                    i++;
+                if (i == columns.size() || key.first != columns[i])
+                    return false;
+                i++;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Make this Join a MergeJoin if both its sides already come in the order of their key columns, or if one does
+// and even the smaller one is too big for a hash table (so sorting the other is cheaper than partitioning both).
+void EvalPlan::use_merge_join() {
+    SortKeys left_keys, right_keys;
+    for (auto const &pair: *this->join_keys) {
+        left_keys.push_back(std::make_pair(pair.first, false));
+        right_keys.push_back(std::make_pair(pair.second, false));
+    }
+    bool left_sorted = this->relation->ordered_by(left_keys), right_sorted = this->other->ordered_by(right_keys);
+    double budget_blocks = (double) HashJoinOperator::memory_budget / DbBlock::BLOCK_SZ;
+    bool too_big = std::min(this->relation->estimate(), this->other->estimate()) > budget_blocks;
+    if (!(left_sorted && right_sorted) && !(too_big && (left_sorted || right_sorted)))
+        return;
+    if (!left_sorted)
+        this->relation = new EvalPlan(new SortKeys(left_keys), this->relation);
+    if (!right_sorted)
+        this->other = new EvalPlan(new SortKeys(right_keys), this->other);
+    this->type = MergeJoin;
+}
+
+bool EvalPlan::vectorized = true;
+bool EvalPlan::parallel = true;
+
+// Pull all the rows through the compiled operators.
 ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+    EvalOperator *top = compile();
+    ValueDicts *ret = new ValueDicts();
+    try {
+        top->open();
+        for (ValueDict *row = top->next(); row != nullptr; row = top->next())
+            ret->push_back(row);
+        top->close();
+    } catch (DbRelationError &e) {
+        for (auto row: *ret)
+            delete row;
+        delete ret;
+        delete top;
+        throw;
+    }
+    delete top;
+    return ret;
+}
+
+// The projection over a scan of the table (or of an index), which checks the Select's comparisons (if there's a
+// Select) as it reads. The scan gets just the projection's columns, unless it's an index-only one, which gets the
+// index's. A Filter is evaluated a batch at a time by a vectorized scan, or else on the scan's rows (which then
+// get the Filter's columns too, for the projection to drop). A Compute evaluates its expressions on the rows of
+// the projection (or Join) under it; a Join hash joins the rows of its two sides, a MergeJoin merges its two sorted
+// sides, a Sort sorts its relation's rows (a TopN keeps just the first few), an Aggregate groups them (on all the
+// cores, if scans are parallel), a Limit stops pulling them once it has enough, and a Filter on a Join or an
+// Aggregate checks its rows one at a time.
+EvalOperator *EvalPlan::compile() {
+    if (this->type == Compute)
+        return new ComputeOperator(this->relation->compile(), this->projection, this->expressions);
+    if (this->type == Aggregate)
+        return new AggregateOperator(this->relation->compile(), *this->projection, *this->expressions,
+                                     *this->aggregates, parallel && TaskScheduler::shared().size() > 1 ?
+                                                        &TaskScheduler::shared() : nullptr);
+    if (this->type == Sort)
+        return new SortOperator(this->relation->compile(), *this->sort_keys);
+    if (this->type == TopN)
+        return new TopNOperator(this->relation->compile(), *this->sort_keys, this->limit);
+    if (this->type == Limit)
+        return new LimitOperator(this->relation->compile(), this->limit, this->offset);
+    if (this->type == MergeJoin)
+        return new MergeJoinOperator(this->relation->compile(), this->other->compile(), *this->join_keys);
+    if (this->type == Join)
+        return new HashJoinOperator(this->relation->compile(), this->other->compile(), *this->join_keys);
+    if (this->type == IndexJoin) {
+        const EvalPlan *project = this->other->relation;
+        const EvalPlan *below = project->relation->type == Filter ? project->relation->relation : project->relation;
+        return new IndexJoinOperator(this->relation->compile(), below->scanned_table(), *this->index,
+                                     *this->join_keys, *project->projection, *this->other->projection,
+                                     below->type == Select ? *below->select_conjunction : Conjunction(),
+                                     project->relation->type == Filter ? project->relation->filter : nullptr);
+    }
+    if (this->type == Filter)
+        return new FilterOperator(this->relation->compile(), this->filter);
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
+    const Expression *filter = this->relation->type == Filter ? this->relation->filter : nullptr;
+    EvalPlan *below = filter != nullptr ? this->relation->relation : this->relation;
+    EvalPlan *scan = below->type == Select ? below->relation : below;
+    const ColumnNames *projection = this->type == Project ? this->projection : nullptr;
+    if (scan->index_only) {
+        EvalOperator *values = new IndexValuesOperator(below);
+        if (filter != nullptr)
+            values = new FilterOperator(values, filter);
+        return new ProjectOperator(values, projection);
+    }
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
-    return ret;
+    DbRelation &table = scan->scanned_table();
+    ColumnNames columns = projection != nullptr ? *projection : table.get_column_names();
+    Conjunction where = below->type == Select ? *below->select_conjunction : Conjunction();
+    if (scan->type == TableScan && vectorized && parallel && TaskScheduler::shared().size() > 1)
+        return new ProjectOperator(new ParallelScanOperator(table, columns, where, filter), nullptr);
+    if (scan->type == TableScan && vectorized)
+        return new ProjectOperator(new VectorScanOperator(table, columns, where, filter), nullptr);
+    if (filter != nullptr)
+        filter->get_columns(columns);
+    EvalOperator *rows;
+    if (scan->type == TableScan)
+        rows = new TableScanOperator(table, columns, where);
+    else
+        rows = new IndexScanOperator(scan, table, columns, where);
+    if (filter == nullptr)
+        return new ProjectOperator(rows, nullptr);
+    return new ProjectOperator(new FilterOperator(rows, filter), projection);
+}
+
+static double table_blocks(DbRelation &table) {
+    BlockIDs *block_ids = table.block_ids();
+    double blocks = (double) block_ids->size();
+    delete block_ids;
+    return blocks;
+}
+
+// Without statistics, just the table's blocks, cut down by the same guesses the index choice uses for comparisons
+// (and a range's guess for a Filter). A Join with keys is guessed to be about as big as its bigger side.
+double EvalPlan::estimate() const {
+    switch (this->type) {
+        case TableScan:
+            return table_blocks(this->table);
+        case IndexLookup:
+            return table_blocks(this->table) * EQUALITY_SELECTIVITY;
+        case IndexRange:
+            return table_blocks(this->table) * RANGE_SELECTIVITY;
+        case IndexAnd:
+            return std::min(this->relation->estimate(), this->other->estimate()) * EQUALITY_SELECTIVITY;
+        case IndexOr:
+            return std::min(this->relation->estimate() + this->other->estimate(), table_blocks(scanned_table()));
+        case Select: {
+            double selectivity = 1.0;
+            for (auto const &comparison: *this->select_conjunction)
+                selectivity *= comparison.op == Comparison::EQ ? EQUALITY_SELECTIVITY :
+                               comparison.op == Comparison::NE ? 1.0 : RANGE_SELECTIVITY;
+            return this->relation->estimate() * selectivity;
+        }
+        case Filter:
+            return this->relation->estimate() * RANGE_SELECTIVITY;
+        case Join:
+        case IndexJoin:
+        case MergeJoin:
+            if (this->join_keys->empty())
+                return this->relation->estimate() * this->other->estimate();
+            return std::max(this->relation->estimate(), this->other->estimate());
+        default:
+            return this->relation->estimate();
+    }
+}
+
+// The table a scan (or an intersection or union of index scans) is on.
+DbRelation &EvalPlan::scanned_table() const {
+    if (this->type == TableScan || this->type == IndexLookup || this->type == IndexRange)
+        return this->table;
+    return this->relation->scanned_table();
+}
+
+// The rows of an index_only scan (or a Select on one), with just the index's columns.
+ValueDicts *EvalPlan::index_values() {
+    if (this->type == IndexLookup) {
+        this->index->open();
+        return this->index->lookup_values(this->index_key);
+    }
+    if (this->type == IndexRange) {
+        this->index->open();
+        return this->index->range_values(this->min_key, this->max_key, this->limit);
+    }
+    if (this->type == Select) {
+        ValueDicts *rows = this->relation->index_values();
+        ValueDicts *ret = new ValueDicts();
+        for (auto const &row: *rows) {
+            bool selected = true;
+            for (auto const &comparison: *this->select_conjunction)
+                selected = selected && comparison.matches((*row)[comparison.column_name]);
+            if (selected)
+                ret->push_back(row);
+            else
+                delete row;
+        }
+        delete rows;
+        return ret;
+    }
+    throw DbRelationError("Not implemented: index-only evaluation other than Select or an index scan");
 }
 
 EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
+    if (this->type == IndexLookup) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->lookup(this->index_key));
+    }
+    if (this->type == IndexRange) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->range(this->min_key, this->max_key, this->limit));
+    }
+    if (this->type == IndexAnd) {
+        // intersect the handles before fetching any rows (they come out in block order)
+        EvalPipeline left = this->relation->pipeline();
+        EvalPipeline right = this->other->pipeline();
+        HandleSet handles = HandleSet(*left.second) & HandleSet(*right.second);
+        delete left.second;
+        delete right.second;
+        return EvalPipeline(left.first, handles.handles());
+    }
+    if (this->type == IndexOr) {
+        // likewise, each row found by both scans is fetched just once
+        EvalPipeline left = this->relation->pipeline();
+        EvalPipeline right = this->other->pipeline();
+        HandleSet handles = HandleSet(*left.second) | HandleSet(*right.second);
+        delete left.second;
+        delete right.second;
+        return EvalPipeline(left.first, handles.handles());
+    }
     if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return EvalPipeline(&this->relation->table, this->relation->table.select(*this->select_conjunction));
 
-    // recursive case
+    // recursive cases
+    if (this->type == Filter) {
+        EvalPipeline pipeline = this->relation->pipeline();
+        DbRelation *temp_table = pipeline.first;
+        Handles *handles = pipeline.second;
+        ColumnNames columns;
+        this->filter->get_columns(columns);
+        Handles *selected = new Handles();
+        ValueDict *row = nullptr;
+        try {
+            for (auto const &handle: *handles) {
+                row = temp_table->project(handle, &columns);
+                bool passed = this->filter->test(*row);
+                delete row;
+                row = nullptr;
+                if (passed)
+                    selected->push_back(handle);
+            }
+        } catch (DbRelationError &e) {
+            delete row;
+            delete handles;
+            delete selected;
+            throw;
+        }
+        delete handles;
+        return EvalPipeline(temp_table, selected);
+    }
     if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
         Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
+        EvalPipeline ret(temp_table, temp_table->select(handles, *this->select_conjunction));
         delete handles;
         return ret;
     }
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+    throw DbRelationError("Not implemented: pipeline other than Select, Filter, TableScan, or an index scan");
 }
\ No newline at end of file
@@ -0,0 +1,415 @@
+/**
+ * @file Expression.cpp - implementation of Expression classes, compiled expressions
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include "Expression.h"
+#include "EvalOperator.h"
+#include "HeapTable.h"
+
+using namespace std;
+
+/**************
+ * Expression *
+ **************/
+
+string_view Expression::eval_text(const ValueDict &row) const {
+    throw DbRelationError("not a TEXT expression");
+}
+
+Value Expression::eval(const ValueDict &row) const {
+    if (this->data_type == ColumnAttribute::TEXT)
+        return Value(string(eval_text(row)));
+    Value value(eval_int(row));
+    value.data_type = this->data_type;
+    return value;
+}
+
+// A BOOLEAN's values from the rows it selects.
+void Expression::eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const {
+    Selection selected(rows);
+    select(batch, selected);
+    u_long j = 0;
+    for (u_long k = 0; k < rows.size(); k++) {
+        out[k] = j < selected.size() && selected[j] == rows[k];
+        j += out[k];
+    }
+}
+
+string_view Expression::eval_text(const ColumnBatch &batch, u_long i) const {
+    throw DbRelationError("not a TEXT expression");
+}
+
+// The rows whose values aren't 0, kept without branching.
+void Expression::select(const ColumnBatch &batch, Selection &rows) const {
+    vector<int32_t> values(rows.size());
+    eval_ints(batch, rows, values.data());
+    u_long kept = 0;
+    for (u_long k = 0; k < rows.size(); k++) {
+        rows[kept] = rows[k];
+        kept += values[k] != 0;
+    }
+    rows.resize(kept);
+}
+
+
+/********************
+ * ColumnExpression *
+ ********************/
+
+Expression *ColumnExpression::copy() const {
+    ColumnExpression *ret = new ColumnExpression(this->column_name, this->data_type);
+    ret->slot = this->slot;
+    return ret;
+}
+
+void ColumnExpression::get_columns(ColumnNames &columns) const {
+    if (find(columns.begin(), columns.end(), this->column_name) == columns.end())
+        columns.push_back(this->column_name);
+}
+
+void ColumnExpression::bind(const ColumnNames &batch_columns) {
+    auto it = find(batch_columns.begin(), batch_columns.end(), this->column_name);
+    if (it == batch_columns.end())
+        throw DbRelationError("table does not have column named '" + this->column_name + "'");
+    this->slot = it - batch_columns.begin();
+}
+
+void ColumnExpression::eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const {
+    const ColumnVector &column = batch.column(this->slot);
+    for (u_long k = 0; k < rows.size(); k++)
+        out[k] = column.get_int(rows[k]);
+}
+
+string_view ColumnExpression::eval_text(const ColumnBatch &batch, u_long i) const {
+    return batch.column(this->slot).get_text(i);
+}
+
+
+/*********************
+ * LiteralExpression *
+ *********************/
+
+void LiteralExpression::eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const {
+    fill(out, out + rows.size(), this->value.n);
+}
+
+
+/********************
+ * BinaryExpression *
+ ********************/
+
+void BinaryExpression::get_columns(ColumnNames &columns) const {
+    this->left->get_columns(columns);
+    this->right->get_columns(columns);
+}
+
+void BinaryExpression::bind(const ColumnNames &batch_columns) {
+    this->left->bind(batch_columns);
+    this->right->bind(batch_columns);
+}
+
+
+/*********************
+ * CompareExpression *
+ *********************/
+
+Expression *CompareExpression::copy() const {
+    return new CompareExpression(this->op, this->left->copy(), this->right->copy());
+}
+
+bool CompareExpression::get_comparisons(Conjunction &conjunction) const {
+    const Identifier *column = this->left->get_column();
+    const Value *value = this->right->get_value();
+    if (column != nullptr && value != nullptr) {
+        conjunction.push_back(Comparison(*column, this->op, *value));
+        return true;
+    }
+    column = this->right->get_column();
+    value = this->left->get_value();
+    if (column != nullptr && value != nullptr) {
+        conjunction.push_back(Comparison(*column, Comparison::reversed(this->op), *value));
+        return true;
+    }
+    return false;
+}
+
+// Is a <op> b? (Works for the results of string_view::compare too, as a <op> 0.)
+static bool compare(Comparison::Op op, int32_t a, int32_t b) {
+    switch (op) {
+        case Comparison::EQ:
+            return a == b;
+        case Comparison::NE:
+            return a != b;
+        case Comparison::LT:
+            return a < b;
+        case Comparison::LE:
+            return a <= b;
+        case Comparison::GT:
+            return a > b;
+        case Comparison::GE:
+            return a >= b;
+    }
+    return false;
+}
+
+int32_t CompareExpression::eval_int(const ValueDict &row) const {
+    if (this->left->get_data_type() == ColumnAttribute::TEXT) {
+        int c = this->left->eval_text(row).compare(this->right->eval_text(row));
+        return compare(this->op, c, 0);
+    }
+    return compare(this->op, this->left->eval_int(row), this->right->eval_int(row));
+}
+
+// One pass for each kind of comparison, with no branches in the loop, so that it vectorizes.
+template<typename Compare>
+static void compare_ints(const int32_t *a, const int32_t *b, u_long n, int32_t *out, Compare compare) {
+    for (u_long k = 0; k < n; k++)
+        out[k] = compare(a[k], b[k]);
+}
+
+void CompareExpression::eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const {
+    u_long n = rows.size();
+    vector<int32_t> a(n), b(n);
+    if (this->left->get_data_type() == ColumnAttribute::TEXT) {
+        for (u_long k = 0; k < n; k++)
+            a[k] = this->left->eval_text(batch, rows[k]).compare(this->right->eval_text(batch, rows[k]));
+    } else {
+        this->left->eval_ints(batch, rows, a.data());
+        this->right->eval_ints(batch, rows, b.data());
+    }
+    switch (this->op) {
+        case Comparison::EQ:
+            return compare_ints(a.data(), b.data(), n, out, equal_to<int32_t>());
+        case Comparison::NE:
+            return compare_ints(a.data(), b.data(), n, out, not_equal_to<int32_t>());
+        case Comparison::LT:
+            return compare_ints(a.data(), b.data(), n, out, less<int32_t>());
+        case Comparison::LE:
+            return compare_ints(a.data(), b.data(), n, out, less_equal<int32_t>());
+        case Comparison::GT:
+            return compare_ints(a.data(), b.data(), n, out, greater<int32_t>());
+        case Comparison::GE:
+            return compare_ints(a.data(), b.data(), n, out, greater_equal<int32_t>());
+    }
+}
+
+
+/************************
+ * ArithmeticExpression *
+ ************************/
+
+Expression *ArithmeticExpression::copy() const {
+    return new ArithmeticExpression(this->op, this->left->copy(), this->right->copy());
+}
+
+// a <op> b, done unsigned so that overflow wraps around (and INT_MIN / -1 is INT_MIN, not a trap).
+static int32_t arithmetic(char op, int32_t a, int32_t b) {
+    u_int32_t ua = (u_int32_t) a, ub = (u_int32_t) b;
+    switch (op) {
+        case '+':
+            return (int32_t) (ua + ub);
+        case '-':
+            return (int32_t) (ua - ub);
+        case '*':
+            return (int32_t) (ua * ub);
+        case '/':
+            if (b == 0)
+                throw DbRelationError("division by zero");
+            return b == -1 ? (int32_t) (0U - ua) : a / b;
+        case '%':
+            if (b == 0)
+                throw DbRelationError("division by zero");
+            return b == -1 ? 0 : a % b;
+        default:
+            throw DbRelationError(string("unknown arithmetic operator ") + op);
+    }
+}
+
+int32_t ArithmeticExpression::eval_int(const ValueDict &row) const {
+    return arithmetic(this->op, this->left->eval_int(row), this->right->eval_int(row));
+}
+
+template<typename Operation>
+static void arithmetic_ints(int32_t *a, const int32_t *b, u_long n, Operation operation) {
+    for (u_long k = 0; k < n; k++)
+        a[k] = (int32_t) operation((u_int32_t) a[k], (u_int32_t) b[k]);
+}
+
+// Addition, subtraction, and multiplication vectorize; division checks each divisor.
+void ArithmeticExpression::eval_ints(const ColumnBatch &batch, const Selection &rows, int32_t *out) const {
+    u_long n = rows.size();
+    vector<int32_t> b(n);
+    this->left->eval_ints(batch, rows, out);
+    this->right->eval_ints(batch, rows, b.data());
+    switch (this->op) {
+        case '+':
+            return arithmetic_ints(out, b.data(), n, plus<u_int32_t>());
+        case '-':
+            return arithmetic_ints(out, b.data(), n, minus<u_int32_t>());
+        case '*':
+            return arithmetic_ints(out, b.data(), n, multiplies<u_int32_t>());
+        default:
+            for (u_long k = 0; k < n; k++)
+                out[k] = arithmetic(this->op, out[k], b[k]);
+    }
+}
+
+
+/**********************************************
+ * AndExpression, OrExpression, NotExpression *
+ **********************************************/
+
+void AndExpression::select(const ColumnBatch &batch, Selection &rows) const {
+    this->left->select(batch, rows);
+    if (!rows.empty())
+        this->right->select(batch, rows);
+}
+
+// The rows the left selects, and of the rest, the ones the right selects.
+void OrExpression::select(const ColumnBatch &batch, Selection &rows) const {
+    Selection selected(rows);
+    this->left->select(batch, selected);
+    Selection rest;
+    set_difference(rows.begin(), rows.end(), selected.begin(), selected.end(), back_inserter(rest));
+    if (!rest.empty())
+        this->right->select(batch, rest);
+    rows.clear();
+    merge(selected.begin(), selected.end(), rest.begin(), rest.end(), back_inserter(rows));
+}
+
+void NotExpression::select(const ColumnBatch &batch, Selection &rows) const {
+    Selection selected(rows);
+    this->operand->select(batch, selected);
+    Selection rest;
+    set_difference(rows.begin(), rows.end(), selected.begin(), selected.end(), back_inserter(rest));
+    rows.swap(rest);
+}
+
+
+// Scan the table with a filter, a row at a time and a batch at a time, checking both against check.
+static bool test_filter(DbRelation &table, const Expression &filter, const function<bool(int, int, string)> &check,
+                        const char *label) {
+    ColumnNames column_names = table.get_column_names();
+    ColumnNames projection = {"a"};
+    FilterOperator rows(new TableScanOperator(table, column_names, Conjunction()), &filter);
+    VectorScanOperator batches(table, projection, Conjunction(), &filter);
+    u_long expected = 0, got_rows = 0, got_batches = 0;
+    bool ok = true;
+
+    Handles *handles = table.select();
+    u_long table_rows = handles->size();
+    for (auto const &handle: *handles) {
+        ValueDict *row = table.project(handle);
+        expected += check((*row)["a"].n, (*row)["b"].n, (*row)["c"].s);
+        delete row;
+    }
+    delete handles;
+
+    auto start = chrono::steady_clock::now();
+    rows.open();
+    for (ValueDict *row = rows.next(); row != nullptr; row = rows.next()) {
+        ok = ok && check((*row)["a"].n, (*row)["b"].n, (*row)["c"].s);
+        got_rows++;
+        delete row;
+    }
+    rows.close();
+    double row_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    batches.open();
+    for (ValueDict *row = batches.next(); row != nullptr; row = batches.next()) {
+        got_batches++;
+        delete row;
+    }
+    batches.close();
+    double batch_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << label << " (" << expected << " of " << table_rows << " rows): " << (long) (table_rows / row_seconds)
+         << " rows/s a row at a time, " << (long) (table_rows / batch_seconds) << " rows/s a batch at a time" << endl;
+    ok = ok && got_rows == expected && got_batches == expected;
+    if (!ok)
+        cout << label << " filter got " << got_rows << " and " << got_batches << " rows, not " << expected << endl;
+    return ok;
+}
+
+bool test_expression() {
+    ColumnNames column_names = {"a", "b", "c"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable table("__test_expression", column_names, column_attributes);
+    table.create();
+    const int n = 50000;
+    ValueDict row;
+    for (int i = 0; i < n; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(i % 100);
+        row["c"] = Value("x" + to_string(i % 7));
+        table.insert(&row);
+    }
+    auto a = [] { return new ColumnExpression("a", ColumnAttribute::INT); };
+    auto b = [] { return new ColumnExpression("b", ColumnAttribute::INT); };
+    auto c = [] { return new ColumnExpression("c", ColumnAttribute::TEXT); };
+    auto literal = [](Value value) { return new LiteralExpression(value); };
+
+    // values, row at a time
+    ArithmeticExpression sum('+', a(), new ArithmeticExpression('*', b(), literal(Value(-3))));
+    ValueDict sample = {{"a", Value(10)}, {"b", Value(4)}, {"c", Value("x3")}};
+    bool ok = sum.eval(sample) == Value(-2);
+    Value lesser = CompareExpression(Comparison::LT, c(), literal(Value("x4"))).eval(sample);
+    ok = ok && lesser.data_type == ColumnAttribute::BOOLEAN && lesser.n == 1;
+    ok = ok && ArithmeticExpression('/', literal(Value(INT32_MIN)), literal(Value(-1))).eval(sample) ==
+               Value(INT32_MIN);
+    try {
+        ArithmeticExpression('%', a(), literal(Value(0))).eval(sample);
+        ok = false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    if (!ok) {
+        cout << "expression values wrong" << endl;
+        return false;
+    }
+
+    // an OR's operands as comparisons (for an index): b = 3 OR (5 >= a AND c = 'x1') OR a % 2 = 0
+    OrExpression either(
+            new OrExpression(new CompareExpression(Comparison::EQ, b(), literal(Value(3))),
+                             new AndExpression(new CompareExpression(Comparison::GE, literal(Value(5)), a()),
+                                               new CompareExpression(Comparison::EQ, c(), literal(Value("x1"))))),
+            new CompareExpression(Comparison::EQ, new ArithmeticExpression('%', a(), literal(Value(2))),
+                                  literal(Value(0))));
+    vector<const Expression *> disjuncts;
+    either.get_disjuncts(disjuncts);
+    Conjunction first, second, third;
+    ok = disjuncts.size() == 3 && disjuncts[0]->get_comparisons(first) && disjuncts[1]->get_comparisons(second) &&
+         !disjuncts[2]->get_comparisons(third);
+    ok = ok && first.size() == 1 && first[0].column_name == "b" && first[0].op == Comparison::EQ &&
+         first[0].value == Value(3);
+    ok = ok && second.size() == 2 && second[0].column_name == "a" && second[0].op == Comparison::LE &&
+         second[0].value == Value(5) && second[1].column_name == "c";
+    if (!ok) {
+        cout << "expression comparisons wrong" << endl;
+        return false;
+    }
+
+    // selective: a % 1000 = 7 OR (b < 3 AND NOT c = 'x5')
+    OrExpression selective(
+            new CompareExpression(Comparison::EQ, new ArithmeticExpression('%', a(), literal(Value(1000))),
+                                  literal(Value(7))),
+            new AndExpression(new CompareExpression(Comparison::LT, b(), literal(Value(3))),
+                              new NotExpression(new CompareExpression(Comparison::EQ, c(), literal(Value("x5"))))));
+    ok = test_filter(table, selective, [](int a, int b, string c) { return a % 1000 == 7 || (b < 3 && c != "x5"); },
+                     "selective expression");
+
+    // non-selective: a - b * 2 >= 100 OR c > 'x3'
+    OrExpression nonselective(
+            new CompareExpression(Comparison::GE, new ArithmeticExpression('-', a(), new ArithmeticExpression(
+                    '*', b(), literal(Value(2)))), literal(Value(100))),
+            new CompareExpression(Comparison::GT, c(), literal(Value("x3"))));
+    ok = ok && test_filter(table, nonselective, [](int a, int b, string c) { return a - b * 2 >= 100 || c > "x3"; },
+                           "non-selective expression");
+    table.drop();
+    return ok;
+}
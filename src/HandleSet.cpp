@@ -0,0 +1,286 @@
+/**
+ * @file HandleSet.cpp - implementation of HandleSet, a compressed set of row handles
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include "HandleSet.h"
+
+using namespace std;
+
+static const uint WORD_BITS = 64;
+
+/***********
+ * Records *
+ ***********/
+
+void HandleSet::Records::add(RecordID record_id) {
+    if (is_bitmap()) {
+        if (!contains(record_id)) {
+            set_bit(record_id);
+            this->count++;
+        }
+        return;
+    }
+    // handles mostly come in order, so they can usually just go on the end
+    auto at = this->array.empty() || this->array.back() < record_id ? this->array.end()
+                                                                       : lower_bound(this->array.begin(),
+                                                                                     this->array.end(), record_id);
+    if (at != this->array.end() && *at == record_id)
+        return;
+    this->array.insert(at, record_id);
+    this->count++;
+    compact();
+}
+
+bool HandleSet::Records::contains(RecordID record_id) const {
+    if (is_bitmap()) {
+        u_long word = record_id / WORD_BITS;
+        return word < this->bitmap.size() && (this->bitmap[word] >> (record_id % WORD_BITS) & 1) != 0;
+    }
+    return binary_search(this->array.begin(), this->array.end(), record_id);
+}
+
+void HandleSet::Records::set_bit(RecordID record_id) {
+    u_long word = record_id / WORD_BITS;
+    if (word >= this->bitmap.size())
+        this->bitmap.resize(word + 1, 0);
+    this->bitmap[word] |= (u_int64_t) 1 << (record_id % WORD_BITS);
+}
+
+// Add the handles for these records of block_id, in record order.
+void HandleSet::Records::append_to(BlockID block_id, Handles &handles) const {
+    if (!is_bitmap()) {
+        for (auto const &record_id: this->array)
+            handles.push_back(Handle(block_id, record_id));
+        return;
+    }
+    for (u_long word = 0; word < this->bitmap.size(); word++) {
+        u_int64_t bits = this->bitmap[word];
+        while (bits != 0) {
+            uint bit = __builtin_ctzll(bits);
+            handles.push_back(Handle(block_id, (RecordID) (word * WORD_BITS + bit)));
+            bits &= bits - 1;
+        }
+    }
+}
+
+u_long HandleSet::Records::byte_size() const {
+    return is_bitmap() ? this->bitmap.size() * sizeof(u_int64_t) : this->array.size() * sizeof(RecordID);
+}
+
+// Switch to whichever of the array or the bitmap is smaller.
+void HandleSet::Records::compact() {
+    if (this->count == 0) {
+        this->array.clear();
+        this->bitmap.clear();
+        return;
+    }
+    if (is_bitmap()) {
+        while (this->bitmap.back() == 0)
+            this->bitmap.pop_back();
+        if (this->count * sizeof(RecordID) < this->bitmap.size() * sizeof(u_int64_t)) {
+            Handles handles;
+            append_to(0, handles);
+            this->bitmap.clear();
+            for (auto const &handle: handles)
+                this->array.push_back(handle.second);
+        }
+    } else {
+        u_long words = this->array.back() / WORD_BITS + 1;
+        if (words * sizeof(u_int64_t) < this->count * sizeof(RecordID)) {
+            for (auto const &record_id: this->array)
+                set_bit(record_id);
+            this->array.clear();
+            this->array.shrink_to_fit();
+        }
+    }
+}
+
+HandleSet::Records HandleSet::Records::intersection(const Records &a, const Records &b) {
+    Records ret;
+    if (a.is_bitmap() && b.is_bitmap()) {
+        ret.bitmap.resize(min(a.bitmap.size(), b.bitmap.size()));
+        for (u_long word = 0; word < ret.bitmap.size(); word++) {
+            ret.bitmap[word] = a.bitmap[word] & b.bitmap[word];
+            ret.count += __builtin_popcountll(ret.bitmap[word]);
+        }
+    } else if (!a.is_bitmap() && !b.is_bitmap()) {
+        set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(ret.array));
+        ret.count = ret.array.size();
+    } else {
+        const Records &sparse = a.is_bitmap() ? b : a;
+        const Records &dense = a.is_bitmap() ? a : b;
+        for (auto const &record_id: sparse.array)
+            if (dense.contains(record_id))
+                ret.array.push_back(record_id);
+        ret.count = ret.array.size();
+    }
+    ret.compact();
+    return ret;
+}
+
+HandleSet::Records HandleSet::Records::join(const Records &a, const Records &b) {
+    Records ret;
+    if (!a.is_bitmap() && !b.is_bitmap()) {
+        set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(ret.array));
+        ret.count = ret.array.size();
+    } else {
+        // start from the (larger) bitmap and add the other's bits to it
+        const Records &dense = a.is_bitmap() && (!b.is_bitmap() || a.bitmap.size() >= b.bitmap.size()) ? a : b;
+        const Records &other = &dense == &a ? b : a;
+        ret.bitmap = dense.bitmap;
+        if (other.is_bitmap()) {
+            for (u_long word = 0; word < other.bitmap.size(); word++)
+                ret.bitmap[word] |= other.bitmap[word];
+        } else {
+            for (auto const &record_id: other.array)
+                ret.set_bit(record_id);
+        }
+        for (auto const &word: ret.bitmap)
+            ret.count += __builtin_popcountll(word);
+    }
+    ret.compact();
+    return ret;
+}
+
+
+/*************
+ * HandleSet *
+ *************/
+
+HandleSet::HandleSet(const Handles &handles) : blocks(), count(0) {
+    for (auto const &handle: handles)
+        add(handle);
+}
+
+void HandleSet::add(Handle handle) {
+    Records &records = this->blocks[handle.first];
+    u_long before = records.size();
+    records.add(handle.second);
+    this->count += records.size() - before;
+}
+
+bool HandleSet::contains(Handle handle) const {
+    auto records = this->blocks.find(handle.first);
+    return records != this->blocks.end() && records->second.contains(handle.second);
+}
+
+// Only the blocks in both sets can have handles in the intersection.
+HandleSet HandleSet::operator&(const HandleSet &other) const {
+    HandleSet ret;
+    auto a = this->blocks.begin();
+    auto b = other.blocks.begin();
+    while (a != this->blocks.end() && b != other.blocks.end()) {
+        if (a->first < b->first) {
+            a++;
+        } else if (b->first < a->first) {
+            b++;
+        } else {
+            Records records = Records::intersection(a->second, b->second);
+            if (records.size() > 0) {
+                ret.count += records.size();
+                ret.blocks.emplace_hint(ret.blocks.end(), a->first, records);
+            }
+            a++;
+            b++;
+        }
+    }
+    return ret;
+}
+
+HandleSet HandleSet::operator|(const HandleSet &other) const {
+    HandleSet ret(*this);
+    for (auto const &block: other.blocks) {
+        auto records = ret.blocks.find(block.first);
+        if (records == ret.blocks.end()) {
+            ret.blocks.insert(block);
+            ret.count += block.second.size();
+        } else {
+            ret.count -= records->second.size();
+            records->second = Records::join(records->second, block.second);
+            ret.count += records->second.size();
+        }
+    }
+    return ret;
+}
+
+Handles *HandleSet::handles() const {
+    Handles *handles = new Handles();
+    handles->reserve(this->count);
+    for (auto const &block: this->blocks)
+        block.second.append_to(block.first, *handles);
+    return handles;
+}
+
+u_long HandleSet::byte_size() const {
+    u_long size = 0;
+    for (auto const &block: this->blocks)
+        size += sizeof(BlockID) + block.second.byte_size();
+    return size;
+}
+
+
+// Check a HandleSet's handles against what they should be.
+static bool test_handles(const HandleSet &handle_set, const set<Handle> &expected, const char *what) {
+    Handles *handles = handle_set.handles();
+    bool ok = handle_set.size() == expected.size() && equal(handles->begin(), handles->end(), expected.begin(),
+                                                            expected.end());
+    delete handles;
+    if (!ok)
+        cout << what << " failed" << endl;
+    return ok;
+}
+
+bool test_handle_set() {
+    // a: every third record of blocks 1-99, and all of block 50 (which should become a bitmap)
+    // b: every other record of blocks 40-139
+    HandleSet a, b;
+    set<Handle> a_expected, b_expected;
+    for (BlockID block_id = 1; block_id < 100; block_id++) {
+        for (RecordID record_id = 1; record_id <= 200; record_id++) {
+            if (record_id % 3 == 0 || block_id == 50) {
+                a.add(Handle(block_id, record_id));
+                a_expected.insert(Handle(block_id, record_id));
+            }
+        }
+    }
+    for (BlockID block_id = 139; block_id >= 40; block_id--) {
+        for (RecordID record_id = 200; record_id >= 1; record_id--) {
+            if (record_id % 2 == 0) {
+                b.add(Handle(block_id, record_id));
+                b_expected.insert(Handle(block_id, record_id));
+            }
+        }
+    }
+    b.add(Handle(40, 2));  // already there
+    if (!test_handles(a, a_expected, "add") || !test_handles(b, b_expected, "unordered add"))
+        return false;
+    if (!a.contains(Handle(50, 7)) || a.contains(Handle(51, 7)) || a.contains(Handle(200, 3)))
+        return false;
+
+    set<Handle> expected;
+    set_intersection(a_expected.begin(), a_expected.end(), b_expected.begin(), b_expected.end(),
+                     inserter(expected, expected.end()));
+    if (!test_handles(a & b, expected, "intersection") || !test_handles(b & a, expected, "intersection"))
+        return false;
+    expected.clear();
+    set_union(a_expected.begin(), a_expected.end(), b_expected.begin(), b_expected.end(),
+              inserter(expected, expected.end()));
+    if (!test_handles(a | b, expected, "union") || !test_handles(b | a, expected, "union"))
+        return false;
+    if (!(a & HandleSet()).empty() || (a | HandleSet()).size() != a.size())
+        return false;
+
+    // a full block takes a bitmap, smaller than the array it would otherwise be
+    HandleSet full;
+    for (RecordID record_id = 1; record_id <= 200; record_id++)
+        full.add(Handle(7, record_id));
+    if (full.byte_size() >= sizeof(BlockID) + 200 * sizeof(RecordID)) {
+        cout << "bitmap compression failed: " << full.byte_size() << " bytes" << endl;
+        return false;
+    }
+    cout << "handle set: " << a.size() << " handles in " << a.byte_size() << " bytes" << endl;
+    return true;
+}
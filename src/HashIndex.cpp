@@ -0,0 +1,414 @@
+/**
+ * @file HashIndex.cpp - implementation of HashIndex, the extendible hashing index, and its HashBucket blocks
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <set>
+#include "HashIndex.h"
+
+using namespace std;
+
+/**************
+ * HashBucket *
+ **************/
+
+HashBucket::HashBucket(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(
+        file, block_id, key_profile, create), local_depth(0), key_map() {
+    if (!create) {
+        RecordIDs *record_id_list = this->block->ids();
+        RecordID last = (RecordID) record_id_list->size();
+        delete record_id_list;
+        if (last > 0) {
+            // record 1: local depth, then record i: posting, record i+1: key
+            this->local_depth = get_block_id(1);
+            for (RecordID i = 2; i < last; i += 2)
+                this->key_map.emplace_hint(this->key_map.end(), get_key(i + 1), get_posting(i));
+        }
+    }
+}
+
+// FNV-1a over the key bytes, then mixed (as in MurmurHash3's finalizer) so the low bits depend on all of them.
+u_int32_t HashBucket::hash(const NormalizedKey &key) {
+    u_int32_t h = 2166136261U;
+    for (unsigned char c: key) {
+        h ^= c;
+        h *= 16777619U;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+// Find the handles for a given key
+Handles *HashBucket::find_eq(const NormalizedKey &key) const {
+    auto entry = this->key_map.find(key);
+    if (entry == this->key_map.end())
+        return new Handles();
+    return entry->second.get_handles(this->file);
+}
+
+// Add key, handle pair to the bucket.
+void HashBucket::insert(const NormalizedKey &key, Handle handle, bool unique) {
+    auto entry = this->key_map.find(key);
+    if (entry != this->key_map.end()) {
+        if (unique)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        entry->second.add(this->file, handle);
+    } else {
+        this->key_map[key] = BTreePosting(handle);
+    }
+}
+
+// Remove key, handle pair from the bucket, and the key too if that was its last handle.
+// (Buckets are never merged back together.)
+bool HashBucket::remove(const NormalizedKey &key, Handle handle) {
+    auto entry = this->key_map.find(key);
+    if (entry == this->key_map.end() || !entry->second.remove(this->file, handle))
+        return false;
+    if (entry->second.size() == 0)
+        this->key_map.erase(entry);
+    save();
+    return true;
+}
+
+// Split on the next bit of the keys' hashes: the ones with it set go to the new bucket.
+HashBucket *HashBucket::split() {
+    HashBucket *sister = new HashBucket(this->file, 0, this->key_profile, true);
+    u_int32_t bit = 1U << this->local_depth;
+    for (auto entry = this->key_map.begin(); entry != this->key_map.end();) {
+        if (hash(entry->first) & bit) {
+            sister->key_map.insert(*entry);
+            entry = this->key_map.erase(entry);
+        } else {
+            entry++;
+        }
+    }
+    this->local_depth++;
+    sister->local_depth = this->local_depth;
+    return sister;
+}
+
+// Bytes needed to save this bucket.
+u_long HashBucket::byte_size() const {
+    u_long size = SLOT_OVERHEAD + sizeof(BlockID);  // local depth
+    for (auto const &item: this->key_map)
+        size += BTreeLeaf::entry_size(item.first, item.second);
+    return size;
+}
+
+// Save the local depth and then the postings and keys.
+void HashBucket::save() {
+    this->block->clear();
+    Dbt *dbt = marshal_block_id(this->local_depth);  // not really a block ID but it fits
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    for (auto const &item: this->key_map) {
+        dbt = item.second.marshal();
+        this->block->add(dbt);
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+
+        dbt = marshal_key(item.first);
+        this->block->add(dbt);
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+    }
+    BTreeNode::save();
+}
+
+
+/*************
+ * HashIndex *
+ *************/
+
+HashIndex::HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
+                                                                                                            name,
+                                                                                                            key_columns,
+                                                                                                            unique),
+                                                                                                    closed(true),
+                                                                                                    file(relation.get_table_name() +
+                                                                                                         "-" + name),
+                                                                                                    key_profile(),
+                                                                                                    global_depth(0),
+                                                                                                    directory(),
+                                                                                                    directory_blocks() {
+    build_key_profile();
+}
+
+// Create the index: one empty bucket, then add each of the existing rows.
+void HashIndex::create() {
+    file.create();
+    closed = false;
+    global_depth = 0;
+    HashBucket bucket(file, 0, key_profile, true);
+    bucket.save();
+    directory = {bucket.get_id()};
+    directory_blocks.clear();
+    save_directory();
+
+    Handles *table_rows = relation.select();
+    for (auto const &row: *table_rows) {
+        ValueDict *key_dict = relation.project(row, &key_columns);
+        NormalizedKey key = nkey(key_dict);
+        delete key_dict;
+        _insert(key, row);
+    }
+    delete table_rows;
+}
+
+// Drop the index.
+void HashIndex::drop() {
+    file.drop();
+    directory.clear();
+    directory_blocks.clear();
+    closed = true;
+}
+
+// Open existing index. Enables: lookup, insert, delete.
+void HashIndex::open() {
+    if (closed) {
+        file.open();
+        load_directory();
+        closed = false;
+    }
+}
+
+// Closes the index. Disables: lookup, insert, delete.
+void HashIndex::close() {
+    if (!closed) {
+        file.close();
+        directory.clear();
+        directory_blocks.clear();
+        closed = true;
+    }
+}
+
+// Read the global depth and the directory.
+void HashIndex::load_directory() {
+    SlottedPage *stat = file.get(STAT);
+    Dbt *dbt = stat->get(1);
+    global_depth = *(u_int32_t *) dbt->get_data();
+    delete dbt;
+    dbt = stat->get(2);
+    BlockID *block_ids = (BlockID *) dbt->get_data();
+    directory_blocks.assign(block_ids, block_ids + dbt->get_size() / sizeof(BlockID));
+    delete dbt;
+    delete stat;
+
+    directory.clear();
+    for (auto block_id: directory_blocks) {
+        SlottedPage *page = file.get(block_id);
+        dbt = page->get(1);
+        BlockID *entries = (BlockID *) dbt->get_data();
+        directory.insert(directory.end(), entries, entries + dbt->get_size() / sizeof(BlockID));
+        delete dbt;
+        delete page;
+    }
+}
+
+// Write out the global depth and the directory, adding directory blocks if it has grown.
+void HashIndex::save_directory() {
+    SlottedPage *page;
+    while (directory_blocks.size() * DIRECTORY_ENTRIES < directory.size()) {
+        page = file.get_new();
+        directory_blocks.push_back(page->get_block_id());
+        delete page;
+    }
+    for (u_long i = 0; i < directory_blocks.size(); i++) {
+        u_long begin = i * DIRECTORY_ENTRIES, end = min(begin + DIRECTORY_ENTRIES, (u_long) directory.size());
+        page = file.get(directory_blocks[i]);
+        page->clear();
+        Dbt dbt(&directory[begin], (u_int32_t) ((end - begin) * sizeof(BlockID)));
+        page->add(&dbt);
+        file.put(page);
+        delete page;
+    }
+
+    page = file.get(STAT);
+    page->clear();
+    u_int32_t depth = global_depth;
+    Dbt dbt(&depth, sizeof(depth));
+    page->add(&dbt);
+    Dbt blocks(directory_blocks.data(), (u_int32_t) (directory_blocks.size() * sizeof(BlockID)));
+    page->add(&blocks);
+    file.put(page);
+    delete page;
+}
+
+// Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
+// names in the index. Returns a list of row handles.
+Handles *HashIndex::lookup(ValueDict *key_dict) const {
+    NormalizedKey key = nkey(key_dict);
+    u_int32_t mask = (1U << global_depth) - 1;
+    HashBucket bucket(file, directory[HashBucket::hash(key) & mask], key_profile, false);
+    return bucket.find_eq(key);
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void HashIndex::insert(Handle handle) {
+    open();
+    ValueDict *key_dict = relation.project(handle, &key_columns);
+    NormalizedKey key = nkey(key_dict);
+    delete key_dict;
+    _insert(key, handle);
+}
+
+// Put the key into its bucket, splitting the bucket (and doubling the directory) until it fits.
+void HashIndex::_insert(const NormalizedKey &key, Handle handle) {
+    u_int32_t hash = HashBucket::hash(key);
+    HashBucket *bucket = new HashBucket(file, directory[hash & ((1U << global_depth) - 1)], key_profile, false);
+    try {
+        bucket->insert(key, handle, unique);
+    } catch (DbRelationError &e) {
+        delete bucket;
+        throw;
+    }
+
+    bool directory_changed = false;
+    while (!bucket->fits()) {
+        uint depth = bucket->get_local_depth();
+        if (depth == global_depth) {
+            if (global_depth == MAX_GLOBAL_DEPTH) {
+                delete bucket;
+                throw DbRelationError("hash index bucket cannot be split any further");
+            }
+            // double the directory: the new upper half points to the same buckets as the lower half
+            directory.insert(directory.end(), directory.begin(), directory.end());
+            global_depth++;
+        }
+
+        // the entries for the old bucket whose next bit is set now go to the new one
+        HashBucket *sister = bucket->split();
+        u_int32_t low = hash & ((1U << depth) - 1);
+        for (u_long i = low | (1U << depth); i < directory.size(); i += 2UL << depth)
+            directory[i] = sister->get_id();
+        directory_changed = true;
+
+        // the half the new key isn't in was all there before, so it fits; the other might still be too full
+        if (hash & (1U << depth))
+            swap(bucket, sister);
+        sister->save();
+        delete sister;
+    }
+    bucket->save();
+    delete bucket;
+    if (directory_changed)
+        save_directory();
+}
+
+// Delete the index entry for a row. Row must still be in relation.
+void HashIndex::del(Handle handle) {
+    open();
+    ValueDict *key_dict = relation.project(handle, &key_columns);
+    NormalizedKey key = nkey(key_dict);
+    delete key_dict;
+    HashBucket bucket(file, directory[HashBucket::hash(key) & ((1U << global_depth) - 1)], key_profile, false);
+    bucket.remove(key, handle);
+}
+
+// Number of different buckets in the directory.
+u_long HashIndex::bucket_count() const {
+    return set<BlockID>(directory.begin(), directory.end()).size();
+}
+
+// Pull out the key values from the ValueDict in index column order and normalize them.
+NormalizedKey HashIndex::nkey(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns)
+        key_value.push_back(key->find(column_name)->second);
+    return BTreeNode::normalize(key_value, key_profile);
+}
+
+// Figure out the data types of each key component and encode them in key_profile.
+void HashIndex::build_key_profile() {
+    map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// Check that lookup of key in index finds exactly expected rows.
+static bool test_hash_lookup(HashIndex &index, const Identifier &column, const Value &key, u_long expected) {
+    ValueDict lookup;
+    lookup[column] = key;
+    Handles *handles = index.lookup(&lookup);
+    bool ok = handles->size() == expected;
+    delete handles;
+    if (!ok)
+        cout << "hash lookup of " << key << " failed" << endl;
+    return ok;
+}
+
+// Session tokens (unique) and user ids (not unique), built from existing rows, added to, and reopened.
+bool test_hash_index() {
+    ColumnNames column_names = {"token", "user_id"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_hash", column_names, column_attributes);
+    table.create();
+    const int n = 20000;
+    ValueDict row;
+    for (int i = 0; i < n; i++) {
+        row["token"] = Value("session-" + to_string(i * 7919L % 1000003));
+        row["user_id"] = Value(i % 100);
+        table.insert(&row);
+    }
+
+    HashIndex tokens(table, "tokenhash", ColumnNames{"token"}, true);
+    tokens.create();
+    HashIndex users(table, "userhash", ColumnNames{"user_id"}, false);
+    users.create();
+    cout << "hash index on " << n << " tokens: global depth " << tokens.get_global_depth() << ", buckets "
+         << tokens.bucket_count() << endl;
+
+    for (int i = 0; i < n; i += 7)
+        if (!test_hash_lookup(tokens, "token", Value("session-" + to_string(i * 7919L % 1000003)), 1))
+            return false;
+    if (!test_hash_lookup(tokens, "token", Value("session-none"), 0) ||
+        !test_hash_lookup(users, "user_id", Value(42), n / 100) ||
+        !test_hash_lookup(users, "user_id", Value(100), 0))
+        return false;
+
+    // add more, including to a key that overflows its bucket
+    for (int i = n; i < n + 5000; i++) {
+        row["token"] = Value("session-" + to_string(i * 7919L % 1000003));
+        row["user_id"] = Value(i % 2 == 0 ? 42 : 100 + i);
+        Handle handle = table.insert(&row);
+        tokens.insert(handle);
+        users.insert(handle);
+    }
+    try {
+        row["token"] = Value("session-0");
+        tokens.insert(table.insert(&row));
+        cout << "duplicate in unique hash index should have failed" << endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+
+    // everything should still be there after reading the directory back in
+    tokens.close();
+    tokens.open();
+    users.close();
+    users.open();
+    for (int i = 0; i < n + 5000; i += 3)
+        if (!test_hash_lookup(tokens, "token", Value("session-" + to_string(i * 7919L % 1000003)), 1))
+            return false;
+    if (!test_hash_lookup(users, "user_id", Value(42), n / 100 + 2500) ||
+        !test_hash_lookup(users, "user_id", Value(101), 0) ||
+        !test_hash_lookup(users, "user_id", Value(n + 101), 1))
+        return false;
+
+    tokens.drop();
+    users.drop();
+    table.drop();
+    return true;
+}
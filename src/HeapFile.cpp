@@ -10,6 +10,24 @@
 using namespace std;
 typedef uint16_t u16;
 
+/**
+ * @class BufferedPage - a SlottedPage on its own copy of the block, freed along with the page
+ *
+ * Berkeley DB's default is to hand back memory owned by the Db handle, which the next get
+ * overwrites. Reading into our own buffer lets any number of pages (in any number of threads)
+ * be in use at once.
+ */
+class BufferedPage : public SlottedPage {
+public:
+    BufferedPage(Dbt &block, BlockID block_id, bool is_new = false) : SlottedPage(block, block_id, is_new) {}
+
+    virtual ~BufferedPage() { delete[] (char *) this->block.get_data(); }
+
+    BufferedPage(const BufferedPage &other) = delete;
+
+    BufferedPage &operator=(const BufferedPage &other) = delete;
+};
+
 /**
  * Constructor
  * @param name
@@ -56,31 +74,35 @@ void HeapFile::close(void) {
  * @return the new empty DbBlock that is managing the records in this block and its block id.
  */
 SlottedPage *HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
+    char *block = new char[DbBlock::BLOCK_SZ];
+    memset(block, 0, DbBlock::BLOCK_SZ);
+    Dbt data(block, DbBlock::BLOCK_SZ);
 
-    int block_id = ++this->last;
+    // write out the initialized empty block (under the lock, so each caller gets a different block id)
+    lock_guard<mutex> guard(this->new_block_mutex);
+    BlockID block_id = ++this->last;
     Dbt key(&block_id, sizeof(block_id));
-
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
-    delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    SlottedPage *page = new BufferedPage(data, block_id, true);
+    this->db.put(nullptr, &key, &data, 0);
+    return page;
 }
 
 /**
  * Get a block from the database file.
  * @param block_id
  * @return          the given slotted page (freed by caller)
+ * @throws DbRelationError if the file doesn't have the block
  */
 SlottedPage *HeapFile::get(BlockID block_id) {
     Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, block_id, false);
+    Dbt data(new char[DbBlock::BLOCK_SZ], DbBlock::BLOCK_SZ);
+    data.set_ulen(DbBlock::BLOCK_SZ);
+    data.set_flags(DB_DBT_USERMEM);
+    if (this->db.get(nullptr, &key, &data, 0) != 0) {
+        delete[] (char *) data.get_data();
+        throw DbRelationError("no block " + to_string(block_id) + " in " + this->dbfilename);
+    }
+    return new BufferedPage(data, block_id, false);
 }
 
 /**
@@ -124,7 +146,7 @@ void HeapFile::db_open(uint flags) {
     if (!this->closed)
         return;
     this->db.set_re_len(DbBlock::BLOCK_SZ); // record length - will be ignored if file already exists
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
+    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags | DB_THREAD, 0644);
 
     this->last = flags ? 0 : get_block_count();
     this->closed = false;
@@ -0,0 +1,504 @@
+/**
+ * @file JoinOperator.cpp - implementation of the join operators
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <chrono>
+#include "JoinOperator.h"
+#include "HashIndex.h"
+#include "btree.h"
+#include "HeapTable.h"
+
+using namespace std;
+
+size_t JoinKeyHash::operator()(const string &key) const {
+    return HashBucket::hash(key);
+}
+
+
+/********************
+ * HashJoinOperator *
+ ********************/
+
+u_long HashJoinOperator::memory_budget = HashJoinOperator::DEFAULT_MEMORY_BUDGET;
+
+HashJoinOperator::HashJoinOperator(EvalOperator *probe, EvalOperator *build, const JoinKeys &keys)
+        : BufferedOperator(), probe(probe), build(build), probe_keys(), build_keys(), table(), table_bytes(0),
+          build_partitions(), probe_partitions(), partition(0), loaded(false) {
+    for (auto const &pair: keys) {
+        this->probe_keys.push_back(pair.first);
+        this->build_keys.push_back(pair.second);
+    }
+}
+
+HashJoinOperator::~HashJoinOperator() {
+    clear_table();
+    clear_partitions();
+    delete this->probe;
+    delete this->build;
+}
+
+// The key columns' values, encoded: INTs and BOOLEANs as their four bytes, TEXTs as their length and characters.
+string HashJoinOperator::key(const ValueDict &row, const ColumnNames &key_columns) {
+    string bytes;
+    for (auto const &column_name: key_columns) {
+        const Value &value = row.at(column_name);
+        if (value.data_type == ColumnAttribute::TEXT) {
+            u_int32_t size = (u_int32_t) value.s.size();
+            bytes.append((const char *) &size, sizeof(size));
+            bytes.append(value.s);
+        } else {
+            bytes.append((const char *) &value.n, sizeof(value.n));
+        }
+    }
+    return bytes;
+}
+
+// Which partition a key's rows go to: the next bits of its hash above the ones the hash table mostly uses.
+static uint partition_of(const string &key) {
+    return (uint) (JoinKeyHash()(key) >> 24) % HashJoinOperator::PARTITIONS;
+}
+
+// Build the hash table (or, if it gets too big, the partitions of both sides).
+void HashJoinOperator::open() {
+    clear();
+    clear_table();
+    clear_partitions();
+    this->build->open();
+    for (ValueDict *row = this->build->next(); row != nullptr; row = this->build->next())
+        add_build_row(row);
+    this->build->close();
+    this->probe->open();
+    if (spilled()) {
+        for (ValueDict *row = this->probe->next(); row != nullptr; row = this->probe->next()) {
+            this->probe_partitions[partition_of(key(*row, this->probe_keys))]->write(*row);
+            delete row;
+        }
+        for (auto file: this->build_partitions)
+            file->rewind();
+        for (auto file: this->probe_partitions)
+            file->rewind();
+    }
+    this->partition = 0;
+    this->loaded = !spilled();
+}
+
+void HashJoinOperator::close() {
+    BufferedOperator::close();
+    clear_table();
+    clear_partitions();
+    this->probe->close();
+}
+
+void HashJoinOperator::add_build_row(ValueDict *row) {
+    string row_key = key(*row, this->build_keys);
+    if (spilled()) {
+        this->build_partitions[partition_of(row_key)]->write(*row);
+        delete row;
+        return;
+    }
+    this->table_bytes += SpillFile::row_bytes(*row) + row_key.size() + 32;
+    this->table.emplace(row_key, row);
+    if (this->table_bytes > memory_budget)
+        spill();
+}
+
+// Move the hash table's rows out to the build side's partitions.
+void HashJoinOperator::spill() {
+    for (uint i = 0; i < PARTITIONS; i++) {
+        this->build_partitions.push_back(new SpillFile());
+        this->probe_partitions.push_back(new SpillFile());
+    }
+    for (auto const &entry: this->table)
+        this->build_partitions[partition_of(entry.first)]->write(*entry.second);
+    clear_table();
+}
+
+// Add the probe row joined with each of its matches to buffer (and free the probe row).
+void HashJoinOperator::join(ValueDict *probe_row) {
+    auto matches = this->table.equal_range(key(*probe_row, this->probe_keys));
+    for (auto match = matches.first; match != matches.second; match++) {
+        ValueDict *row = new ValueDict(*probe_row);
+        row->insert(match->second->begin(), match->second->end());
+        this->buffer.push_back(row);
+    }
+    delete probe_row;
+}
+
+// Join probe rows until there's a batch of joined rows (or no more probe rows). Once spilled, the probe rows come
+// from the partition being joined, whose build rows are loaded into the table first.
+bool HashJoinOperator::fill() {
+    while (this->buffer.size() < BATCH_SIZE) {
+        if (!spilled()) {
+            ValueDict *row = this->probe->next();
+            if (row == nullptr)
+                break;
+            join(row);
+            continue;
+        }
+        if (this->partition == PARTITIONS)
+            break;
+        if (!this->loaded) {
+            SpillFile *build_rows = this->build_partitions[this->partition];
+            for (ValueDict *row = build_rows->read(); row != nullptr; row = build_rows->read())
+                this->table.emplace(key(*row, this->build_keys), row);
+            this->loaded = true;
+        }
+        ValueDict *row = this->probe_partitions[this->partition]->read();
+        if (row == nullptr) {
+            clear_table();
+            this->partition++;
+            this->loaded = false;
+            continue;
+        }
+        join(row);
+    }
+    return !this->buffer.empty();
+}
+
+void HashJoinOperator::clear_table() {
+    for (auto const &entry: this->table)
+        delete entry.second;
+    this->table.clear();
+    this->table_bytes = 0;
+}
+
+void HashJoinOperator::clear_partitions() {
+    for (auto file: this->build_partitions)
+        delete file;
+    for (auto file: this->probe_partitions)
+        delete file;
+    this->build_partitions.clear();
+    this->probe_partitions.clear();
+}
+
+
+/*********************
+ * MergeJoinOperator *
+ *********************/
+
+MergeJoinOperator::MergeJoinOperator(EvalOperator *left, EvalOperator *right, const JoinKeys &keys)
+        : BufferedOperator(), left(left), right(right), left_keys(), right_keys(), left_row(nullptr), left_key(),
+          right_row(nullptr), right_key(), group(), group_key() {
+    for (auto const &pair: keys) {
+        this->left_keys.push_back(make_pair(pair.first, false));
+        this->right_keys.push_back(make_pair(pair.second, false));
+    }
+}
+
+MergeJoinOperator::~MergeJoinOperator() {
+    clear_rows();
+    delete this->left;
+    delete this->right;
+}
+
+void MergeJoinOperator::open() {
+    clear();
+    clear_rows();
+    this->left->open();
+    this->right->open();
+    next_left();
+    next_right();
+}
+
+void MergeJoinOperator::close() {
+    BufferedOperator::close();
+    clear_rows();
+    this->left->close();
+    this->right->close();
+}
+
+void MergeJoinOperator::next_left() {
+    this->left_row = this->left->next();
+    if (this->left_row != nullptr)
+        this->left_key = SortOperator::sort_key(*this->left_row, this->left_keys);
+}
+
+void MergeJoinOperator::next_right() {
+    this->right_row = this->right->next();
+    if (this->right_row != nullptr)
+        this->right_key = SortOperator::sort_key(*this->right_row, this->right_keys);
+}
+
+// Join left rows with their groups of right rows until there's a batch of joined rows (or no more matches).
+bool MergeJoinOperator::fill() {
+    while (this->left_row != nullptr && this->buffer.size() < BATCH_SIZE) {
+        if (this->group.empty() || this->left_key != this->group_key) {
+            // find the group of right rows with the left row's key, if it has one
+            for (auto row: this->group)
+                delete row;
+            this->group.clear();
+            while (this->right_row != nullptr && this->right_key < this->left_key) {
+                delete this->right_row;
+                next_right();
+            }
+            if (this->right_row == nullptr)
+                break;
+            if (this->left_key < this->right_key) {
+                delete this->left_row;
+                next_left();
+                continue;
+            }
+            this->group_key = this->right_key;
+            while (this->right_row != nullptr && this->right_key == this->group_key) {
+                this->group.push_back(this->right_row);
+                next_right();
+            }
+        }
+        for (auto right_row: this->group) {
+            ValueDict *row = new ValueDict(*this->left_row);
+            row->insert(right_row->begin(), right_row->end());
+            this->buffer.push_back(row);
+        }
+        delete this->left_row;
+        next_left();
+    }
+    return !this->buffer.empty();
+}
+
+void MergeJoinOperator::clear_rows() {
+    delete this->left_row;
+    this->left_row = nullptr;
+    delete this->right_row;
+    this->right_row = nullptr;
+    for (auto row: this->group)
+        delete row;
+    this->group.clear();
+}
+
+
+/*********************
+ * IndexJoinOperator *
+ *********************/
+
+IndexJoinOperator::IndexJoinOperator(EvalOperator *outer, DbRelation &table, DbIndex &index, const JoinKeys &keys,
+                                     const ColumnNames &columns, const ColumnNames &names, const Conjunction &where,
+                                     const Expression *filter)
+        : BufferedOperator(), outer(outer), table(table), index(index), keys(keys), index_columns(), index_keys(),
+          columns(columns), names(names), fetched(columns), where(where),
+          filter(filter != nullptr ? filter->copy() : nullptr) {
+    for (auto const &column_name: index.get_key_columns()) {
+        auto key = find_if(keys.begin(), keys.end(), [&](const pair<Identifier, Identifier> &k) {
+            return k.second == column_name;
+        });
+        if (key == keys.end())
+            break;
+        this->index_columns.push_back(column_name);
+        this->index_keys.push_back(key->first);
+    }
+    if (this->index_columns.empty())
+        throw DbRelationError("index join needs an index on a join column");
+    for (auto const &key: keys)
+        if (find(this->fetched.begin(), this->fetched.end(), key.second) == this->fetched.end())
+            this->fetched.push_back(key.second);
+    if (this->filter != nullptr)
+        this->filter->get_columns(this->fetched);
+}
+
+IndexJoinOperator::~IndexJoinOperator() {
+    delete this->outer;
+    delete this->filter;
+}
+
+void IndexJoinOperator::open() {
+    clear();
+    this->index.open();
+    this->outer->open();
+}
+
+void IndexJoinOperator::close() {
+    BufferedOperator::close();
+    this->outer->close();
+}
+
+// Add the outer row joined with each of the table's rows for the handles that match it to buffer (and free the
+// handles).
+void IndexJoinOperator::join(const ValueDict &outer_row, Handles *handles) {
+    if (!this->where.empty() && !handles->empty()) {
+        Handles *selected;
+        try {
+            selected = this->table.select(handles, this->where);
+        } catch (DbRelationError &e) {
+            delete handles;
+            throw;
+        }
+        delete handles;
+        handles = selected;
+    }
+    ValueDicts *rows;
+    try {
+        rows = this->table.project(handles, &this->fetched);
+    } catch (DbRelationError &e) {
+        delete handles;
+        throw;
+    }
+    delete handles;
+    for (ValueDict *row: *rows) {
+        bool matches = true;
+        for (auto const &key: this->keys)
+            matches = matches && row->at(key.second) == outer_row.at(key.first);
+        if (matches && this->filter != nullptr)
+            matches = this->filter->test(*row);
+        if (matches) {
+            ValueDict *joined = new ValueDict(outer_row);
+            for (u_long i = 0; i < this->columns.size(); i++)
+                (*joined)[this->names[i]] = (*row)[this->columns[i]];
+            this->buffer.push_back(joined);
+        }
+        delete row;
+    }
+    delete rows;
+}
+
+// Look up the keys of the next batch of outer rows, until some of them have matches (or there are no more).
+bool IndexJoinOperator::fill() {
+    while (this->buffer.empty()) {
+        ValueDicts outer_rows, index_keys;
+        for (ValueDict *row = this->outer->next(); row != nullptr; row = this->outer->next()) {
+            outer_rows.push_back(row);
+            ValueDict *key = new ValueDict();
+            for (u_long i = 0; i < this->index_columns.size(); i++)
+                (*key)[this->index_columns[i]] = row->at(this->index_keys[i]);
+            index_keys.push_back(key);
+            if (outer_rows.size() == BATCH_SIZE)
+                break;
+        }
+        if (outer_rows.empty())
+            return false;
+        HandleLists *matches = nullptr;
+        u_long i = 0;
+        try {
+            matches = this->index.lookup_many(index_keys);
+            for (; i < outer_rows.size(); i++)
+                join(*outer_rows[i], (*matches)[i]);
+        } catch (DbRelationError &e) {
+            if (matches != nullptr)
+                for (i++; i < matches->size(); i++)
+                    delete (*matches)[i];
+            delete matches;
+            for (auto row: outer_rows)
+                delete row;
+            for (auto key: index_keys)
+                delete key;
+            throw;
+        }
+        delete matches;
+        for (auto row: outer_rows)
+            delete row;
+        for (auto key: index_keys)
+            delete key;
+    }
+    return true;
+}
+
+
+// Join the tables' rows with a hash join, and check them against the count worked out from how they were made.
+static bool test_hash_join(DbRelation &r, DbRelation &s, u_long expected, const char *label) {
+    HashJoinOperator join(new TableScanOperator(s, s.get_column_names(), Conjunction()),
+                          new TableScanOperator(r, r.get_column_names(), Conjunction()), {{"r_id", "id"}});
+    auto start = chrono::steady_clock::now();
+    u_long joined = 0;
+    bool ok = true;
+    join.open();
+    bool spilled = join.spilled();
+    for (ValueDict *row = join.next(); row != nullptr; row = join.next()) {
+        ok = ok && (*row)["id"] == (*row)["r_id"] && (*row)["name"].s == "r" + to_string((*row)["id"].n);
+        joined++;
+        delete row;
+    }
+    join.close();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << label << (spilled ? " (spilled)" : " (in memory)") << ": " << joined << " rows joined, "
+         << (long) (joined / seconds) << " rows/s" << endl;
+    if (!ok || joined != expected)
+        cout << label << " got " << joined << " rows, not " << expected << endl;
+    return ok && joined == expected;
+}
+
+// Join them again with a merge join, sorting both sides (in runs, if the sort budget is small).
+static bool test_merge_join(DbRelation &r, DbRelation &s, u_long expected, u_long sort_budget) {
+    u_long budget = SortOperator::memory_budget;
+    SortOperator::memory_budget = sort_budget;
+    MergeJoinOperator join(
+            new SortOperator(new TableScanOperator(s, s.get_column_names(), Conjunction()), {{"r_id", false}}),
+            new SortOperator(new TableScanOperator(r, r.get_column_names(), Conjunction()), {{"id", false}}),
+            {{"r_id", "id"}});
+    auto start = chrono::steady_clock::now();
+    u_long joined = 0;
+    bool ok = true;
+    int32_t last = INT32_MIN;
+    join.open();
+    for (ValueDict *row = join.next(); row != nullptr; row = join.next()) {
+        ok = ok && (*row)["id"] == (*row)["r_id"] && (*row)["name"].s == "r" + to_string((*row)["id"].n) &&
+             (*row)["id"].n >= last;
+        last = (*row)["id"].n;
+        joined++;
+        delete row;
+    }
+    join.close();
+    SortOperator::memory_budget = budget;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "merge join" << (sort_budget < budget ? " (sorts spilled)" : "") << ": " << joined << " rows joined, "
+         << (long) (joined / seconds) << " rows/s" << endl;
+    if (!ok || joined != expected)
+        cout << "merge join got " << joined << " rows (in key order: " << ok << "), not " << expected << endl;
+    return ok && joined == expected;
+}
+
+// Join them again with an index join, looking up s's rows' r_id values in an index on r's ids.
+static bool test_index_join(DbRelation &r, DbRelation &s, u_long expected) {
+    BTreeIndex index(r, "__test_join_r_id", ColumnNames{"id"}, true);
+    index.create();
+    IndexJoinOperator join(new TableScanOperator(s, s.get_column_names(), Conjunction()), r, index,
+                           {{"r_id", "id"}}, r.get_column_names(), r.get_column_names(), Conjunction(), nullptr);
+    auto start = chrono::steady_clock::now();
+    u_long joined = 0;
+    bool ok = true;
+    join.open();
+    for (ValueDict *row = join.next(); row != nullptr; row = join.next()) {
+        ok = ok && (*row)["id"] == (*row)["r_id"] && (*row)["name"].s == "r" + to_string((*row)["id"].n);
+        joined++;
+        delete row;
+    }
+    join.close();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "index join: " << joined << " rows joined, " << (long) (joined / seconds) << " rows/s" << endl;
+    index.drop();
+    if (!ok || joined != expected)
+        cout << "index join got " << joined << " rows, not " << expected << endl;
+    return ok && joined == expected;
+}
+
+bool test_join() {
+    HeapTable r("__test_join_r", {"id", "name"}, {ColumnAttribute(ColumnAttribute::INT),
+                                                   ColumnAttribute(ColumnAttribute::TEXT)});
+    HeapTable s("__test_join_s", {"r_id", "v"}, {ColumnAttribute(ColumnAttribute::INT),
+                                                  ColumnAttribute(ColumnAttribute::INT)});
+    r.create();
+    s.create();
+    const int r_rows = 2000, s_rows = 20000;
+    ValueDict row;
+    for (int i = 0; i < r_rows; i++) {
+        row = {{"id", Value(i)}, {"name", Value("r" + to_string(i))}};
+        r.insert(&row);
+    }
+    for (int i = 0; i < s_rows; i++) {
+        row = {{"r_id", Value(i * 7 % 2500)}, {"v", Value(i)}};
+        s.insert(&row);
+    }
+    u_long expected = 0;
+    for (int i = 0; i < s_rows; i++)
+        expected += i * 7 % 2500 < r_rows;
+
+    bool ok = test_hash_join(r, s, expected, "hash join");
+    u_long budget = HashJoinOperator::memory_budget;
+    HashJoinOperator::memory_budget = 16 * 1024;
+    ok = ok && test_hash_join(r, s, expected, "hash join");
+    HashJoinOperator::memory_budget = budget;
+    ok = ok && test_merge_join(r, s, expected, SortOperator::memory_budget);
+    ok = ok && test_merge_join(r, s, expected, 64 * 1024);
+    ok = ok && test_index_join(r, s, expected);
+    r.drop();
+    s.drop();
+    return ok;
+}
@@ -68,6 +68,8 @@ string ParseTreeToString::operator_expression(const Expr *expr) {
         return "null";
 
     string ret;
+    if (expr->opType == Expr::UMINUS)
+        return "-" + expression(expr->expr);
     if (expr->opType == Expr::NOT)
         ret += "NOT ";
     ret += expression(expr->expr) + " ";
@@ -84,14 +86,20 @@ string ParseTreeToString::operator_expression(const Expr *expr) {
         case Expr::NONE:
             break;
         case Expr::BETWEEN:
+            ret += "BETWEEN";
+            if (expr->exprList != NULL && expr->exprList->size() == 2)
+                ret += " " + expression((*expr->exprList)[0]) + " AND " + expression((*expr->exprList)[1]);
             break;
         case Expr::CASE:
             break;
         case Expr::NOT_EQUALS:
+            ret += "<>";
             break;
         case Expr::LESS_EQ:
+            ret += "<=";
             break;
         case Expr::GREATER_EQ:
+            ret += ">=";
             break;
         case Expr::LIKE:
             break;
@@ -137,7 +145,7 @@ string ParseTreeToString::expression(const Expr *expr) {
             ret += to_string(expr->ival);
             break;
         case kExprFunctionRef:
-            ret += string(expr->name) + "?" + expr->expr->name;
+            ret += string(expr->name) + "(" + (expr->distinct ? "DISTINCT " : "") + expression(expr->expr) + ")";
             break;
         case kExprOperator:
             ret += operator_expression(expr);
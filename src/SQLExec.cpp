@@ -4,6 +4,11 @@
  * @see "Seattle University, CPSC5300, Winter 2024"
  */
 #include "SQLExec.h"
+#include <algorithm>
+#include <memory>
+#include <strings.h>
+#include <sstream>
+#include "ParseTreeToString.h"
 #include <sql/DropStatement.h>
 
 using namespace std;
@@ -68,16 +73,19 @@ QueryResult::~QueryResult() {
  * @throws SQLExecError if an error occurs during statement execution.
  */
 
-QueryResult* SQLExec::execute(const SQLStatement* statement) {
+QueryResult* SQLExec::execute(const SQLStatement* statement, const ColumnNames& included) {
     if (!SQLExec::tables)
         SQLExec::tables = new Tables();
     if (!SQLExec::indices)
         SQLExec::indices = new Indices();
 
+    if (!included.empty() && (statement->type() != kStmtCreate ||
+                              ((const CreateStatement*) statement)->type != CreateStatement::kIndex))
+        throw SQLExecError("INCLUDE is only for CREATE INDEX");
     try {
         switch (statement->type()) {
             case kStmtCreate:
-                return create((const CreateStatement*) statement);
+                return create((const CreateStatement*) statement, included);
             case kStmtDrop:
                 return drop((const DropStatement*) statement);
             case kStmtShow:
@@ -96,6 +104,46 @@ QueryResult* SQLExec::execute(const SQLStatement* statement) {
     }
 }
 
+// The clause is the word INCLUDE and a parenthesized list of column names, anywhere outside a quoted string.
+bool SQLExec::take_include_clause(string& query, ColumnNames& included) {
+    static const string keyword = "include";
+    char quote = '\0';
+    for (size_t at = 0; at < query.size(); at++) {
+        char c = query[at];
+        if (quote != '\0') {
+            if (c == quote)
+                quote = '\0';
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            quote = c;
+            continue;
+        }
+        if ((at > 0 && (isalnum(query[at - 1]) || query[at - 1] == '_')) ||
+            strncasecmp(query.c_str() + at, keyword.c_str(), keyword.size()) != 0)
+            continue;
+        size_t open = query.find_first_not_of(" \t", at + keyword.size());
+        if (open == string::npos || query[open] != '(')
+            continue;
+        size_t close = query.find(')', open);
+        if (close == string::npos)
+            throw SQLExecError("unterminated INCLUDE clause");
+        stringstream columns(query.substr(open + 1, close - open - 1));
+        string column_name;
+        while (getline(columns, column_name, ',')) {
+            size_t first = column_name.find_first_not_of(" \t");
+            if (first == string::npos)
+                throw SQLExecError("empty column name in INCLUDE clause");
+            included.push_back(column_name.substr(first, column_name.find_last_not_of(" \t") - first + 1));
+        }
+        if (included.empty())
+            throw SQLExecError("empty INCLUDE clause");
+        query.erase(at, close + 1 - at);
+        return true;
+    }
+    return false;
+}
+
 QueryResult* SQLExec::insert(const InsertStatement* statement) {
     Identifier table_name = statement->tableName;
 
@@ -138,102 +186,897 @@ QueryResult* SQLExec::insert(const InsertStatement* statement) {
     return new QueryResult("successfully inserted 1 row into " + table_name + suffix);
 }
 
-void get_where_conjunction(const Expr* where, ValueDict* conjunction) {
-    if (where->opType == Expr::OperatorType::AND) {
-        get_where_conjunction(where->expr, conjunction);
-        get_where_conjunction(where->expr2, conjunction);
-    } else if (where->opType == Expr::OperatorType::SIMPLE_OP && where->opChar == '=') {
-        switch (where->expr2->type) {
-            case kExprLiteralInt:
-                (*conjunction)[where->expr->name] = Value(where->expr2->ival);
-                break;
-            case kExprLiteralString:
-                (*conjunction)[where->expr->name] = Value(where->expr2->name);
-                break;
-            default:
-                throw SQLExecError("unrecognized expression");
+// Value of a literal in a where clause.
+static Value get_literal(const Expr* expr) {
+    switch (expr->type) {
+        case kExprLiteralInt:
+            return Value(expr->ival);
+        case kExprLiteralString:
+            return Value(expr->name);
+        default:
+            throw SQLExecError("unrecognized expression");
+    }
+}
+
+// A table in a statement's FROM clause, by the name the statement knows it by (its alias, if it has one).
+struct FromTable {
+    Identifier name;
+    DbRelation* table;
+};
+typedef vector<FromTable> FromTables;
+
+// Which of the FROM tables a column reference is to: the one it's qualified with, or else the only one with such a
+// column. Returns the table's index in from, and sets the column's data type.
+static uint resolve_column(const Expr* column, const FromTables& from, ColumnAttribute::DataType& data_type) {
+    uint found = (uint) from.size();
+    bool named = false;
+    for (uint i = 0; i < from.size(); i++) {
+        if (column->table != nullptr && from[i].name != column->table)
+            continue;
+        named = true;
+        const ColumnNames& column_names = from[i].table->get_column_names();
+        auto it = find(column_names.begin(), column_names.end(), column->name);
+        if (it == column_names.end())
+            continue;
+        if (found < from.size())
+            throw SQLExecError("column " + string(column->name) + " is ambiguous");
+        found = i;
+        data_type = from[i].table->get_column_attributes()[it - column_names.begin()].get_data_type();
+    }
+    if (!named)
+        throw SQLExecError("no table named " + string(column->table) + " in FROM clause");
+    if (found == from.size())
+        throw SQLExecError("table does not have column named '" + string(column->name) + "'");
+    return found;
+}
+
+// Add <column> <op> <literal> to the conjunction (written either way around). The column is checked against the
+// FROM table the way any other column reference is.
+static void add_comparison(const Expr* left, Comparison::Op op, const Expr* right, const FromTables& from,
+                           Conjunction* conjunction) {
+    ColumnAttribute::DataType data_type;
+    if (left->type == kExprColumnRef) {
+        resolve_column(left, from, data_type);
+        conjunction->push_back(Comparison(left->name, op, get_literal(right)));
+    } else if (right->type == kExprColumnRef) {
+        resolve_column(right, from, data_type);
+        conjunction->push_back(Comparison(right->name, Comparison::reversed(op), get_literal(left)));
+    } else {
+        throw SQLExecError("unrecognized expression");
+    }
+}
+
+// Is the expression <column> <op> <literal> (written either way around), or <column> BETWEEN <literal> AND <literal>,
+// so that it can go in a Select's conjunction (where an index might do it)?
+static bool is_comparison(const Expr* expr) {
+    auto literal = [](const Expr* e) { return e->type == kExprLiteralInt || e->type == kExprLiteralString; };
+    if (expr->type != kExprOperator)
+        return false;
+    switch (expr->opType) {
+        case Expr::OperatorType::SIMPLE_OP:
+            if (expr->opChar != '=' && expr->opChar != '<' && expr->opChar != '>')
+                return false;
+            // fall through
+        case Expr::OperatorType::NOT_EQUALS:
+        case Expr::OperatorType::LESS_EQ:
+        case Expr::OperatorType::GREATER_EQ:
+            return (expr->expr->type == kExprColumnRef && literal(expr->expr2)) ||
+                   (expr->expr2->type == kExprColumnRef && literal(expr->expr));
+        case Expr::OperatorType::BETWEEN:
+            return expr->expr->type == kExprColumnRef && expr->exprList != nullptr && expr->exprList->size() == 2 &&
+                   literal((*expr->exprList)[0]) && literal((*expr->exprList)[1]);
+        default:
+            return false;
+    }
+}
+
+// Add a comparison (see is_comparison) to the conjunction.
+static void add_comparison(const Expr* where, const FromTables& from, Conjunction* conjunction) {
+    switch (where->opType) {
+        case Expr::OperatorType::SIMPLE_OP:
+            switch (where->opChar) {
+                case '=':
+                    add_comparison(where->expr, Comparison::EQ, where->expr2, from, conjunction);
+                    break;
+                case '<':
+                    add_comparison(where->expr, Comparison::LT, where->expr2, from, conjunction);
+                    break;
+                default:
+                    add_comparison(where->expr, Comparison::GT, where->expr2, from, conjunction);
+                    break;
+            }
+            break;
+        case Expr::OperatorType::NOT_EQUALS:
+            add_comparison(where->expr, Comparison::NE, where->expr2, from, conjunction);
+            break;
+        case Expr::OperatorType::LESS_EQ:
+            add_comparison(where->expr, Comparison::LE, where->expr2, from, conjunction);
+            break;
+        case Expr::OperatorType::GREATER_EQ:
+            add_comparison(where->expr, Comparison::GE, where->expr2, from, conjunction);
+            break;
+        default:
+            add_comparison(where->expr, Comparison::GE, (*where->exprList)[0], from, conjunction);
+            add_comparison(where->expr, Comparison::LE, (*where->exprList)[1], from, conjunction);
+            break;
+    }
+}
+
+static const char* type_name(ColumnAttribute::DataType data_type) {
+    switch (data_type) {
+        case ColumnAttribute::INT:
+            return "INT";
+        case ColumnAttribute::TEXT:
+            return "TEXT";
+        default:
+            return "BOOLEAN";
+    }
+}
+
+// A column's name in the rows of a query on the FROM tables: just its own, from a single table, but qualified with
+// its table's name in joined rows (which have the columns of all of them).
+static Identifier column_name(const FromTables& from, uint table, const Identifier& column) {
+    return from.size() == 1 ? column : from[table].name + "." + column;
+}
+
+// An expression's text, without its alias (for naming a column computed from it).
+static Identifier expression_text(const Expr* expr) {
+    string text = ParseTreeToString::expression(expr);
+    if (expr->alias != nullptr)
+        text.resize(text.size() - string(" AS ").size() - string(expr->alias).size());
+    return text;
+}
+
+// Are two parse trees the same expression (with column references to the same column, however they're qualified)?
+static bool same_expression(const Expr* a, const Expr* b, const FromTables& from) {
+    if (a == nullptr || b == nullptr)
+        return a == b;
+    if (a->type != b->type)
+        return false;
+    switch (a->type) {
+        case kExprColumnRef: {
+            ColumnAttribute::DataType data_type;
+            return string(a->name) == b->name &&
+                   resolve_column(a, from, data_type) == resolve_column(b, from, data_type);
         }
+        case kExprLiteralInt:
+            return a->ival == b->ival;
+        case kExprLiteralString:
+            return string(a->name) == b->name;
+        case kExprStar:
+            return true;
+        case kExprFunctionRef:
+            return strcasecmp(a->name, b->name) == 0 && a->distinct == b->distinct &&
+                   same_expression(a->expr, b->expr, from);
+        case kExprOperator:
+            if (a->opType != b->opType || a->opChar != b->opChar || !same_expression(a->expr, b->expr, from) ||
+                !same_expression(a->expr2, b->expr2, from))
+                return false;
+            if (a->exprList == nullptr || b->exprList == nullptr)
+                return a->exprList == b->exprList;
+            if (a->exprList->size() != b->exprList->size())
+                return false;
+            for (uint i = 0; i < a->exprList->size(); i++)
+                if (!same_expression((*a->exprList)[i], (*b->exprList)[i], from))
+                    return false;
+            return true;
+        default:
+            return false;
     }
 }
 
-ValueDict* get_where_conjunction(const Expr* where) {
-    ValueDict* conjunction = new ValueDict();
-    get_where_conjunction(where, conjunction);
-    return conjunction;
+// Does an expression have an aggregate function in it (making its query a grouped one)?
+static bool has_aggregate(const Expr* expr) {
+    if (expr == nullptr)
+        return false;
+    if (expr->type == kExprFunctionRef)
+        return true;
+    if (has_aggregate(expr->expr) || has_aggregate(expr->expr2))
+        return true;
+    if (expr->exprList != nullptr)
+        for (const Expr* item : *expr->exprList)
+            if (has_aggregate(item))
+                return true;
+    return false;
 }
 
+// A grouped query's GROUP BY columns, and the aggregates its select list, HAVING, and ORDER BY use: the columns of
+// its grouped rows, which the expressions on those rows are compiled against, instead of the FROM tables' columns.
+struct Grouping {
+    vector<const Expr*> keys;  // the GROUP BY's
+    ColumnNames names;  // of their columns
+    Expressions expressions;  // their values, on the FROM tables' rows
+    Aggregates aggregates;
+
+    ~Grouping() {
+        for (auto expression : expressions)
+            delete expression;
+        for (auto const& aggregate : aggregates)
+            delete aggregate.argument;
+    }
 
-QueryResult* SQLExec::del(const DeleteStatement* statement) {
-    Identifier table_name = statement->tableName;
+    // Add the columns of the FROM tables' rows that the grouping needs to columns.
+    void get_columns(ColumnNames& columns) const {
+        for (auto expression : expressions)
+            expression->get_columns(columns);
+        for (auto const& aggregate : aggregates)
+            if (aggregate.argument != nullptr)
+                aggregate.argument->get_columns(columns);
+    }
 
-    // check table exists
+    // An Aggregate of the grouping on the plan (which then has the grouping's expressions and aggregates).
+    EvalPlan* plan(EvalPlan* relation) {
+        EvalPlan* ret = new EvalPlan(new ColumnNames(names), new Expressions(expressions), new Aggregates(aggregates),
+                                     relation);
+        names.clear();
+        expressions.clear();
+        aggregates.clear();
+        return ret;
+    }
+};
+
+static Expression* get_expression(const Expr* expr, const FromTables& from, Grouping* grouping = nullptr);
+
+// Compile the GROUP BY's columns into the grouping.
+static void get_group_by(const GroupByDescription* group_by, const FromTables& from, Grouping& grouping) {
+    for (const Expr* expr : *group_by->columns) {
+        bool repeated = false;
+        for (const Expr* key : grouping.keys)
+            repeated = repeated || same_expression(expr, key, from);
+        if (repeated)
+            continue;
+        grouping.expressions.push_back(get_expression(expr, from));
+        const Identifier* column = grouping.expressions.back()->get_column();
+        grouping.names.push_back(column != nullptr ? *column : expression_text(expr));
+        grouping.keys.push_back(expr);
+    }
+}
+
+// Compile an aggregate function of a grouped query's rows, adding it to the grouping's aggregates unless it's there
+// already. Returns the expression for its column of the grouped rows (freed by caller).
+static Expression* get_aggregate(const Expr* expr, const FromTables& from, Grouping& grouping) {
+    Aggregate::Function function;
+    if (!Aggregate::get_function(expr->name, function))
+        throw SQLExecError("unknown function " + string(expr->name));
+    if (expr->distinct)
+        throw SQLExecError("DISTINCT aggregates are not supported");
+    unique_ptr<Expression> argument;
+    if (expr->expr == nullptr || expr->expr->type == kExprStar) {
+        if (function != Aggregate::COUNT)
+            throw SQLExecError("only COUNT can be of *");
+    } else {
+        argument.reset(get_expression(expr->expr, from));
+        if ((function == Aggregate::SUM || function == Aggregate::AVG) &&
+            argument->get_data_type() != ColumnAttribute::INT)
+            throw SQLExecError("operand of " + string(expr->name) + " must be INT");
+    }
+    Identifier name = expression_text(expr);
+    for (auto const& aggregate : grouping.aggregates)
+        if (aggregate.name == name)
+            return new ColumnExpression(name, aggregate.get_data_type());
+    grouping.aggregates.push_back(Aggregate(function, argument.release(), name));
+    return new ColumnExpression(name, grouping.aggregates.back().get_data_type());
+}
+
+// Compile both operands of a binary operator, which must be of the given type.
+static void get_operands(const Expr* expr, const FromTables& from, Grouping* grouping,
+                         ColumnAttribute::DataType data_type, const string& op, unique_ptr<Expression>& left,
+                         unique_ptr<Expression>& right) {
+    left.reset(get_expression(expr->expr, from, grouping));
+    right.reset(get_expression(expr->expr2, from, grouping));
+    if (left->get_data_type() != data_type || right->get_data_type() != data_type)
+        throw SQLExecError("operands of " + op + " must be " + type_name(data_type));
+}
+
+// Compile a comparison of two operands of the same type.
+static Expression* get_comparison(Comparison::Op op, const Expr* left_expr, const Expr* right_expr,
+                                  const FromTables& from, Grouping* grouping) {
+    unique_ptr<Expression> left(get_expression(left_expr, from, grouping));
+    unique_ptr<Expression> right(get_expression(right_expr, from, grouping));
+    if (left->get_data_type() != right->get_data_type())
+        throw SQLExecError(string("cannot compare ") + type_name(left->get_data_type()) + " with " +
+                           type_name(right->get_data_type()));
+    return new CompareExpression(op, left.release(), right.release());
+}
+
+// Compile an expression from the parse tree, checking its columns and types against the FROM tables'. For a
+// grouped query's rows (given its grouping), its GROUP BY columns and aggregates are the grouped rows' columns,
+// and it can't use the FROM tables' columns otherwise. Returns the expression (freed by caller).
+static Expression* get_expression(const Expr* expr, const FromTables& from, Grouping* grouping) {
+    unique_ptr<Expression> left, right;
+    if (grouping != nullptr) {
+        for (uint i = 0; i < grouping->keys.size(); i++)
+            if (same_expression(expr, grouping->keys[i], from))
+                return new ColumnExpression(grouping->names[i], grouping->expressions[i]->get_data_type());
+        if (expr->type == kExprFunctionRef)
+            return get_aggregate(expr, from, *grouping);
+        if (expr->type == kExprColumnRef)
+            throw SQLExecError("column " + string(expr->name) + " must be in the GROUP BY or in an aggregate");
+    }
+    switch (expr->type) {
+        case kExprLiteralInt:
+            return new LiteralExpression(Value((int32_t) expr->ival));
+        case kExprLiteralString:
+            return new LiteralExpression(Value(expr->name));
+        case kExprColumnRef: {
+            ColumnAttribute::DataType data_type;
+            uint table = resolve_column(expr, from, data_type);
+            return new ColumnExpression(column_name(from, table, expr->name), data_type);
+        }
+        case kExprFunctionRef: {
+            Aggregate::Function function;
+            if (!Aggregate::get_function(expr->name, function))
+                throw SQLExecError("unknown function " + string(expr->name));
+            throw SQLExecError("aggregate " + string(expr->name) + " is not allowed here");
+        }
+        case kExprOperator:
+            break;
+        default:
+            throw SQLExecError("unsupported expression");
+    }
+    switch (expr->opType) {
+        case Expr::OperatorType::AND:
+            get_operands(expr, from, grouping, ColumnAttribute::BOOLEAN, "AND", left, right);
+            return new AndExpression(left.release(), right.release());
+        case Expr::OperatorType::OR:
+            get_operands(expr, from, grouping, ColumnAttribute::BOOLEAN, "OR", left, right);
+            return new OrExpression(left.release(), right.release());
+        case Expr::OperatorType::NOT:
+            left.reset(get_expression(expr->expr, from, grouping));
+            if (left->get_data_type() != ColumnAttribute::BOOLEAN)
+                throw SQLExecError("operand of NOT must be BOOLEAN");
+            return new NotExpression(left.release());
+        case Expr::OperatorType::UMINUS:
+            left.reset(get_expression(expr->expr, from, grouping));
+            if (left->get_data_type() != ColumnAttribute::INT)
+                throw SQLExecError("operand of - must be INT");
+            return new ArithmeticExpression('-', new LiteralExpression(Value(0)), left.release());
+        case Expr::OperatorType::SIMPLE_OP:
+            switch (expr->opChar) {
+                case '=':
+                    return get_comparison(Comparison::EQ, expr->expr, expr->expr2, from, grouping);
+                case '<':
+                    return get_comparison(Comparison::LT, expr->expr, expr->expr2, from, grouping);
+                case '>':
+                    return get_comparison(Comparison::GT, expr->expr, expr->expr2, from, grouping);
+                case '+':
+                case '-':
+                case '*':
+                case '/':
+                case '%':
+                    get_operands(expr, from, grouping, ColumnAttribute::INT, string(1, expr->opChar), left, right);
+                    return new ArithmeticExpression(expr->opChar, left.release(), right.release());
+                default:
+                    throw SQLExecError(string("unsupported operator ") + expr->opChar);
+            }
+        case Expr::OperatorType::NOT_EQUALS:
+            return get_comparison(Comparison::NE, expr->expr, expr->expr2, from, grouping);
+        case Expr::OperatorType::LESS_EQ:
+            return get_comparison(Comparison::LE, expr->expr, expr->expr2, from, grouping);
+        case Expr::OperatorType::GREATER_EQ:
+            return get_comparison(Comparison::GE, expr->expr, expr->expr2, from, grouping);
+        case Expr::OperatorType::BETWEEN:
+            if (expr->exprList == nullptr || expr->exprList->size() != 2)
+                throw SQLExecError("unrecognized expression");
+            left.reset(get_comparison(Comparison::GE, expr->expr, (*expr->exprList)[0], from, grouping));
+            right.reset(get_comparison(Comparison::LE, expr->expr, (*expr->exprList)[1], from, grouping));
+            return new AndExpression(left.release(), right.release());
+        default:
+            throw SQLExecError("unsupported operator in expression");
+    }
+}
+
+// Split a where clause's conjuncts into the comparisons (see is_comparison) and the rest.
+static void get_where(const Expr* where, const FromTables& from, Conjunction* conjunction, Expressions& rest) {
+    if (where->type == kExprOperator && where->opType == Expr::OperatorType::AND) {
+        get_where(where->expr, from, conjunction, rest);
+        get_where(where->expr2, from, conjunction, rest);
+    } else if (is_comparison(where)) {
+        add_comparison(where, from, conjunction);
+    } else {
+        rest.push_back(get_expression(where, from));
+        if (rest.back()->get_data_type() != ColumnAttribute::BOOLEAN)
+            throw SQLExecError("where clause must be a condition, not " +
+                               string(type_name(rest.back()->get_data_type())));
+    }
+}
+
+// Put the where clause's conjuncts on the plan: a Select for the comparisons (which an index may do, and the scans
+// check in batches), under a Filter for the rest of them (if there are any).
+static EvalPlan* where_plan(const vector<const Expr*>& where, const FromTables& from, EvalPlan* plan) {
+    Conjunction* conjunction = new Conjunction();
+    Expressions rest;
+    try {
+        for (const Expr* conjunct : where)
+            get_where(conjunct, from, conjunction, rest);
+    } catch (SQLExecError& e) {
+        delete conjunction;
+        for (auto expression: rest)
+            delete expression;
+        delete plan;
+        throw;
+    }
+    if (!conjunction->empty())
+        plan = new EvalPlan(conjunction, plan);
+    else
+        delete conjunction;
+    if (rest.empty())
+        return plan;
+    Expression* filter = rest[0];
+    for (uint i = 1; i < rest.size(); i++)
+        filter = new AndExpression(filter, rest[i]);
+    return new EvalPlan(filter, plan);
+}
+
+DbRelation& SQLExec::get_table(const Identifier& table_name, const string& attempting) {
     ValueDict where = {{"table_name", Value(table_name)}};
     Handles* tabMeta = SQLExec::tables->select(&where);
     bool tableExists = !tabMeta->empty();
     delete tabMeta;
     if (!tableExists)
-        throw SQLExecError("attempting to delete from non-existent table " + table_name);
-    DbRelation& table = SQLExec::tables->get_table(table_name);
-    
+        throw SQLExecError("attempting to " + attempting + " non-existent table " + table_name);
+    return SQLExec::tables->get_table(table_name);
+}
+
+QueryResult* SQLExec::del(const DeleteStatement* statement) {
+    Identifier table_name = statement->tableName;
+
+    DbRelation& table = get_table(table_name, "delete from");
+
     // evaluation plan
     EvalPlan* plan = new EvalPlan(table);
     if (statement->expr)
-        plan = new EvalPlan(get_where_conjunction(statement->expr), plan);
-    plan = plan->optimize();
+        plan = where_plan({statement->expr}, {{table_name, &table}}, plan);
+    EvalPlan* optimized = plan->optimize(*SQLExec::indices);
+    delete plan;
+    plan = optimized;
 
     // get handles to remove tuples from table and indices
     Handles* handles = plan->pipeline().second;
     IndexNames indices = SQLExec::indices->get_index_names(table_name);
     for (const Handle& handle : *handles) {
-        // FIXME: Implement index row del
-        // for (const Identifier& index : indices)
-        //     SQLExec::indices->get_index(table_name, index).del(handle);
+        for (const Identifier& index : indices)
+            SQLExec::indices->get_index(table_name, index).del(handle);
         table.del(handle);
     }
 
     size_t rows_n = handles->size();
     size_t indices_n = indices.size();
-    string suffix = indices_n ? " FIXME: and from " + to_string(indices_n) + " indices" : "";
+    string suffix = indices_n ? " and from " + to_string(indices_n) + " indices" : "";
     delete plan;
     delete handles;
     return new QueryResult("successfully deleted " + to_string(rows_n) + " rows" + suffix);
 }
 
+// The ORDER BY's sort keys, on the result's columns (by their names or aliases). An item that isn't one of them is
+// added to names and expressions as one more column, which the QueryResult leaves out. Returns the keys (freed by
+// caller).
+static SortKeys* get_order(const vector<OrderDescription*>& order, const FromTables& from, Grouping* grouping,
+                           ColumnNames& names, Expressions& expressions) {
+    SortKeys* keys = new SortKeys();
+    try {
+        for (const OrderDescription* item : order) {
+            const Expr* expr = item->expr;
+            Identifier name = expr->type == kExprColumnRef && expr->table == nullptr ?
+                              Identifier(expr->name) : ParseTreeToString::expression(expr);
+            if (find(names.begin(), names.end(), name) == names.end()) {
+                expressions.push_back(get_expression(expr, from, grouping));
+                names.push_back(name);
+            }
+            keys->push_back(make_pair(name, item->type == kOrderDesc));
+        }
+    } catch (SQLExecError& e) {
+        delete keys;
+        throw;
+    }
+    return keys;
+}
+
+// Is the query a grouped one: with a GROUP BY, or with aggregates in its select list or ORDER BY?
+static bool is_grouped(const SelectStatement* statement) {
+    bool grouped = statement->groupBy != nullptr;
+    for (const Expr* expr : *statement->selectList)
+        grouped = grouped || has_aggregate(expr);
+    if (statement->order != nullptr)
+        for (const OrderDescription* item : *statement->order)
+            grouped = grouped || has_aggregate(item->expr);
+    return grouped;
+}
+
+// The grouping and HAVING condition of a grouped query (or nullptr for neither, if it isn't one). Returns the
+// grouping (freed by caller), and sets having (freed by caller).
+static Grouping* get_grouping(const SelectStatement* statement, const FromTables& from, Expression*& having) {
+    having = nullptr;
+    if (!is_grouped(statement))
+        return nullptr;
+    unique_ptr<Grouping> grouping(new Grouping());
+    if (statement->groupBy != nullptr) {
+        get_group_by(statement->groupBy, from, *grouping);
+        if (statement->groupBy->having != nullptr) {
+            unique_ptr<Expression> condition(get_expression(statement->groupBy->having, from, grouping.get()));
+            if (condition->get_data_type() != ColumnAttribute::BOOLEAN)
+                throw SQLExecError("having clause must be a condition, not " +
+                                   string(type_name(condition->get_data_type())));
+            having = condition.release();
+        }
+    }
+    return grouping.release();
+}
+
+// Put the LIMIT (and OFFSET) on the plan, if there is one.
+static EvalPlan* limit_plan(const SelectStatement* statement, EvalPlan* plan) {
+    if (statement->limit == nullptr)
+        return plan;
+    int64_t limit = statement->limit->limit, offset = statement->limit->offset;
+    return new EvalPlan(limit < 0 ? EvalPlan::NO_LIMIT : (u_long) limit, offset < 0 ? 0 : (u_long) offset, plan);
+}
+
+// Put the grouping on the plan (an Aggregate, and a Filter for the HAVING condition, if there is one).
+static EvalPlan* group_plan(Grouping& grouping, Expression* having, EvalPlan* plan) {
+    plan = grouping.plan(plan);
+    if (having != nullptr)
+        plan = new EvalPlan(having, plan);
+    return plan;
+}
+
 QueryResult* SQLExec::select(const SelectStatement* statement) {
-    Identifier table_name = statement->fromTable->getName();
+    if (statement->fromTable->type != kTableName)
+        return select_join(statement);
+    DbRelation& table = get_table(statement->fromTable->name, "select from");
+    FromTables from = {{statement->fromTable->getName(), &table}};
 
-    // check table exists
-    ValueDict where = {{"table_name", Value(table_name)}};
-    Handles* tabMeta = SQLExec::tables->select(&where);
-    bool tableExists = !tabMeta->empty();
-    delete tabMeta;
-    if (!tableExists)
-        throw SQLExecError("attempting to select from non-existent table " + table_name);
-    DbRelation& table = SQLExec::tables->get_table(table_name);
+    // start base of plan at a TableScan, and enclose in selection (and filter) if where clause exists
+    EvalPlan* plan = new EvalPlan(table);
+    if (statement->whereClause)
+        plan = where_plan({statement->whereClause}, from, plan);
+
+    // a select list of just columns is a projection; anything else (or anything ordered or grouped) is computed
+    // from one
+    bool computed = statement->order != nullptr || is_grouped(statement);
+    for (const Expr* expr : *statement->selectList)
+        computed = computed || (expr->type != kExprStar && (expr->type != kExprColumnRef || expr->alias != nullptr));
     ColumnNames* cn = new ColumnNames();
-    for (const Expr* expr : *statement->selectList) {
-        if (expr->type == kExprStar)
-            for (const Identifier& col : table.get_column_names())
-                cn->push_back(col);
+    ColumnAttributes* ca = nullptr;
+    if (!computed) {
+        for (const Expr* expr : *statement->selectList) {
+            if (expr->type == kExprStar) {
+                for (const Identifier& col : table.get_column_names())
+                    cn->push_back(col);
+            } else {
+                ColumnAttribute::DataType data_type;
+                try {
+                    resolve_column(expr, from, data_type);
+                } catch (SQLExecError& e) {
+                    delete cn;
+                    delete plan;
+                    throw;
+                }
+                cn->push_back(expr->name);
+            }
+        }
+        // wrap in project (with its own copy of the column names, since cn goes with the result)
+        plan = new EvalPlan(new ColumnNames(*cn), plan);
+    } else {
+        Expressions* expressions = new Expressions();
+        ColumnNames* names = nullptr;
+        SortKeys* sort_keys = nullptr;
+        unique_ptr<Grouping> grouping;
+        unique_ptr<Expression> having;
+        try {
+            Expression* condition;
+            grouping.reset(get_grouping(statement, from, condition));
+            having.reset(condition);
+            for (const Expr* expr : *statement->selectList) {
+                if (expr->type == kExprStar) {
+                    if (grouping)
+                        throw SQLExecError("cannot select * from grouped rows");
+                    for (uint i = 0; i < table.get_column_names().size(); i++) {
+                        cn->push_back(table.get_column_names()[i]);
+                        expressions->push_back(new ColumnExpression(table.get_column_names()[i],
+                                                                    table.get_column_attributes()[i].get_data_type()));
+                    }
+                } else {
+                    expressions->push_back(get_expression(expr, from, grouping.get()));
+                    cn->push_back(expr->alias != nullptr ? expr->alias : ParseTreeToString::expression(expr));
+                }
+            }
+            names = new ColumnNames(*cn);
+            if (statement->order != nullptr)
+                sort_keys = get_order(*statement->order, from, grouping.get(), *names, *expressions);
+        } catch (SQLExecError& e) {
+            for (auto expression : *expressions)
+                delete expression;
+            delete expressions;
+            delete names;
+            delete cn;
+            delete plan;
+            throw;
+        }
+        // wrap in project of the columns the expressions use (or that the grouping does, and group that), and
+        // compute them from that (and sort them)
+        ColumnNames* projection = new ColumnNames();
+        ca = new ColumnAttributes();
+        if (grouping)
+            grouping->get_columns(*projection);
         else
-            cn->push_back(expr->name);
+            for (auto expression : *expressions)
+                expression->get_columns(*projection);
+        if (projection->empty())
+            projection->push_back(table.get_column_names()[0]);  // there's still a row for each of the table's
+        for (uint i = 0; i < cn->size(); i++)
+            ca->push_back(ColumnAttribute((*expressions)[i]->get_data_type()));
+        plan = new EvalPlan(projection, plan);
+        if (grouping)
+            plan = group_plan(*grouping, having.release(), plan);
+        plan = new EvalPlan(names, expressions, plan);
+        if (sort_keys != nullptr)
+            plan = new EvalPlan(sort_keys, plan);
     }
+    plan = limit_plan(statement, plan);
 
-    // start base of plan at a TableScan
-    EvalPlan* plan = new EvalPlan(table);
+    // optimize and evaluate
+    EvalPlan* optimized = plan->optimize(*SQLExec::indices);
+    delete plan;
+    plan = optimized;
+    ValueDicts* rows = plan->evaluate();
+    delete plan;
+    if (ca == nullptr)
+        ca = table.get_column_attributes(*cn);
+    return new QueryResult(cn, ca, rows, "successfully return " + to_string(rows->size()) + " rows");
+}
+
+// The tables a FROM clause of joins and/or a list of tables is on, and the joins' ON conditions.
+static void get_from(const TableRef* from, vector<const TableRef*>& tables, vector<const Expr*>& conditions) {
+    switch (from->type) {
+        case kTableName:
+            tables.push_back(from);
+            break;
+        case kTableJoin:
+            if (from->join->type != kJoinInner)
+                throw SQLExecError("only inner joins are supported");
+            get_from(from->join->left, tables, conditions);
+            get_from(from->join->right, tables, conditions);
+            if (from->join->condition != nullptr)
+                conditions.push_back(from->join->condition);
+            break;
+        case kTableCrossProduct:
+            for (const TableRef* table : *from->list)
+                get_from(table, tables, conditions);
+            break;
+        default:
+            throw SQLExecError("unsupported FROM clause");
+    }
+}
+
+// Split a condition at its ANDs.
+static void get_conjuncts(const Expr* condition, vector<const Expr*>& conjuncts) {
+    if (condition->type == kExprOperator && condition->opType == Expr::OperatorType::AND) {
+        get_conjuncts(condition->expr, conjuncts);
+        get_conjuncts(condition->expr2, conjuncts);
+    } else {
+        conjuncts.push_back(condition);
+    }
+}
 
-    // enclose in selection if where clause exists
+// Which of the FROM tables an expression has columns of, as a bit for each.
+static u_int64_t tables_of(const Expr* expr, const FromTables& from) {
+    if (expr == nullptr)
+        return 0;
+    if (expr->type == kExprColumnRef) {
+        ColumnAttribute::DataType data_type;
+        return (u_int64_t) 1 << resolve_column(expr, from, data_type);
+    }
+    u_int64_t tables = tables_of(expr->expr, from) | tables_of(expr->expr2, from);
+    if (expr->exprList != nullptr)
+        for (const Expr* e : *expr->exprList)
+            tables |= tables_of(e, from);
+    return tables;
+}
+
+// A join key: a column of each of two tables, whose values must be equal.
+struct JoinKey {
+    uint left_table, right_table;
+    Identifier left, right;  // column names in the joined rows
+};
+
+// Is the conjunct <column> = <column> with the columns from different tables (and of the same type), so the join
+// that brings the tables together can match rows on it? If it is, sets the key.
+static bool is_join_key(const Expr* conjunct, const FromTables& from, JoinKey& key) {
+    if (conjunct->type != kExprOperator || conjunct->opType != Expr::OperatorType::SIMPLE_OP ||
+        conjunct->opChar != '=' || conjunct->expr->type != kExprColumnRef || conjunct->expr2->type != kExprColumnRef)
+        return false;
+    ColumnAttribute::DataType left_type, right_type;
+    key.left_table = resolve_column(conjunct->expr, from, left_type);
+    key.right_table = resolve_column(conjunct->expr2, from, right_type);
+    if (key.left_table == key.right_table || left_type != right_type)
+        return false;
+    key.left = column_name(from, key.left_table, conjunct->expr->name);
+    key.right = column_name(from, key.right_table, conjunct->expr2->name);
+    return true;
+}
+
+// Are any of the table's columns (by their qualified names) among the used ones?
+static bool used_from(const ColumnNames& used, const FromTable& table) {
+    for (auto const& column_name : used)
+        if (column_name.compare(0, table.name.size() + 1, table.name + ".") == 0)
+            return true;
+    return false;
+}
+
+// A select on several tables. Each table's own conjuncts (of the where clause and the ON conditions) go on its
+// scan, which gets just the columns the query needs, renamed to their qualified names. The tables are joined in
+// FROM order, each join on the <column> = <column> conjuncts between the new table and the ones before it, and any
+// other conjunct is checked as soon as all its tables are joined. The select list is computed from the result.
+QueryResult* SQLExec::select_join(const SelectStatement* statement) {
+    vector<const TableRef*> table_refs;
+    vector<const Expr*> conditions, conjuncts;
+    get_from(statement->fromTable, table_refs, conditions);
     if (statement->whereClause)
-        plan = new EvalPlan(get_where_conjunction(statement->whereClause), plan);
-    
-    // wrap in project
-    plan = new EvalPlan(cn, plan);
+        conditions.push_back(statement->whereClause);
+    for (const Expr* condition : conditions)
+        get_conjuncts(condition, conjuncts);
+    FromTables from;
+    for (const TableRef* table_ref : table_refs) {
+        Identifier name = table_ref->getName();
+        for (auto const& table : from)
+            if (table.name == name)
+                throw SQLExecError("table " + name + " is in the FROM clause more than once (give it an alias)");
+        from.push_back({name, &get_table(table_ref->name, "select from")});
+    }
+    if (from.size() > 64)
+        throw SQLExecError("too many tables in FROM clause");
+
+    // sort out the conjuncts by the tables they're on
+    vector<vector<const Expr*>> table_conjuncts(from.size());
+    vector<JoinKey> keys;
+    vector<const Expr*> rest;
+    vector<u_int64_t> rest_tables;
+    for (const Expr* conjunct : conjuncts) {
+        u_int64_t tables = tables_of(conjunct, from);
+        JoinKey key;
+        if (tables != 0 && (tables & (tables - 1)) == 0) {
+            table_conjuncts[__builtin_ctzll(tables)].push_back(conjunct);
+        } else if (is_join_key(conjunct, from, key)) {
+            keys.push_back(key);
+        } else {
+            rest.push_back(conjunct);
+            rest_tables.push_back(tables);
+        }
+    }
+
+    ColumnNames* cn = new ColumnNames();
+    ColumnAttributes* ca = new ColumnAttributes();
+    Expressions* expressions = new Expressions();
+    Expressions filters;
+    ColumnNames* names = nullptr;
+    SortKeys* sort_keys = nullptr;
+    unique_ptr<Grouping> grouping;
+    unique_ptr<Expression> having;
+    EvalPlan* plan = nullptr;
+    try {
+        Expression* condition;
+        grouping.reset(get_grouping(statement, from, condition));
+        having.reset(condition);
+
+        // the select list (with * for all the tables' columns, qualified only where that's needed to tell them apart)
+        for (const Expr* expr : *statement->selectList) {
+            if (expr->type != kExprStar) {
+                expressions->push_back(get_expression(expr, from, grouping.get()));
+                cn->push_back(expr->alias != nullptr ? expr->alias : ParseTreeToString::expression(expr));
+                continue;
+            }
+            if (grouping)
+                throw SQLExecError("cannot select * from grouped rows");
+            for (uint i = 0; i < from.size(); i++) {
+                const ColumnNames& column_names = from[i].table->get_column_names();
+                for (uint j = 0; j < column_names.size(); j++) {
+                    uint tables = 0;
+                    for (auto const& table : from) {
+                        const ColumnNames& others = table.table->get_column_names();
+                        tables += find(others.begin(), others.end(), column_names[j]) != others.end();
+                    }
+                    Identifier name = column_name(from, i, column_names[j]);
+                    cn->push_back(tables > 1 ? name : column_names[j]);
+                    expressions->push_back(
+                            new ColumnExpression(name, from[i].table->get_column_attributes()[j].get_data_type()));
+                }
+            }
+        }
+        for (const Expr* conjunct : rest) {
+            filters.push_back(get_expression(conjunct, from));
+            if (filters.back()->get_data_type() != ColumnAttribute::BOOLEAN)
+                throw SQLExecError("where clause must be a condition, not " +
+                                   string(type_name(filters.back()->get_data_type())));
+        }
+        names = new ColumnNames(*cn);
+        if (statement->order != nullptr)
+            sort_keys = get_order(*statement->order, from, grouping.get(), *names, *expressions);
+        ColumnNames used;
+        if (grouping)
+            grouping->get_columns(used);
+        else
+            for (auto expression : *expressions)
+                expression->get_columns(used);
+        for (auto filter : filters)
+            filter->get_columns(used);
+        for (auto const& key : keys) {
+            used.push_back(key.left);
+            used.push_back(key.right);
+        }
+
+        u_int64_t joined = 0;
+        for (uint i = 0; i < from.size(); i++) {
+            // scan the table for its own conjuncts, and name the columns the rest of the plan uses by their
+            // qualified names (a table none are used from still gives one, so there's a row for each of its rows)
+            EvalPlan* scan = new EvalPlan(*from[i].table);
+            if (!table_conjuncts[i].empty())
+                scan = where_plan(table_conjuncts[i], {from[i]}, scan);
+            const ColumnNames& column_names = from[i].table->get_column_names();
+            ColumnNames* projection = new ColumnNames();
+            ColumnNames* qualified = new ColumnNames();
+            Expressions* columns = new Expressions();
+            for (uint j = 0; j < column_names.size(); j++) {
+                Identifier name = column_name(from, i, column_names[j]);
+                if (find(used.begin(), used.end(), name) == used.end() && (j > 0 || used_from(used, from[i])))
+                    continue;
+                ColumnAttribute::DataType data_type = from[i].table->get_column_attributes()[j].get_data_type();
+                projection->push_back(column_names[j]);
+                qualified->push_back(name);
+                columns->push_back(new ColumnExpression(column_names[j], data_type));
+            }
+            scan = new EvalPlan(qualified, columns, new EvalPlan(projection, scan));
+
+            // join it on its keys with the tables before it
+            if (plan == nullptr) {
+                plan = scan;
+            } else {
+                JoinKeys* join_keys = new JoinKeys();
+                for (auto const& key : keys) {
+                    if (key.right_table == i && key.left_table < i)
+                        join_keys->push_back({key.left, key.right});
+                    else if (key.left_table == i && key.right_table < i)
+                        join_keys->push_back({key.right, key.left});
+                }
+                plan = new EvalPlan(join_keys, plan, scan);
+            }
+            joined |= (u_int64_t) 1 << i;
+
+            // and check the conjuncts that have all their tables now
+            for (uint k = 0; k < filters.size(); k++) {
+                if (filters[k] != nullptr && (rest_tables[k] & ~joined) == 0) {
+                    plan = new EvalPlan(filters[k], plan);
+                    filters[k] = nullptr;
+                }
+            }
+        }
+    } catch (SQLExecError& e) {
+        for (auto expression : *expressions)
+            delete expression;
+        delete expressions;
+        for (auto filter : filters)
+            delete filter;
+        delete names;
+        delete cn;
+        delete ca;
+        delete plan;
+        throw;
+    }
+    for (uint i = 0; i < cn->size(); i++)
+        ca->push_back(ColumnAttribute((*expressions)[i]->get_data_type()));
+    if (grouping)
+        plan = group_plan(*grouping, having.release(), plan);
+    plan = new EvalPlan(names, expressions, plan);
+    if (sort_keys != nullptr)
+        plan = new EvalPlan(sort_keys, plan);
+    plan = limit_plan(statement, plan);
 
     // optimize and evaluate
-    plan = plan->optimize();
+    EvalPlan* optimized = plan->optimize(*SQLExec::indices);
+    delete plan;
+    plan = optimized;
     ValueDicts* rows = plan->evaluate();
     delete plan;
-    return new QueryResult(cn, table.get_column_attributes(*cn), rows, "successfully return " + to_string(rows->size()) + " rows");
+    return new QueryResult(cn, ca, rows, "successfully return " + to_string(rows->size()) + " rows");
 }
 
 /**
@@ -266,12 +1109,12 @@ void SQLExec::column_definition(const ColumnDefinition* col, Identifier& column_
  * @return Pointer to a QueryResult object containing the outcome of the CREATE operation.
  */
 
-QueryResult* SQLExec::create(const CreateStatement* statement) {
+QueryResult* SQLExec::create(const CreateStatement* statement, const ColumnNames& included) {
     switch(statement->type) {
         case CreateStatement::kTable:
             return create_table(statement);
         case CreateStatement::kIndex:
-            return create_index(statement);
+            return create_index(statement, included);
         default:
             return new QueryResult("not implemented");
     }
@@ -337,19 +1180,40 @@ QueryResult* SQLExec::create_table(const CreateStatement* statement) {
  * Handles the CREATE INDEX statement and physically creates a new table in the database based on the specs in the statement.
  * It updates schema tables (_tables,_columns,_indices)
  * @param statement Pointer to a CreateStatement object specifying the index to create.
+ * @param included  Columns whose values the index carries along with the key (BTREE or BTREE_MULTI only).
  * @return Pointer to a QueryResult object indicating the success of the index creation.
  * @throws DbRelationError if an error occurs during index creation.
  */
 
-QueryResult* SQLExec::create_index(const CreateStatement* statement) {
+QueryResult* SQLExec::create_index(const CreateStatement* statement, const ColumnNames& included) {
     DbRelation& table = SQLExec::tables->get_table(statement->tableName);
 
+    // USING BTREE (the default) is a unique BTree index, BTREE_MULTI a non-unique one (a key may have many rows)
+    string index_type = statement->indexType;
+    if (index_type != "BTREE" && index_type != "BTREE_MULTI" && index_type != "HASH")
+        throw SQLExecError("unknown index type " + index_type + " (use BTREE, BTREE_MULTI, or HASH)");
+
     // check that all the index columns exist in the table
     const ColumnNames& cn = table.get_column_names();
     for (char* column_name : *statement->indexColumns)
         if (find(cn.begin(), cn.end(), string(column_name)) == cn.end())
             throw SQLExecError("no such column " + string(column_name) + " in table " + statement->tableName);
 
+    // included columns go after the key in a BTree's entries (unique or not), so they can't be key columns, too
+    if (!included.empty() && index_type == "HASH")
+        throw SQLExecError("a HASH index can't have included columns");
+    if (statement->indexColumns->size() + included.size() > DbIndex::MAX_COMPOSITE)
+        throw SQLExecError("too many columns in index " + string(statement->indexName));
+    for (auto const& column_name : included) {
+        if (find(cn.begin(), cn.end(), column_name) == cn.end())
+            throw SQLExecError("no such column " + column_name + " in table " + statement->tableName);
+        for (char* key_column : *statement->indexColumns)
+            if (column_name == key_column)
+                throw SQLExecError("column " + column_name + " is already in the index key");
+        if (count(included.begin(), included.end(), column_name) > 1)
+            throw SQLExecError("column " + column_name + " is included twice");
+    }
+
     // insert a row for each column in index key into _indices
     ValueDict row = {
         {"table_name", Value(statement->tableName)},
@@ -357,13 +1221,20 @@ QueryResult* SQLExec::create_index(const CreateStatement* statement) {
         {"column_name", Value("")},
         {"seq_in_index", Value()},
         {"index_type", Value(statement->indexType)},
-        {"is_unique", Value(string(statement->indexType) == "BTREE")}
+        {"is_unique", Value(index_type == "BTREE")}
     };
     for (char* column_name : *statement->indexColumns) {
         row["column_name"] = Value(column_name);
         row["seq_in_index"].n += 1;
         SQLExec::indices->insert(&row);
     }
+    // included columns are numbered -1, -2, ... so they're told apart from the key columns
+    row["seq_in_index"].n = 0;
+    for (auto const& column_name : included) {
+        row["column_name"] = Value(column_name);
+        row["seq_in_index"].n -= 1;
+        SQLExec::indices->insert(&row);
+    }
 
     // call get_index to get a reference to the new index and then invoke the create method on it
     DbIndex& index = SQLExec::indices->get_index(string(statement->tableName), string(statement->indexName));
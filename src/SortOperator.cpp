@@ -0,0 +1,341 @@
+/**
+ * @file SortOperator.cpp - implementation of SortOperator and LoserTree
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include "SortOperator.h"
+
+using namespace std;
+
+/*************
+ * LoserTree *
+ *************/
+
+// Leaf i is node sources + i, so the interior nodes are 1 to sources - 1, and node n's children are 2n and 2n + 1.
+LoserTree::LoserTree(uint sources, function<bool(uint, uint)> less) : sources(sources), less(less),
+                                                                       tree(sources, 0) {
+    this->tree[0] = sources == 1 ? 0 : play(1);
+}
+
+// Ties go to the lower source (wherever it is in the tree), so a merge of runs in input order is stable.
+bool LoserTree::beats(uint a, uint b) const {
+    return this->less(a, b) || (!this->less(b, a) && a < b);
+}
+
+// Play the matches below the node, leaving the losers in the interior nodes. Returns the winner.
+uint LoserTree::play(uint node) {
+    if (node >= this->sources)
+        return node - this->sources;
+    uint left = play(2 * node), right = play(2 * node + 1);
+    bool right_wins = beats(right, left);
+    this->tree[node] = right_wins ? left : right;
+    return right_wins ? right : left;
+}
+
+void LoserTree::replay() {
+    uint winner = this->tree[0];
+    for (uint node = (this->sources + winner) / 2; node > 0; node /= 2) {
+        uint loser = this->tree[node];
+        if (beats(loser, winner)) {
+            this->tree[node] = winner;
+            winner = loser;
+        }
+    }
+    this->tree[0] = winner;
+}
+
+
+/****************
+ * SortOperator *
+ ****************/
+
+u_long SortOperator::memory_budget = SortOperator::DEFAULT_MEMORY_BUDGET;
+
+SortOperator::SortOperator(EvalOperator *input, const SortKeys &keys)
+        : BufferedOperator(), input(input), keys(keys), entries(), entries_bytes(0), entry_index(0), runs(), heads(),
+          tree(nullptr) {
+}
+
+SortOperator::~SortOperator() {
+    clear_entries();
+    clear_runs();
+    delete this->input;
+}
+
+NormalizedKey SortOperator::sort_key(const ValueDict &row, const SortKeys &keys) {
+    NormalizedKey key;
+    for (auto const &sort_key: keys) {
+        const Value &value = row.at(sort_key.first);
+        u_long start = key.size();
+        BTreeNode::normalize_value(value, value.data_type, key);
+        // a normalized value is never the prefix of another, so inverting its bytes reverses the order
+        if (sort_key.second)
+            for (u_long i = start; i < key.size(); i++)
+                key[i] = (char) ~key[i];
+    }
+    return key;
+}
+
+// Read all the input, sorting it in memory or into runs, and get ready to hand out the rows in order.
+void SortOperator::open() {
+    clear();
+    clear_entries();
+    clear_runs();
+    this->input->open();
+    for (ValueDict *row = this->input->next(); row != nullptr; row = this->input->next()) {
+        this->entries.push_back(Entry(sort_key(*row, this->keys), row));
+        this->entries_bytes += sizeof(Entry) + this->entries.back().first.capacity() + SpillFile::row_bytes(*row);
+        if (this->entries_bytes > memory_budget)
+            spill();
+    }
+    this->input->close();
+    if (!spilled()) {
+        stable_sort(this->entries.begin(), this->entries.end(),
+                    [](const Entry &a, const Entry &b) { return a.first < b.first; });
+        return;
+    }
+    if (!this->entries.empty())
+        spill();
+
+    // merge the first runs into one in their place until there are few enough to merge at once
+    while (this->runs.size() > MAX_FAN_IN) {
+        SpillFile *merged = new SpillFile();
+        start_merge(MAX_FAN_IN);
+        try {
+            for (ValueDict *row = next_merged(); row != nullptr; row = next_merged()) {
+                merged->write(*row);
+                delete row;
+            }
+        } catch (DbRelationError &e) {
+            delete merged;
+            throw;
+        }
+        for (uint i = 0; i < MAX_FAN_IN; i++)
+            delete this->runs[i];
+        this->runs.erase(this->runs.begin(), this->runs.begin() + MAX_FAN_IN);
+        this->runs.insert(this->runs.begin(), merged);
+    }
+    start_merge(this->runs.size());
+}
+
+void SortOperator::close() {
+    BufferedOperator::close();
+    clear_entries();
+    clear_runs();
+}
+
+// Sort the rows in memory and write them out as the next run.
+void SortOperator::spill() {
+    stable_sort(this->entries.begin(), this->entries.end(),
+                [](const Entry &a, const Entry &b) { return a.first < b.first; });
+    SpillFile *run = new SpillFile();
+    this->runs.push_back(run);
+    for (auto &entry: this->entries) {
+        run->write(*entry.second);
+        delete entry.second;
+        entry.second = nullptr;
+    }
+    clear_entries();
+}
+
+// Get ready to merge the first count runs: read their first rows and play the tournament.
+void SortOperator::start_merge(u_long count) {
+    for (auto const &head: this->heads)
+        delete head.second;
+    this->heads.clear();
+    delete this->tree;
+    this->tree = nullptr;
+    for (u_long i = 0; i < count; i++) {
+        this->runs[i]->rewind();
+        ValueDict *row = this->runs[i]->read();
+        this->heads.push_back(Entry(row != nullptr ? sort_key(*row, this->keys) : NormalizedKey(), row));
+    }
+    this->tree = new LoserTree((uint) count, [this](uint a, uint b) {
+        const Entry &head_a = this->heads[a], &head_b = this->heads[b];
+        return head_a.second != nullptr && (head_b.second == nullptr || head_a.first < head_b.first);
+    });
+}
+
+// The least of the runs' heads (freed by caller), replaced by the next row of its run. Returns nullptr when all
+// the runs are done.
+ValueDict *SortOperator::next_merged() {
+    uint winner = this->tree->winner();
+    Entry &head = this->heads[winner];
+    ValueDict *row = head.second;
+    if (row == nullptr)
+        return nullptr;
+    head.second = this->runs[winner]->read();
+    head.first = head.second != nullptr ? sort_key(*head.second, this->keys) : NormalizedKey();
+    this->tree->replay();
+    return row;
+}
+
+bool SortOperator::fill() {
+    if (spilled()) {
+        for (ValueDict *row = next_merged(); row != nullptr; row = next_merged()) {
+            this->buffer.push_back(row);
+            if (this->buffer.size() == BATCH_SIZE)
+                break;
+        }
+    } else {
+        u_long end = min(this->entry_index + BATCH_SIZE, (u_long) this->entries.size());
+        for (; this->entry_index < end; this->entry_index++) {
+            this->buffer.push_back(this->entries[this->entry_index].second);
+            this->entries[this->entry_index].second = nullptr;
+        }
+    }
+    return !this->buffer.empty();
+}
+
+void SortOperator::clear_entries() {
+    for (auto const &entry: this->entries)
+        delete entry.second;
+    this->entries.clear();
+    this->entries_bytes = 0;
+    this->entry_index = 0;
+}
+
+void SortOperator::clear_runs() {
+    for (auto const &head: this->heads)
+        delete head.second;
+    this->heads.clear();
+    delete this->tree;
+    this->tree = nullptr;
+    for (auto run: this->runs)
+        delete run;
+    this->runs.clear();
+}
+
+
+/****************
+ * TopNOperator *
+ ****************/
+
+TopNOperator::TopNOperator(EvalOperator *input, const SortKeys &keys, u_long count)
+        : BufferedOperator(), input(input), keys(keys), count(count), heap(), heap_index(0) {
+}
+
+TopNOperator::~TopNOperator() {
+    clear_heap();
+    delete this->input;
+}
+
+// Read all the input, keeping the first count rows in the heap, and then sort them.
+void TopNOperator::open() {
+    clear();
+    clear_heap();
+    this->input->open();
+    u_long sequence = 0;
+    for (ValueDict *row = this->count > 0 ? this->input->next() : nullptr; row != nullptr;
+         row = this->input->next(), sequence++) {
+        Ranked ranked = {SortOperator::sort_key(*row, this->keys), sequence, row};
+        if (this->heap.size() < this->count) {
+            this->heap.push_back(std::move(ranked));
+            push_heap(this->heap.begin(), this->heap.end());
+        } else if (ranked < this->heap.front()) {
+            pop_heap(this->heap.begin(), this->heap.end());
+            delete this->heap.back().row;
+            this->heap.back() = std::move(ranked);
+            push_heap(this->heap.begin(), this->heap.end());
+        } else {
+            delete row;
+        }
+    }
+    this->input->close();
+    sort_heap(this->heap.begin(), this->heap.end());
+}
+
+void TopNOperator::close() {
+    BufferedOperator::close();
+    clear_heap();
+}
+
+bool TopNOperator::fill() {
+    for (; this->heap_index < this->heap.size() && this->buffer.size() < SortOperator::BATCH_SIZE;
+           this->heap_index++) {
+        this->buffer.push_back(this->heap[this->heap_index].row);
+        this->heap[this->heap_index].row = nullptr;
+    }
+    return !this->buffer.empty();
+}
+
+void TopNOperator::clear_heap() {
+    for (auto const &ranked: this->heap)
+        delete ranked.row;
+    this->heap.clear();
+    this->heap_index = 0;
+}
+
+
+// Does row x come before row y on (b descending, a)?
+static bool in_test_order(const ValueDict *x, const ValueDict *y) {
+    if (x->at("b").s != y->at("b").s)
+        return x->at("b").s > y->at("b").s;
+    return x->at("a").n < y->at("a").n;
+}
+
+// Sort the rows on (b descending, a), and check that they come out in the same order as from std::stable_sort.
+static bool test_sort_rows(const ValueDicts &rows, const char *label) {
+    ValueDicts expected(rows);
+    stable_sort(expected.begin(), expected.end(), in_test_order);
+    SortOperator sort(new RowsOperator(rows), {{"b", true}, {"a", false}});
+    auto start = chrono::steady_clock::now();
+    sort.open();
+    bool spilled = sort.spilled();
+    bool ok = true;
+    u_long i = 0;
+    for (ValueDict *row = sort.next(); row != nullptr; row = sort.next(), i++) {
+        ok = ok && i < expected.size() && *row == *expected[i];
+        delete row;
+    }
+    sort.close();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << label << (spilled ? " (spilled)" : " (in memory)") << ": " << i << " rows, " << (long) (i / seconds)
+         << " rows/s" << endl;
+    if (!ok || i != expected.size())
+        cout << label << " came out in the wrong order" << endl;
+    return ok && i == expected.size();
+}
+
+// Check that the top count rows on (b descending, a) are the first count of them from std::stable_sort.
+static bool test_top_n(const ValueDicts &rows, u_long count) {
+    ValueDicts expected(rows);
+    stable_sort(expected.begin(), expected.end(), in_test_order);
+    expected.resize(min(count, (u_long) expected.size()));
+    TopNOperator top(new RowsOperator(rows), {{"b", true}, {"a", false}}, count);
+    top.open();
+    bool ok = true;
+    u_long i = 0;
+    for (ValueDict *row = top.next(); row != nullptr; row = top.next(), i++) {
+        ok = ok && i < expected.size() && *row == *expected[i];
+        delete row;
+    }
+    top.close();
+    if (!ok || i != expected.size())
+        cout << "top " << count << " came out wrong" << endl;
+    return ok && i == expected.size();
+}
+
+bool test_sort() {
+    // lots of ties on b (including texts that are prefixes of each other, and ones with nulls), and negative a's;
+    // c tells the ties apart, to check the sort is stable
+    mt19937 rng(5300);
+    ValueDicts rows;
+    for (int i = 0; i < 100000; i++) {
+        string b = string(rng() % 4, 'x') + (rng() % 2 ? string(1, '\0') : "") + to_string(rng() % 50);
+        rows.push_back(new ValueDict{{"a", Value((int32_t) (rng() % 2000) - 1000)}, {"b", Value(b)},
+                                     {"c", Value(i)}});
+    }
+    bool ok = test_sort_rows(rows, "sort");
+    u_long budget = SortOperator::memory_budget;
+    SortOperator::memory_budget = 64 * 1024;  // a couple of hundred runs, so there's a merge pass before the last
+    ok = ok && test_sort_rows(rows, "sort");
+    SortOperator::memory_budget = budget;
+    for (u_long count: {0UL, 1UL, 10UL, 1000UL, 200000UL})
+        ok = ok && test_top_n(rows, count);
+    for (auto row: rows)
+        delete row;
+    return ok;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file SpillFile.cpp - implementation of SpillFile, rows in a temporary file
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include "SpillFile.h"
+
+using namespace std;
+
+SpillFile::SpillFile() : file(tmpfile()), column_names(), rows(0), rows_read(0) {
+    if (this->file == nullptr)
+        throw DbRelationError("cannot make a temporary file to spill rows to");
+}
+
+SpillFile::~SpillFile() {
+    fclose(this->file);
+}
+
+void SpillFile::write(const ValueDict &row) {
+    if (this->rows == 0)
+        for (auto const &column: row)
+            this->column_names.push_back(column.first);
+    bool ok = true;
+    for (auto const &column: row) {
+        const Value &value = column.second;
+        char data_type = (char) value.data_type;
+        ok = ok && fwrite(&data_type, 1, 1, this->file) == 1;
+        if (value.data_type == ColumnAttribute::TEXT) {
+            u_int32_t size = (u_int32_t) value.s.size();
+            ok = ok && fwrite(&size, sizeof(size), 1, this->file) == 1 &&
+                 fwrite(value.s.data(), 1, size, this->file) == size;
+        } else {
+            ok = ok && fwrite(&value.n, sizeof(value.n), 1, this->file) == 1;
+        }
+    }
+    if (!ok)
+        throw DbRelationError("cannot write to spill file");
+    this->rows++;
+}
+
+// Flush what's been written, and read from the start.
+void SpillFile::rewind() {
+    if (fflush(this->file) != 0 || fseek(this->file, 0, SEEK_SET) != 0)
+        throw DbRelationError("cannot rewind spill file");
+    this->rows_read = 0;
+}
+
+ValueDict *SpillFile::read() {
+    if (this->rows_read == this->rows)
+        return nullptr;
+    ValueDict *row = new ValueDict();
+    bool ok = true;
+    for (auto const &column_name: this->column_names) {
+        Value value;
+        char data_type = 0;
+        ok = ok && fread(&data_type, 1, 1, this->file) == 1;
+        value.data_type = (ColumnAttribute::DataType) data_type;
+        if (value.data_type == ColumnAttribute::TEXT) {
+            u_int32_t size = 0;
+            ok = ok && fread(&size, sizeof(size), 1, this->file) == 1;
+            value.s.resize(ok ? size : 0);
+            ok = ok && fread(&value.s[0], 1, size, this->file) == size;
+        } else {
+            ok = ok && fread(&value.n, sizeof(value.n), 1, this->file) == 1;
+        }
+        (*row)[column_name] = value;
+    }
+    if (!ok) {
+        delete row;
+        throw DbRelationError("cannot read from spill file");
+    }
+    this->rows_read++;
+    return row;
+}
+
+// A map node (with its key and Value) for each column, plus the TEXT values' characters.
+u_long SpillFile::row_bytes(const ValueDict &row) {
+    u_long bytes = sizeof(ValueDict);
+    for (auto const &column: row)
+        bytes += 48 + sizeof(column) + column.first.capacity() + column.second.s.capacity();
+    return bytes;
+}
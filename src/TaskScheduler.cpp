@@ -0,0 +1,198 @@
+/**
+ * @file TaskScheduler.cpp - implementation of TaskScheduler, worker threads with work stealing
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <chrono>
+#include "TaskScheduler.h"
+#include "EvalOperator.h"
+#include "HeapTable.h"
+
+using namespace std;
+
+TaskScheduler::TaskScheduler(uint workers) : threads(), queues(), run_mutex(), mutex(), wake(), finished(),
+                                             job(nullptr), job_number(0), active(0), remaining(0), failed(false),
+                                             error(), stopping(false) {
+    if (workers == 0)
+        workers = max(1U, thread::hardware_concurrency());
+    this->queues.reset(new Queue[workers]);
+    for (uint worker = 0; worker < workers; worker++)
+        this->threads.push_back(thread(&TaskScheduler::work, this, worker));
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        lock_guard<std::mutex> guard(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (auto &worker: this->threads)
+        worker.join();
+}
+
+TaskScheduler &TaskScheduler::shared() {
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+// The morsels are dealt out while no worker is still in the last job (one that woke up late could otherwise take
+// a morsel of this job and do the last one's work on it).
+void TaskScheduler::run(u_long morsels, const Job &job) {
+    if (morsels == 0)
+        return;
+    lock_guard<std::mutex> run_guard(this->run_mutex);
+    unique_lock<std::mutex> lock(this->mutex);
+    this->finished.wait(lock, [this] { return this->active == 0; });
+    for (u_long morsel = 0; morsel < morsels; morsel++) {
+        Queue &queue = this->queues[morsel % size()];
+        lock_guard<std::mutex> guard(queue.mutex);
+        queue.morsels.push_back(morsel);
+    }
+    this->job = &job;
+    this->job_number++;
+    this->remaining = morsels;
+    this->failed = false;
+    this->error = nullptr;
+    this->wake.notify_all();
+    this->finished.wait(lock, [this] { return this->remaining == 0 && this->active == 0; });
+    if (this->error)
+        rethrow_exception(this->error);
+}
+
+void TaskScheduler::work(uint worker) {
+    u_long done_job = 0;
+    while (true) {
+        const Job *job;
+        {
+            unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(lock, [this, done_job] { return this->stopping || this->job_number != done_job; });
+            if (this->stopping)
+                return;
+            done_job = this->job_number;
+            job = this->job;
+            this->active++;
+        }
+        u_long morsel;
+        while (take(worker, morsel)) {
+            if (!this->failed) {
+                try {
+                    (*job)(morsel, worker);
+                } catch (...) {
+                    lock_guard<std::mutex> guard(this->mutex);
+                    if (!this->error)
+                        this->error = current_exception();
+                    this->failed = true;
+                }
+            }
+            this->remaining--;
+        }
+        lock_guard<std::mutex> guard(this->mutex);
+        this->active--;
+        if (this->remaining == 0 && this->active == 0)
+            this->finished.notify_all();
+    }
+}
+
+// A morsel from the back of the worker's own queue, or else from the front of another's.
+bool TaskScheduler::take(uint worker, u_long &morsel) {
+    for (uint i = 0; i < size(); i++) {
+        Queue &queue = this->queues[(worker + i) % size()];
+        lock_guard<std::mutex> guard(queue.mutex);
+        if (queue.morsels.empty())
+            continue;
+        if (i == 0) {
+            morsel = queue.morsels.back();
+            queue.morsels.pop_back();
+        } else {
+            morsel = queue.morsels.front();
+            queue.morsels.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+
+// Time a scan of the table with the given operator. Returns the rows it got (freed by caller).
+static ValueDicts *time_scan(EvalOperator &scan, const char *label, u_long table_rows) {
+    auto start = chrono::steady_clock::now();
+    ValueDicts *rows = new ValueDicts();
+    scan.open();
+    for (ValueDict *row = scan.next(); row != nullptr; row = scan.next())
+        rows->push_back(row);
+    scan.close();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << label << ": " << (long) (table_rows / seconds) << " rows/s" << endl;
+    return rows;
+}
+
+bool test_task_scheduler() {
+    // every morsel is done once, however the workers steal them
+    TaskScheduler scheduler(4);
+    const u_long n = 10000;
+    vector<atomic<int>> done(n);
+    for (auto &d: done)
+        d = 0;
+    atomic<u_long> sum(0);
+    for (int round = 0; round < 3; round++) {
+        scheduler.run(n, [&](u_long morsel, uint worker) {
+            if (morsel % 100 == 0)
+                this_thread::sleep_for(chrono::microseconds(200));  // some slow ones, to be stolen around
+            done[morsel]++;
+            sum += morsel;
+        });
+    }
+    for (auto &d: done) {
+        if (d != 3) {
+            cout << "task scheduler morsel done " << d << " times" << endl;
+            return false;
+        }
+    }
+    if (sum != 3 * n * (n - 1) / 2)
+        return false;
+    try {
+        scheduler.run(100, [](u_long morsel, uint worker) {
+            if (morsel == 42)
+                throw DbRelationError("morsel 42");
+        });
+        cout << "task scheduler should have passed on the exception" << endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+
+    // a parallel scan gets the same rows, in the same order, as a serial one
+    ColumnNames column_names = {"a", "b", "c"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable table("__test_task_scheduler", column_names, column_attributes);
+    table.create();
+    const int table_rows = 100000;
+    ValueDict row;
+    for (int i = 0; i < table_rows; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(i % 1000);
+        row["c"] = Value("row " + to_string(i));
+        table.insert(&row);
+    }
+    ColumnNames projection = {"a", "c"};
+    Conjunction where = {Comparison("b", Comparison::LT, Value(10))};
+    VectorScanOperator serial(table, projection, where);
+    ParallelScanOperator parallel(table, projection, where, nullptr, scheduler);
+    ValueDicts *expected = time_scan(serial, "serial scan", table_rows);
+    string label = "parallel scan (" + to_string(scheduler.size()) + " workers, " +
+                   to_string(thread::hardware_concurrency()) + " cores)";
+    ValueDicts *got = time_scan(parallel, label.c_str(), table_rows);
+    bool ok = expected->size() == table_rows / 100 && got->size() == expected->size();
+    for (u_long i = 0; i < expected->size(); i++) {
+        ok = ok && i < got->size() && *(*got)[i] == *(*expected)[i];
+        delete (*expected)[i];
+        if (i < got->size())
+            delete (*got)[i];
+    }
+    delete expected;
+    delete got;
+    table.drop();
+    if (!ok)
+        cout << "parallel scan got different rows" << endl;
+    return ok;
+}
@@ -3,55 +3,224 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include "btree.h"
+#include "BTreeLoader.h"
 
-BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
-                                                                                                              name,
-                                                                                                              key_columns,
-                                                                                                              unique),
-                                                                                                      closed(true),
-                                                                                                      stat(nullptr),
-                                                                                                      root(nullptr),
-                                                                                                      file(relation.get_table_name() +
-                                                                                                           "-" + name),
-                                                                                                      key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
+// Get the latch for a block, making it if this is the first time.
+std::shared_mutex &BTreeLatches::operator[](BlockID block_id) {
+    Shard &shard = shards[block_id % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    std::unique_ptr<std::shared_mutex> &latch = shard.latches[block_id];
+    if (!latch)
+        latch.reset(new std::shared_mutex());
+    return *latch;
+}
+
+BTreeAdaptiveHash::BTreeAdaptiveHash(u_long budget) : shards(), budget(budget), lookups(0), hits(0) {}
+
+// The new budget is in place before the table is emptied, so offers made meanwhile keep to it.
+void BTreeAdaptiveHash::set_budget(u_long budget) {
+    this->budget = budget;
+    clear();
+}
+
+// A miss counts as a lookup of the key toward it getting hot.
+Handles *BTreeAdaptiveHash::find(const NormalizedKey &key, u_int64_t &version) {
+    if (budget == 0)
+        return nullptr;
+    lookups++;
+    size_t h = std::hash<NormalizedKey>()(key);
+    Shard &shard = shards[h % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    auto entry = shard.entries.find(key);
+    if (entry != shard.entries.end()) {
+        hits++;
+        shard.recent.splice(shard.recent.begin(), shard.recent, entry->second.recent);
+        return new Handles(entry->second.handles);
+    }
+    version = shard.version;
+    u_int8_t &count = shard.counts[h / SHARDS % COUNTERS];
+    if (count < UINT8_MAX)
+        count++;
+    if (++shard.counted >= 8 * COUNTERS) {
+        for (auto &c: shard.counts)
+            c /= 2;
+        shard.counted = 0;
+    }
+    return nullptr;
+}
+
+// The budget is read just once, so a set_budget meanwhile can't change the shard's limit partway through.
+void BTreeAdaptiveHash::offer(const NormalizedKey &key, const Handles &handles, u_int64_t version) {
+    u_long limit = budget / SHARDS;
+    if (limit == 0)
+        return;
+    size_t h = std::hash<NormalizedKey>()(key);
+    Shard &shard = shards[h % SHARDS];
+    u_long bytes = entry_bytes(key, handles);
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    if (shard.version != version || shard.counts[h / SHARDS % COUNTERS] < HOT_LOOKUPS || bytes > limit)
+        return;
+    if (shard.entries.count(key) > 0)
+        return;  // another thread just cached it
+    while (shard.bytes + bytes > limit)
+        evict(shard, shard.entries.find(shard.recent.back()));
+    shard.recent.push_front(key);
+    shard.entries[key] = Entry{handles, shard.recent.begin()};
+    shard.bytes += bytes;
+}
+
+void BTreeAdaptiveHash::invalidate(const NormalizedKey &key) {
+    if (budget == 0)
+        return;
+    Shard &shard = shards[std::hash<NormalizedKey>()(key) % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    shard.version++;
+    auto entry = shard.entries.find(key);
+    if (entry != shard.entries.end())
+        evict(shard, entry);
+}
+
+void BTreeAdaptiveHash::clear() {
+    for (auto &shard: shards) {
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        shard.version++;
+        shard.entries.clear();
+        shard.recent.clear();
+        shard.bytes = 0;
+    }
+}
+
+u_long BTreeAdaptiveHash::byte_size() const {
+    u_long bytes = 0;
+    for (auto &shard: shards) {
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}
+
+u_long BTreeAdaptiveHash::entry_bytes(const NormalizedKey &key, const Handles &handles) {
+    return ENTRY_OVERHEAD + 2 * key.size() + handles.size() * sizeof(Handle);  // the key is in the map and the list
+}
+
+void BTreeAdaptiveHash::evict(Shard &shard, std::unordered_map<NormalizedKey, Entry>::iterator entry) {
+    shard.bytes -= entry_bytes(entry->first, entry->second.handles);
+    shard.recent.erase(entry->second.recent);
+    shard.entries.erase(entry);
+}
+
+BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+                       ColumnNames included) : DbIndex(relation, name, key_columns, unique),
+                                               included(included),
+                                               entry_columns(key_columns),
+                                               closed(true),
+                                               stat(nullptr),
+                                               stat_latch(),
+                                               file(relation.get_table_name() + "-" + name),
+                                               latches(),
+                                               key_profile(),
+                                               fill_factor(DEFAULT_FILL_FACTOR),
+                                               sort_budget(DEFAULT_SORT_BUDGET),
+                                               bloom_rate(0.0),
+                                               bloom(nullptr),
+                                               bloom_file(nullptr),
+                                               hot_keys(),
+                                               rightmost_mutex(),
+                                               rightmost(0),
+                                               right_low() {
+    entry_columns.insert(entry_columns.end(), included.begin(), included.end());
     build_key_profile();
 }
 
 BTreeIndex::~BTreeIndex() {
     delete stat;
-    delete root;
+    delete bloom;
+    delete bloom_file;
 }
 
-// Create the index.
+// Create the index. The existing rows' keys are gathered in one pass, a block of the table at a time (so each
+// block is read for its handles and then for all its rows' keys at once, not once per row), sorted (spilling to
+// disk if needed), and the tree is built bottom-up with each block filled to fill_factor. A Bloom filter is sized
+// for the table's rows, so with one the blocks are first gone through to count them.
 void BTreeIndex::create() {
     file.create();
     stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
     closed = false;
-    Handles *table_rows = relation.select();
-    for (auto const &row: *table_rows)
-        insert(row);
-    delete table_rows;
+    BTreeLoader loader(file, key_profile, relation.get_table_name() + "-" + name, unique, key_columns.size(),
+                       fill_factor, sort_budget);
+    BlockIDs *block_ids = relation.block_ids();
+    delete bloom;
+    bloom = nullptr;
+    if (bloom_rate > 0.0) {
+        u_long rows = 0;
+        for (auto const &block_id: *block_ids) {
+            Handles *handles = relation.select_block(block_id);
+            rows += handles->size();
+            delete handles;
+        }
+        bloom = new BloomFilter(rows, bloom_rate);
+    }
+    stat->set_bloom(bloom != nullptr);
+    for (auto const &block_id: *block_ids) {
+        Handles *handles = relation.select_block(block_id);
+        ValueDicts *key_dicts = relation.project(handles, &entry_columns);
+        for (u_long i = 0; i < handles->size(); i++) {
+            NormalizedKey key = nkey((*key_dicts)[i]);
+            loader.add(key, (*handles)[i]);
+            if (bloom != nullptr)
+                bloom->add(unique_part(key));
+            delete (*key_dicts)[i];
+        }
+        delete key_dicts;
+        delete handles;
+    }
+    delete block_ids;
+    loader.build(stat);
+    forget_rightmost();
+    hot_keys.clear();
+    if (bloom != nullptr) {
+        bloom_file = new_bloom_file();
+        bloom_file->create();
+        bloom->save(*bloom_file, 1);
+    }
 }
 
-// Drop the index.
+// Drop the index (and its Bloom filter, if its stat block says it has one).
 void BTreeIndex::drop() {
+    open();
+    if (bloom_file != nullptr) {
+        bloom_file->drop();
+        delete bloom_file;
+        bloom_file = nullptr;
+    }
+    delete bloom;
+    bloom = nullptr;
     file.drop();
+    delete stat;
+    stat = nullptr;
+    forget_rightmost();
+    hot_keys.clear();
+    closed = true;
 }
 
 // Open existing index. Enables: lookup, range, insert, delete, update.
+// (Not thread safe: open the index before sharing it between threads.)
 void BTreeIndex::open() {
     if (closed) {
         file.open();
         stat = new BTreeStat(file, STAT, key_profile);
-        if (stat->get_height() == 1)
-            root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
-        else
-            root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+        if (stat->has_bloom()) {
+            bloom_file = new_bloom_file();
+            bloom_file->open();
+            bloom = BloomFilter::load(*bloom_file, 1);
+        }
+        forget_rightmost();
+        closed = false;
     }
 }
 
@@ -61,92 +230,486 @@ void BTreeIndex::close() {
         file.close();
         delete stat;
         stat = nullptr;
-        delete root;
-        root = nullptr;
+        if (bloom_file != nullptr) {
+            bloom_file->close();
+            delete bloom_file;
+            bloom_file = nullptr;
+        }
+        delete bloom;
+        bloom = nullptr;
+        forget_rightmost();
+        hot_keys.clear();
         closed = true;
     }
 }
 
+// Where the tree starts, as of now (another thread may grow a new root at any time).
+void BTreeIndex::root_snapshot(BlockID &root_id, uint &height) const {
+    std::shared_lock<std::shared_mutex> latch(stat_latch);
+    root_id = stat->get_root_id();
+    height = stat->get_height();
+}
+
+// Follow key down from the root to the given level (1 is the leaves), moving right past any node that has
+// split since its parent was read. Only one node is latched at a time. Returns the block to start from on that
+// level (it may have split by the time the caller latches it, too). If path isn't null, it gets the block we
+// went through on each level above, indexed by level.
+BlockID BTreeIndex::descend(const NormalizedKey &key, uint level, BlockPointers *path) const {
+    BlockID block_id;
+    uint height;
+    root_snapshot(block_id, height);
+    if (path != nullptr)
+        path->assign(height + 1, 0);
+    while (height > level) {
+        std::shared_lock<std::shared_mutex> latch(latches[block_id]);
+        BTreeInterior node(file, block_id, key_profile, false);
+        if (!node.covers(key)) {
+            block_id = node.get_right();
+            continue;
+        }
+        if (path != nullptr)
+            (*path)[height] = block_id;
+        block_id = node.find_child(key);
+        height--;
+    }
+    return block_id;
+}
+
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
-// names in the index. Returns a list of row handles.
+// names in the index, or the first few of them (then all the rows with those are found). Returns a list of
+// row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
-    KeyValue *key = tkey(key_dict);
-    Handles *handles = _lookup(root, stat->get_height(), key);
-    delete key;
+    // a key the Bloom filter hasn't seen isn't there
+    NormalizedKey key = nkey(key_dict);
+    uint size = tkey_size(key_dict);
+    if (bloom != nullptr && size >= key_columns.size() && !bloom->may_contain(unique_part(key)))
+        return new Handles();
+
+    // the keys for just the first few columns (or without the included ones) are the range of keys starting with them
+    if (size < entry_columns.size())
+        return range(key_dict, key_dict);
+
+    // hot keys are answered from memory, without going down the tree
+    u_int64_t version = 0;
+    Handles *handles = hot_keys.find(key, version);
+    if (handles != nullptr)
+        return handles;
+
+    BlockID block_id = descend(key, 1, nullptr);
+    while (true) {
+        // the leaf stays latched while we read its postings (which may go on to overflow blocks)
+        std::shared_lock<std::shared_mutex> latch(latches[block_id]);
+        BTreeLeaf leaf(file, block_id, key_profile, false);
+        if (leaf.covers(key)) {
+            handles = leaf.find_eq(key);
+            hot_keys.offer(key, *handles, version);
+            return handles;
+        }
+        block_id = leaf.get_right();
+    }
+}
+
+// Look up the keys in sorted order, so that each leaf is read just once, however many of the keys are in it, and
+// each descent starts from the lowest interior node read for the key before that still covers the new key (the
+// copies of those nodes may be out of date, but as in descend, a node that has split since is just followed
+// right). Keys for just the first few columns are each done as a range by lookup, and keys the Bloom filter
+// rules out aren't looked for at all.
+HandleLists *BTreeIndex::lookup_many(const ValueDicts &keys) const {
+    HandleLists *ret = new HandleLists(keys.size(), nullptr);
+    std::vector<std::pair<NormalizedKey, u_long>> probes;
+    for (u_long i = 0; i < keys.size(); i++) {
+        if (tkey_size(keys[i]) < entry_columns.size()) {
+            (*ret)[i] = lookup(keys[i]);
+            continue;
+        }
+        NormalizedKey key = nkey(keys[i]);
+        if (bloom != nullptr && !bloom->may_contain(unique_part(key)))
+            (*ret)[i] = new Handles();
+        else
+            probes.push_back(std::make_pair(key, i));
+    }
+    std::sort(probes.begin(), probes.end());
+
+    std::vector<BTreeInterior *> interiors;  // last node read on each interior level, indexed by level
+    std::shared_lock<std::shared_mutex> latch;
+    BTreeLeaf *leaf = nullptr;
+    for (u_long i = 0; i < probes.size(); i++) {
+        const NormalizedKey &key = probes[i].first;
+        if (i > 0 && key == probes[i - 1].first) {
+            (*ret)[probes[i].second] = new Handles(*(*ret)[probes[i - 1].second]);
+            continue;
+        }
+        // keys come in order, so the leaf we have covers this one, or the one we want is to its right
+        if (leaf == nullptr || !leaf->covers(key)) {
+            // (readers hold one latch at a time, so let go of the leaf first)
+            delete leaf;
+            if (latch.owns_lock())
+                latch.unlock();
+            BlockID block_id = descend_from(key, interiors);
+            latch = std::shared_lock<std::shared_mutex>(latches[block_id]);
+            leaf = new BTreeLeaf(file, block_id, key_profile, false);
+            while (!leaf->covers(key)) {
+                block_id = leaf->get_right();
+                delete leaf;
+                latch = std::shared_lock<std::shared_mutex>(latches[block_id]);
+                leaf = new BTreeLeaf(file, block_id, key_profile, false);
+            }
+        }
+        (*ret)[probes[i].second] = leaf->find_eq(key);
+    }
+    delete leaf;
+    for (auto const &node: interiors)
+        delete node;
+    return ret;
+}
+
+// Like descend(key, 1, nullptr), but starting from the lowest of the interior nodes last read (if any) that covers
+// key, and keeping the nodes read on the way down in their place.
+BlockID BTreeIndex::descend_from(const NormalizedKey &key, std::vector<BTreeInterior *> &interiors) const {
+    uint level = 2;
+    while (level < interiors.size() && (interiors[level] == nullptr || !interiors[level]->covers(key)))
+        level++;
+    BlockID block_id;
+    if (level < interiors.size()) {
+        block_id = interiors[level]->find_child(key);
+        level--;
+    } else {
+        // none cover it (or we've just started), so from the root
+        root_snapshot(block_id, level);
+        for (auto const &node: interiors)
+            delete node;
+        interiors.assign(level + 1, nullptr);
+    }
+    while (level > 1) {
+        std::shared_lock<std::shared_mutex> latch(latches[block_id]);
+        BTreeInterior *node = new BTreeInterior(file, block_id, key_profile, false);
+        while (!node->covers(key)) {
+            block_id = node->get_right();
+            delete node;
+            latch = std::shared_lock<std::shared_mutex>(latches[block_id]);
+            node = new BTreeInterior(file, block_id, key_profile, false);
+        }
+        delete interiors[level];
+        interiors[level] = node;
+        block_id = node->find_child(key);
+        level--;
+    }
+    return block_id;
+}
+
+// Handles for the keys from min_key to max_key, inclusive, in key order. Either may be nullptr for no limit, and
+// either may have values for just the first few key columns: then max_key takes in all the keys starting with it.
+Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key, u_long limit) const {
+    Handles *handles = new Handles();
+    scan(min_key, max_key, *handles, nullptr, limit);
     return handles;
 }
 
-Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key) const {
-    // Base case: node is a leaf
-    if (height == 1) {
-        BTreeLeaf *leaf = dynamic_cast<BTreeLeaf *>(node);
-        try {
-            return new Handles{leaf->find_eq(key)};
-        } catch (std::out_of_range &e) {
-            return new Handles();
+// Values of the key and included columns for each row whose key columns are equal to key (see lookup), without
+// reading the rows.
+ValueDicts *BTreeIndex::lookup_values(ValueDict *key) const {
+    return range_values(key, key);
+}
+
+// Values of the key and included columns for each row from min_key to max_key (see range), in key order, without
+// reading the rows.
+ValueDicts *BTreeIndex::range_values(ValueDict *min_key, ValueDict *max_key, u_long limit) const {
+    Handles handles;
+    NormalizedKeys keys;
+    scan(min_key, max_key, handles, &keys, limit);
+    ValueDicts *rows = new ValueDicts();
+    rows->reserve(keys.size());
+    for (auto const &key: keys) {
+        KeyValue *key_value = BTreeNode::denormalize(key, key_profile);
+        ValueDict *row = new ValueDict();
+        for (uint i = 0; i < entry_columns.size(); i++)
+            (*row)[entry_columns[i]] = (*key_value)[i];
+        delete key_value;
+        rows->push_back(row);
+    }
+    return rows;
+}
+
+// Add the handles for the keys from min_key to max_key to handles (and the keys themselves, one per handle, to keys
+// if it isn't nullptr), or just the first limit of them (if limit isn't 0), stopping at the leaf they end in.
+void BTreeIndex::scan(const ValueDict *min_key, const ValueDict *max_key, Handles &handles, NormalizedKeys *keys,
+                      u_long limit) const {
+    NormalizedKey low = min_key == nullptr ? NormalizedKey() : nkey(min_key);
+    NormalizedKey high = max_key == nullptr ? NormalizedKey() : nkey(max_key);
+    BlockID block_id = descend(low, 1, nullptr);
+    while (block_id != 0) {
+        std::shared_lock<std::shared_mutex> latch(latches[block_id]);
+        BTreeLeaf leaf(file, block_id, key_profile, false);
+        if (!leaf.covers(low)) {
+            block_id = leaf.get_right();
+            continue;
         }
+        leaf.find_range(low, max_key == nullptr ? nullptr : &high, handles, keys);
+        if (limit != 0 && handles.size() >= limit) {
+            handles.resize(limit);
+            if (keys != nullptr)
+                keys->resize(limit);
+            break;
+        }
+
+        // the next leaf's keys start at this one's high key; after that, later keys are past the limit too
+        block_id = leaf.get_right();
+        if (max_key != nullptr && !BTreeNode::up_to(leaf.get_high_key(), high))
+            block_id = 0;
+
+        // from now on, every key in a leaf is at least low
+        low = leaf.get_high_key();
+    }
+}
+
+// Write-latch the node that covers key, starting at block_id and moving right along its level as needed (the
+// next node is latched before letting go of the one before it). Returns the node (freed by caller), held by latch.
+template<class Node>
+Node *BTreeIndex::latch_covering(const NormalizedKey &key, BlockID block_id,
+                                 std::unique_lock<std::shared_mutex> &latch) {
+    latch = std::unique_lock<std::shared_mutex>(latches[block_id]);
+    Node *node = new Node(file, block_id, key_profile, false);
+    while (!node->covers(key)) {
+        block_id = node->get_right();
+        delete node;
+        std::unique_lock<std::shared_mutex> right(latches[block_id]);
+        latch.swap(right);
+        right.unlock();
+        node = new Node(file, block_id, key_profile, false);
     }
-    // Recursive case: node is an interior node
-    BTreeInterior *interior = dynamic_cast<BTreeInterior *>(node);
-    BTreeNode *next_node = interior->find(key, height);
-    Handles *result = _lookup(next_node, height - 1, key);
-    delete next_node;
-    return result;
+    return node;
 }
 
-Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME
+// Write-latch the leaf that covers the key columns of key (the part that has to be unique when there are included
+// columns) and make sure no entry has them yet, reading on to the right while the entries could still start with
+// them. Every insert with the same key columns latches the same leaf first, so they check one at a time. Returns
+// the leaf (freed by caller), held by first_latch.
+BTreeLeaf *BTreeIndex::latch_unique(const NormalizedKey &key, BlockPointers &path,
+                                    std::unique_lock<std::shared_mutex> &first_latch) {
+    NormalizedKey prefix = unique_part(key);
+    BTreeLeaf *first = latch_covering<BTreeLeaf>(prefix, descend(prefix, 1, &path), first_latch);
+    if (bloom != nullptr && !bloom->may_contain(prefix))
+        return first;  // the key columns are new (the caller adds them to the filter before letting go of first)
+    Handles handles;
+    first->find_range(prefix, &prefix, handles);
+    BlockID block_id = first->get_right();
+    bool more = block_id != 0 && BTreeNode::up_to(first->get_high_key(), prefix);
+    while (handles.empty() && more) {
+        std::shared_lock<std::shared_mutex> latch(latches[block_id]);
+        BTreeLeaf leaf(file, block_id, key_profile, false);
+        leaf.find_range(prefix, &prefix, handles);
+        block_id = leaf.get_right();
+        more = block_id != 0 && BTreeNode::up_to(leaf.get_high_key(), prefix);
+    }
+    if (!handles.empty()) {
+        delete first;
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    }
+    return first;
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
 void BTreeIndex::insert(Handle handle) {
     open();
-    ValueDict *key = relation.project(handle);
-    KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
-    if (!BTreeNode::insertion_is_none(insertion)) {
-        auto *new_root = new BTreeInterior(file, 0, key_profile, true);
-        new_root->set_first(root->get_id());
-        new_root->insert(&insertion.second, insertion.first);
-        new_root->save();
-        stat->set_root_id(new_root->get_id());
-        stat->set_height(stat->get_height() + 1);
-        stat->save();
-        delete root;
-        root = new_root;
-        std::cout << "new root: " << *new_root << std::endl;
-    }
-    delete key;
-    delete tkey;
-}
-
-// Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle) {
-    if (height == 1) {
-        auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        return leaf->insert(key, handle);
+    ValueDict *key_dict = relation.project(handle, &entry_columns);
+    NormalizedKey key = nkey(key_dict);
+    delete key_dict;
+
+    BlockPointers path;
+    std::unique_lock<std::shared_mutex> latch;
+    std::unique_lock<std::shared_mutex> unique_latch;  // held until the key is in, if it was checked by latch_unique
+    BTreeLeaf *leaf;
+    if (unique && !included.empty()) {
+        leaf = latch_unique(key, path, unique_latch);
+        if (leaf->covers(key)) {
+            latch.swap(unique_latch);
+        } else {
+            BlockID right = leaf->get_right();
+            delete leaf;
+            leaf = latch_covering<BTreeLeaf>(key, right, latch);
+        }
     } else {
-        auto *interior = dynamic_cast<BTreeInterior *>(node);
-        Insertion insertion = _insert(interior->find(key, height), height - 1, key, handle);
-        if (!BTreeNode::insertion_is_none(insertion))
-            insertion = interior->insert(&insertion.second, insertion.first);
-        return insertion;
+        // keys at the right edge start from the rightmost leaf, the rest from the root
+        BlockID block_id = rightmost_for(key);
+        if (block_id == 0)
+            block_id = descend(key, 1, &path);
+        leaf = latch_covering<BTreeLeaf>(key, block_id, latch);
+    }
+    if (bloom != nullptr)
+        bloom->add(unique_part(key));
+    bool last = leaf->get_right() == 0;
+    BlockID leaf_id = leaf->get_id();
+    Insertion insertion;
+    try {
+        insertion = leaf->insert(key, handle, unique);
+    } catch (DbRelationError &e) {
+        delete leaf;
+        throw;
+    }
+    hot_keys.invalidate(key);  // while the leaf is still latched
+    delete leaf;
+    if (BTreeNode::insertion_is_none(insertion))
+        return;
+
+    // if the rightmost leaf split, the new sister is the rightmost leaf now
+    if (last) {
+        std::lock_guard<std::mutex> guard(rightmost_mutex);
+        rightmost = insertion.first;
+        right_low = insertion.second;
+    }
+    insert_above(2, path, leaf_id, insertion, latch);
+}
+
+// Put the (new node, boundary) from a split of child_id into the level above it, and so on up as long as the
+// nodes there split, too. The child is still latched, by child_latch, until its parent is.
+void BTreeIndex::insert_above(uint level, const BlockPointers &path, BlockID child_id, Insertion insertion,
+                              std::unique_lock<std::shared_mutex> &child_latch) {
+    while (!BTreeNode::insertion_is_none(insertion)) {
+        BlockID parent_id = level < path.size() ? path[level] : 0;
+        while (parent_id == 0) {
+            // we didn't come down through this level (we started at the rightmost leaf, or the tree has grown)
+            std::unique_lock<std::shared_mutex> stat_lock(stat_latch);
+            if (stat->get_root_id() == child_id) {
+                grow_root(child_id, insertion);
+                return;
+            }
+            bool grown = stat->get_height() >= level;
+            stat_lock.unlock();
+            if (grown)
+                parent_id = descend(insertion.second, level, nullptr);
+            else
+                std::this_thread::yield();  // the root split and the thread that split it hasn't grown a new one yet
+        }
+
+        // the parent of the child that split is the node on this level that covers the new boundary
+        std::unique_lock<std::shared_mutex> latch;
+        BTreeInterior *parent = latch_covering<BTreeInterior>(insertion.second, parent_id, latch);
+        child_latch.unlock();
+        insertion = parent->insert(insertion.second, insertion.first);
+        child_id = parent->get_id();
+        delete parent;
+        child_latch.swap(latch);
+        level++;
+    }
+}
+
+// The root split, so put a new root above it and its new sister. Called with stat_latch held for writing.
+void BTreeIndex::grow_root(BlockID old_root, Insertion insertion) {
+    auto *new_root = new BTreeInterior(file, 0, key_profile, true);
+    new_root->set_first(old_root);
+    new_root->insert(insertion.second, insertion.first);
+    new_root->save();
+    stat->set_root_id(new_root->get_id());
+    stat->set_height(stat->get_height() + 1);
+    stat->save();
+    // std::cout << "new root: " << *new_root << std::endl; // DEBUG
+    delete new_root;
+}
+
+// The rightmost leaf if key goes in it or to its right (loading it if we don't have it yet), otherwise 0.
+BlockID BTreeIndex::rightmost_for(const NormalizedKey &key) {
+    std::lock_guard<std::mutex> guard(rightmost_mutex);
+    if (rightmost == 0)
+        load_rightmost();
+    return key >= right_low ? rightmost : 0;
+}
+
+// Follow the right links and last pointers down from the root to find the right edge of the tree.
+// Called with rightmost_mutex held.
+void BTreeIndex::load_rightmost() {
+    BlockID block_id;
+    uint height;
+    root_snapshot(block_id, height);
+    right_low.clear();
+    while (height > 1) {
+        std::shared_lock<std::shared_mutex> latch(latches[block_id]);
+        BTreeInterior node(file, block_id, key_profile, false);
+        if (node.get_right() != 0) {
+            right_low = node.get_high_key();
+            block_id = node.get_right();
+            continue;
+        }
+        if (node.last_boundary() != nullptr)
+            right_low = *node.last_boundary();  // the ones further down are bigger
+        block_id = node.last_child();
+        height--;
     }
+    rightmost = block_id;
+}
+
+// Drop the cached right edge; it will be reloaded when it's needed.
+void BTreeIndex::forget_rightmost() {
+    std::lock_guard<std::mutex> guard(rightmost_mutex);
+    rightmost = 0;
+    right_low.clear();
 }
 
+// Delete the index entry for a row. Row must still be in relation. Leaves are left as they are, even if they
+// end up empty (they'll fill again with later inserts).
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
+    open();
+    ValueDict *key_dict = relation.project(handle, &entry_columns);
+    NormalizedKey key = nkey(key_dict);
+    delete key_dict;
+    std::unique_lock<std::shared_mutex> latch;
+    BTreeLeaf *leaf = latch_covering<BTreeLeaf>(key, descend(key, 1, nullptr), latch);
+    leaf->remove(key, handle);
+    hot_keys.invalidate(key);
+    delete leaf;
+}
+
+// Walk the interior levels breadth-first, counting the blocks on each.
+std::vector<u_long> BTreeIndex::level_sizes() {
+    open();
+    std::vector<u_long> sizes;
+    BlockPointers level{stat->get_root_id()};
+    for (uint height = stat->get_height(); height > 1; height--) {
+        sizes.push_back(level.size());
+        BlockPointers below;
+        for (auto block_id: level) {
+            BTreeInterior node(file, block_id, key_profile, false);
+            BlockPointers children = node.children();
+            below.insert(below.end(), children.begin(), children.end());
+        }
+        level = below;
+    }
+    sizes.push_back(level.size());
+    return sizes;
 }
 
+// Pull out the key values from the ValueDict in order (stopping at the first key column it doesn't have).
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
     KeyValue *key_value = new KeyValue();
-    for (auto const &column_name: key_columns)
-        key_value->push_back(key->find(column_name)->second);
+    for (uint i = 0, n = tkey_size(key); i < n; i++)
+        key_value->push_back(key->find(entry_columns[i])->second);
     return key_value;
 }
 
+// How many of the key columns (and then the included columns), from the first, are in the ValueDict.
+uint BTreeIndex::tkey_size(const ValueDict *key) const {
+    uint n = 0;
+    while (n < entry_columns.size() && key->find(entry_columns[n]) != key->end())
+        n++;
+    return n;
+}
+
+// Pull out the key values from the ValueDict and normalize them. A prefix of the key columns normalizes to a
+// prefix of the whole key's bytes.
+NormalizedKey BTreeIndex::nkey(const ValueDict *key) const {
+    KeyValue *key_value = tkey(key);
+    KeyProfile profile(key_profile.begin(), key_profile.begin() + key_value->size());
+    NormalizedKey normalized = BTreeNode::normalize(*key_value, profile);
+    delete key_value;
+    return normalized;
+}
+
+// The part of the normalized key made of the key columns' values (all of it, unless there are included columns).
+NormalizedKey BTreeIndex::unique_part(const NormalizedKey &key) const {
+    if (included.empty())
+        return key;
+    return key.substr(0, BTreeNode::key_length(key, key_profile, key_columns.size()));
+}
+
 // Figure out the data types of each key component and encode them in key_profile, a list of int/str classes.
 void BTreeIndex::build_key_profile() {
     std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
@@ -156,10 +719,691 @@ void BTreeIndex::build_key_profile() {
         ColumnAttribute ca = column_attributes[col_num++];
         types_by_colname[column_name] = ca.get_data_type();
     }
-    for (auto const &column_name: key_columns)
+    for (auto const &column_name: entry_columns)
         key_profile.push_back(types_by_colname[column_name]);
 }
 
+// Normalized keys should sort like the key values they came from and convert back to them.
+static bool test_normalized_keys() {
+    KeyProfile key_profile = {ColumnAttribute::INT, ColumnAttribute::TEXT, ColumnAttribute::BOOLEAN};
+    Value no(0), yes(1);
+    no.data_type = yes.data_type = ColumnAttribute::BOOLEAN;
+    std::vector<KeyValue> keys;
+    for (int32_t n: {INT32_MIN, -70000, -1, 0, 1, 255, 256, 70000, INT32_MAX})
+        for (const char *s: {"", "a", "ab", "b"})
+            for (auto const &b: {no, yes})
+                keys.push_back(KeyValue{Value(n), Value(s), b});
+    keys.push_back(KeyValue{Value(0), Value(std::string("a\0", 2)), yes});
+    keys.push_back(KeyValue{Value(0), Value(std::string("a\0b", 3)), no});
+    for (auto const &a: keys) {
+        NormalizedKey na = BTreeNode::normalize(a, key_profile);
+        KeyValue *back = BTreeNode::denormalize(na, key_profile);
+        bool same = *back == a;
+        delete back;
+        if (!same) {
+            std::cout << "normalized key round trip failed for " << a[0] << ", " << a[1] << std::endl;
+            return false;
+        }
+        for (auto const &b: keys)
+            if ((a < b) != (na < BTreeNode::normalize(b, key_profile))) {
+                std::cout << "normalized key order wrong for " << a[0] << ", " << a[1] << " vs " << b[0] << ", "
+                          << b[1] << std::endl;
+                return false;
+            }
+    }
+    return true;
+}
+
+// Report the height, number of leaves, and average fan-out of the index.
+static void print_shape(const std::string &label, BTreeIndex &index) {
+    std::vector<u_long> sizes = index.level_sizes();
+    u_long interiors = 0, children = 0;
+    for (uint i = 0; i + 1 < sizes.size(); i++) {
+        interiors += sizes[i];
+        children += sizes[i + 1];
+    }
+    std::cout << label << ": height " << sizes.size() << ", leaves " << sizes.back() << ", fan-out "
+              << (interiors ? (double) children / interiors : 0.0) << std::endl;
+}
+
+// Report on the shape of the index and check that every key can be found.
+static bool test_text_index_shape(const char *label, BTreeIndex &index, const std::vector<std::string> &keys) {
+    print_shape(std::string("text keys (") + label + ")", index);
+    ValueDict lookup;
+    for (u_long i = 0; i < keys.size(); i++) {
+        lookup["url"] = Value(keys[i]);
+        Handles *handles = index.lookup(&lookup);
+        bool found = handles->size() == 1;
+        delete handles;
+        if (!found) {
+            std::cout << "lookup of " << keys[i] << " failed" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Long TEXT keys with long common prefixes, the case separator truncation and prefix compression are for.
+static bool test_btree_text_keys() {
+    ColumnNames column_names = {"url", "id"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_text", column_names, column_attributes);
+    table.create();
+    std::vector<std::string> keys;
+    ValueDict row;
+    for (int i = 0; i < 20000; i++) {
+        int customer = (i * 7919) % 20000;
+        keys.push_back("https://www.example.com/customers/" + std::to_string(customer) + "/orders/" +
+                       std::to_string(customer * 31 % 1000) + "?ref=newsletter-" + std::to_string(customer % 7));
+        row["url"] = Value(keys.back());
+        row["id"] = Value(i);
+        table.insert(&row);
+    }
+
+    BTreeIndex bulk(table, "urlbulk", ColumnNames{"url"}, true);
+    bulk.create();
+    bool ok = test_text_index_shape("bulk load", bulk, keys);
+    bulk.drop();
+
+    // built up one insert at a time from an empty table
+    HeapTable copy("__test_btree_text2", column_names, column_attributes);
+    copy.create();
+    BTreeIndex inserted(copy, "urlinsert", ColumnNames{"url"}, true);
+    inserted.create();
+    for (u_long i = 0; ok && i < keys.size(); i++) {
+        row["url"] = Value(keys[i]);
+        row["id"] = Value((int) i);
+        inserted.insert(copy.insert(&row));
+    }
+    ok = ok && test_text_index_shape("inserts", inserted, keys);
+    inserted.drop();
+    copy.drop();
+    table.drop();
+    return ok;
+}
+
+// Increasing keys inserted one at a time (like a sequence number primary key) should pack the leaves.
+static bool test_btree_append() {
+    ColumnNames column_names = {"id"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_seq", column_names, column_attributes);
+    table.create();
+    BTreeIndex index(table, "idseq", ColumnNames{"id"}, true);
+    index.create();
+    ValueDict row;
+    const int n = 50000;
+    for (int i = 0; i < n; i++) {
+        if (i == n / 2) {
+            // the cached right edge should be reloaded after this
+            index.close();
+            index.open();
+        }
+        row["id"] = Value(i);
+        index.insert(table.insert(&row));
+    }
+    print_shape("sequential inserts", index);
+
+    // some out of order, including ones that split leaves away from the right edge
+    for (int i = 0; i < 2000; i++) {
+        row["id"] = Value(-1 - 2 * i);
+        index.insert(table.insert(&row));
+    }
+    row["id"] = Value(n + 1);
+    index.insert(table.insert(&row));
+    row["id"] = Value(n);
+    index.insert(table.insert(&row));
+    try {
+        row["id"] = Value(n - 1);
+        index.insert(table.insert(&row));
+        std::cout << "duplicate at right edge should have failed" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+
+    ValueDict lookup;
+    for (int i = -4000; i <= n + 1; i++) {
+        lookup["id"] = Value(i);
+        Handles *handles = index.lookup(&lookup);
+        bool ok = handles->size() == (i >= 0 || i % 2 != 0 ? 1u : 0u);
+        delete handles;
+        if (!ok) {
+            std::cout << "lookup of " << i << " after appends failed" << std::endl;
+            return false;
+        }
+    }
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Insert and look up from several threads at once into one index, reporting the throughput for each number of
+// threads. The keys are scattered, so the threads work all over the tree and split nodes under each other.
+static bool test_btree_concurrent() {
+    ColumnNames column_names = {"id"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT)};
+    const int n = 40000;
+    for (uint threads: {1, 2, 4}) {
+        HeapTable table("__test_btree_mt", column_names, column_attributes);
+        table.create();
+        BTreeIndex index(table, "idmt", ColumnNames{"id"}, true);
+        index.create();
+
+        // the table isn't thread safe, so its rows go in first
+        Handles handles;
+        ValueDict row;
+        for (int i = 0; i < n; i++) {
+            row["id"] = Value((int) ((i * 7919L) % n));
+            handles.push_back(table.insert(&row));
+        }
+
+        // each thread inserts every threads-th row, looking up the one it inserted before after each
+        std::atomic<int> failures(0);
+        auto work = [&](uint t) {
+            ValueDict lookup;
+            for (int i = t; i < n; i += threads) {
+                index.insert(handles[i]);
+                if (i >= (int) threads) {
+                    lookup["id"] = Value((int) (((i - threads) * 7919L) % n));
+                    Handles *found = index.lookup(&lookup);
+                    if (found->size() != 1)
+                        failures++;
+                    delete found;
+                }
+            }
+        };
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (uint t = 0; t < threads; t++)
+            workers.emplace_back(work, t);
+        for (auto &worker: workers)
+            worker.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "concurrent btree, " << threads << " thread(s): " << (long) (2 * n / seconds)
+                  << " inserts+lookups/s" << std::endl;
+
+        ValueDict lookup;
+        for (int i = 0; i < n; i++) {
+            lookup["id"] = Value(i);
+            Handles *found = index.lookup(&lookup);
+            if (found->size() != 1)
+                failures++;
+            delete found;
+        }
+        index.drop();
+        table.drop();
+        if (failures > 0) {
+            std::cout << "concurrent btree with " << threads << " threads: " << failures << " lookups failed"
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Lookups on the first column of a two-column key, and deletes from overflowed and short postings.
+static bool test_btree_prefix() {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_prefix", column_names, column_attributes);
+    table.create();
+    ValueDict row;
+    for (int i = 0; i < 10000; i++) {
+        row["a"] = Value(std::string("group") + std::to_string(i % 10) + (i % 100 == 0 ? "x" : ""));
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    BTreeIndex index(table, "abprefix", ColumnNames{"a", "b"}, true);
+    index.create();
+    ValueDict lookup;
+    lookup["a"] = Value("group3");
+    Handles *handles = index.lookup(&lookup);
+    bool ok = handles->size() == 1000;
+    delete handles;
+    lookup["a"] = Value("group0");  // not the "group0x" ones, though "group0" is a prefix of them
+    handles = index.lookup(&lookup);
+    ok = ok && handles->size() == 900;
+    delete handles;
+    lookup["a"] = Value("group0x");
+    handles = index.lookup(&lookup);
+    ok = ok && handles->size() == 100;
+    delete handles;
+    if (!ok) {
+        std::cout << "prefix lookup failed" << std::endl;
+        return false;
+    }
+
+    // a range from one prefix to another takes in all of the last one's keys
+    ValueDict min_key, max_key;
+    min_key["a"] = Value("group1");
+    min_key["b"] = Value(500);
+    max_key["a"] = Value("group2");
+    handles = index.range(&min_key, &max_key);
+    ok = handles->size() == 950 + 1000;
+    delete handles;
+    max_key["b"] = Value(1);  // below all of group2's b values
+    handles = index.range(&min_key, &max_key);
+    ok = ok && handles->size() == 950;
+    delete handles;
+    if (!ok) {
+        std::cout << "prefix range failed" << std::endl;
+        return false;
+    }
+
+    // delete a group's rows from the index
+    lookup["a"] = Value("group3");
+    handles = index.lookup(&lookup);
+    for (auto const &handle: *handles)
+        index.del(handle);
+    delete handles;
+    handles = index.lookup(&lookup);
+    ok = handles->empty();
+    delete handles;
+    lookup["b"] = Value(13);
+    handles = index.lookup(&lookup);
+    ok = ok && handles->empty();
+    delete handles;
+    lookup["a"] = Value("group4");
+    lookup["b"] = Value(14);
+    handles = index.lookup(&lookup);
+    ok = ok && handles->size() == 1;
+    delete handles;
+    if (!ok) {
+        std::cout << "delete by prefix failed" << std::endl;
+        return false;
+    }
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Unique index on a with b included: the values come back from the index, and a is still what has to be unique.
+static bool test_btree_include() {
+    ColumnNames column_names = {"a", "b", "c"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_include", column_names, column_attributes);
+    table.create();
+    auto key = [](int i) {
+        std::string digits = std::to_string(i);
+        return Value("key" + std::string(4 - digits.size(), '0') + digits);  // so they sort in numeric order
+    };
+    ValueDict row;
+    for (int i = 0; i < 5000; i++) {
+        row["a"] = key(i);
+        row["b"] = Value(-i);
+        row["c"] = Value(i % 7);
+        table.insert(&row);
+    }
+    BTreeIndex index(table, "ainclude", ColumnNames{"a"}, true, ColumnNames{"b"});
+    index.create();
+    ValueDict lookup;
+    lookup["a"] = key(1234);
+    ValueDicts *rows = index.lookup_values(&lookup);
+    bool ok = rows->size() == 1 && (*rows)[0]->size() == 2 && (*rows)[0]->at("b") == Value(-1234);
+    for (auto const &values: *rows)
+        delete values;
+    delete rows;
+    ValueDict min_key, max_key;
+    min_key["a"] = key(1000);
+    max_key["a"] = key(1099);
+    rows = index.range_values(&min_key, &max_key);
+    ok = ok && rows->size() == 100;
+    for (u_long i = 0; ok && i < rows->size(); i++)
+        ok = (*rows)[i]->at("a") == key(1000 + (int) i) &&
+             (*rows)[i]->at("b") == Value(-1000 - (int) i);
+    for (auto const &values: *rows)
+        delete values;
+    delete rows;
+    if (!ok) {
+        std::cout << "index-only lookup failed" << std::endl;
+        return false;
+    }
+
+    // the same a with another b is still a duplicate, whether inserted or there when the index is built
+    row["a"] = key(77);
+    row["b"] = Value(77);
+    Handle duplicate = table.insert(&row);
+    try {
+        index.insert(duplicate);
+        std::cout << "duplicate key with another included value should have failed" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    BTreeIndex rebuilt(table, "aincluderebuilt", ColumnNames{"a"}, true, ColumnNames{"b"});
+    try {
+        rebuilt.create();
+        std::cout << "building unique index with included columns on duplicate keys should have failed" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        rebuilt.drop();
+    }
+
+    // once the old row is gone, the new one can go in
+    lookup["a"] = key(77);
+    Handles *handles = index.lookup(&lookup);
+    index.del(handles->back());
+    table.del(handles->back());
+    delete handles;
+    index.insert(duplicate);
+    rows = index.lookup_values(&lookup);
+    ok = rows->size() == 1 && rows->back()->at("b") == Value(77);
+    for (auto const &values: *rows)
+        delete values;
+    delete rows;
+    if (!ok) {
+        std::cout << "insert after delete with included columns failed" << std::endl;
+        return false;
+    }
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Batched lookups should find what single lookups do, in probe order, and take less time (reported for both).
+static bool test_btree_lookup_many() {
+    ColumnNames column_names = {"id", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_many", column_names, column_attributes);
+    table.create();
+    const int n = 100000;
+    ValueDict row;
+    for (int i = 0; i < n; i++) {
+        row["id"] = Value((int) ((i * 7919L) % n) * 2);  // just the even ids
+        row["b"] = Value(i % 10);
+        table.insert(&row);
+    }
+    BTreeIndex index(table, "idmany", ColumnNames{"id", "b"}, true);
+    index.create();
+
+    // scattered probes, half of them misses, some repeated, and a few for just the first key column
+    ValueDicts probes;
+    for (int i = 0; i < 20000; i++) {
+        ValueDict *probe = new ValueDict();
+        int id = (int) ((i * 104729L) % (2 * n));
+        (*probe)["id"] = Value(i % 100 == 0 ? 2 * n - 2 : id);
+        if (i % 1000 != 1)
+            (*probe)["b"] = Value(id / 2 * 3 % 10);  // not necessarily right
+        probes.push_back(probe);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    HandleLists singles;
+    for (auto const &probe: probes)
+        singles.push_back(index.lookup(probe));
+    double single_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    HandleLists *batched = index.lookup_many(probes);
+    double batched_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "lookup of " << probes.size() << " keys: " << (long) (probes.size() / single_seconds)
+              << " keys/s one at a time, " << (long) (probes.size() / batched_seconds) << " keys/s batched"
+              << std::endl;
+
+    bool ok = batched->size() == singles.size();
+    u_long found = 0;
+    for (u_long i = 0; i < singles.size(); i++) {
+        if (ok && *(*batched)[i] != *singles[i]) {
+            std::cout << "batched lookup of probe " << i << " failed" << std::endl;
+            ok = false;
+        }
+        found += singles[i]->size();
+        delete singles[i];
+        delete (*batched)[i];
+        delete probes[i];
+    }
+    delete batched;
+    if (ok && (found == 0 || found == probes.size())) {
+        std::cout << "batched lookup probes should have both hits and misses" << std::endl;
+        ok = false;
+    }
+    index.drop();
+    table.drop();
+    return ok;
+}
+
+// Time lookups of keys that aren't in the index, checking that none are found.
+static bool time_absent_lookups(BTreeIndex &index, int n, const char *label) {
+    ValueDict lookup;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        lookup["id"] = Value(2 * i + 1);
+        Handles *handles = index.lookup(&lookup);
+        bool found = !handles->empty();
+        delete handles;
+        if (found) {
+            std::cout << label << ": absent key " << 2 * i + 1 << " found" << std::endl;
+            return false;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << label << ": " << (long) (n / seconds) << " absent lookups/s" << std::endl;
+    return true;
+}
+
+// Bloom filters on a unique index and on one with included columns, through inserts, closing, and reopening.
+static bool test_btree_bloom() {
+    ColumnNames column_names = {"id", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_bloom", column_names, column_attributes);
+    table.create();
+    const int n = 20000;
+    ValueDict row;
+    for (int i = 0; i < n; i++) {
+        row["id"] = Value(2 * i);  // just the even ids
+        row["b"] = Value(i % 10);
+        table.insert(&row);
+    }
+    BTreeIndex plain(table, "idplain", ColumnNames{"id"}, true);
+    plain.create();
+    BTreeIndex index(table, "idbloom", ColumnNames{"id"}, true, ColumnNames{"b"});
+    index.set_bloom_filter(0.01);
+    index.create();
+    if (!time_absent_lookups(plain, n, "without bloom filter") || !time_absent_lookups(index, n, "with bloom filter"))
+        return false;
+
+    // new keys get into the filter, and it's still there after reopening the index
+    row["id"] = Value(1);
+    row["b"] = Value(1);
+    index.insert(table.insert(&row));
+    index.close();
+    index.open();
+    ValueDict lookup;
+    lookup["id"] = Value(1);
+    Handles *handles = index.lookup(&lookup);
+    bool ok = index.has_bloom_filter() && handles->size() == 1;
+    delete handles;
+    lookup["id"] = Value(2 * n - 2);
+    handles = index.lookup(&lookup);
+    ok = ok && handles->size() == 1;
+    delete handles;
+    if (!ok) {
+        std::cout << "bloom filter lookup after insert failed" << std::endl;
+        return false;
+    }
+    try {
+        row["b"] = Value(2);
+        index.insert(table.insert(&row));
+        std::cout << "duplicate key with bloom filter should have failed" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    plain.drop();
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Time hot-key lookups: 50 keys, over and over. Returns the lookups per second, or 0 if one of them went wrong.
+static double time_hot_lookups(BTreeIndex &index, int rounds) {
+    ValueDict lookup;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < 50; i++) {
+            lookup["a"] = Value(i * 97);
+            Handles *handles = index.lookup(&lookup);
+            bool ok = handles->size() == 2;
+            delete handles;
+            if (!ok)
+                return 0.0;
+        }
+    }
+    return rounds * 50 / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The adaptive hash index: hot keys are cached and hit, inserts and deletes show through, and it stays in budget.
+static bool test_btree_adaptive_hash() {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_hot", column_names, column_attributes);
+    table.create();
+    const int n = 20000;
+    ValueDict row;
+    for (int i = 0; i < n; i++) {
+        row["a"] = Value(i / 2);  // two rows for each key
+        row["b"] = Value(i);
+        table.insert(&row);
+    }
+    BTreeIndex index(table, "hot", ColumnNames{"a"}, false);
+    index.create();
+    BTreeIndex cold(table, "cold", ColumnNames{"a"}, false);
+    cold.set_adaptive_hash_budget(0);
+    cold.create();
+    double cold_rate = time_hot_lookups(cold, 200);
+    double hot_rate = time_hot_lookups(index, 200);
+    const BTreeAdaptiveHash &hot_keys = index.get_adaptive_hash();
+    std::cout << "adaptive hash: " << (long) cold_rate << " lookups/s without, " << (long) hot_rate << " with ("
+              << hot_keys.get_hits() << " hits of " << hot_keys.get_lookups() << ", " << hot_keys.byte_size()
+              << " bytes)" << std::endl;
+    if (cold_rate == 0.0 || hot_rate == 0.0 || hot_keys.hit_rate() < 0.95 ||
+        cold.get_adaptive_hash().get_lookups() != 0)
+        return false;
+
+    // a new row for a cached key, and a deleted one, show up in its next lookup
+    row["a"] = Value(97);
+    row["b"] = Value(-1);
+    Handle handle = table.insert(&row);
+    index.insert(handle);
+    ValueDict lookup;
+    lookup["a"] = Value(97);
+    Handles *handles = index.lookup(&lookup);
+    bool ok = handles->size() == 3;
+    delete handles;
+    index.del(handle);
+    table.del(handle);
+    handles = index.lookup(&lookup);
+    ok = ok && handles->size() == 2;
+    delete handles;
+    if (!ok) {
+        std::cout << "adaptive hash lookup after insert or delete failed" << std::endl;
+        return false;
+    }
+
+    // looking up every key over and over fills a small budget, and no more
+    index.set_adaptive_hash_budget(16 * 1024);
+    for (uint round = 0; round < BTreeAdaptiveHash::HOT_LOOKUPS; round++) {
+        for (int i = 0; i < n / 2; i++) {
+            lookup["a"] = Value(i);
+            delete index.lookup(&lookup);
+        }
+    }
+    if (hot_keys.byte_size() == 0 || hot_keys.byte_size() > 16 * 1024) {
+        std::cout << "adaptive hash over budget: " << hot_keys.byte_size() << " bytes" << std::endl;
+        return false;
+    }
+    cold.drop();
+    index.drop();
+    table.drop();
+    return true;
+}
+
+// Check that lookup of key b in index finds exactly expected rows, all with that b.
+static bool test_lookup_count(DbRelation &table, BTreeIndex &index, int b, u_long expected) {
+    ValueDict lookup;
+    lookup["b"] = b;
+    Handles *handles = index.lookup(&lookup);
+    bool ok = handles->size() == expected;
+    for (u_long i = 0; ok && i < handles->size(); i++) {
+        if (i > 0 && !((*handles)[i - 1] < (*handles)[i]))
+            ok = false;  // should be sorted and distinct
+        ValueDict *row = table.project((*handles)[i]);
+        if ((*row)["b"] != Value(b))
+            ok = false;
+        delete row;
+    }
+    delete handles;
+    if (!ok)
+        std::cout << "non-unique lookup of " << b << " failed" << std::endl;
+    return ok;
+}
+
+// Non-unique index on a low-cardinality column, with some keys long enough to overflow.
+static bool test_btree_non_unique() {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__test_btree_multi", column_names, column_attributes);
+    table.create();
+    ValueDict row;
+    for (int i = 0; i < 10 * 1000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(i % 10);
+        table.insert(&row);
+    }
+    for (int i = 0; i < 5; i++) {
+        row["a"] = Value(-i);
+        row["b"] = Value(100 + i);
+        table.insert(&row);
+    }
+
+    BTreeIndex unique_index(table, "bunique", ColumnNames{"b"}, true);
+    try {
+        unique_index.create();
+        std::cout << "unique index on duplicate keys should have failed" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        unique_index.drop();
+    }
+
+    BTreeIndex index(table, "bmulti", ColumnNames{"b"}, false);
+    index.create();
+    if (!test_lookup_count(table, index, 3, 1000) || !test_lookup_count(table, index, 102, 1) ||
+        !test_lookup_count(table, index, 50, 0))
+        return false;
+
+    // add to an overflowed posting, a short one, and a new key (in and out of handle order)
+    for (int i = 0; i < 2000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(i % 2 == 0 ? 3 : 102);
+        index.insert(table.insert(&row));
+    }
+    row["b"] = Value(50);
+    Handle first = table.insert(&row);
+    index.insert(table.insert(&row));
+    index.insert(first);
+    index.insert(first);  // already there
+    if (!test_lookup_count(table, index, 3, 2000) || !test_lookup_count(table, index, 102, 1001) ||
+        !test_lookup_count(table, index, 50, 2))
+        return false;
+
+    // delete from the overflowed posting (until it fits in the leaf again) and all of a short one
+    ValueDict lookup;
+    lookup["b"] = Value(3);
+    Handles *handles = index.lookup(&lookup);
+    for (u_long i = 0; i < handles->size(); i += 2)
+        index.del((*handles)[i]);
+    for (u_long i = 1; i < 1990; i += 2)
+        index.del((*handles)[i]);
+    delete handles;
+    index.del(first);
+    if (!test_lookup_count(table, index, 3, 5) || !test_lookup_count(table, index, 50, 1))
+        return false;
+    index.drop();
+    table.drop();
+    return true;
+}
+
 bool test_btree() {
     ColumnNames column_names;
     column_names.push_back("a");
@@ -229,12 +1473,69 @@ bool test_btree() {
             delete handles;
             delete result;
         }
-    // TODO: Remove these
-    index.drop();
-    table.drop();
-    return true;
 
-    // FIXME Implement delete
+    // build another one with a small sort budget (so the keys get spilled to sorted runs) and full blocks
+    BTreeIndex packed(table, "fooindex_packed", column_names, true);
+    packed.set_sort_budget(64 * 1024);
+    packed.set_fill_factor(1.0);
+    packed.create();
+    for (int i = 0; i < 100 * 1000; i += 97) {
+        lookup["a"] = i + 100;
+        handles = packed.lookup(&lookup);
+        if (handles->size() != 1) {
+            std::cout << "packed lookup failed " << i << std::endl;
+            return false;
+        }
+        result = table.project(handles->back());
+        row1["a"] = i + 100;
+        row1["b"] = -i;
+        if (*result != row1) {
+            std::cout << "packed lookup failed " << i << std::endl;
+            return false;
+        }
+        delete handles;
+        delete result;
+    }
+    // inserts into the full blocks have to split them (index gets them too, so it still has every row)
+    for (int i = 0; i < 50; i++) {
+        ValueDict row;
+        row["a"] = Value(-i - 1);
+        row["b"] = Value(i);
+        Handle handle = table.insert(&row);
+        packed.insert(handle);
+        index.insert(handle);
+    }
+    lookup["a"] = -50;
+    handles = packed.lookup(&lookup);
+    if (handles->size() != 1) {
+        std::cout << "insert after packed build failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    packed.drop();
+
+    if (!test_normalized_keys())
+        return false;
+    if (!test_btree_non_unique())
+        return false;
+    if (!test_btree_text_keys())
+        return false;
+    if (!test_btree_append())
+        return false;
+    if (!test_btree_concurrent())
+        return false;
+
+    if (!test_btree_prefix())
+        return false;
+    if (!test_btree_include())
+        return false;
+    if (!test_btree_lookup_many())
+        return false;
+    if (!test_btree_bloom())
+        return false;
+    if (!test_btree_adaptive_hash())
+        return false;
+
     // test delete
     ValueDict row;
     row["a"] = 44;
@@ -260,7 +1561,6 @@ bool test_btree() {
     }
     delete handles;
 
-    // FIXME: Implement range
     // test range
     ValueDict minkey, maxkey;
     minkey["a"] = 100;
@@ -280,6 +1580,21 @@ bool test_btree() {
         delete vd;
     delete results;
 
+    // test range with a limit: just the first rows of it
+    handles = index.range(&minkey, nullptr, 25);
+    results = table.project(handles);
+    bool limited = results->size() == 25;
+    for (u_long i = 0; limited && i < results->size(); i++)
+        limited = results->at(i)->at("a") == Value(100 + (int) i);
+    delete handles;
+    for (auto vd: *results)
+        delete vd;
+    delete results;
+    if (!limited) {
+        std::cout << "limited range failed" << std::endl;
+        return false;
+    }
+
     // test range from beginning and to end
     handles = index.range(nullptr, nullptr);
     u_long count_i = handles->size();
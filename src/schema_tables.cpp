@@ -6,6 +6,7 @@
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
 #include "btree.h"
+#include "HashIndex.h"
 
 
 void initialize_schema_tables() {
@@ -313,7 +314,7 @@ Handle Indices::insert(const ValueDict *row) {
     ValueDict where;
     where["table_name"] = row->at("table_name");
     where["index_name"] = row->at("index_name");
-    if (row->at("seq_in_index").n > 1)
+    if (row->at("seq_in_index").n != 1)
         where["column_name"] = row->at("column_name");  // check for duplicate columns on the same index
     Handles *handles = select(&where);
     bool unique = handles->empty();
@@ -342,52 +343,47 @@ void Indices::del(Handle handle) {
 // Return a list of column names and column attributes for given table.
 void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
                           bool &is_unique) {
+    ColumnNames included;
+    get_columns(table_name, index_name, column_names, included, is_hash, is_unique);
+}
+
+// Included columns have negative seq_in_index: -1 for the first, -2 for the next, etc.
+void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+                          ColumnNames &included, bool &is_hash, bool &is_unique) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
     where["index_name"] = index_name;
     Handles *handles = select(&where);
 
-    Identifier colnames[DbIndex::MAX_COMPOSITE];
-    uint size = 0;
+    Identifier colnames[DbIndex::MAX_COMPOSITE], included_names[DbIndex::MAX_COMPOSITE];
+    uint size = 0, included_size = 0;
     for (auto const &handle: *handles) {
         ValueDict *row = project(handle);
 
         Identifier column_name = (*row)["column_name"].s;
-        uint which = (uint) (*row)["seq_in_index"].n;
-        colnames[which - 1] = column_name;  // seq_in_index is 1-based
-        if (which > size)
-            size = which;
+        int seq = (*row)["seq_in_index"].n;
+        uint which = (uint) (seq < 0 ? -seq : seq);
+        if (seq < 0) {
+            included_names[which - 1] = column_name;
+            if (which > included_size)
+                included_size = which;
+        } else {
+            colnames[which - 1] = column_name;  // seq_in_index is 1-based
+            if (which > size)
+                size = which;
+        }
         is_unique = (*row)["is_unique"].n != 0;
         is_hash = (*row)["index_type"].s == "HASH";
         delete row;
     }
     for (uint i = 0; i < size; i++)
         column_names.push_back(colnames[i]);
+    for (uint i = 0; i < included_size; i++)
+        included.push_back(included_names[i]);
     delete handles;
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation &rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-
-    void create() {}
-
-    void drop() {}
-
-    void open() {}
-
-    void close() {}
-
-    Handles *lookup(ValueDict *key_values) const { return nullptr; }
-
-    void insert(Handle handle) {}
-
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
@@ -395,16 +391,16 @@ DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
-    ColumnNames column_names;
+    // otherwise make a BTreeIndex or HashIndex for it
+    ColumnNames column_names, included;
     bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    get_columns(table_name, index_name, column_names, included, is_hash, is_unique);
     DbRelation &table = Tables::get_table(table_name);
     DbIndex *index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+        index = new HashIndex(table, index_name, column_names, is_unique);
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = new BTreeIndex(table, index_name, column_names, is_unique, included);
     }
     Indices::index_cache[cache_key] = index;
     return *index;
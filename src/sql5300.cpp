@@ -16,6 +16,15 @@
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "HashIndex.h"
+#include "HandleSet.h"
+#include "BloomFilter.h"
+#include "ColumnBatch.h"
+#include "Expression.h"
+#include "JoinOperator.h"
+#include "SortOperator.h"
+#include "AggregateOperator.h"
+#include "TaskScheduler.h"
 
 using namespace std;
 using namespace hsql;
@@ -44,7 +53,7 @@ int main(int argc, char *argv[]) {
     env.set_error_stream(&cerr);
 
     try {
-        env.open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+        env.open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_THREAD, 0);
     } catch (DbException &exc) {
         cerr << "(sql5300: " << exc.what() << ")";
         exit(1);
@@ -69,6 +78,24 @@ int main(int argc, char *argv[]) {
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
+            cout << "test_handle_set: " << (test_handle_set() ? "ok" : "failed") << endl;
+            cout << "test_bloom_filter: " << (test_bloom_filter() ? "ok" : "failed") << endl;
+            cout << "test_column_batch: " << (test_column_batch() ? "ok" : "failed") << endl;
+            cout << "test_task_scheduler: " << (test_task_scheduler() ? "ok" : "failed") << endl;
+            cout << "test_expression: " << (test_expression() ? "ok" : "failed") << endl;
+            cout << "test_sort: " << (test_sort() ? "ok" : "failed") << endl;
+            cout << "test_join: " << (test_join() ? "ok" : "failed") << endl;
+            cout << "test_aggregate: " << (test_aggregate() ? "ok" : "failed") << endl;
+            continue;
+        }
+
+        // the Hyrise sql parser doesn't know INCLUDE clauses (for covering indices), so we take it out first
+        ColumnNames included;
+        try {
+            SQLExec::take_include_clause(query, included);
+        } catch (SQLExecError &e) {
+            cout << "Error: " << e.what() << endl;
             continue;
         }
 
@@ -84,8 +111,11 @@ int main(int argc, char *argv[]) {
         for (uint i = 0; i < parse->size(); ++i) {
             const SQLStatement *statement = parse->getStatement(i);
             try {
-                cout << ParseTreeToString::statement(statement) << endl;
-                QueryResult *result = SQLExec::execute(statement);
+                cout << ParseTreeToString::statement(statement);
+                for (uint j = 0; j < included.size(); j++)
+                    cout << (j == 0 ? " INCLUDE (" : ", ") << included[j] << (j + 1 == included.size() ? ")" : "");
+                cout << endl;
+                QueryResult *result = SQLExec::execute(statement, included);
                 cout << *result << endl;
                 delete result;
             } catch (SQLExecError &e) {
@@ -5,13 +5,14 @@
  */
 #include <algorithm>
 #include "storage_engine.h"
+#include "ColumnBatch.h"
 
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s == other.s;
+    return this->n == other.n;
 }
 
 bool Value::operator!=(const Value &other) const {
@@ -63,6 +64,110 @@ std::ostream &operator<<(std::ostream &out, const Value &value) {
     return out;
 }
 
+bool Comparison::matches(const Value &column_value) const {
+    switch (this->op) {
+        case EQ:
+            return column_value == this->value;
+        case NE:
+            return column_value != this->value;
+        case LT:
+            return column_value < this->value;
+        case LE:
+            return !(this->value < column_value);
+        case GT:
+            return this->value < column_value;
+        case GE:
+            return !(column_value < this->value);
+    }
+    return false;
+}
+
+Comparison::Op Comparison::reversed(Op op) {
+    switch (op) {
+        case LT:
+            return GT;
+        case LE:
+            return GE;
+        case GT:
+            return LT;
+        case GE:
+            return LE;
+        default:
+            return op;
+    }
+}
+
+std::ostream &operator<<(std::ostream &out, const Comparison &comparison) {
+    static const char *ops[] = {"=", "<>", "<", "<=", ">", ">="};
+    out << comparison.column_name << ' ' << ops[comparison.op] << ' ' << comparison.value;
+    return out;
+}
+
+// Filter all the rows.
+Handles *DbRelation::select(const Conjunction &where) {
+    Handles *all = select();
+    Handles *ret = select(all, where);
+    delete all;
+    return ret;
+}
+
+// Filter the given rows, projecting (all at once) just the columns the comparisons need.
+Handles *DbRelation::select(Handles *current_selection, const Conjunction &where) {
+    ColumnNames columns;
+    for (auto const &comparison: where)
+        if (std::find(columns.begin(), columns.end(), comparison.column_name) == columns.end())
+            columns.push_back(comparison.column_name);
+    ColumnAttributes *attributes = get_column_attributes(columns);
+    for (auto const &comparison: where) {
+        ptrdiff_t index = std::find(columns.begin(), columns.end(), comparison.column_name) - columns.begin();
+        if ((*attributes)[index].get_data_type() != comparison.value.data_type) {
+            delete attributes;
+            throw DbRelationError("column " + comparison.column_name + " compared with a value of another type");
+        }
+    }
+    delete attributes;
+
+    Handles *ret = new Handles();
+    if (where.empty()) {
+        ret->assign(current_selection->begin(), current_selection->end());
+        return ret;
+    }
+    ValueDicts *rows = project(current_selection, &columns);
+    for (u_long i = 0; i < rows->size(); i++) {
+        ValueDict *row = (*rows)[i];
+        bool selected = true;
+        for (auto const &comparison: where) {
+            if (!comparison.matches((*row)[comparison.column_name])) {
+                selected = false;
+                break;
+            }
+        }
+        delete row;
+        if (selected)
+            ret->push_back((*current_selection)[i]);
+    }
+    delete rows;
+    return ret;
+}
+
+// Fetch the block's rows as ValueDicts and add them to the batch.
+void DbRelation::scan_block(BlockID block_id, ColumnBatch &batch) {
+    Handles *handles = select_block(block_id);
+    ValueDicts *rows;
+    try {
+        rows = project(handles, &batch.get_column_names());
+    } catch (DbRelationError &e) {
+        delete handles;
+        throw;
+    }
+    for (u_long i = 0; i < handles->size(); i++) {
+        batch.add_row((*handles)[i], *(*rows)[i]);
+        delete (*rows)[i];
+    }
+    delete rows;
+    delete handles;
+}
+
 // Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     ColumnNames t;
@@ -92,8 +197,5 @@ ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
     ColumnNames t;
     for (auto const &column: *where)
         t.push_back(column.first);
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle, &t));
-    return ret;
+    return project(handles, &t);
 }